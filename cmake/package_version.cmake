@@ -8,8 +8,11 @@ if (GIT_FOUND AND EXISTS "${PROJECT_SOURCE_DIR}/.git")
                     OUTPUT_VARIABLE RTGA_VERSION
                     ERROR_QUIET
                     OUTPUT_STRIP_TRAILING_WHITESPACE)
-else()
-    get_target_property(RTGA_VERSION rtga VERSION)
+endif()
+
+# Fall back to the project version when there are no tags to describe
+if (NOT RTGA_VERSION)
+    set(RTGA_VERSION ${PROJECT_VERSION})
 endif()
 
 # Split version
@@ -3,10 +3,16 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #define TGA_HEADER_SIZE 18
 
+// TGA 2.0 extension area and footer
+#define TGA_EXTENSION_SIZE 495
+#define TGA_FOOTER_SIZE 26
+#define TGA_SIGNATURE "TRUEVISION-XFILE."
+
 // Return codes
 #define TGA_SUCCESS 0
 #define TGA_ALLOCATION_ERROR 1
@@ -15,6 +21,11 @@
 #define TGA_FILE_WRITE_ERROR 4
 #define TGA_NULL_PTR_ERROR 5
 #define TGA_INVALID_PIXEL_DEPTH_ERROR 6
+#define TGA_RLE_DECODE_ERROR 7
+#define TGA_UNSUPPORTED_IMAGE_TYPE_ERROR 8
+#define TGA_NO_POSTAGE_STAMP_ERROR 9
+#define TGA_SIZE_MISMATCH_ERROR 10
+#define TGA_ATLAS_FULL_ERROR 11
 
 //
 // Colors
@@ -44,43 +55,43 @@ typedef struct {
 #define COLOR32(r, g, b, a) (TgaColor){{b, g, r, a}, 32}
 
 // 8-bit Greyscale Values (C)
-const TgaColor WHITE8;
-const TgaColor LIGHT_GRAY8;
-const TgaColor GRAY8;
-const TgaColor DARK_GRAY8;
-const TgaColor BLACK8;
+extern const TgaColor WHITE8;
+extern const TgaColor LIGHT_GRAY8;
+extern const TgaColor GRAY8;
+extern const TgaColor DARK_GRAY8;
+extern const TgaColor BLACK8;
 
 // 16-bit Color Values (RGB)
-const TgaColor RED16;
-const TgaColor GREEN16;
-const TgaColor BLUE16;
-const TgaColor YELLOW16;
-const TgaColor MAGENTA16;
-const TgaColor CYAN16;
-const TgaColor PURPLE16;
-const TgaColor ROSE16;
-const TgaColor ORANGE16;
-const TgaColor LIME16;
-const TgaColor MINT16;
-const TgaColor AZURE16;
-const TgaColor WHITE16;
-const TgaColor BLACK16;
+extern const TgaColor RED16;
+extern const TgaColor GREEN16;
+extern const TgaColor BLUE16;
+extern const TgaColor YELLOW16;
+extern const TgaColor MAGENTA16;
+extern const TgaColor CYAN16;
+extern const TgaColor PURPLE16;
+extern const TgaColor ROSE16;
+extern const TgaColor ORANGE16;
+extern const TgaColor LIME16;
+extern const TgaColor MINT16;
+extern const TgaColor AZURE16;
+extern const TgaColor WHITE16;
+extern const TgaColor BLACK16;
 
 // 24-bit Color Values (RGB)
-const TgaColor BLUE24;
-const TgaColor GREEN24;
-const TgaColor RED24;
-const TgaColor YELLOW24;
-const TgaColor MAGENTA24;
-const TgaColor CYAN24;
-const TgaColor PURPLE24;
-const TgaColor ROSE24;
-const TgaColor ORANGE24;
-const TgaColor LIME24;
-const TgaColor MINT24;
-const TgaColor AZURE24;
-const TgaColor WHITE24;
-const TgaColor BLACK24;
+extern const TgaColor BLUE24;
+extern const TgaColor GREEN24;
+extern const TgaColor RED24;
+extern const TgaColor YELLOW24;
+extern const TgaColor MAGENTA24;
+extern const TgaColor CYAN24;
+extern const TgaColor PURPLE24;
+extern const TgaColor ROSE24;
+extern const TgaColor ORANGE24;
+extern const TgaColor LIME24;
+extern const TgaColor MINT24;
+extern const TgaColor AZURE24;
+extern const TgaColor WHITE24;
+extern const TgaColor BLACK24;
 
 // Image data representations 
 typedef enum {
@@ -89,6 +100,7 @@ typedef enum {
     UNCOMPRESSED_TRUE_COLOR_IMAGE = 2,
     UNCOMPRESSED_BLACK_AND_WHITE_IMAGE = 3,
     RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE = 9,
+    RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE = 10,
     RUN_LENGTH_ENCODED_BLACK_AND_WHITE_IMAGE = 11,
 } TgaImageType;
 
@@ -115,6 +127,63 @@ typedef struct {
     uint8_t descriptor;
 } TgaHeader;
 
+// Memory allocator for image buffers and scratch memory
+//
+// Each function gets context as its first argument and behaves like malloc,
+// realloc and free. An allocator whose alloc is NULL uses malloc, realloc and
+// free, so a zeroed TgaAllocator is the general heap.
+typedef struct {
+    void *(*alloc)(void *context, size_t size);
+    void *(*realloc)(void *context, void *ptr, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+} TgaAllocator;
+
+// Bump allocator over a caller provided buffer
+//
+// Memory is only given back by tga_arena_reset, except that the most recent
+// allocation can be freed or grown in place.
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    // Offset of the most recent allocation, or size if it was freed
+    size_t last;
+} TgaArena;
+
+// Number of size classes of a TgaPool, from 64 bytes up to 2 GiB
+#define TGA_POOL_CLASS_COUNT 26
+
+// Allocator that recycles blocks of power of two size classes, carved out of
+// a caller provided buffer
+typedef struct {
+    TgaArena arena;
+    // Freed blocks of each size class
+    void *free_lists[TGA_POOL_CLASS_COUNT];
+} TgaPool;
+
+// Callbacks for reading and writing TGA data without a file, such as from a
+// socket or a cache
+//
+// read and write transfer up to size bytes and return how many they did,
+// where fewer means the end of the data or an error. seek moves to offset
+// bytes from origin (SEEK_SET, SEEK_CUR or SEEK_END) and returns 0 on
+// success. Decoding and encoding read and write strictly in order, so seek
+// may be NULL for streams that cannot seek.
+typedef struct {
+    size_t (*read)(void *context, void *buffer, size_t size);
+    size_t (*write)(void *context, const void *buffer, size_t size);
+    int (*seek)(void *context, int64_t offset, int origin);
+    void *context;
+} TgaIo;
+
+// Caller provided buffer behind the callbacks of tga_memory_io
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t position;
+} TgaMemoryIo;
+
 // TGA image
 typedef struct {
     TgaHeader header;
@@ -122,8 +191,304 @@ typedef struct {
     uint8_t *image_id;
     uint8_t *color_map_data;
     uint8_t *image_data;
+    // File mapping that the pointers above point into, if any
+    void *mapping;
+    size_t mapping_size;
+    // Allocator that owns image_id, color_map_data and image_data
+    TgaAllocator allocator;
 } TgaImage;
 
+// Rectangle of pixels whose rows are stride bytes apart
+//
+// Views point into a TgaImage or any other memory without owning it, so a
+// sub-rectangle of an image or atlas can be filled, converted and written
+// in place instead of being copied out first.
+typedef struct {
+    uint8_t *data;
+    uint16_t width;
+    uint16_t height;
+    size_t stride;
+    uint8_t pixel_depth;
+} TgaView;
+
+// Options for reading TGA image files
+typedef struct {
+    // Expand color mapped images to true color while reading instead of
+    // keeping them color mapped until tga_from_color_map is called
+    bool expand_color_map;
+    // Threads used to decode run-length encoded files that have a scan line
+    // table, where 0 means one per CPU
+    unsigned thread_count;
+    // Allocator for the image and scratch memory, or NULL for the general heap
+    const TgaAllocator *allocator;
+    // Store scanlines from the top left corner, whatever corner the file
+    // starts from, and move the origin of the descriptor there. Scanlines
+    // are placed as they are decoded, so this costs no extra pass.
+    bool top_left;
+} TgaReadOptions;
+
+// Options for writing TGA image files
+typedef struct {
+    // Threads used to run-length encode image data, where 0 means one per CPU
+    unsigned thread_count;
+    // Write a TGA 2.0 extension area and scan line table, which lets readers
+    // decode bands of run-length encoded scanlines in parallel
+    bool scan_line_table;
+    // Largest width and height of a postage stamp of the image to write in
+    // a TGA 2.0 extension area, where 0 means none. TGA 2.0 suggests 64.
+    uint8_t postage_stamp;
+} TgaWriteOptions;
+
+// Filters that resizing resamples pixels with
+typedef enum {
+    // Average of the source pixels that each pixel covers
+    TGA_FILTER_BOX,
+    // Tent over the two nearest source pixels, widened when downscaling
+    TGA_FILTER_BILINEAR,
+    // Three lobe Lanczos, the sharpest and slowest
+    TGA_FILTER_LANCZOS,
+} TgaFilter;
+
+// Options for generating mipmaps
+typedef struct {
+    TgaFilter filter;
+    // Threads used to resample each level, where 0 means one per CPU
+    unsigned thread_count;
+    // Run-length encode the levels that are written to files
+    bool rle;
+} TgaMipmapOptions;
+
+// Operation applied to every file of a batch
+typedef enum {
+    // Rewrite image data uncompressed or run-length encoded
+    TGA_BATCH_RECOMPRESS,
+    // Convert pixels to another pixel depth, expanding color mapped images
+    TGA_BATCH_CONVERT_DEPTH,
+    // Convert true color and grayscale images to color mapped images
+    TGA_BATCH_PALETTIZE,
+} TgaBatchOperation;
+
+// Options for converting batches of TGA image files
+typedef struct {
+    TgaBatchOperation operation;
+    // Run-length encode the output files
+    bool rle;
+    // Pixel depth of the output files for TGA_BATCH_CONVERT_DEPTH
+    uint8_t pixel_depth;
+    // Worker threads, where 0 means two per CPU
+    unsigned thread_count;
+} TgaBatchOptions;
+
+// Totals of a batch conversion
+typedef struct {
+    size_t files_converted;
+    size_t files_failed;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    // Wall clock time of the whole batch
+    double seconds;
+} TgaBatchStats;
+
+// Options of the tga_atlas functions
+typedef struct {
+    // Largest atlas, where 0 means 65535. Unless max_width is given, the
+    // atlas is as wide as the smallest power of two it fits in.
+    uint16_t max_width;
+    uint16_t max_height;
+    // Pixels left between images
+    uint16_t padding;
+    // Pixel depth of the atlas, which images are converted to, where 0
+    // means 32
+    uint8_t pixel_depth;
+    // Threads to read and copy images on, where 0 means one per CPU
+    unsigned thread_count;
+    // Allocator of the atlas and scratch memory, which may be NULL
+    const TgaAllocator *allocator;
+} TgaAtlasOptions;
+
+// Place of an image in an atlas, from its top left corner
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+} TgaAtlasRect;
+
+// Phases of reading and writing that instrumentation counts
+typedef enum {
+    // Opening and mapping files
+    TGA_PHASE_OPEN,
+    // Parsing headers
+    TGA_PHASE_HEADER,
+    // Reading and writing file data
+    TGA_PHASE_IO,
+    // Run-length decoding and color map expansion
+    TGA_PHASE_DECODE,
+    // Run-length encoding
+    TGA_PHASE_ENCODE,
+    // Allocating and reallocating buffers
+    TGA_PHASE_ALLOC,
+    TGA_PHASE_COUNT,
+} TgaPhase;
+
+// Counters of one phase
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t nanoseconds;
+} TgaPhaseStats;
+
+// Counters of every phase, indexed by TgaPhase
+typedef struct {
+    TgaPhaseStats phases[TGA_PHASE_COUNT];
+} TgaStats;
+
+// Least recently used cache of encoded TGA files, which tga_cache_create
+// allocates
+typedef struct TgaCache TgaCache;
+
+// Counters of a TgaCache
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    // Files held and their total size in bytes
+    size_t entry_count;
+    size_t size;
+} TgaCacheStats;
+
+// Options of tga_compare
+typedef struct {
+    // Threads to compare on, where 0 means one per CPU
+    unsigned thread_count;
+    // Whether to compute the structural similarity as well
+    bool ssim;
+} TgaCompareOptions;
+
+// Differences between two images that tga_compare measures
+typedef struct {
+    // Channels compared per pixel: 1 for two grayscale images, 4 when
+    // either image has alpha and 3 otherwise
+    uint8_t channels;
+    // Pixels that differ in any channel
+    uint64_t different_pixels;
+    // Largest and mean absolute difference of a channel
+    uint8_t max_error;
+    double mean_error;
+    // Mean squared error and peak signal to noise ratio in decibels, which
+    // is INFINITY for identical images
+    double mse;
+    double psnr;
+    // Mean structural similarity of the luma of both images from -1 to 1,
+    // if it was asked for
+    double ssim;
+} TgaCompareResult;
+
+// Metadata of a TGA image that tga_probe_file reads without its pixels
+typedef struct {
+    TgaHeader header;
+    // Size of the whole file and offset of its image data
+    uint64_t file_size;
+    uint64_t data_offset;
+    // Whether the file ends in a TGA 2.0 footer with a valid extension area,
+    // and the fields of the extension area that rtga uses
+    bool has_extension;
+    uint32_t extension_offset;
+    uint32_t postage_stamp_offset;
+    uint32_t scan_line_offset;
+    uint8_t attributes_type;
+} TgaProbe;
+
+// Options for scanning directories of TGA image files
+typedef struct {
+    // Scan subdirectories as well
+    bool recursive;
+    // Read the TGA 2.0 footer and extension area of every file
+    bool extension;
+    // Threads that probe files, where 0 means two per CPU
+    unsigned thread_count;
+} TgaScanOptions;
+
+// File found by tga_scan_directory
+typedef struct {
+    const char *path;
+    // Result of probing the file, which leaves probe valid on TGA_SUCCESS
+    int result;
+    TgaProbe probe;
+} TgaScanEntry;
+
+// Loader that reads many TGA image files at once, which tga_loader_create
+// allocates
+typedef struct TgaLoader TgaLoader;
+
+// File loaded by a TgaLoader
+typedef struct {
+    // Value the file was submitted with
+    void *user_data;
+    // Result of loading the file, which leaves image valid on TGA_SUCCESS.
+    // The image belongs to the caller, who frees it with tga_free.
+    int result;
+    TgaImage image;
+} TgaLoadResult;
+
+// Options for loading TGA image files asynchronously
+typedef struct {
+    // How files are decoded. Every file is decoded on a single thread, since
+    // files are decoded in parallel, so thread_count is ignored. The
+    // allocator is called from several threads at once.
+    TgaReadOptions read;
+    // Threads that decode files, where 0 means one per CPU, or two per CPU
+    // when they also read files
+    unsigned thread_count;
+    // Most files read or waiting to be decoded at once, where 0 means 64
+    unsigned queue_depth;
+    // Called on a decoding thread with every loaded file instead of
+    // queueing it for tga_loader_poll. It may submit more files.
+    void (*callback)(void *context, TgaLoadResult *result);
+    void *context;
+    // Read files with blocking calls on the decoding threads even where
+    // io_uring is available
+    bool blocking_io;
+} TgaLoaderOptions;
+
+// Streaming TGA reader
+//
+// Scanlines are read in the order they are stored in the file.
+typedef struct {
+    TgaHeader header;
+    uint8_t *image_id;
+    uint8_t *color_map_data;
+    // Source of the file data, and the file behind it if the reader opened one
+    TgaIo io;
+    FILE *fp;
+    uint8_t pixel_size;
+    uint16_t rows_read;
+    // Run-length packet that continues past the last scanline read
+    uint8_t packet_remaining;
+    bool packet_is_run;
+    uint8_t packet_pixel[4];
+    // Buffered run-length encoded file data
+    uint8_t *buffer;
+    size_t buffer_start;
+    size_t buffer_end;
+    // Allocator of the buffers above
+    TgaAllocator allocator;
+} TgaReader;
+
+// Streaming TGA writer
+typedef struct {
+    TgaHeader header;
+    // Destination of the file data, and the file behind it if the writer
+    // opened one
+    TgaIo io;
+    FILE *fp;
+    uint8_t pixel_size;
+    uint16_t rows_written;
+    // Run-length encoded scanline
+    uint8_t *row_buffer;
+    // Allocator of the buffers above
+    TgaAllocator allocator;
+} TgaWriter;
+
 // Allocates memory for a TGA image in memory 
 //
 // Returns:
@@ -134,7 +499,22 @@ typedef struct {
 //  TGA_ALLOCATION_ERROR
 int tga_alloc(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t pixel_depth, TgaImage *tga);
 
+// Allocates memory for a TGA image in memory with an allocator
+//
+// allocator may be NULL for the general heap. The image keeps a copy of
+// allocator, which every later call that replaces or frees its buffers
+// uses, including tga_write_file for scratch memory.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_NULL_PTR_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_ALLOCATION_ERROR
+int tga_alloc_ex(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t pixel_depth, const TgaAllocator *allocator, TgaImage *tga);
+
 // Frees allocated memory for a TGA image.
+//
+// Images created by tga_map_file are unmapped instead.
 void tga_free(TgaImage *tga);
 
 // Reads a TGA image from a file
@@ -143,29 +523,783 @@ void tga_free(TgaImage *tga);
 //  TGA_SUCCESS,
 //  TGA_ALLOCATION_ERROR,
 //  TGA_FILE_OPEN_ERROR,
-//  TGA_FILE_READ_ERROR
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_RLE_DECODE_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
 int tga_read_file(TgaImage *tga, const char *filename);
 
+// Reads a TGA image from a file with options
+//
+// options may be NULL, which reads the same way as tga_read_file.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_RLE_DECODE_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_read_file_ex(TgaImage *tga, const char *filename, const TgaReadOptions *options);
+
 // Writes a TGA image into a file
 //
+// Image data is run-length encoded when the header's image type is an RLE type.
+//
 // Returns:
 //  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
 //  TGA_FILE_OPEN_ERROR,
-//  TGA_FILE_WRITE_ERROR
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
 int tga_write_file(TgaImage *tga, const char *filename);
 
+// Writes a TGA image into a file with options
+//
+// options may be NULL, which writes the same way as tga_write_file. The file
+// is the same for every thread count.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_write_file_ex(TgaImage *tga, const char *filename, const TgaWriteOptions *options);
+
+// Reads a TGA image through I/O callbacks
+//
+// Data is read in order, so scan line tables are not used. Uncompressed
+// image data is read up to its end, while run-length encoded data is read
+// ahead in blocks. options may be NULL.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_RLE_DECODE_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_read_io(TgaImage *tga, const TgaIo *io, const TgaReadOptions *options);
+
+// Writes a TGA image through I/O callbacks
+//
+// options may be NULL. The data is the same as tga_write_file_ex writes.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_write_io(TgaImage *tga, const TgaIo *io, const TgaWriteOptions *options);
+
+// Decodes a TGA image from size bytes of file data in memory
+//
+// options may be NULL. Run-length encoded data with a scan line table is
+// decoded in parallel like tga_read_file_ex does.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_READ_ERROR if the data ends early,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_RLE_DECODE_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_decode_memory(TgaImage *tga, const void *data, size_t size, const TgaReadOptions *options);
+
+// Returns the exact number of bytes tga_encode_memory and tga_write_file_ex
+// write for an image and options, which may be NULL, or 0 if the pixel depth
+// is invalid
+//
+// Run-length encoded images are measured without being encoded, on
+// options->thread_count threads.
+size_t tga_encoded_size(const TgaImage *tga, const TgaWriteOptions *options);
+
+// Encodes a TGA image into a buffer of dst_size bytes
+//
+// The data is the same as tga_write_file_ex writes. The number of bytes
+// written is stored in encoded_size if it is not NULL.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_WRITE_ERROR if dst is smaller than tga_encoded_size,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_encode_memory(TgaImage *tga, void *dst, size_t dst_size, const TgaWriteOptions *options, size_t *encoded_size);
+
+// Starts memory at the beginning of size bytes at data
+void tga_memory_io_init(TgaMemoryIo *memory, void *data, size_t size);
+
+// Returns I/O callbacks that read, write and seek within memory
+//
+// Writes past the end of the buffer are cut short.
+TgaIo tga_memory_io(TgaMemoryIo *memory);
+
+// Opens a TGA image file for reading one chunk of scanlines at a time
+//
+// The header, image id and color map are read into the reader. The image id
+// and color map are freed by tga_reader_close unless they are taken from the
+// reader and replaced with NULL.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_reader_open(TgaReader *reader, const char *filename);
+
+// Opens a reader over I/O callbacks
+//
+// io is copied into the reader, and tga_reader_close does not close it.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_reader_open_io(TgaReader *reader, const TgaIo *io);
+
+// Reads the next row_count scanlines into dst
+//
+// dst must have room for row_count * width pixels. Run-length packets that
+// cross scanlines are continued by the next call.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_READ_ERROR,
+//  TGA_RLE_DECODE_ERROR
+int tga_reader_read_rows(TgaReader *reader, uint8_t *dst, uint16_t row_count);
+
+// Closes a reader and frees everything it owns.
+void tga_reader_close(TgaReader *reader);
+
+// Opens a TGA image file for writing one chunk of scanlines at a time
+//
+// The header, image id and color map are written immediately. Image data is
+// run-length encoded when the header's image type is an RLE type.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_writer_open(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const char *filename);
+
+// Opens a writer over I/O callbacks
+//
+// io is copied into the writer, and tga_writer_close does not close it.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_writer_open_io(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const TgaIo *io);
+
+// Writes the next row_count scanlines from src
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_WRITE_ERROR
+int tga_writer_write_rows(TgaWriter *writer, const uint8_t *src, uint16_t row_count);
+
+// Writes every row of view as the next view->height scanlines. view must be
+// as wide as the image.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR if view has another pixel depth,
+//  TGA_FILE_WRITE_ERROR if view has another width or more rows than are left
+int tga_writer_write_view(TgaWriter *writer, const TgaView *view);
+
+// Closes a writer
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_WRITE_ERROR if not every scanline was written or the file could not be flushed
+int tga_writer_close(TgaWriter *writer);
+
+// Maps an uncompressed TGA image file into memory
+//
+// No image data is copied: image_id, color_map_data and image_data point
+// straight into a private copy-on-write mapping of the file, which stays
+// valid until tga_unmap_file or tga_free is called.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_map_file(TgaImage *tga, const char *filename);
+
+// Unmaps a TGA image created by tga_map_file.
+void tga_unmap_file(TgaImage *tga);
+
 // Sets a pixel to color
 void tga_set_pixel(TgaImage *tga, uint16_t x, uint16_t y, TgaColor color);
 
 // Sets every pixel in the image to color.
 void tga_fill(TgaImage *tga, TgaColor color);
 
+// Sets every pixel in a rectangle to color.
+//
+// The rectangle is clipped to the image.
+void tga_fill_rect(TgaImage *tga, uint16_t x, uint16_t y, uint16_t width, uint16_t height, TgaColor color);
+
+// Sets length pixels of row y to color, from x to the right.
+//
+// Coordinates are the same as for tga_set_pixel, and the span is clipped to
+// the image.
+void tga_draw_span(TgaImage *tga, int32_t x, int32_t y, int32_t length, TgaColor color);
+
+// Sets the pixels of a line from x0, y0 to x1, y1 to color, both ends
+// included.
+//
+// The line is clipped to the image and gets the same pixels as if it were
+// drawn whole. Coordinates may lie up to 2^29 pixels outside the image.
+void tga_draw_line(TgaImage *tga, int32_t x0, int32_t y0, int32_t x1, int32_t y1, TgaColor color);
+
+// Sets the pixels of a rectangle, or only its outline unless filled, to
+// color.
+//
+// The rectangle is clipped to the image.
+void tga_draw_rect(TgaImage *tga, int32_t x, int32_t y, int32_t width, int32_t height, bool filled, TgaColor color);
+
+// Sets the pixel at xs[i], ys[i] to color for each of count points.
+//
+// Points outside the image are skipped.
+void tga_draw_points(TgaImage *tga, const int32_t *xs, const int32_t *ys, size_t count, TgaColor color);
+
+// Sets up a view of width by height pixels at data, with rows stride bytes
+// apart. A stride of 0 means rows are packed with no gap between them.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_view_init(TgaView *view, void *data, uint16_t width, uint16_t height, size_t stride, uint8_t pixel_depth);
+
+// Returns a view of the image data of an uncompressed or color mapped image
+TgaView tga_image_view(TgaImage *tga);
+
+// Returns a view of a rectangle inside view
+//
+// The rectangle is clipped to view, so it may be empty.
+TgaView tga_subview(const TgaView *view, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+// Sets every pixel of a view to color.
+void tga_view_fill(const TgaView *view, TgaColor color);
+
+// Converts the pixels of src into the pixel depth of dst
+//
+// Both views are cut to the width and height they share. dst may be the
+// same pixels as src with the same stride, as long as its pixels are not
+// larger, or the rows have room for them. src_alpha tells whether the
+// attribute bits of 16-bit and 32-bit source pixels hold alpha. dither is the
+// same as for tga_convert_depth.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_view_convert(const TgaView *dst, const TgaView *src, bool src_alpha, bool dither);
+
+// Writes the pixels of view as a TGA image file of image_type, which is a
+// true color or grayscale type. Other header fields are left empty, and
+// tga_writer_write_view writes views under any header.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_ALLOCATION_ERROR
+int tga_write_view(const TgaView *view, TgaImageType image_type, const char *filename);
+
+// Flips the rows of an uncompressed or color mapped image upside down in place
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_flip_vertical(TgaImage *tga);
+
+// Reverses every row of an uncompressed or color mapped image in place
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_flip_horizontal(TgaImage *tga);
+
+// Swaps the rows and columns of an uncompressed or color mapped image
+//
+// Square images are transposed in place. Other images are copied tile by
+// tile into a new buffer.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_transpose(TgaImage *tga);
+
+// Rotates an uncompressed or color mapped image by 90 degrees, as seen with
+// the first row at the top. Square images are rotated in place.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_rotate_90(TgaImage *tga, bool clockwise);
+
+// Flips an image in place so its first pixel is the top left corner, and
+// moves the origin of the descriptor there. This is the same as reading with
+// the top_left option, for images that are already in memory.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_normalize_orientation(TgaImage *tga);
+
+// Blends the 32-bit pixels of src over the 32-bit pixels of dst, with the
+// top left corner of src at column x and row y of dst
+//
+// src is clipped to dst, so it may start at a negative offset. Pixels hold
+// premultiplied alpha if premultiplied, and straight alpha otherwise.
+// Transparent straight pixels leave dst as it is.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR if either view is not 32-bit
+int tga_blend(const TgaView *dst, const TgaView *src, int32_t x, int32_t y, bool premultiplied);
+
+// Multiplies the color of every pixel by its alpha, or of every color map
+// entry for color mapped images
+//
+// The number of alpha bits in the descriptor decides what alpha is. 32-bit
+// pixels with 8 alpha bits are scaled, 16-bit pixels with 1 alpha bit lose
+// their color where the bit is clear, and pixels without alpha stay as they
+// are.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_premultiply(TgaImage *tga);
+
+// Divides the color of every pixel by its alpha, undoing tga_premultiply up
+// to rounding. Colors of pixels with no alpha become 0.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_unpremultiply(TgaImage *tga);
+
+// Resamples the pixels of src into dst, scaling them to the size of dst
+//
+// Filters are applied to rows and then to columns, on thread_count threads
+// where 0 means one per CPU. 15-bit and 16-bit pixels are resampled as
+// 32-bit pixels. The views must not overlap, and an empty view leaves dst
+// as it is.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR if the views differ in pixel depth
+int tga_resize_view(const TgaView *dst, const TgaView *src, TgaFilter filter, unsigned thread_count);
+
+// Resizes an uncompressed image to width by height pixels
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image is color mapped or run-length encoded
+int tga_resize(TgaImage *tga, uint16_t width, uint16_t height, TgaFilter filter, unsigned thread_count);
+
+// Returns the number of levels in the mipmap chain of an image, including
+// the image itself, down to a level of 1 by 1 pixels
+unsigned tga_mipmap_count(uint16_t width, uint16_t height);
+
+// Generates the mipmap chain of an uncompressed image, halving each level
+// from the one before it
+//
+// levels may be NULL, or hold tga_mipmap_count - 1 images, where levels[i]
+// receives level i + 1 and must be freed with tga_free. filenames may be
+// NULL, or hold tga_mipmap_count file names, where level 0 is tga and a
+// NULL name skips its level. Levels are written as they are generated, so
+// without levels only two of them are in memory at a time. options may be
+// NULL for a box filter.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image is color mapped or run-length encoded
+int tga_generate_mipmaps(TgaImage *tga, const TgaMipmapOptions *options, TgaImage *levels, const char *const *filenames);
+
 // Converts instance of TgaImage from uncompressed to color mapped
+//
+// Images with at most 256 distinct pixels keep every pixel exactly. Other
+// images are quantized to a 256 entry color map with median cut. Image data
+// becomes 8-bit indices and grayscale images get a 24-bit color map.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image is not uncompressed
 int tga_to_color_map(TgaImage *tga);
 
 // Converts instance of TgaImage from color mapped to uncompressed
+//
+// Indices outside of the color map become zero.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image is not color mapped
 int tga_from_color_map(TgaImage *tga);
 
+// Converts the pixels of an instance of TgaImage to another pixel depth
+//
+// Any valid depth converts to any other. Pixels go through 32-bit color:
+// 15-bit and 16-bit channels widen to 8 bits, 8-bit pixels become gray, and
+// downconversion rounds to nearest or, with dither, uses a 4x4 ordered
+// dither. Grayscale results use Rec. 601 luma. Alpha is kept where the
+// descriptor says the source has alpha and the new depth can hold it.
+//
+// Conversion is in place where pixels shrink. Color mapped images convert
+// their color map instead, without dithering.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image is run-length encoded
+int tga_convert_depth(TgaImage *tga, uint8_t pixel_depth, bool dither);
+
+// Expands pixel_count color map indices into color map entries
+//
+// The indices use the pixel depth of header and the entries use its color map
+// pixel depth. Indices outside of the color map become zero. Expanding a few
+// rows at a time lets color mapped images stay small in memory.
+void tga_color_map_expand(uint8_t *dst, const uint8_t *indices, size_t pixel_count, const TgaHeader *header, const uint8_t *color_map_data);
+
+// Reads the header of a TGA image file and checks it without reading pixels
+//
+// Only the header is read unless extension is true, in which case the
+// footer and extension area are read as well. A file without a valid footer
+// is not an error, it only leaves probe->has_extension false.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_READ_ERROR if the file is too short for its header, color map
+//  or uncompressed image data,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_probe_file(const char *filename, bool extension, TgaProbe *probe);
+
+// Same as tga_probe_file for size bytes of file data in memory
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_READ_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR
+int tga_probe_memory(const void *data, size_t size, bool extension, TgaProbe *probe);
+
+// Reads the TGA 2.0 postage stamp of a file as an image of its own
+//
+// Only the header, color map, footer, extension area and stamp are read,
+// never the image data. The thumbnail is uncompressed, and is read with
+// options like the image would be, so it can be expanded or turned to the
+// top left corner. options may be NULL.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_READ_ERROR if the file is too short for its header, color map
+//  or postage stamp,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR,
+//  TGA_NO_POSTAGE_STAMP_ERROR if the file has no postage stamp
+int tga_read_thumbnail(TgaImage *thumbnail, const char *filename, const TgaReadOptions *options);
+
+// Probes every .tga file in a directory on a pool of worker threads
+//
+// entries is set to an array of entry_count entries sorted by path, which is
+// freed with tga_scan_free. Files are probed in parallel, since probing is
+// bound by the latency of opening files. Subdirectories that cannot be
+// opened are skipped.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR if directory cannot be opened
+int tga_scan_directory(const char *directory, const TgaScanOptions *options, TgaScanEntry **entries, size_t *entry_count);
+
+// Frees the entries of tga_scan_directory
+void tga_scan_free(TgaScanEntry *entries);
+
+// Creates a loader that reads and decodes submitted files in the background
+//
+// On Linux, files are opened, sized and read in batches through io_uring
+// and decoded on worker threads as their data arrives. Where io_uring is
+// not available, worker threads read files with blocking calls instead.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR if the loader or its threads cannot be created
+int tga_loader_create(const TgaLoaderOptions *options, TgaLoader **loader);
+
+// Queues a file to be loaded. user_data is handed back with its result.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR
+int tga_loader_submit(TgaLoader *loader, const char *filename, void *user_data);
+
+// Takes the result of a loaded file, in the order files finish loading
+//
+// If wait, waits for a file to finish when none has yet. Returns false when
+// there is no result to take: none has finished and wait is false, or every
+// submitted file has already been taken or handed to the callback.
+bool tga_loader_poll(TgaLoader *loader, bool wait, TgaLoadResult *result);
+
+// Waits until every submitted file has been loaded
+void tga_loader_wait(TgaLoader *loader);
+
+// Returns whether a loader reads files through io_uring
+bool tga_loader_uses_io_uring(const TgaLoader *loader);
+
+// Waits for every submitted file, then frees a loader along with the images
+// of results that were never taken
+void tga_loader_destroy(TgaLoader *loader);
+
+// Converts file_count TGA image files on a pool of worker threads
+//
+// input_files[i] is converted into output_files[i]. Each worker reuses its
+// buffers from file to file, reads and writes every file in one call, and
+// decodes uncompressed image data in place. If results is not NULL, the
+// result of each file is stored in it. If stats is not NULL, the totals of
+// the batch are stored in it.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR if the pixel depth of options is invalid,
+//  or the result of the first file that failed
+int tga_batch_convert(const char *const *input_files, const char *const *output_files, size_t file_count, const TgaBatchOptions *options, int *results, TgaBatchStats *stats);
+
+// Places count rectangles of widths[i] by heights[i] pixels in an atlas
+// without overlap, and stores their places in rects and the size of the
+// atlas in atlas_width and atlas_height
+//
+// Rectangles are packed tallest first along a skyline, each where its top
+// ends up lowest.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_ATLAS_FULL_ERROR if the rectangles do not fit in the largest atlas
+int tga_atlas_pack(const uint16_t *widths, const uint16_t *heights, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects, uint16_t *atlas_width, uint16_t *atlas_height);
+
+// Packs count images into one uncompressed atlas stored from its top left
+// corner, and stores the place of each image in rects
+//
+// Rows are copied straight into the atlas on a pool of worker threads,
+// converted to its pixel depth where they need to be. Pixels between images
+// are zero.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_ATLAS_FULL_ERROR if the images do not fit in the largest atlas,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if any image is run-length encoded
+int tga_atlas_build(TgaImage *atlas, const TgaImage *images, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects);
+
+// Same as tga_atlas_build, with images read from files
+//
+// Files are packed by the sizes in their headers, then read and copied one
+// at a time by each worker thread. If results is not NULL, the result of
+// each file is stored in it. The atlas is allocated unless packing it
+// fails, even if some files fail, whose rectangles are left empty.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_ATLAS_FULL_ERROR if the images do not fit in the largest atlas,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR if the pixel depth of options is invalid,
+//  or the result of the first file that failed
+int tga_atlas_build_files(TgaImage *atlas, const char *const *filenames, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects, int *results);
+
+// Writes the size of an atlas and the name and place of each of its count
+// images to a JSON file. names may be NULL to leave the names out.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR
+int tga_atlas_write_table(const char *filename, const TgaImage *atlas, const char *const *names, const TgaAtlasRect *rects, size_t count);
+
+// Returns whether rtga was built with instrumentation (RTGA_ENABLE_STATS).
+// Without it, every counter stays 0 and traces are empty.
+bool tga_stats_enabled(void);
+
+// Returns the name of a phase, as it appears in traces
+const char *tga_phase_name(TgaPhase phase);
+
+// Gets the counters of every thread added together, including threads that
+// have exited
+//
+// Each thread counts on its own, so totals are exact once the threads that
+// use rtga are idle.
+void tga_stats_get(TgaStats *stats);
+
+// Gets the counters of the calling thread
+void tga_stats_get_thread(TgaStats *stats);
+
+// Sets the counters of every thread to 0
+void tga_stats_reset(void);
+
+// Starts recording an event for every counted call, dropping the events of
+// an earlier trace
+void tga_trace_begin(void);
+
+// Stops recording events and writes them to a file in the Chrome trace
+// event format, which chrome://tracing and Perfetto open
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR
+int tga_trace_end(const char *filename);
+
+// Returns a 64-bit hash of size bytes of data
+//
+// The hash is the same on every host and build, so it can be stored.
+uint64_t tga_hash(const void *data, size_t size);
+
+// Hashes the pixels of an image as they look
+//
+// Pixels are hashed as 32-bit pixels from the top left corner, with opaque
+// alpha where the image has no alpha bits and color mapped pixels looked up
+// in the color map. Images that look the same hash the same whatever their
+// pixel depth or orientation, which finds duplicates across files.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_content_hash(const TgaImage *tga, uint64_t *hash);
+
+// Tells whether two images look the same, stopping at the first pixel that
+// differs
+//
+// Pixels are compared as tga_content_hash hashes them, so the images may
+// differ in pixel depth and orientation. Images of different sizes are not
+// equal. Unless they are equal, x and y are set to the first pixel that
+// differs, counted from the top left corner in rows; either may be NULL.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_equal(const TgaImage *a, const TgaImage *b, bool *equal, uint16_t *x, uint16_t *y);
+
+// Measures how much two images of the same size differ
+//
+// Pixels are compared as tga_content_hash hashes them. The structural
+// similarity compares the luma of 8x8 windows every 4 pixels. options may
+// be NULL to compare on every CPU without it.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR,
+//  TGA_SIZE_MISMATCH_ERROR if the images are not the same size,
+//  TGA_UNSUPPORTED_IMAGE_TYPE_ERROR if the image data is run-length encoded
+int tga_compare(const TgaImage *a, const TgaImage *b, const TgaCompareOptions *options, TgaCompareResult *result);
+
+// Creates a cache that holds up to capacity bytes of encoded files
+//
+// Memory comes from allocator, which may be NULL. The cache may be used by
+// several threads at once.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR
+int tga_cache_create(size_t capacity, const TgaAllocator *allocator, TgaCache **cache);
+
+// Frees a cache and every file it holds
+void tga_cache_destroy(TgaCache *cache);
+
+// Gets the counters of a cache
+void tga_cache_get_stats(TgaCache *cache, TgaCacheStats *stats);
+
+// Same as tga_encode_memory, except that an image encoded with the same
+// options before is copied out of the cache instead of encoded again
+//
+// Images are looked up by a hash of their header, image id, color map and
+// image data as they are stored, along with the options that change the
+// file. On TGA_FILE_WRITE_ERROR encoded_size is the size dst needs.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_WRITE_ERROR if dst is too small,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_cache_encode_memory(TgaCache *cache, TgaImage *tga, void *dst, size_t dst_size, const TgaWriteOptions *options, size_t *encoded_size);
+
+// Same as tga_write_file_ex, except that an image encoded with the same
+// options before is written out of the cache instead of encoded again
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_ALLOCATION_ERROR,
+//  TGA_FILE_OPEN_ERROR,
+//  TGA_FILE_WRITE_ERROR,
+//  TGA_INVALID_PIXEL_DEPTH_ERROR
+int tga_cache_write_file(TgaCache *cache, TgaImage *tga, const char *filename, const TgaWriteOptions *options);
+
+// Starts a bump arena over size bytes of buffer
+void tga_arena_init(TgaArena *arena, void *buffer, size_t size);
+
+// Frees every allocation of an arena at once
+void tga_arena_reset(TgaArena *arena);
+
+// Returns an allocator that allocates from arena
+//
+// The allocator is not thread safe and points to arena, which must outlive
+// every allocation.
+TgaAllocator tga_arena_allocator(TgaArena *arena);
+
+// Starts a size class pool over size bytes of buffer
+void tga_pool_init(TgaPool *pool, void *buffer, size_t size);
+
+// Returns an allocator that allocates from pool
+//
+// The allocator is not thread safe and points to pool, which must outlive
+// every allocation.
+TgaAllocator tga_pool_allocator(TgaPool *pool);
+
 // Returns the size of each pixel in bytes.
 uint8_t tga_pixel_size(const TgaHeader *header);
 
@@ -175,4 +1309,36 @@ size_t tga_image_size(const TgaHeader *header);
 // Returns true if pixel_depth is a valid bit depth
 bool tga_valid_depth(uint8_t pixel_depth);
 
+// Returns true if image data of image_type is run-length encoded
+bool tga_is_rle(TgaImageType image_type);
+
+//
+// Run-length encoding
+//
+
+// Returns the largest number of bytes tga_rle_encode can write for pixel_count pixels.
+size_t tga_rle_bound(size_t pixel_count, uint8_t pixel_size);
+
+// Run-length encodes pixel_count pixels of pixel_size bytes from src into dst.
+//
+// dst must have room for tga_rle_bound(pixel_count, pixel_size) bytes.
+// Packets never extend past pixel_count, so encoding one scanline at a time
+// keeps packets from crossing scanlines.
+//
+// Returns the number of bytes written to dst.
+size_t tga_rle_encode(uint8_t *dst, const uint8_t *src, size_t pixel_count, uint8_t pixel_size);
+
+// Returns the number of bytes tga_rle_encode writes for the same pixels
+// without writing them.
+size_t tga_rle_encoded_size(const uint8_t *src, size_t pixel_count, uint8_t pixel_size);
+
+// Decodes run-length encoded packets from src until pixel_count pixels are written to dst.
+//
+// If bytes_read is not NULL, the number of bytes consumed from src is stored in it.
+//
+// Returns:
+//  TGA_SUCCESS,
+//  TGA_RLE_DECODE_ERROR
+int tga_rle_decode(uint8_t *dst, size_t pixel_count, const uint8_t *src, size_t src_size, uint8_t pixel_size, size_t *bytes_read);
+
 #endif
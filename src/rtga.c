@@ -1,4 +1,4 @@
-#include "rtga/rtga.h"
+#include "rtga_internal.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -43,7 +43,131 @@ const TgaColor AZURE24 = COLOR24(0, 128, 255);
 const TgaColor WHITE24 = COLOR24(255, 255, 255);
 const TgaColor BLACK24 = COLOR24(0, 0, 0);
 
+void rtga_parse_header(TgaHeader *header, const uint8_t *bytes) {
+    RTGA_STATS_BEGIN(start);
+
+    // All multi-byte fields are little-endian
+    header->id_length = bytes[0];
+    header->color_map_type = bytes[1] != 0;
+    header->image_type = (TgaImageType)bytes[2];
+    header->color_map_first_index = (uint16_t)(bytes[3] | bytes[4] << 8);
+    header->color_map_length = (uint16_t)(bytes[5] | bytes[6] << 8);
+    header->color_map_pixel_depth = bytes[7];
+    header->x_origin = (uint16_t)(bytes[8] | bytes[9] << 8);
+    header->y_origin = (uint16_t)(bytes[10] | bytes[11] << 8);
+    header->width = (uint16_t)(bytes[12] | bytes[13] << 8);
+    header->height = (uint16_t)(bytes[14] | bytes[15] << 8);
+    header->image_pixel_depth = bytes[16];
+    header->descriptor = bytes[17];
+
+    RTGA_STATS_END(start, TGA_PHASE_HEADER, TGA_HEADER_SIZE);
+}
+
+void rtga_serialize_header(uint8_t *bytes, const TgaHeader *header) {
+    bytes[0] = header->id_length;
+    bytes[1] = header->color_map_type;
+    bytes[2] = (uint8_t)header->image_type;
+    bytes[3] = (uint8_t)header->color_map_first_index;
+    bytes[4] = (uint8_t)(header->color_map_first_index >> 8);
+    bytes[5] = (uint8_t)header->color_map_length;
+    bytes[6] = (uint8_t)(header->color_map_length >> 8);
+    bytes[7] = header->color_map_pixel_depth;
+    bytes[8] = (uint8_t)header->x_origin;
+    bytes[9] = (uint8_t)(header->x_origin >> 8);
+    bytes[10] = (uint8_t)header->y_origin;
+    bytes[11] = (uint8_t)(header->y_origin >> 8);
+    bytes[12] = (uint8_t)header->width;
+    bytes[13] = (uint8_t)(header->width >> 8);
+    bytes[14] = (uint8_t)header->height;
+    bytes[15] = (uint8_t)(header->height >> 8);
+    bytes[16] = header->image_pixel_depth;
+    bytes[17] = header->descriptor;
+}
+
+void rtga_serialize_extension(uint8_t *bytes, const RtgaExtension *extension) {
+    memset(bytes, 0, TGA_EXTENSION_SIZE);
+
+    // Extension size, then little-endian offsets near the end of the area
+    bytes[0] = (uint8_t)TGA_EXTENSION_SIZE;
+    bytes[1] = (uint8_t)(TGA_EXTENSION_SIZE >> 8);
+    for (int i = 0; i < 4; ++i) {
+        bytes[486 + i] = (uint8_t)(extension->postage_stamp_offset >> (8 * i));
+        bytes[490 + i] = (uint8_t)(extension->scan_line_offset >> (8 * i));
+    }
+    bytes[494] = extension->attributes_type;
+}
+
+void rtga_parse_extension(RtgaExtension *extension, const uint8_t *bytes) {
+    extension->postage_stamp_offset = 0;
+    extension->scan_line_offset = 0;
+    for (int i = 0; i < 4; ++i) {
+        extension->postage_stamp_offset |= (uint32_t)bytes[486 + i] << (8 * i);
+        extension->scan_line_offset |= (uint32_t)bytes[490 + i] << (8 * i);
+    }
+    extension->attributes_type = bytes[494];
+}
+
+void rtga_serialize_footer(uint8_t *bytes, uint32_t extension_offset) {
+    // Extension area offset, no developer directory, then the signature
+    memset(bytes, 0, TGA_FOOTER_SIZE);
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = (uint8_t)(extension_offset >> (8 * i));
+    }
+    memcpy(bytes + 8, TGA_SIGNATURE, sizeof(TGA_SIGNATURE));
+}
+
+bool rtga_parse_footer(const uint8_t *bytes, uint32_t *extension_offset) {
+    if (memcmp(bytes + 8, TGA_SIGNATURE, sizeof(TGA_SIGNATURE)) != 0) return false;
+
+    *extension_offset = 0;
+    for (int i = 0; i < 4; ++i) {
+        *extension_offset |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return true;
+}
+
+size_t rtga_color_map_size(const TgaHeader *header) {
+    if (!header->color_map_type) return 0;
+
+    return (size_t)header->color_map_length * ((header->color_map_pixel_depth + 7) / 8);
+}
+
+int rtga_check_header(const TgaHeader *header) {
+    bool color_mapped = false;
+    switch (header->image_type) {
+    case UNCOMPRESSED_COLOR_MAPPED_IMAGE:
+    case RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE:
+        color_mapped = true;
+        break;
+    case UNCOMPRESSED_TRUE_COLOR_IMAGE:
+    case UNCOMPRESSED_BLACK_AND_WHITE_IMAGE:
+    case RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE:
+    case RUN_LENGTH_ENCODED_BLACK_AND_WHITE_IMAGE:
+        break;
+    default:
+        return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    }
+    if (color_mapped && !header->color_map_type) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (!tga_valid_depth(header->image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (header->color_map_type && !tga_valid_depth(header->color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    return TGA_SUCCESS;
+}
+
+uint64_t rtga_min_data_size(const TgaHeader *header) {
+    uint64_t pixel_count = (uint64_t)header->width * header->height;
+    uint8_t pixel_size = tga_pixel_size(header);
+
+    // Every packet holds at most 128 pixels in a packet byte and one pixel
+    if (tga_is_rle(header->image_type)) return (pixel_count + 127) / 128 * (1 + pixel_size);
+    return pixel_count * pixel_size;
+}
+
 int tga_alloc(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t pixel_depth, TgaImage *tga) {
+    return tga_alloc_ex(image_type, width, height, pixel_depth, NULL, tga);
+}
+
+int tga_alloc_ex(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t pixel_depth, const TgaAllocator *allocator, TgaImage *tga) {
     assert(tga);
     assert(tga_valid_depth(pixel_depth));
 
@@ -58,9 +182,15 @@ int tga_alloc(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t
     tga->header.height = height;
     tga->header.image_pixel_depth = pixel_depth;
     tga->state = IS_UNCOMPRESSED;
+    tga->image_id = NULL;
+    tga->color_map_data = NULL;
+    tga->mapping = NULL;
+    tga->mapping_size = 0;
+    memset(&tga->allocator, 0, sizeof(TgaAllocator));
+    if (allocator) tga->allocator = *allocator;
 
     // Allocate image data
-    tga->image_data = malloc(tga_image_size(&tga->header));
+    tga->image_data = rtga_alloc(&tga->allocator, tga_image_size(&tga->header));
     if (!tga->image_data) return TGA_ALLOCATION_ERROR;
 
     return TGA_SUCCESS;
@@ -69,10 +199,16 @@ int tga_alloc(TgaImageType image_type, uint16_t width, uint16_t height, uint8_t
 void tga_free(TgaImage *tga) {
     assert(tga);
 
+    // Mapped images do not own their buffers
+    if (tga->mapping) {
+        tga_unmap_file(tga);
+        return;
+    }
+
     // Free all allocated memory
-    free(tga->image_id);
-    free(tga->color_map_data);
-    free(tga->image_data);
+    rtga_free(&tga->allocator, tga->image_id);
+    rtga_free(&tga->allocator, tga->color_map_data);
+    rtga_free(&tga->allocator, tga->image_data);
 
     // Assign NULL to all pointers
     tga->image_id = NULL;
@@ -81,111 +217,346 @@ void tga_free(TgaImage *tga) {
 }
 
 int tga_read_file(TgaImage *tga, const char *filename) {
-    uint8_t header_bytes[TGA_HEADER_SIZE];
-    FILE *fp;
-    size_t bytes_read;
+    return tga_read_file_ex(tga, filename, NULL);
+}
 
-    assert(tga);
+// Reads color mapped image data in chunks and expands each chunk into the
+// true color image data, storing every row where orientation puts it
+static int read_expanded(TgaReader *reader, TgaImage *tga, RtgaOrientation orientation) {
+    const TgaHeader *header = &reader->header;
+    uint8_t entry_size = (header->color_map_pixel_depth + 7) / 8;
+    size_t index_row_size = (size_t)header->width * reader->pixel_size;
+    size_t pixel_row_size = (size_t)header->width * entry_size;
+
+    // Chunks of about 64 KiB of indices
+    uint16_t chunk_rows = index_row_size ? (uint16_t)(65536 / index_row_size) : 1;
+    if (chunk_rows == 0) chunk_rows = 1;
+    if (chunk_rows > header->height) chunk_rows = header->height;
+
+    uint8_t *indices = rtga_alloc(&tga->allocator, chunk_rows * index_row_size + 1);
+    if (!indices) return TGA_ALLOCATION_ERROR;
+
+    for (uint16_t y = 0; y < header->height; y += chunk_rows) {
+        uint16_t rows = header->height - y < chunk_rows ? header->height - y : chunk_rows;
+        int result = tga_reader_read_rows(reader, indices, rows);
+        if (result != TGA_SUCCESS) {
+            rtga_free(&tga->allocator, indices);
+            return result;
+        }
+        if (!orientation.flip_rows && !orientation.flip_columns) {
+            tga_color_map_expand(tga->image_data + y * pixel_row_size, indices, (size_t)rows * header->width, header, reader->color_map_data);
+            continue;
+        }
+        for (uint16_t i = 0; i < rows; ++i) {
+            size_t row = orientation.flip_rows ? (size_t)(header->height - 1 - (y + i)) : (size_t)(y + i);
+            uint8_t *dst = tga->image_data + row * pixel_row_size;
+            tga_color_map_expand(dst, indices + i * index_row_size, header->width, header, reader->color_map_data);
+            if (orientation.flip_columns) rtga_reverse_pixels(dst, header->width, entry_size);
+        }
+    }
 
-    // Open file
-    fp = fopen(filename, "rb");
-    if (!fp) return TGA_FILE_OPEN_ERROR;
+    rtga_free(&tga->allocator, indices);
+    return TGA_SUCCESS;
+}
 
-    // Read header from file
-    bytes_read = fread(&header_bytes[0], 1, TGA_HEADER_SIZE, fp);
-    if (bytes_read != TGA_HEADER_SIZE) return TGA_FILE_READ_ERROR;
+// Reads the scanlines of a reader one at a time into the rows orientation
+// puts them in. Each scanline is reversed while it is still in cache.
+static int read_oriented(TgaReader *reader, uint8_t *image_data, RtgaOrientation orientation) {
+    const TgaHeader *header = &reader->header;
+    size_t row_size = (size_t)header->width * reader->pixel_size;
+
+    for (uint16_t y = 0; y < header->height; ++y) {
+        size_t row = orientation.flip_rows ? header->height - 1 - y : y;
+        uint8_t *dst = image_data + row * row_size;
+        int result = tga_reader_read_rows(reader, dst, 1);
+        if (result != TGA_SUCCESS) return result;
+        if (orientation.flip_columns) rtga_reverse_pixels(dst, header->width, reader->pixel_size);
+    }
 
-    // Convert header into struct instance
-    TgaHeader header;
-    memcpy(&header.id_length, &header_bytes[0], 1);
-    memcpy(&header.color_map_type, &header_bytes[1], 1);
-    memcpy(&header.image_type, &header_bytes[2], 1);
-    memcpy(&header.color_map_first_index, &header_bytes[3], 2);
-    memcpy(&header.color_map_length, &header_bytes[5], 2);
-    memcpy(&header.color_map_pixel_depth, &header_bytes[7], 1);
-    memcpy(&header.x_origin, &header_bytes[8], 2);
-    memcpy(&header.y_origin, &header_bytes[10], 2);
-    memcpy(&header.width, &header_bytes[12], 2);
-    memcpy(&header.height, &header_bytes[14], 2);
-    memcpy(&header.image_pixel_depth, &header_bytes[16], 1);
-    memcpy(&header.descriptor, &header_bytes[17], 1);
+    return TGA_SUCCESS;
+}
+
+// Reads the image data of an open reader into tga and closes the reader
+static int read_image(TgaImage *tga, TgaReader *reader, const TgaReadOptions *options) {
+    const TgaAllocator *allocator = options ? options->allocator : NULL;
+    int result;
+
+    bool color_mapped = reader->header.image_type == UNCOMPRESSED_COLOR_MAPPED_IMAGE ||
+                        reader->header.image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE;
+    bool expand = color_mapped && options && options->expand_color_map;
+    RtgaOrientation orientation = rtga_read_orientation(&reader->header, options && options->top_left);
+
+    if (expand && !tga_valid_depth(reader->header.color_map_pixel_depth)) {
+        tga_reader_close(reader);
+        return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    }
 
     // Allocate TGA image
-    if (tga_alloc(header.image_type, header.width, header.height, header.image_pixel_depth, tga) != TGA_SUCCESS) return TGA_ALLOCATION_ERROR;
+    uint8_t pixel_depth = expand ? reader->header.color_map_pixel_depth : reader->header.image_pixel_depth;
+    if (tga_alloc_ex(reader->header.image_type, reader->header.width, reader->header.height, pixel_depth, allocator, tga) != TGA_SUCCESS) {
+        tga_reader_close(reader);
+        return TGA_ALLOCATION_ERROR;
+    }
+    tga->header = reader->header;
+
+    // Take the image id from the reader
+    tga->image_id = reader->image_id;
+    reader->image_id = NULL;
+
+    if (expand) {
+        // Read image data from file straight into true color
+        result = read_expanded(reader, tga, orientation);
+
+        tga->header.image_type = tga_is_rle(reader->header.image_type)
+            ? RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE
+            : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        tga->header.color_map_type = false;
+        tga->header.color_map_first_index = 0;
+        tga->header.color_map_length = 0;
+        tga->header.color_map_pixel_depth = 0;
+        tga->header.image_pixel_depth = pixel_depth;
+    } else {
+        // Take the color map from the reader and read image data from file
+        tga->color_map_data = reader->color_map_data;
+        reader->color_map_data = NULL;
+        if (color_mapped) tga->state = IS_COLOR_MAPPED;
+
+        if (orientation.flip_rows || orientation.flip_columns) {
+            result = read_oriented(reader, tga->image_data, orientation);
+        } else {
+            result = tga_reader_read_rows(reader, tga->image_data, reader->header.height);
+        }
+    }
+    if (orientation.flip_rows || orientation.flip_columns) {
+        tga->header.descriptor = rtga_top_left_descriptor(tga->header.descriptor);
+    }
 
-    // Read image id from file if it exists
-    if (tga->header.id_length > 0) {
-        bytes_read = fread(&tga->image_id, 1, tga->header.id_length, fp);
-        if (bytes_read != tga->header.id_length) return TGA_FILE_READ_ERROR;
+    tga_reader_close(reader);
+    if (result != TGA_SUCCESS) {
+        tga_free(tga);
+        return result;
     }
 
-    // Write color map to file if it exists
-    if (header.color_map_type && tga->header.color_map_length > 0) {
-        bytes_read = fread(tga->color_map_data, 1, tga->header.color_map_length, fp);
-        if (bytes_read != tga->header.color_map_length) return TGA_FILE_READ_ERROR;
+    return TGA_SUCCESS;
+}
+
+int tga_read_file_ex(TgaImage *tga, const char *filename, const TgaReadOptions *options) {
+    TgaReader reader;
+
+    assert(tga);
+
+    // Open file and read everything before the image data
+    int result = rtga_reader_open(&reader, filename, options ? options->allocator : NULL);
+    if (result != TGA_SUCCESS) return result;
+
+    // Decode bands of scanlines in parallel when the file has a scan line table
+    if (!(options && options->expand_color_map)) {
+        bool handled;
+        result = rtga_read_rle_bands(tga, &reader, filename, options ? options->thread_count : 0, options && options->top_left, &handled);
+        if (result != TGA_SUCCESS || handled) {
+            tga_reader_close(&reader);
+            return result;
+        }
     }
 
-    // Write image data to file
-    bytes_read = fread(tga->image_data, 1, tga_image_size(&tga->header), fp);
-    if (bytes_read != tga_image_size(&tga->header)) return TGA_FILE_READ_ERROR;
+    return read_image(tga, &reader, options);
+}
 
-    // Close file
-    fclose(fp);
+int tga_read_io(TgaImage *tga, const TgaIo *io, const TgaReadOptions *options) {
+    TgaReader reader;
 
-    return TGA_SUCCESS;
+    assert(tga);
+    assert(io);
+
+    int result = rtga_reader_open_io(&reader, io, options ? options->allocator : NULL);
+    if (result != TGA_SUCCESS) return result;
+
+    return read_image(tga, &reader, options);
 }
 
 int tga_write_file(TgaImage *tga, const char *filename) {
-    uint8_t header_bytes[TGA_HEADER_SIZE];
-    FILE *fp;
-    size_t bytes_written;
+    return tga_write_file_ex(tga, filename, NULL);
+}
 
-    assert(tga);
+// Writes a postage stamp and scan line table, either of which may be
+// missing, then an extension area and footer after the image data
+static int write_trailer(TgaWriter *writer, uint64_t data_start, uint64_t data_size, const uint8_t *stamp, size_t stamp_size, const uint64_t *row_offsets) {
+    const TgaHeader *header = &writer->header;
+    uint64_t stamp_offset = data_start + data_size;
+    uint64_t table_offset = stamp_offset + stamp_size;
+    size_t table_size = row_offsets ? (size_t)header->height * 4 : 0;
+    uint64_t extension_offset = table_offset + table_size;
+
+    // Offsets are 32 bits, so files too large for them have no trailer
+    if (extension_offset > UINT32_MAX) return TGA_SUCCESS;
+
+    uint8_t *table = NULL;
+    if (table_size > 0) {
+        table = rtga_alloc(&writer->allocator, table_size);
+        if (!table) return TGA_ALLOCATION_ERROR;
+        for (size_t y = 0; y < header->height; ++y) {
+            uint64_t offset = data_start + row_offsets[y];
+            for (int i = 0; i < 4; ++i) {
+                table[y * 4 + i] = (uint8_t)(offset >> (8 * i));
+            }
+        }
+    }
 
-    // Open file
-    fp = fopen(filename, "wb");
-    if (!fp) return TGA_FILE_OPEN_ERROR;
-
-    // Convert header into byte array
-    // (Hopefully I can find a better method than this monstrosity...)
-    TgaHeader header = tga->header;
-    memcpy(&header_bytes[0], &header.id_length, 1);
-    memcpy(&header_bytes[1], &header.color_map_type, 1);
-    memcpy(&header_bytes[2], &header.image_type, 1);
-    memcpy(&header_bytes[3], &header.color_map_first_index, 2);
-    memcpy(&header_bytes[5], &header.color_map_length, 2);
-    memcpy(&header_bytes[7], &header.color_map_pixel_depth, 1);
-    memcpy(&header_bytes[8], &header.x_origin, 2);
-    memcpy(&header_bytes[10], &header.y_origin, 2);
-    memcpy(&header_bytes[12], &header.width, 2);
-    memcpy(&header_bytes[14], &header.height, 2);
-    memcpy(&header_bytes[16], &header.image_pixel_depth, 1);
-    memcpy(&header_bytes[17], &header.descriptor, 1);
-
-    // Write header to file
-    bytes_written = fwrite(header_bytes, 1, TGA_HEADER_SIZE, fp);
-    if (bytes_written != TGA_HEADER_SIZE) return TGA_FILE_WRITE_ERROR;
-    
-    // Write image id to file if it exists
-    if (tga->header.id_length > 0) {
-        bytes_written = fwrite(tga->image_id, 1, tga->header.id_length, fp);
-        if (bytes_written != tga->header.id_length) return TGA_FILE_WRITE_ERROR;
+    RtgaExtension extension;
+    uint8_t extension_bytes[TGA_EXTENSION_SIZE];
+    uint8_t footer[TGA_FOOTER_SIZE];
+    extension.postage_stamp_offset = stamp_size > 0 ? (uint32_t)stamp_offset : 0;
+    extension.scan_line_offset = row_offsets ? (uint32_t)table_offset : 0;
+    // Images with alpha bits are taken to have straight alpha
+    extension.attributes_type = (header->descriptor & 0x0f) ? 3 : 0;
+    rtga_serialize_extension(extension_bytes, &extension);
+    rtga_serialize_footer(footer, (uint32_t)extension_offset);
+
+    int result = TGA_SUCCESS;
+    const TgaIo *io = &writer->io;
+    if ((stamp_size > 0 && io->write(io->context, stamp, stamp_size) != stamp_size) ||
+        (table_size > 0 && io->write(io->context, table, table_size) != table_size) ||
+        io->write(io->context, extension_bytes, TGA_EXTENSION_SIZE) != TGA_EXTENSION_SIZE ||
+        io->write(io->context, footer, TGA_FOOTER_SIZE) != TGA_FOOTER_SIZE) {
+        result = TGA_FILE_WRITE_ERROR;
     }
+    rtga_free(&writer->allocator, table);
+
+    return result;
+}
 
-    // Write color map to file if it exists
-    if (header.color_map_type && tga->header.color_map_length > 0) {
-        bytes_written = fwrite(tga->color_map_data, 1, tga->header.color_map_length, fp);
-        if (bytes_written != tga->header.color_map_length) return TGA_FILE_WRITE_ERROR;
+// Writes the image data of tga with an open writer and closes the writer
+static int write_image(TgaImage *tga, TgaWriter *writer, const TgaWriteOptions *options) {
+    unsigned thread_count = rtga_thread_count(options ? options->thread_count : 0);
+    bool scan_line_table = options && options->scan_line_table;
+    int result = TGA_SUCCESS;
+
+    // The postage stamp is made before any image data is written, so a
+    // failure leaves nothing half written
+    uint8_t *stamp = NULL;
+    size_t stamp_size = 0;
+    if (options && options->postage_stamp) {
+        result = rtga_make_postage_stamp(tga, options->postage_stamp, thread_count, &stamp, &stamp_size);
     }
 
-    // Write image data to file
-    bytes_written = fwrite(tga->image_data, 1, tga_image_size(&tga->header), fp);
-    if (bytes_written != tga_image_size(&tga->header)) return TGA_FILE_WRITE_ERROR;
+    uint64_t *row_offsets = NULL;
+    if (result == TGA_SUCCESS && scan_line_table) {
+        row_offsets = rtga_alloc(&writer->allocator, ((size_t)tga->header.height + 1) * sizeof(uint64_t));
+        if (!row_offsets) result = TGA_ALLOCATION_ERROR;
+    }
 
-    // Close file
-    fclose(fp);
+    // Write image data to file. A trailer needs the size of run-length
+    // encoded data, which encoding in bands measures.
+    bool trailer = scan_line_table || stamp_size > 0;
+    uint64_t data_size = 0;
+    if (result != TGA_SUCCESS) {
+        // Nothing more is written
+    } else if (tga_is_rle(tga->header.image_type) && (thread_count > 1 || trailer)) {
+        result = rtga_write_rle_bands(writer, tga->image_data, thread_count, row_offsets, &data_size);
+    } else {
+        result = tga_writer_write_rows(writer, tga->image_data, tga->header.height);
+        size_t row_size = (size_t)tga->header.width * writer->pixel_size;
+        for (size_t y = 0; scan_line_table && y < tga->header.height; ++y) {
+            row_offsets[y] = y * row_size;
+        }
+        data_size = (uint64_t)tga->header.height * row_size;
+    }
 
-    return TGA_SUCCESS;
+    if (result == TGA_SUCCESS && trailer) {
+        uint64_t data_start = TGA_HEADER_SIZE + tga->header.id_length + rtga_color_map_size(&tga->header);
+        result = write_trailer(writer, data_start, data_size, stamp, stamp_size, row_offsets);
+    }
+    rtga_free(&writer->allocator, row_offsets);
+    rtga_free(&tga->allocator, stamp);
+
+    int close_result = tga_writer_close(writer);
+
+    return result != TGA_SUCCESS ? result : close_result;
+}
+
+int tga_write_file_ex(TgaImage *tga, const char *filename, const TgaWriteOptions *options) {
+    TgaWriter writer;
+
+    assert(tga);
+
+    // Open file and write everything before the image data
+    int result = rtga_writer_open(&writer, &tga->header, tga->image_id, tga->color_map_data, filename, &tga->allocator);
+    if (result != TGA_SUCCESS) return result;
+
+    return write_image(tga, &writer, options);
+}
+
+int tga_write_view(const TgaView *view, TgaImageType image_type, const char *filename) {
+    TgaWriter writer;
+    TgaHeader header;
+
+    assert(view);
+    assert(filename);
+
+    memset(&header, 0, sizeof(TgaHeader));
+    header.image_type = image_type;
+    header.width = view->width;
+    header.height = view->height;
+    header.image_pixel_depth = view->pixel_depth;
+
+    int result = tga_writer_open(&writer, &header, NULL, NULL, filename);
+    if (result != TGA_SUCCESS) return result;
+
+    result = tga_writer_write_view(&writer, view);
+    int close_result = tga_writer_close(&writer);
+
+    return result != TGA_SUCCESS ? result : close_result;
+}
+
+int tga_write_io(TgaImage *tga, const TgaIo *io, const TgaWriteOptions *options) {
+    TgaWriter writer;
+
+    assert(tga);
+    assert(io);
+
+    int result = rtga_writer_open_io(&writer, &tga->header, tga->image_id, tga->color_map_data, io, &tga->allocator);
+    if (result != TGA_SUCCESS) return result;
+
+    return write_image(tga, &writer, options);
+}
+
+void rtga_replicate_pixel(uint8_t *dst, const uint8_t *pixel, size_t count, uint8_t pixel_size) {
+    size_t total = count * pixel_size;
+
+#ifdef RTGA_SSE2
+    if (total >= 48) {
+        // 48 bytes hold a whole number of pixels of every size, so three
+        // vectors of the repeating pattern cover 24-bit pixels as well.
+        uint8_t pattern[48];
+        for (int i = 0; i < 48; ++i) {
+            pattern[i] = pixel[i % pixel_size];
+        }
+        __m128i vec0 = _mm_loadu_si128((const __m128i *)pattern);
+        __m128i vec1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+        __m128i vec2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+        size_t offset = 0;
+
+        while (total - offset >= 48) {
+            _mm_storeu_si128((__m128i *)(dst + offset), vec0);
+            _mm_storeu_si128((__m128i *)(dst + offset + 16), vec1);
+            _mm_storeu_si128((__m128i *)(dst + offset + 32), vec2);
+            offset += 48;
+        }
+        memcpy(dst + offset, pattern, total - offset);
+        return;
+    }
+#endif
+
+    if (total == 0) return;
+
+    // Copy the pixel once, then keep doubling the filled region
+    memcpy(dst, pixel, pixel_size);
+    size_t filled = pixel_size;
+    while (filled < total) {
+        size_t chunk = filled < total - filled ? filled : total - filled;
+        memcpy(dst + filled, dst, chunk);
+        filled += chunk;
+    }
 }
 
 void tga_set_pixel(TgaImage *tga, uint16_t x, uint16_t y, TgaColor color) {
@@ -201,19 +572,82 @@ void tga_set_pixel(TgaImage *tga, uint16_t x, uint16_t y, TgaColor color) {
 void tga_fill(TgaImage *tga, TgaColor color) {
     assert(tga);
 
-    for (uint16_t y = 0; y < tga->header.height; ++y) {
-        for (uint16_t x = 0; x < tga->header.width; ++x) {
-            tga_set_pixel(tga, x, y, color);
-        }
-    }
+    tga_fill_rect(tga, 0, 0, tga->header.width, tga->header.height, color);
+}
+
+void tga_fill_rect(TgaImage *tga, uint16_t x, uint16_t y, uint16_t width, uint16_t height, TgaColor color) {
+    assert(tga);
+    assert(tga_pixel_size(&tga->header) == color.bit_size / 8);
+
+    TgaView view = tga_image_view(tga);
+    TgaView rect = tga_subview(&view, x, y, width, height);
+    tga_view_fill(&rect, color);
+}
+
+int tga_view_init(TgaView *view, void *data, uint16_t width, uint16_t height, size_t stride, uint8_t pixel_depth) {
+    assert(view);
+    assert(data || width == 0 || height == 0);
+
+    if (!tga_valid_depth(pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    size_t row_size = (size_t)width * ((pixel_depth + 7) / 8);
+    assert(stride == 0 || stride >= row_size);
+
+    view->data = data;
+    view->width = width;
+    view->height = height;
+    view->stride = stride ? stride : row_size;
+    view->pixel_depth = pixel_depth;
+    return TGA_SUCCESS;
 }
 
-int tga_to_color_map(TgaImage *tga) {
-    return 1;
+TgaView tga_image_view(TgaImage *tga) {
+    assert(tga);
+
+    TgaView view;
+    view.data = tga->image_data;
+    view.width = tga->header.width;
+    view.height = tga->header.height;
+    view.stride = (size_t)tga->header.width * tga_pixel_size(&tga->header);
+    view.pixel_depth = tga->header.image_pixel_depth;
+    return view;
 }
 
-int tga_from_color_map(TgaImage *tga) {
-    return 1;
+TgaView tga_subview(const TgaView *view, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    assert(view);
+
+    // Clip the rectangle to the view
+    if (x > view->width) x = view->width;
+    if (y > view->height) y = view->height;
+    if (width > view->width - x) width = view->width - x;
+    if (height > view->height - y) height = view->height - y;
+
+    TgaView subview = *view;
+    subview.width = width;
+    subview.height = height;
+    if (width > 0 && height > 0) {
+        subview.data = view->data + y * view->stride + (size_t)x * ((view->pixel_depth + 7) / 8);
+    }
+    return subview;
+}
+
+void tga_view_fill(const TgaView *view, TgaColor color) {
+    assert(view);
+
+    if (view->width == 0 || view->height == 0) return;
+
+    uint8_t pixel_size = (view->pixel_depth + 7) / 8;
+    size_t row_size = (size_t)view->width * pixel_size;
+    uint8_t *first_row = view->data;
+    assert(pixel_size == color.bit_size / 8);
+
+    // Fill the first row with pattern stores, then copy it into the rest
+    // while it is still in cache. memcpy uses the widest stores available,
+    // which beats replicating the pattern again on every row.
+    rtga_replicate_pixel(first_row, color.bgra, view->width, pixel_size);
+    for (uint16_t row = 1; row < view->height; ++row) {
+        memcpy(first_row + row * view->stride, first_row, row_size);
+    }
 }
 
 uint8_t tga_pixel_size(const TgaHeader *header) {
@@ -232,9 +666,16 @@ uint8_t tga_pixel_size(const TgaHeader *header) {
 size_t tga_image_size(const TgaHeader *header) {
     assert(header);
 
-    return header->width * header->height * tga_pixel_size(header);
+    // A 65535 by 65535 image of 32-bit pixels does not fit in an int
+    return (size_t)header->width * header->height * tga_pixel_size(header);
 }
 
 bool tga_valid_depth(uint8_t pixel_depth) {
-    return (pixel_depth % 8 == 0 && pixel_depth <= 32 || pixel_depth == 15);
+    return (pixel_depth != 0 && pixel_depth % 8 == 0 && pixel_depth <= 32) || pixel_depth == 15;
+}
+
+bool tga_is_rle(TgaImageType image_type) {
+    return image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE ||
+           image_type == RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE ||
+           image_type == RUN_LENGTH_ENCODED_BLACK_AND_WHITE_IMAGE;
 }
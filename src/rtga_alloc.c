@@ -0,0 +1,215 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Alignment of every block from an arena or pool
+#define BLOCK_ALIGNMENT 16
+
+// Bytes in front of every block that record its size or size class. It is
+// a whole alignment unit so that blocks stay aligned.
+#define BLOCK_HEADER_SIZE BLOCK_ALIGNMENT
+
+// Size of the smallest pool block, including its header
+#define POOL_MIN_BLOCK 64
+
+//
+// Default allocator
+//
+
+void *rtga_alloc(const TgaAllocator *allocator, size_t size) {
+    RTGA_STATS_BEGIN(start);
+    void *ptr = allocator && allocator->alloc ? allocator->alloc(allocator->context, size) : malloc(size);
+    RTGA_STATS_END(start, TGA_PHASE_ALLOC, size);
+    return ptr;
+}
+
+void *rtga_realloc(const TgaAllocator *allocator, void *ptr, size_t size) {
+    RTGA_STATS_BEGIN(start);
+    void *result = allocator && allocator->alloc ? allocator->realloc(allocator->context, ptr, size) : realloc(ptr, size);
+    RTGA_STATS_END(start, TGA_PHASE_ALLOC, size);
+    return result;
+}
+
+void rtga_free(const TgaAllocator *allocator, void *ptr) {
+    if (!ptr) return;
+    if (allocator && allocator->alloc) {
+        allocator->free(allocator->context, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+//
+// Bump arena
+//
+
+static inline size_t block_size(const void *ptr) {
+    size_t size;
+    memcpy(&size, (const uint8_t *)ptr - BLOCK_HEADER_SIZE, sizeof(size));
+    return size;
+}
+
+void tga_arena_init(TgaArena *arena, void *buffer, size_t size) {
+    assert(arena);
+    assert(buffer || size == 0);
+
+    // Start the arena at the first aligned byte of buffer
+    size_t padding = (BLOCK_ALIGNMENT - (uintptr_t)buffer % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT;
+    if (padding > size) padding = size;
+    arena->base = (uint8_t *)buffer + padding;
+    arena->size = size - padding;
+    arena->used = 0;
+    arena->last = arena->size;
+}
+
+void tga_arena_reset(TgaArena *arena) {
+    assert(arena);
+
+    arena->used = 0;
+    arena->last = arena->size;
+}
+
+static void *arena_alloc(void *context, size_t size) {
+    TgaArena *arena = context;
+
+    // Every block starts aligned, so only sizes are rounded up
+    size_t offset = (arena->used + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+    if (offset > arena->size || arena->size - offset < BLOCK_HEADER_SIZE ||
+        arena->size - offset - BLOCK_HEADER_SIZE < size) {
+        return NULL;
+    }
+
+    memcpy(arena->base + offset, &size, sizeof(size));
+    arena->last = offset;
+    arena->used = offset + BLOCK_HEADER_SIZE + size;
+    return arena->base + offset + BLOCK_HEADER_SIZE;
+}
+
+static bool arena_is_last(const TgaArena *arena, const void *ptr) {
+    return arena->last != arena->size && (const uint8_t *)ptr == arena->base + arena->last + BLOCK_HEADER_SIZE;
+}
+
+static void arena_free(void *context, void *ptr) {
+    TgaArena *arena = context;
+
+    // Only the most recent block can be given back before a reset
+    if (ptr && arena_is_last(arena, ptr)) {
+        arena->used = arena->last;
+        arena->last = arena->size;
+    }
+}
+
+static void *arena_realloc(void *context, void *ptr, size_t size) {
+    TgaArena *arena = context;
+
+    if (!ptr) return arena_alloc(context, size);
+
+    // The most recent block grows or shrinks in place
+    size_t old_size = block_size(ptr);
+    if (arena_is_last(arena, ptr)) {
+        size_t offset = arena->last + BLOCK_HEADER_SIZE;
+        if (arena->size - offset < size) return NULL;
+        memcpy(arena->base + arena->last, &size, sizeof(size));
+        arena->used = offset + size;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(context, size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    return new_ptr;
+}
+
+TgaAllocator tga_arena_allocator(TgaArena *arena) {
+    assert(arena);
+
+    TgaAllocator allocator = {arena_alloc, arena_realloc, arena_free, arena};
+    return allocator;
+}
+
+//
+// Size class pool
+//
+
+// Returns the size class of blocks that hold size bytes, or
+// TGA_POOL_CLASS_COUNT if size is too large for every class
+static unsigned pool_class(size_t size) {
+    unsigned size_class = 0;
+    size_t capacity = POOL_MIN_BLOCK - BLOCK_HEADER_SIZE;
+
+    while (capacity < size && size_class < TGA_POOL_CLASS_COUNT) {
+        capacity = capacity * 2 + BLOCK_HEADER_SIZE;
+        ++size_class;
+    }
+    return size_class;
+}
+
+static inline size_t pool_block_size(unsigned size_class) {
+    return (size_t)POOL_MIN_BLOCK << size_class;
+}
+
+void tga_pool_init(TgaPool *pool, void *buffer, size_t size) {
+    assert(pool);
+
+    tga_arena_init(&pool->arena, buffer, size);
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+}
+
+static void *pool_alloc(void *context, size_t size) {
+    TgaPool *pool = context;
+    unsigned size_class = pool_class(size);
+    if (size_class == TGA_POOL_CLASS_COUNT) return NULL;
+
+    // Reuse a freed block of the same class
+    uint8_t *block = pool->free_lists[size_class];
+    if (block) {
+        memcpy(&pool->free_lists[size_class], block + BLOCK_HEADER_SIZE, sizeof(void *));
+        return block + BLOCK_HEADER_SIZE;
+    }
+
+    // Otherwise carve a new block out of the buffer. Block sizes are
+    // multiples of the alignment, so blocks stay aligned.
+    TgaArena *arena = &pool->arena;
+    size_t total = pool_block_size(size_class);
+    if (arena->size - arena->used < total) return NULL;
+    block = arena->base + arena->used;
+    arena->used += total;
+
+    size_t header = size_class;
+    memcpy(block, &header, sizeof(header));
+    return block + BLOCK_HEADER_SIZE;
+}
+
+static void pool_free(void *context, void *ptr) {
+    TgaPool *pool = context;
+    if (!ptr) return;
+
+    // Push the block onto the free list of its class
+    uint8_t *block = (uint8_t *)ptr - BLOCK_HEADER_SIZE;
+    size_t size_class = block_size(ptr);
+    memcpy(ptr, &pool->free_lists[size_class], sizeof(void *));
+    pool->free_lists[size_class] = block;
+}
+
+static void *pool_realloc(void *context, void *ptr, size_t size) {
+    if (!ptr) return pool_alloc(context, size);
+
+    // Blocks that are already large enough are kept
+    unsigned size_class = (unsigned)block_size(ptr);
+    size_t capacity = pool_block_size(size_class) - BLOCK_HEADER_SIZE;
+    if (size <= capacity) return ptr;
+
+    void *new_ptr = pool_alloc(context, size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, capacity);
+    pool_free(context, ptr);
+    return new_ptr;
+}
+
+TgaAllocator tga_pool_allocator(TgaPool *pool) {
+    assert(pool);
+
+    TgaAllocator allocator = {pool_alloc, pool_realloc, pool_free, pool};
+    return allocator;
+}
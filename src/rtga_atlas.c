@@ -0,0 +1,420 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest side of an atlas
+#define MAX_SIDE 65535u
+
+//
+// Packing
+//
+
+// Segment of the skyline, the top edge of everything packed so far
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+} Node;
+
+// Skyline over an atlas of width, whose segments cover it from left to right.
+// Boxes are padded on their right and bottom, so the skyline is padding wider
+// than the atlas.
+typedef struct {
+    Node *nodes;
+    size_t count;
+    uint32_t width;
+    uint32_t max_height;
+    uint32_t padding;
+} Skyline;
+
+// Rectangle to pack and where it came from
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    size_t index;
+} Item;
+
+// Orders items tallest first, then widest first, then as they were given
+static int compare_items(const void *a, const void *b) {
+    const Item *item_a = a, *item_b = b;
+    if (item_a->height != item_b->height) return item_a->height > item_b->height ? -1 : 1;
+    if (item_a->width != item_b->width) return item_a->width > item_b->width ? -1 : 1;
+    return item_a->index < item_b->index ? -1 : item_a->index > item_b->index;
+}
+
+// Returns the lowest y at which a box of width rests on the skyline from
+// node i, or UINT32_MAX if it runs past the right edge
+static uint32_t fit(const Skyline *skyline, size_t i, uint32_t width) {
+    if (skyline->nodes[i].x + width > skyline->width) return UINT32_MAX;
+
+    uint32_t y = 0;
+    for (size_t j = i; width > 0 && j < skyline->count; ++j) {
+        if (skyline->nodes[j].y > y) y = skyline->nodes[j].y;
+        width -= width < skyline->nodes[j].width ? width : skyline->nodes[j].width;
+    }
+    return y;
+}
+
+static void remove_node(Skyline *skyline, size_t i) {
+    memmove(skyline->nodes + i, skyline->nodes + i + 1, (skyline->count - i - 1) * sizeof(Node));
+    skyline->count--;
+}
+
+// Places a box where its top ends up lowest, preferring the narrowest
+// segment on a tie, and raises the skyline over it
+static bool place(Skyline *skyline, uint32_t width, uint32_t height, uint32_t *x, uint32_t *y) {
+    size_t best = skyline->count;
+    uint32_t best_top = UINT32_MAX, best_width = UINT32_MAX;
+    for (size_t i = 0; i < skyline->count; ++i) {
+        uint32_t bottom = fit(skyline, i, width);
+        if (bottom == UINT32_MAX || bottom + height - skyline->padding > skyline->max_height) continue;
+        uint32_t top = bottom + height;
+        if (top < best_top || (top == best_top && skyline->nodes[i].width < best_width)) {
+            best = i;
+            best_top = top;
+            best_width = skyline->nodes[i].width;
+        }
+    }
+    if (best == skyline->count) return false;
+
+    Node node = {skyline->nodes[best].x, best_top, width};
+    *x = node.x;
+    *y = best_top - height;
+    memmove(skyline->nodes + best + 1, skyline->nodes + best, (skyline->count - best) * sizeof(Node));
+    skyline->nodes[best] = node;
+    skyline->count++;
+
+    // Cut the segments that the box covers
+    for (size_t j = best + 1; j < skyline->count;) {
+        uint32_t end = node.x + node.width;
+        if (skyline->nodes[j].x >= end) break;
+        uint32_t covered = end - skyline->nodes[j].x;
+        if (covered < skyline->nodes[j].width) {
+            skyline->nodes[j].x += covered;
+            skyline->nodes[j].width -= covered;
+            break;
+        }
+        remove_node(skyline, j);
+    }
+
+    // Join neighbors of the same height
+    for (size_t j = 0; j + 1 < skyline->count;) {
+        if (skyline->nodes[j].y == skyline->nodes[j + 1].y) {
+            skyline->nodes[j].width += skyline->nodes[j + 1].width;
+            remove_node(skyline, j + 1);
+        } else {
+            ++j;
+        }
+    }
+    return true;
+}
+
+// Packs the items into an atlas of width, and stores the height it takes
+static bool pack_width(Skyline *skyline, const Item *items, size_t count, uint32_t width, TgaAtlasRect *rects, uint32_t *height) {
+    skyline->width = width + skyline->padding;
+    skyline->count = 1;
+    skyline->nodes[0].x = 0;
+    skyline->nodes[0].y = 0;
+    skyline->nodes[0].width = skyline->width;
+
+    *height = 1;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t x, y;
+        if (!place(skyline, items[i].width + skyline->padding, items[i].height + skyline->padding, &x, &y)) return false;
+        TgaAtlasRect *rect = &rects[items[i].index];
+        rect->x = (uint16_t)x;
+        rect->y = (uint16_t)y;
+        if (y + items[i].height > *height) *height = y + items[i].height;
+    }
+    return true;
+}
+
+// Same as tga_atlas_pack, with scratch memory from allocator
+static int pack(const uint16_t *widths, const uint16_t *heights, size_t count, const TgaAtlasOptions *options, const TgaAllocator *allocator, TgaAtlasRect *rects, uint16_t *atlas_width, uint16_t *atlas_height) {
+    uint32_t max_width = options && options->max_width ? options->max_width : MAX_SIDE;
+    uint32_t max_height = options && options->max_height ? options->max_height : MAX_SIDE;
+    uint32_t padding = options ? options->padding : 0;
+
+    Item *items = rtga_alloc(allocator, (count ? count : 1) * sizeof(Item));
+    Node *nodes = rtga_alloc(allocator, (count + 1) * sizeof(Node));
+    if (!items || !nodes) {
+        rtga_free(allocator, nodes);
+        rtga_free(allocator, items);
+        return TGA_ALLOCATION_ERROR;
+    }
+    size_t item_count = 0;
+    uint32_t widest = 1;
+    uint64_t area = 0;
+    for (size_t i = 0; i < count; ++i) {
+        rects[i].x = 0;
+        rects[i].y = 0;
+        rects[i].width = widths[i];
+        rects[i].height = heights[i];
+        // Empty images take no room
+        if (widths[i] == 0 || heights[i] == 0) continue;
+        items[item_count].width = widths[i];
+        items[item_count].height = heights[i];
+        items[item_count].index = i;
+        item_count++;
+        if (widths[i] > widest) widest = widths[i];
+        area += (uint64_t)(widths[i] + padding) * (heights[i] + padding);
+    }
+    qsort(items, item_count, sizeof(Item), compare_items);
+
+    // Without a fixed width, start from the smallest square power of two
+    // that could hold every image and widen it until they fit
+    uint32_t width = max_width;
+    if (!options || !options->max_width) {
+        width = 1;
+        while (width < widest || (uint64_t)width * width < area) width *= 2;
+        if (width > max_width) width = max_width;
+    }
+
+    Skyline skyline = {nodes, 0, 0, max_height, padding};
+    uint32_t height = 1;
+    int result = widest <= width ? TGA_SUCCESS : TGA_ATLAS_FULL_ERROR;
+    while (result == TGA_SUCCESS && !pack_width(&skyline, items, item_count, width, rects, &height)) {
+        if (width == max_width || (options && options->max_width)) {
+            result = TGA_ATLAS_FULL_ERROR;
+        } else {
+            width = width * 2 < max_width ? width * 2 : max_width;
+        }
+    }
+
+    rtga_free(allocator, nodes);
+    rtga_free(allocator, items);
+    if (result != TGA_SUCCESS) return result;
+    *atlas_width = (uint16_t)width;
+    *atlas_height = (uint16_t)height;
+    return TGA_SUCCESS;
+}
+
+int tga_atlas_pack(const uint16_t *widths, const uint16_t *heights, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects, uint16_t *atlas_width, uint16_t *atlas_height) {
+    assert((widths && heights && rects) || count == 0);
+    assert(atlas_width);
+    assert(atlas_height);
+
+    return pack(widths, heights, count, options, options ? options->allocator : NULL, rects, atlas_width, atlas_height);
+}
+
+//
+// Copying
+//
+
+// Images to copy into an atlas, either in memory or in files
+typedef struct {
+    TgaImage *atlas;
+    const TgaImage *images;
+    const char *const *filenames;
+    TgaAtlasRect *rects;
+    const TgaAllocator *allocator;
+    int *results;
+    // Scratch memory of each worker to convert rows in
+    uint8_t *scratch;
+    size_t scratch_size;
+} AtlasJob;
+
+// Copies the rows of src into its place in the atlas from the top down.
+// Rows stored like the atlas are copied as they are, the rest go through
+// 32-bit pixels.
+static int copy_image(const AtlasJob *job, const TgaAtlasRect *rect, const TgaImage *src, uint8_t *scratch) {
+    RtgaPixelRows rows;
+    int result = rtga_pixel_rows_init(&rows, src);
+    if (result != TGA_SUCCESS) return result;
+
+    const TgaHeader *header = &job->atlas->header;
+    uint8_t depth = header->image_pixel_depth;
+    uint8_t pixel_size = tga_pixel_size(header);
+    size_t stride = (size_t)header->width * pixel_size;
+    size_t row_size = (size_t)rect->width * pixel_size;
+    bool alpha_bits = depth == 16 || depth == 32;
+    bool copy = !rows.color_mapped && src->header.image_pixel_depth == depth && !rows.orientation.flip_columns &&
+                (rows.alpha || !alpha_bits);
+
+    for (uint16_t y = 0; y < rect->height; ++y) {
+        uint8_t *dst = job->atlas->image_data + (size_t)(rect->y + y) * stride + (size_t)rect->x * pixel_size;
+        if (copy) {
+            size_t stored = rows.orientation.flip_rows ? (size_t)(rect->height - 1 - y) : y;
+            memcpy(dst, src->image_data + stored * row_size, row_size);
+        } else {
+            rtga_convert_pixels(dst, depth, rtga_pixel_row(&rows, y, scratch), 32, rect->width, true);
+        }
+    }
+    return TGA_SUCCESS;
+}
+
+static void copy_task(void *context, unsigned worker, size_t index) {
+    AtlasJob *job = context;
+    const TgaAtlasRect *rect = &job->rects[index];
+    uint8_t *scratch = job->scratch + worker * job->scratch_size;
+    if (job->images) {
+        job->results[index] = copy_image(job, rect, &job->images[index], scratch);
+        return;
+    }
+
+    // Files that failed to probe have no place to copy into
+    if (job->results[index] != TGA_SUCCESS) return;
+    TgaImage tga;
+    TgaReadOptions read_options = {false, 1, job->allocator, true};
+    int result = tga_read_file_ex(&tga, job->filenames[index], &read_options);
+    if (result != TGA_SUCCESS) {
+        job->results[index] = result;
+        return;
+    }
+    if (tga.header.width != rect->width || tga.header.height != rect->height) {
+        result = TGA_SIZE_MISMATCH_ERROR;
+    } else {
+        result = copy_image(job, rect, &tga, scratch);
+    }
+    tga_free(&tga);
+    job->results[index] = result;
+}
+
+static void probe_task(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    AtlasJob *job = context;
+    TgaProbe probe;
+    job->results[index] = tga_probe_file(job->filenames[index], false, &probe);
+    // Sizes are passed on through the rectangles until they are packed
+    TgaAtlasRect *rect = &job->rects[index];
+    rect->width = job->results[index] == TGA_SUCCESS ? probe.header.width : 0;
+    rect->height = job->results[index] == TGA_SUCCESS ? probe.header.height : 0;
+}
+
+// Packs the images whose sizes rects hold, allocates the atlas and copies
+// every image into it
+static int build(TgaImage *atlas, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects, AtlasJob *job) {
+    uint8_t depth = options && options->pixel_depth ? options->pixel_depth : 32;
+    if (!tga_valid_depth(depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    unsigned thread_count = rtga_thread_count(options ? options->thread_count : 0);
+    const TgaAllocator *allocator = job->allocator;
+
+    uint16_t *sizes = rtga_alloc(allocator, (count ? count : 1) * 2 * sizeof(uint16_t));
+    if (!sizes) return TGA_ALLOCATION_ERROR;
+    uint16_t widest = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sizes[i] = rects[i].width;
+        sizes[count + i] = rects[i].height;
+        if (rects[i].width > widest) widest = rects[i].width;
+    }
+    uint16_t width, height;
+    int result = pack(sizes, sizes + count, count, options, allocator, rects, &width, &height);
+    rtga_free(allocator, sizes);
+    if (result != TGA_SUCCESS) return result;
+
+    result = tga_alloc_ex(depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, depth, allocator, atlas);
+    if (result != TGA_SUCCESS) return result;
+    atlas->header.descriptor = 0x20 | (depth == 32 ? 8 : depth == 16 ? 1 : 0);
+    memset(atlas->image_data, 0, tga_image_size(&atlas->header));
+
+    job->atlas = atlas;
+    job->rects = rects;
+    job->scratch_size = (size_t)widest * 8 + 1;
+    job->scratch = rtga_alloc(allocator, thread_count * job->scratch_size);
+    if (!job->scratch) {
+        tga_free(atlas);
+        return TGA_ALLOCATION_ERROR;
+    }
+    rtga_parallel_for(count, thread_count, copy_task, job);
+    rtga_free(allocator, job->scratch);
+    return TGA_SUCCESS;
+}
+
+int tga_atlas_build(TgaImage *atlas, const TgaImage *images, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects) {
+    assert(atlas);
+    assert((images && rects) || count == 0);
+
+    // Images that can not be copied fail before anything is allocated
+    for (size_t i = 0; i < count; ++i) {
+        RtgaPixelRows rows;
+        int result = rtga_pixel_rows_init(&rows, &images[i]);
+        if (result != TGA_SUCCESS) return result;
+        rects[i].width = images[i].header.width;
+        rects[i].height = images[i].header.height;
+    }
+
+    AtlasJob job;
+    memset(&job, 0, sizeof(job));
+    job.images = images;
+    job.allocator = options ? options->allocator : NULL;
+    job.results = rtga_alloc(job.allocator, (count ? count : 1) * sizeof(int));
+    if (!job.results) return TGA_ALLOCATION_ERROR;
+
+    int result = build(atlas, count, options, rects, &job);
+    rtga_free(job.allocator, job.results);
+    return result;
+}
+
+int tga_atlas_build_files(TgaImage *atlas, const char *const *filenames, size_t count, const TgaAtlasOptions *options, TgaAtlasRect *rects, int *results) {
+    assert(atlas);
+    assert((filenames && rects) || count == 0);
+
+    uint8_t depth = options && options->pixel_depth ? options->pixel_depth : 32;
+    if (!tga_valid_depth(depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    AtlasJob job;
+    memset(&job, 0, sizeof(job));
+    job.filenames = filenames;
+    job.allocator = options ? options->allocator : NULL;
+    job.rects = rects;
+    job.results = results ? results : rtga_alloc(job.allocator, (count ? count : 1) * sizeof(int));
+    if (!job.results) return TGA_ALLOCATION_ERROR;
+
+    // Headers are probed on the workers too, since opening a file costs
+    // more than reading its header
+    rtga_parallel_for(count, rtga_thread_count(options ? options->thread_count : 0), probe_task, &job);
+    int result = build(atlas, count, options, rects, &job);
+    for (size_t i = 0; result == TGA_SUCCESS && i < count; ++i) {
+        if (job.results[i] != TGA_SUCCESS) result = job.results[i];
+    }
+
+    if (!results) rtga_free(job.allocator, job.results);
+    return result;
+}
+
+//
+// Tables
+//
+
+// Writes s as a JSON string
+static void write_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+int tga_atlas_write_table(const char *filename, const TgaImage *atlas, const char *const *names, const TgaAtlasRect *rects, size_t count) {
+    assert(filename);
+    assert(atlas);
+    assert(rects || count == 0);
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp) return TGA_FILE_OPEN_ERROR;
+
+    fprintf(fp, "{\"width\": %u, \"height\": %u, \"images\": [", atlas->header.width, atlas->header.height);
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(fp, "%s\n  {", i ? "," : "");
+        if (names) {
+            fprintf(fp, "\"name\": ");
+            write_string(fp, names[i]);
+            fprintf(fp, ", ");
+        }
+        fprintf(fp, "\"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u}", rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+    }
+    fprintf(fp, "\n]}\n");
+
+    bool written = !ferror(fp);
+    return fclose(fp) != 0 || !written ? TGA_FILE_WRITE_ERROR : TGA_SUCCESS;
+}
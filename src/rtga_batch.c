@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Entries in a color map built by TGA_BATCH_PALETTIZE
+#define BATCH_PALETTE_SIZE 256
+
+// Buffers and counters owned by one worker thread
+//
+// Buffers only ever grow, so after the first few files a worker converts
+// files without allocating.
+typedef struct {
+    uint8_t *file;
+    size_t file_capacity;
+    uint8_t *pixels;
+    size_t pixels_capacity;
+    uint8_t *expanded;
+    size_t expanded_capacity;
+    uint8_t *converted;
+    size_t converted_capacity;
+    uint8_t *encoded;
+    size_t encoded_capacity;
+    uint8_t color_map[BATCH_PALETTE_SIZE * 4];
+    size_t files_converted;
+    size_t files_failed;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} BatchWorker;
+
+typedef struct {
+    const char *const *input_files;
+    const char *const *output_files;
+    const TgaBatchOptions *options;
+    BatchWorker *workers;
+    int *results;
+} BatchJob;
+
+// Grows buffer to hold at least size bytes
+static bool reserve(uint8_t **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) return true;
+
+    // Grow geometrically so a run of slightly larger files reallocates rarely
+    size_t new_capacity = *capacity * 2 > size ? *capacity * 2 : size;
+    uint8_t *new_buffer = realloc(*buffer, new_capacity);
+    if (!new_buffer) return false;
+
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Reads a whole file into the worker's file buffer
+static int read_input(BatchWorker *worker, const char *filename, size_t *size) {
+    RTGA_STATS_BEGIN(open_start);
+    FILE *fp = fopen(filename, "rb");
+    RTGA_STATS_END(open_start, TGA_PHASE_OPEN, 0);
+    if (!fp) return TGA_FILE_OPEN_ERROR;
+
+    long end;
+    if (fseek(fp, 0, SEEK_END) != 0 || (end = ftell(fp)) < TGA_HEADER_SIZE || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return TGA_FILE_READ_ERROR;
+    }
+    if (!reserve(&worker->file, &worker->file_capacity, (size_t)end)) {
+        fclose(fp);
+        return TGA_ALLOCATION_ERROR;
+    }
+    RTGA_STATS_BEGIN(read_start);
+    size_t count = fread(worker->file, 1, (size_t)end, fp);
+    RTGA_STATS_END(read_start, TGA_PHASE_IO, count);
+    if (count != (size_t)end) {
+        fclose(fp);
+        return TGA_FILE_READ_ERROR;
+    }
+    fclose(fp);
+
+    worker->bytes_read += (uint64_t)end;
+    *size = (size_t)end;
+    return TGA_SUCCESS;
+}
+
+// Returns the image type of a color mapped, true color or grayscale image
+static TgaImageType batch_image_type(TgaImageType base, bool rle) {
+    return rle ? (TgaImageType)(base + 8) : base;
+}
+
+// Converts one file with the worker's buffers
+static int convert_file(BatchWorker *worker, const char *input_file, const char *output_file, const TgaBatchOptions *options) {
+    size_t file_size;
+    int result = read_input(worker, input_file, &file_size);
+    if (result != TGA_SUCCESS) return result;
+
+    TgaHeader header;
+    rtga_parse_header(&header, worker->file);
+    result = rtga_check_header(&header);
+    if (result != TGA_SUCCESS) return result;
+
+    // Make sure the image id, color map and image data can lie within the file
+    const uint8_t *image_id = worker->file + TGA_HEADER_SIZE;
+    const uint8_t *color_map_data = image_id + header.id_length;
+    size_t color_map_size = rtga_color_map_size(&header);
+    size_t data_start = TGA_HEADER_SIZE + header.id_length + color_map_size;
+    if (data_start > file_size) return TGA_FILE_READ_ERROR;
+    if (file_size - data_start < rtga_min_data_size(&header)) {
+        return tga_is_rle(header.image_type) ? TGA_RLE_DECODE_ERROR : TGA_FILE_READ_ERROR;
+    }
+
+    // Decode image data, using uncompressed data in place
+    size_t pixel_count = (size_t)header.width * header.height;
+    uint8_t pixel_size = tga_pixel_size(&header);
+    const uint8_t *pixels = worker->file + data_start;
+    if (tga_is_rle(header.image_type)) {
+        if (!reserve(&worker->pixels, &worker->pixels_capacity, pixel_count * pixel_size)) return TGA_ALLOCATION_ERROR;
+        result = tga_rle_decode(worker->pixels, pixel_count, pixels, file_size - data_start, pixel_size, NULL);
+        if (result != TGA_SUCCESS) return result;
+        pixels = worker->pixels;
+    }
+
+    bool color_mapped = header.image_type == UNCOMPRESSED_COLOR_MAPPED_IMAGE ||
+                        header.image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE;
+    TgaHeader out = header;
+
+    if (options->operation == TGA_BATCH_CONVERT_DEPTH) {
+        // Color mapped images are expanded before they are converted
+        uint8_t src_depth = header.image_pixel_depth;
+        if (color_mapped) {
+            if (!tga_valid_depth(header.color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+            src_depth = header.color_map_pixel_depth;
+            if (!reserve(&worker->expanded, &worker->expanded_capacity, pixel_count * ((src_depth + 7) / 8))) return TGA_ALLOCATION_ERROR;
+            tga_color_map_expand(worker->expanded, pixels, pixel_count, &header, color_map_data);
+            pixels = worker->expanded;
+        }
+
+        bool alpha = (header.descriptor & 0x0f) != 0;
+        uint8_t dst_depth = options->pixel_depth;
+        if (!reserve(&worker->converted, &worker->converted_capacity, pixel_count * ((dst_depth + 7) / 8))) return TGA_ALLOCATION_ERROR;
+        rtga_convert_pixels(worker->converted, dst_depth, pixels, src_depth, pixel_count, alpha);
+        pixels = worker->converted;
+
+        out.image_type = dst_depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        out.color_map_type = false;
+        out.color_map_first_index = 0;
+        out.color_map_length = 0;
+        out.color_map_pixel_depth = 0;
+        out.image_pixel_depth = dst_depth;
+        // Keep the orientation and only keep alpha bits where there is alpha
+        out.descriptor = header.descriptor & 0x30;
+        if (alpha && dst_depth == 32) out.descriptor |= 8;
+        if (alpha && dst_depth == 16) out.descriptor |= 1;
+    } else if (options->operation == TGA_BATCH_PALETTIZE && !color_mapped) {
+        if (!reserve(&worker->converted, &worker->converted_capacity, pixel_count)) return TGA_ALLOCATION_ERROR;
+        result = rtga_build_color_map(pixels, pixel_count, header.image_pixel_depth, worker->converted, worker->color_map, &out.color_map_length, NULL);
+        if (result != TGA_SUCCESS) return result;
+        pixels = worker->converted;
+        color_map_data = worker->color_map;
+
+        out.image_type = UNCOMPRESSED_COLOR_MAPPED_IMAGE;
+        out.color_map_type = true;
+        out.color_map_first_index = 0;
+        out.color_map_pixel_depth = header.image_pixel_depth == 8 ? 24 : header.image_pixel_depth;
+        out.image_pixel_depth = 8;
+    } else {
+        // Recompressing keeps the image type apart from its encoding
+        out.image_type = tga_is_rle(header.image_type) ? (TgaImageType)(header.image_type - 8) : header.image_type;
+    }
+    out.image_type = batch_image_type(out.image_type, options->rle);
+
+    // Encode the whole output file into one buffer, which is written at once
+    uint8_t out_pixel_size = tga_pixel_size(&out);
+    size_t out_color_map_size = rtga_color_map_size(&out);
+    size_t row_bound = options->rle ? tga_rle_bound(out.width, out_pixel_size) : (size_t)out.width * out_pixel_size;
+    size_t bound = TGA_HEADER_SIZE + out.id_length + out_color_map_size + row_bound * out.height;
+    if (!reserve(&worker->encoded, &worker->encoded_capacity, bound)) return TGA_ALLOCATION_ERROR;
+
+    uint8_t *dst = worker->encoded;
+    rtga_serialize_header(dst, &out);
+    dst += TGA_HEADER_SIZE;
+    memcpy(dst, image_id, out.id_length);
+    dst += out.id_length;
+    if (out_color_map_size > 0) memcpy(dst, color_map_data, out_color_map_size);
+    dst += out_color_map_size;
+    if (options->rle) {
+        size_t row_size = (size_t)out.width * out_pixel_size;
+        for (size_t y = 0; y < out.height; ++y) {
+            dst += tga_rle_encode(dst, pixels + y * row_size, out.width, out_pixel_size);
+        }
+    } else {
+        memcpy(dst, pixels, pixel_count * out_pixel_size);
+        dst += pixel_count * out_pixel_size;
+    }
+
+    size_t encoded_size = (size_t)(dst - worker->encoded);
+    RTGA_STATS_BEGIN(open_start);
+    FILE *fp = fopen(output_file, "wb");
+    RTGA_STATS_END(open_start, TGA_PHASE_OPEN, 0);
+    if (!fp) return TGA_FILE_OPEN_ERROR;
+    RTGA_STATS_BEGIN(write_start);
+    size_t count = fwrite(worker->encoded, 1, encoded_size, fp);
+    RTGA_STATS_END(write_start, TGA_PHASE_IO, count);
+    bool written = count == encoded_size;
+    if (fclose(fp) != 0 || !written) return TGA_FILE_WRITE_ERROR;
+
+    worker->bytes_written += encoded_size;
+    return TGA_SUCCESS;
+}
+
+static void batch_task(void *context, unsigned worker_index, size_t index) {
+    BatchJob *job = context;
+    BatchWorker *worker = &job->workers[worker_index];
+
+    int result = convert_file(worker, job->input_files[index], job->output_files[index], job->options);
+    if (result == TGA_SUCCESS) {
+        ++worker->files_converted;
+    } else {
+        ++worker->files_failed;
+    }
+    if (job->results) job->results[index] = result;
+}
+
+// Returns a monotonic time in seconds
+static double batch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int tga_batch_convert(const char *const *input_files, const char *const *output_files, size_t file_count, const TgaBatchOptions *options, int *results, TgaBatchStats *stats) {
+    assert(input_files || file_count == 0);
+    assert(output_files || file_count == 0);
+    assert(options);
+
+    if (options->operation == TGA_BATCH_CONVERT_DEPTH && !tga_valid_depth(options->pixel_depth)) {
+        return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    }
+
+    // Twice as many workers as CPUs by default, so that while half of them
+    // wait on reads and writes the other half keep every CPU converting
+    unsigned thread_count = options->thread_count;
+    if (thread_count == 0) thread_count = 2 * rtga_thread_count(0);
+    thread_count = rtga_thread_count(thread_count);
+
+    BatchWorker *workers = calloc(thread_count, sizeof(BatchWorker));
+    int *file_results = results ? results : malloc((file_count ? file_count : 1) * sizeof(int));
+    if (!workers || !file_results) {
+        free(workers);
+        if (!results) free(file_results);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    BatchJob job = {input_files, output_files, options, workers, file_results};
+    double start = batch_now();
+    rtga_parallel_for(file_count, thread_count, batch_task, &job);
+    double seconds = batch_now() - start;
+
+    // Sum the counters of every worker
+    TgaBatchStats totals = {0};
+    totals.seconds = seconds;
+    for (unsigned i = 0; i < thread_count; ++i) {
+        totals.files_converted += workers[i].files_converted;
+        totals.files_failed += workers[i].files_failed;
+        totals.bytes_read += workers[i].bytes_read;
+        totals.bytes_written += workers[i].bytes_written;
+        free(workers[i].file);
+        free(workers[i].pixels);
+        free(workers[i].expanded);
+        free(workers[i].converted);
+        free(workers[i].encoded);
+    }
+    free(workers);
+    if (stats) *stats = totals;
+
+    // Report the first file that failed
+    int result = TGA_SUCCESS;
+    for (size_t i = 0; i < file_count && result == TGA_SUCCESS; ++i) {
+        result = file_results[i];
+    }
+    if (!results) free(file_results);
+
+    return result;
+}
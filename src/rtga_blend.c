@@ -0,0 +1,336 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Returns x / 255 rounded to the nearest integer, for x up to 255 * 255
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+//
+// Scalar kernels
+//
+
+// Straight alpha goes through floats, since the blended color is divided by
+// the blended alpha. The SIMD kernels do the same operations in the same
+// order, so both give the same bytes.
+static inline void blend_straight_pixel(uint8_t *dst, const uint8_t *src) {
+    // Transparent sources leave the destination alone
+    if (src[3] == 0) return;
+
+    float src_alpha = src[3];
+    float dst_alpha = dst[3] * (255.0f - src_alpha) / 255.0f;
+    float alpha = src_alpha + dst_alpha;
+    // Blended alpha is either 0, with every color 0, or at least 1
+    float divisor = alpha < 1.0f ? 1.0f : alpha;
+
+    for (int c = 0; c < 3; ++c) {
+        dst[c] = (uint8_t)(int)((src[c] * src_alpha + dst[c] * dst_alpha) / divisor + 0.5f);
+    }
+    dst[3] = (uint8_t)(int)(alpha + 0.5f);
+}
+
+static void blend_straight_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        blend_straight_pixel(dst + i * 4, src + i * 4);
+    }
+}
+
+static void blend_premultiplied_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for (size_t i = 0; i < count * 4; i += 4) {
+        uint32_t inverse_alpha = 255 - src[i + 3];
+        for (int c = 0; c < 4; ++c) {
+            uint32_t value = src[i + c] + div255(dst[i + c] * inverse_alpha);
+            dst[i + c] = (uint8_t)(value > 255 ? 255 : value);
+        }
+    }
+}
+
+static void premultiply_scalar(uint8_t *pixels, size_t count) {
+    for (size_t i = 0; i < count * 4; i += 4) {
+        uint32_t alpha = pixels[i + 3];
+        for (int c = 0; c < 3; ++c) {
+            pixels[i + c] = (uint8_t)div255(pixels[i + c] * alpha);
+        }
+    }
+}
+
+static void unpremultiply_scalar(uint8_t *pixels, size_t count) {
+    for (size_t i = 0; i < count * 4; i += 4) {
+        uint8_t alpha = pixels[i + 3];
+        float scale = alpha ? 255.0f / alpha : 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            float value = pixels[i + c] * scale + 0.5f;
+            pixels[i + c] = (uint8_t)(value > 255.0f ? 255 : (int)value);
+        }
+    }
+}
+
+//
+// SSE2 kernels
+//
+// Four pixels are blended at a time. Integer kernels widen channels to 16
+// bits, and float kernels hold one pixel per vector.
+//
+
+#ifdef RTGA_SSE2
+// Returns round(x / 255) for every 16-bit lane, for x up to 255 * 255
+static inline __m128i div255_epu16(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Returns the alpha of every pixel in all four 16-bit lanes of the pixel,
+// for the two pixels in the low or high half of pixels
+static inline __m128i alpha_lanes(__m128i alpha32, bool high) {
+    // alpha32 holds the alpha of each pixel in the low bits of its lane
+    __m128i alpha16 = _mm_or_si128(alpha32, _mm_slli_epi32(alpha32, 16));
+    return high ? _mm_unpackhi_epi32(alpha16, alpha16) : _mm_unpacklo_epi32(alpha16, alpha16);
+}
+
+static size_t blend_premultiplied_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max_alpha = _mm_set1_epi32(255);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i * 4));
+        __m128i inverse_alpha = _mm_sub_epi32(max_alpha, _mm_srli_epi32(s, 24));
+
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), alpha_lanes(inverse_alpha, false));
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), alpha_lanes(inverse_alpha, true));
+        __m128i scaled = _mm_packus_epi16(div255_epu16(low), div255_epu16(high));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_adds_epu8(s, scaled));
+    }
+
+    return i;
+}
+
+static size_t premultiply_sse2(uint8_t *pixels, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+        __m128i alpha = _mm_srli_epi32(p, 24);
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), alpha_lanes(alpha, false));
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), alpha_lanes(alpha, true));
+        __m128i result = _mm_packus_epi16(div255_epu16(low), div255_epu16(high));
+        // Keep the original alpha bytes exactly
+        result = _mm_or_si128(_mm_andnot_si128(alpha_mask, result), _mm_and_si128(alpha_mask, p));
+        _mm_storeu_si128((__m128i *)(pixels + i * 4), result);
+    }
+
+    return i;
+}
+
+// Widens the four pixels of a vector to one float vector each
+static inline void load_pixels_ps(__m128i p, __m128 out[4]) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(p, zero);
+    __m128i high = _mm_unpackhi_epi8(p, zero);
+    out[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+    out[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+    out[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+    out[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+}
+
+// Rounds four float pixels, which are at least 0, back to bytes
+static inline __m128i store_pixels_ps(const __m128 in[4]) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128i p0 = _mm_cvttps_epi32(_mm_add_ps(in[0], half));
+    __m128i p1 = _mm_cvttps_epi32(_mm_add_ps(in[1], half));
+    __m128i p2 = _mm_cvttps_epi32(_mm_add_ps(in[2], half));
+    __m128i p3 = _mm_cvttps_epi32(_mm_add_ps(in[3], half));
+    return _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+}
+
+#define BROADCAST_ALPHA(v) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(3, 3, 3, 3))
+
+static size_t blend_straight_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    const __m128 max_alpha = _mm_set1_ps(255.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    // Lanes 0 to 2 hold colors and lane 3 holds alpha
+    const __m128 color_lanes = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i src_alpha = _mm_and_si128(s, alpha_mask);
+
+        // Opaque sources replace the destination, and transparent ones leave
+        // it alone
+        __m128i transparent = _mm_cmpeq_epi32(src_alpha, _mm_setzero_si128());
+        if (_mm_movemask_epi8(transparent) == 0xffff) continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(src_alpha, alpha_mask)) == 0xffff) {
+            _mm_storeu_si128((__m128i *)(dst + i * 4), s);
+            continue;
+        }
+
+        __m128 src_pixels[4];
+        __m128 dst_pixels[4];
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i * 4));
+        load_pixels_ps(s, src_pixels);
+        load_pixels_ps(d, dst_pixels);
+        for (int p = 0; p < 4; ++p) {
+            __m128 sa = BROADCAST_ALPHA(src_pixels[p]);
+            __m128 da = _mm_div_ps(_mm_mul_ps(BROADCAST_ALPHA(dst_pixels[p]), _mm_sub_ps(max_alpha, sa)), max_alpha);
+            __m128 alpha = _mm_add_ps(sa, da);
+            __m128 color = _mm_add_ps(_mm_mul_ps(src_pixels[p], sa), _mm_mul_ps(dst_pixels[p], da));
+            color = _mm_div_ps(color, _mm_max_ps(alpha, one));
+            dst_pixels[p] = _mm_or_ps(_mm_and_ps(color_lanes, color), _mm_andnot_ps(color_lanes, alpha));
+        }
+        __m128i blended = store_pixels_ps(dst_pixels);
+        blended = _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, blended));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), blended);
+    }
+
+    return i;
+}
+
+static size_t unpremultiply_sse2(uint8_t *pixels, size_t count) {
+    const __m128 max_alpha = _mm_set1_ps(255.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 color_lanes = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    // Alpha is scaled by 1, which leaves it as it is
+    const __m128 alpha_scale = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 values[4];
+        load_pixels_ps(_mm_loadu_si128((const __m128i *)(pixels + i * 4)), values);
+        for (int p = 0; p < 4; ++p) {
+            __m128 alpha = BROADCAST_ALPHA(values[p]);
+            // Colors of transparent pixels become 0
+            __m128 scale = _mm_and_ps(_mm_div_ps(max_alpha, _mm_max_ps(alpha, one)), _mm_cmpgt_ps(alpha, zero));
+            scale = _mm_or_ps(_mm_and_ps(color_lanes, scale), alpha_scale);
+            values[p] = _mm_min_ps(_mm_mul_ps(values[p], scale), max_alpha);
+        }
+        _mm_storeu_si128((__m128i *)(pixels + i * 4), store_pixels_ps(values));
+    }
+
+    return i;
+}
+#endif
+
+//
+// Row kernels
+//
+
+static void blend_row(uint8_t *dst, const uint8_t *src, size_t count, bool premultiplied) {
+    size_t i = 0;
+
+    if (premultiplied) {
+#ifdef RTGA_SSE2
+        i = blend_premultiplied_sse2(dst, src, count);
+#endif
+        blend_premultiplied_scalar(dst + i * 4, src + i * 4, count - i);
+    } else {
+#ifdef RTGA_SSE2
+        i = blend_straight_sse2(dst, src, count);
+#endif
+        blend_straight_scalar(dst + i * 4, src + i * 4, count - i);
+    }
+}
+
+static void premultiply_row(uint8_t *pixels, size_t count) {
+    size_t i = 0;
+
+#ifdef RTGA_SSE2
+    i = premultiply_sse2(pixels, count);
+#endif
+    premultiply_scalar(pixels + i * 4, count - i);
+}
+
+static void unpremultiply_row(uint8_t *pixels, size_t count) {
+    size_t i = 0;
+
+#ifdef RTGA_SSE2
+    i = unpremultiply_sse2(pixels, count);
+#endif
+    unpremultiply_scalar(pixels + i * 4, count - i);
+}
+
+//
+// Compositing
+//
+
+int tga_blend(const TgaView *dst, const TgaView *src, int32_t x, int32_t y, bool premultiplied) {
+    assert(dst);
+    assert(src);
+
+    if (dst->pixel_depth != 32 || src->pixel_depth != 32) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    // Clip the source to the destination, in 64 bits so that no offset
+    // overflows
+    int64_t left = x > 0 ? x : 0;
+    int64_t top = y > 0 ? y : 0;
+    int64_t right = (int64_t)x + src->width < dst->width ? (int64_t)x + src->width : dst->width;
+    int64_t bottom = (int64_t)y + src->height < dst->height ? (int64_t)y + src->height : dst->height;
+    if (left >= right || top >= bottom) return TGA_SUCCESS;
+
+    size_t count = (size_t)(right - left);
+    for (int64_t row = top; row < bottom; ++row) {
+        uint8_t *dst_row = dst->data + (size_t)row * dst->stride + (size_t)left * 4;
+        const uint8_t *src_row = src->data + (size_t)(row - y) * src->stride + (size_t)(left - x) * 4;
+        blend_row(dst_row, src_row, count, premultiplied);
+    }
+
+    return TGA_SUCCESS;
+}
+
+// Applies a 32-bit or 16-bit alpha pass to pixel_count pixels of pixel_depth,
+// where alpha_bits comes from the descriptor. 16-bit pixels have one bit of
+// alpha, which premultiplies color into all or nothing and leaves nothing
+// to unpremultiply.
+static void alpha_pass(uint8_t *pixels, size_t pixel_count, uint8_t pixel_depth, uint8_t alpha_bits, bool premultiply) {
+    if (pixel_depth == 32 && alpha_bits == 8) {
+        if (premultiply) {
+            premultiply_row(pixels, pixel_count);
+        } else {
+            unpremultiply_row(pixels, pixel_count);
+        }
+    } else if (pixel_depth == 16 && alpha_bits == 1 && premultiply) {
+        for (size_t i = 0; i < pixel_count * 2; i += 2) {
+            if (!(pixels[i + 1] & 0x80)) {
+                pixels[i] = 0;
+                pixels[i + 1] = 0;
+            }
+        }
+    }
+}
+
+// Premultiplies or unpremultiplies the pixels of tga, or its color map
+static int convert_alpha(TgaImage *tga, bool premultiply) {
+    TgaHeader *header = &tga->header;
+    uint8_t alpha_bits = header->descriptor & 0x0f;
+
+    if (tga->state == IS_RLE) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (tga->state == IS_COLOR_MAPPED) {
+        if (!tga_valid_depth(header->color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+        alpha_pass(tga->color_map_data, header->color_map_length, header->color_map_pixel_depth, alpha_bits, premultiply);
+        return TGA_SUCCESS;
+    }
+    if (!tga_valid_depth(header->image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    alpha_pass(tga->image_data, (size_t)header->width * header->height, header->image_pixel_depth, alpha_bits, premultiply);
+    return TGA_SUCCESS;
+}
+
+int tga_premultiply(TgaImage *tga) {
+    assert(tga);
+
+    return convert_alpha(tga, true);
+}
+
+int tga_unpremultiply(TgaImage *tga) {
+    assert(tga);
+
+    return convert_alpha(tga, false);
+}
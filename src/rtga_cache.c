@@ -0,0 +1,369 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_PTHREADS 1
+#include <pthread.h>
+#endif
+
+// Buckets the table starts with, and most entries per bucket before it
+// doubles
+#define MIN_BUCKETS 64
+#define MAX_LOAD 2
+
+// Encoded file of one image, which is freed once it has left the cache and
+// nothing is copying out of it any more
+typedef struct Entry {
+    uint64_t key;
+    uint8_t *data;
+    size_t size;
+    // Callers copying out of the entry, and whether it is still cached
+    unsigned users;
+    bool cached;
+    // Neighbors in order of use, most recent first, and in its bucket
+    struct Entry *newer;
+    struct Entry *older;
+    struct Entry *chain;
+} Entry;
+
+struct TgaCache {
+    TgaAllocator allocator;
+    size_t capacity;
+    Entry **buckets;
+    size_t bucket_count;
+    Entry *newest;
+    Entry *oldest;
+    TgaCacheStats stats;
+#ifdef RTGA_PTHREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef RTGA_PTHREADS
+#define LOCK(cache) pthread_mutex_lock(&(cache)->lock)
+#define UNLOCK(cache) pthread_mutex_unlock(&(cache)->lock)
+#else
+#define LOCK(cache) ((void)0)
+#define UNLOCK(cache) ((void)0)
+#endif
+
+int tga_cache_create(size_t capacity, const TgaAllocator *allocator, TgaCache **cache) {
+    assert(cache);
+
+    *cache = rtga_alloc(allocator, sizeof(TgaCache));
+    if (!*cache) return TGA_ALLOCATION_ERROR;
+
+    TgaCache *created = *cache;
+    memset(created, 0, sizeof(TgaCache));
+    if (allocator) created->allocator = *allocator;
+    created->capacity = capacity;
+    created->bucket_count = MIN_BUCKETS;
+    created->buckets = rtga_alloc(allocator, MIN_BUCKETS * sizeof(Entry *));
+    if (!created->buckets) {
+        rtga_free(allocator, created);
+        *cache = NULL;
+        return TGA_ALLOCATION_ERROR;
+    }
+    memset(created->buckets, 0, MIN_BUCKETS * sizeof(Entry *));
+#ifdef RTGA_PTHREADS
+    pthread_mutex_init(&created->lock, NULL);
+#endif
+
+    return TGA_SUCCESS;
+}
+
+static void free_entry(TgaCache *cache, Entry *entry) {
+    rtga_free(&cache->allocator, entry->data);
+    rtga_free(&cache->allocator, entry);
+}
+
+void tga_cache_destroy(TgaCache *cache) {
+    if (!cache) return;
+
+    Entry *entry = cache->newest;
+    while (entry) {
+        Entry *older = entry->older;
+        free_entry(cache, entry);
+        entry = older;
+    }
+#ifdef RTGA_PTHREADS
+    pthread_mutex_destroy(&cache->lock);
+#endif
+    TgaAllocator allocator = cache->allocator;
+    rtga_free(&allocator, cache->buckets);
+    rtga_free(&allocator, cache);
+}
+
+void tga_cache_get_stats(TgaCache *cache, TgaCacheStats *stats) {
+    assert(cache);
+    assert(stats);
+
+    LOCK(cache);
+    *stats = cache->stats;
+    UNLOCK(cache);
+}
+
+//
+// Entries
+//
+
+// The caller holds the lock for every function below
+
+static Entry **bucket_of(TgaCache *cache, uint64_t key) {
+    return &cache->buckets[key & (cache->bucket_count - 1)];
+}
+
+static Entry *find(TgaCache *cache, uint64_t key) {
+    Entry *entry = *bucket_of(cache, key);
+    while (entry && entry->key != key) entry = entry->chain;
+    return entry;
+}
+
+// Moves entry to the front of the order of use
+static void touch(TgaCache *cache, Entry *entry) {
+    if (cache->newest == entry) return;
+
+    // Unlink
+    entry->newer->older = entry->older;
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+
+    // Link at the front
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    cache->newest->newer = entry;
+    cache->newest = entry;
+}
+
+// Takes entry out of the cache. It is freed now unless someone is still
+// copying out of it, in which case the last of them frees it.
+static void evict(TgaCache *cache, Entry *entry) {
+    Entry **link = bucket_of(cache, entry->key);
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+
+    cache->stats.entry_count--;
+    cache->stats.size -= entry->size;
+    entry->cached = false;
+    if (entry->users == 0) free_entry(cache, entry);
+}
+
+// Doubles the buckets when they get crowded. A table that can not grow
+// keeps working with longer chains.
+static void grow(TgaCache *cache) {
+    if (cache->stats.entry_count <= cache->bucket_count * MAX_LOAD) return;
+
+    size_t bucket_count = cache->bucket_count * 2;
+    Entry **buckets = rtga_alloc(&cache->allocator, bucket_count * sizeof(Entry *));
+    if (!buckets) return;
+    memset(buckets, 0, bucket_count * sizeof(Entry *));
+
+    for (size_t b = 0; b < cache->bucket_count; ++b) {
+        Entry *entry = cache->buckets[b];
+        while (entry) {
+            Entry *chain = entry->chain;
+            Entry **bucket = &buckets[entry->key & (bucket_count - 1)];
+            entry->chain = *bucket;
+            *bucket = entry;
+            entry = chain;
+        }
+    }
+    rtga_free(&cache->allocator, cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+// Adds entry as the newest, then evicts the oldest entries until the cache
+// fits its capacity again
+static void insert(TgaCache *cache, Entry *entry) {
+    Entry **bucket = bucket_of(cache, entry->key);
+    entry->chain = *bucket;
+    *bucket = entry;
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+    entry->cached = true;
+
+    cache->stats.entry_count++;
+    cache->stats.size += entry->size;
+    while (cache->stats.size > cache->capacity) evict(cache, cache->oldest);
+    grow(cache);
+}
+
+static void release(TgaCache *cache, Entry *entry) {
+    LOCK(cache);
+    entry->users--;
+    if (!entry->cached && entry->users == 0) free_entry(cache, entry);
+    UNLOCK(cache);
+}
+
+//
+// Encoding
+//
+
+// Returns the key of tga encoded with options. Everything that ends up in
+// the file is hashed as it is stored, since images that look the same can
+// still be different files.
+static uint64_t cache_key(const TgaImage *tga, const TgaWriteOptions *options) {
+    const TgaHeader *header = &tga->header;
+    uint8_t header_bytes[TGA_HEADER_SIZE];
+    rtga_serialize_header(header_bytes, header);
+
+    // Encoding gives the same bytes on any number of threads, so only the
+    // scan line table and postage stamp make a difference
+    RtgaHash hash;
+    rtga_hash_init(&hash, options ? (uint64_t)options->scan_line_table | (uint64_t)options->postage_stamp << 1 : 0);
+    rtga_hash_update(&hash, header_bytes, TGA_HEADER_SIZE);
+    rtga_hash_update(&hash, tga->image_id, tga->image_id ? header->id_length : 0);
+    rtga_hash_update(&hash, tga->color_map_data, tga->color_map_data ? rtga_color_map_size(header) : 0);
+    rtga_hash_update(&hash, tga->image_data, tga_image_size(header));
+    return rtga_hash_final(&hash);
+}
+
+// Growing buffer that a miss is encoded into
+typedef struct {
+    const TgaAllocator *allocator;
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} Buffer;
+
+static size_t buffer_write(void *context, const void *data, size_t size) {
+    Buffer *buffer = context;
+    if (buffer->capacity - buffer->size < size) {
+        size_t capacity = buffer->capacity * 2 > buffer->size + size ? buffer->capacity * 2 : buffer->size + size;
+        uint8_t *grown = rtga_realloc(buffer->allocator, buffer->data, capacity);
+        if (!grown) {
+            buffer->failed = true;
+            return 0;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return size;
+}
+
+// Finds the entry of tga encoded with options, encoding it on a miss, and
+// marks it in use until release
+static int lookup(TgaCache *cache, TgaImage *tga, const TgaWriteOptions *options, Entry **found) {
+    if (!tga_valid_depth(tga->header.image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    uint64_t key = cache_key(tga, options);
+
+    LOCK(cache);
+    Entry *entry = find(cache, key);
+    if (entry) {
+        cache->stats.hits++;
+        entry->users++;
+        touch(cache, entry);
+    } else {
+        cache->stats.misses++;
+    }
+    UNLOCK(cache);
+    if (entry) {
+        *found = entry;
+        return TGA_SUCCESS;
+    }
+
+    // Encode without holding the lock, starting with room for the
+    // uncompressed file
+    entry = rtga_alloc(&cache->allocator, sizeof(Entry));
+    if (!entry) return TGA_ALLOCATION_ERROR;
+    Buffer buffer = {&cache->allocator, NULL, 0, 0, false};
+    buffer.capacity = TGA_HEADER_SIZE + tga->header.id_length + rtga_color_map_size(&tga->header) + tga_image_size(&tga->header);
+    buffer.data = rtga_alloc(&cache->allocator, buffer.capacity);
+    TgaIo io = {NULL, buffer_write, NULL, &buffer};
+    int result = buffer.data ? tga_write_io(tga, &io, options) : TGA_ALLOCATION_ERROR;
+    if (result != TGA_SUCCESS) {
+        rtga_free(&cache->allocator, buffer.data);
+        rtga_free(&cache->allocator, entry);
+        return buffer.failed ? TGA_ALLOCATION_ERROR : result;
+    }
+
+    entry->key = key;
+    entry->data = buffer.data;
+    entry->size = buffer.size;
+    entry->users = 1;
+    entry->cached = false;
+
+    // Files larger than the whole cache are handed back without being kept,
+    // and so are images another thread encoded at the same time
+    LOCK(cache);
+    if (entry->size <= cache->capacity && !find(cache, key)) insert(cache, entry);
+    UNLOCK(cache);
+
+    *found = entry;
+    return TGA_SUCCESS;
+}
+
+int tga_cache_encode_memory(TgaCache *cache, TgaImage *tga, void *dst, size_t dst_size, const TgaWriteOptions *options, size_t *encoded_size) {
+    assert(cache);
+    assert(tga);
+    assert(dst || dst_size == 0);
+
+    Entry *entry;
+    int result = lookup(cache, tga, options, &entry);
+    if (result != TGA_SUCCESS) {
+        if (encoded_size) *encoded_size = 0;
+        return result;
+    }
+
+    // The size is given back even when dst is too small, so the caller can
+    // try again with a buffer that fits
+    size_t size = entry->size;
+    if (size <= dst_size) memcpy(dst, entry->data, size);
+    release(cache, entry);
+
+    if (encoded_size) *encoded_size = size;
+    return size <= dst_size ? TGA_SUCCESS : TGA_FILE_WRITE_ERROR;
+}
+
+int tga_cache_write_file(TgaCache *cache, TgaImage *tga, const char *filename, const TgaWriteOptions *options) {
+    assert(cache);
+    assert(tga);
+    assert(filename);
+
+    Entry *entry;
+    int result = lookup(cache, tga, options, &entry);
+    if (result != TGA_SUCCESS) return result;
+
+    RTGA_STATS_BEGIN(open_start);
+    FILE *fp = fopen(filename, "wb");
+    RTGA_STATS_END(open_start, TGA_PHASE_OPEN, 0);
+    if (!fp) {
+        release(cache, entry);
+        return TGA_FILE_OPEN_ERROR;
+    }
+    RTGA_STATS_BEGIN(write_start);
+    size_t count = fwrite(entry->data, 1, entry->size, fp);
+    RTGA_STATS_END(write_start, TGA_PHASE_IO, count);
+    bool written = count == entry->size;
+    release(cache, entry);
+
+    return fclose(fp) != 0 || !written ? TGA_FILE_WRITE_ERROR : TGA_SUCCESS;
+}
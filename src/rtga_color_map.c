@@ -0,0 +1,537 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Most color map entries an 8-bit index can address
+#define MAX_PALETTE_SIZE 256
+
+// Slots in the exact color set, a power of two well above MAX_PALETTE_SIZE
+#define COLOR_SET_BITS 10
+#define COLOR_SET_SLOTS (1 << COLOR_SET_BITS)
+#define COLOR_SET_EMPTY 0xffff
+
+//
+// Channel layouts
+//
+
+// Channels in blue, green, red, alpha order
+#define CHANNEL_COUNT 4
+
+// Bits and bit offset of every channel in a pixel or histogram bin
+typedef struct {
+    uint8_t bits[CHANNEL_COUNT];
+    uint8_t shift[CHANNEL_COUNT];
+} ChannelLayout;
+
+// Returns the channel layout of pixels of pixel_depth
+static ChannelLayout pixel_layout(uint8_t pixel_depth) {
+    switch (pixel_depth) {
+    case 15:
+        return (ChannelLayout){{5, 5, 5, 0}, {0, 5, 10, 15}};
+    case 16:
+        return (ChannelLayout){{5, 5, 5, 1}, {0, 5, 10, 15}};
+    case 24:
+        return (ChannelLayout){{8, 8, 8, 0}, {0, 8, 16, 24}};
+    default:
+        return (ChannelLayout){{8, 8, 8, 8}, {0, 8, 16, 24}};
+    }
+}
+
+// Returns the channel layout of quantizer histogram bins for pixel_depth.
+// 16-bit pixels are used as they are, deeper pixels are truncated to at
+// most 18 bits.
+static ChannelLayout bin_layout(uint8_t pixel_depth) {
+    switch (pixel_depth) {
+    case 24:
+        return (ChannelLayout){{6, 6, 6, 0}, {0, 6, 12, 18}};
+    case 32:
+        return (ChannelLayout){{5, 5, 5, 3}, {0, 5, 10, 15}};
+    default:
+        return pixel_layout(pixel_depth);
+    }
+}
+
+static inline uint32_t channel(uint32_t value, const ChannelLayout *layout, int c) {
+    return (value >> layout->shift[c]) & ((1u << layout->bits[c]) - 1);
+}
+
+// Returns the histogram bin of a pixel
+static inline uint32_t bin_key(uint32_t value, const ChannelLayout *pixel, const ChannelLayout *bin) {
+    uint32_t key = 0;
+    for (int c = 0; c < CHANNEL_COUNT; ++c) {
+        key |= (channel(value, pixel, c) >> (pixel->bits[c] - bin->bits[c])) << bin->shift[c];
+    }
+    return key;
+}
+
+//
+// Exact palettes
+//
+
+// Builds a palette of every distinct pixel and writes the index of every
+// pixel into indices. Returns false as soon as there are more than
+// MAX_PALETTE_SIZE distinct pixels.
+static bool exact_palette(const uint8_t *src, size_t pixel_count, uint8_t pixel_size, uint8_t *indices, uint32_t *palette, size_t *palette_length) {
+    uint32_t keys[COLOR_SET_SLOTS];
+    uint16_t slots[COLOR_SET_SLOTS];
+    size_t length = 0;
+
+    for (size_t i = 0; i < COLOR_SET_SLOTS; ++i) {
+        slots[i] = COLOR_SET_EMPTY;
+    }
+
+    // Neighbouring pixels are often equal, so the last lookup is kept
+    uint32_t last_value = 0;
+    uint8_t last_index = 0;
+    bool have_last = false;
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        uint32_t value = rtga_load_pixel(src + i * pixel_size, pixel_size);
+
+        if (!have_last || value != last_value) {
+            // Open addressing with linear probing
+            uint32_t slot = (value * 0x9e3779b1u) >> (32 - COLOR_SET_BITS);
+            while (slots[slot] != COLOR_SET_EMPTY && keys[slot] != value) {
+                slot = (slot + 1) & (COLOR_SET_SLOTS - 1);
+            }
+            if (slots[slot] == COLOR_SET_EMPTY) {
+                if (length == MAX_PALETTE_SIZE) return false;
+                keys[slot] = value;
+                slots[slot] = (uint16_t)length;
+                palette[length++] = value;
+            }
+            last_value = value;
+            last_index = (uint8_t)slots[slot];
+            have_last = true;
+        }
+
+        indices[i] = last_index;
+    }
+
+    *palette_length = length;
+    return true;
+}
+
+//
+// Median cut quantization
+//
+
+// Range of histogram bins that become one palette entry
+typedef struct {
+    size_t start;
+    size_t end;
+    uint64_t count;
+    uint8_t min[CHANNEL_COUNT];
+    uint8_t max[CHANNEL_COUNT];
+} ColorBox;
+
+static void box_bounds(ColorBox *box, const uint32_t *keys, const uint32_t *weights, const ChannelLayout *bin) {
+    box->count = 0;
+    for (int c = 0; c < CHANNEL_COUNT; ++c) {
+        box->min[c] = 255;
+        box->max[c] = 0;
+    }
+
+    for (size_t i = box->start; i < box->end; ++i) {
+        box->count += weights[i];
+        for (int c = 0; c < CHANNEL_COUNT; ++c) {
+            uint8_t value = (uint8_t)channel(keys[i], bin, c);
+            if (value < box->min[c]) box->min[c] = value;
+            if (value > box->max[c]) box->max[c] = value;
+        }
+    }
+}
+
+// Returns the channel a box is widest in, scaled to 8 bits per channel
+static int box_longest_channel(const ColorBox *box, const ChannelLayout *bin, uint32_t *length) {
+    int longest = 0;
+    *length = 0;
+
+    for (int c = 0; c < CHANNEL_COUNT; ++c) {
+        if (bin->bits[c] == 0) continue;
+        uint32_t scaled = (uint32_t)(box->max[c] - box->min[c]) << (8 - bin->bits[c]);
+        if (scaled > *length) {
+            *length = scaled;
+            longest = c;
+        }
+    }
+
+    return longest;
+}
+
+// Sorts the bins of a box by one channel with a counting sort
+static void box_sort(const ColorBox *box, int c, uint32_t *keys, uint32_t *weights, uint32_t *key_scratch, uint32_t *weight_scratch, const ChannelLayout *bin) {
+    size_t offsets[257] = {0};
+
+    for (size_t i = box->start; i < box->end; ++i) {
+        ++offsets[channel(keys[i], bin, c) + 1];
+    }
+    for (int v = 0; v < 256; ++v) {
+        offsets[v + 1] += offsets[v];
+    }
+    for (size_t i = box->start; i < box->end; ++i) {
+        size_t position = offsets[channel(keys[i], bin, c)]++;
+        key_scratch[position] = keys[i];
+        weight_scratch[position] = weights[i];
+    }
+
+    size_t length = box->end - box->start;
+    memcpy(keys + box->start, key_scratch, length * sizeof(uint32_t));
+    memcpy(weights + box->start, weight_scratch, length * sizeof(uint32_t));
+}
+
+// Builds a palette of at most MAX_PALETTE_SIZE entries with median cut and
+// writes the index of every pixel into indices
+static int quantize_palette(const uint8_t *src, size_t pixel_count, uint8_t pixel_depth, uint8_t *indices, uint32_t *palette, size_t *palette_length, const TgaAllocator *allocator) {
+    ChannelLayout pixel = pixel_layout(pixel_depth);
+    ChannelLayout bin = bin_layout(pixel_depth);
+    uint8_t pixel_size = (pixel_depth + 7) / 8;
+    size_t bin_count = (size_t)1 << (bin.shift[3] + bin.bits[3]);
+    int result = TGA_ALLOCATION_ERROR;
+
+    uint32_t *histogram = rtga_alloc(allocator, bin_count * sizeof(uint32_t));
+    uint8_t *bin_index = rtga_alloc(allocator, bin_count);
+    uint32_t *keys = NULL;
+    uint32_t *weights = NULL;
+    uint32_t *scratch = NULL;
+    if (!histogram || !bin_index) goto cleanup;
+    memset(histogram, 0, bin_count * sizeof(uint32_t));
+
+    // Histogram of the pixels
+    for (size_t i = 0; i < pixel_count; ++i) {
+        ++histogram[bin_key(rtga_load_pixel(src + i * pixel_size, pixel_size), &pixel, &bin)];
+    }
+
+    // List of the bins that are in use
+    size_t used = 0;
+    for (size_t key = 0; key < bin_count; ++key) {
+        used += histogram[key] != 0;
+    }
+    keys = rtga_alloc(allocator, used * sizeof(uint32_t));
+    weights = rtga_alloc(allocator, used * sizeof(uint32_t));
+    scratch = rtga_alloc(allocator, used * 2 * sizeof(uint32_t));
+    if (!keys || !weights || !scratch) goto cleanup;
+    used = 0;
+    for (size_t key = 0; key < bin_count; ++key) {
+        if (histogram[key]) {
+            keys[used] = (uint32_t)key;
+            weights[used++] = histogram[key];
+        }
+    }
+
+    // Repeatedly split the box with the most pixels times its longest side
+    // at the weighted median of that side
+    ColorBox boxes[MAX_PALETTE_SIZE];
+    size_t box_count = 1;
+    boxes[0].start = 0;
+    boxes[0].end = used;
+    box_bounds(&boxes[0], keys, weights, &bin);
+
+    while (box_count < MAX_PALETTE_SIZE) {
+        size_t best = box_count;
+        uint64_t best_score = 0;
+        int best_channel = 0;
+        for (size_t b = 0; b < box_count; ++b) {
+            uint32_t length;
+            int c = box_longest_channel(&boxes[b], &bin, &length);
+            uint64_t score = boxes[b].count * length;
+            if (boxes[b].end - boxes[b].start > 1 && score > best_score) {
+                best = b;
+                best_score = score;
+                best_channel = c;
+            }
+        }
+        if (best == box_count) break;
+
+        ColorBox *box = &boxes[best];
+        box_sort(box, best_channel, keys, weights, scratch, scratch + used, &bin);
+
+        uint64_t half = box->count / 2;
+        uint64_t total = 0;
+        size_t split = box->start;
+        while (split < box->end - 1 && total + weights[split] <= half) {
+            total += weights[split++];
+        }
+        if (split == box->start) split = box->start + 1;
+
+        ColorBox *next = &boxes[box_count++];
+        next->start = split;
+        next->end = box->end;
+        box->end = split;
+        box_bounds(box, keys, weights, &bin);
+        box_bounds(next, keys, weights, &bin);
+    }
+
+    for (size_t b = 0; b < box_count; ++b) {
+        for (size_t i = boxes[b].start; i < boxes[b].end; ++i) {
+            bin_index[keys[i]] = (uint8_t)b;
+        }
+    }
+
+    // Map every pixel and average the pixels of each entry at full precision
+    uint64_t sums[MAX_PALETTE_SIZE][CHANNEL_COUNT] = {{0}};
+    uint64_t counts[MAX_PALETTE_SIZE] = {0};
+    for (size_t i = 0; i < pixel_count; ++i) {
+        uint32_t value = rtga_load_pixel(src + i * pixel_size, pixel_size);
+        uint8_t index = bin_index[bin_key(value, &pixel, &bin)];
+        indices[i] = index;
+        ++counts[index];
+        for (int c = 0; c < CHANNEL_COUNT; ++c) {
+            sums[index][c] += channel(value, &pixel, c);
+        }
+    }
+
+    for (size_t b = 0; b < box_count; ++b) {
+        uint32_t value = 0;
+        for (int c = 0; c < CHANNEL_COUNT; ++c) {
+            uint32_t average = counts[b] ? (uint32_t)((sums[b][c] + counts[b] / 2) / counts[b]) : 0;
+            value |= average << pixel.shift[c];
+        }
+        palette[b] = value;
+    }
+    *palette_length = box_count;
+    result = TGA_SUCCESS;
+
+cleanup:
+    rtga_free(allocator, scratch);
+    rtga_free(allocator, weights);
+    rtga_free(allocator, keys);
+    rtga_free(allocator, bin_index);
+    rtga_free(allocator, histogram);
+    return result;
+}
+
+//
+// Conversion
+//
+
+int rtga_build_color_map(const uint8_t *src, size_t pixel_count, uint8_t pixel_depth, uint8_t *indices, uint8_t *color_map_data, uint16_t *color_map_length, const TgaAllocator *allocator) {
+    uint32_t palette[MAX_PALETTE_SIZE];
+    size_t palette_length = 0;
+    uint8_t pixel_size = (pixel_depth + 7) / 8;
+    uint8_t color_map_pixel_size = pixel_depth == 8 ? 3 : pixel_size;
+
+    // Use every color as is when there are few enough of them
+    if (!exact_palette(src, pixel_count, pixel_size, indices, palette, &palette_length)) {
+        int result = quantize_palette(src, pixel_count, pixel_depth, indices, palette, &palette_length, allocator);
+        if (result != TGA_SUCCESS) return result;
+    }
+
+    for (size_t i = 0; i < palette_length; ++i) {
+        uint32_t value = pixel_depth == 8 ? palette[i] * 0x010101u : palette[i];
+        rtga_store_pixel(color_map_data + i * color_map_pixel_size, value, color_map_pixel_size);
+    }
+    *color_map_length = (uint16_t)palette_length;
+
+    return TGA_SUCCESS;
+}
+
+int tga_to_color_map(TgaImage *tga) {
+    assert(tga);
+
+    if (tga->state != IS_UNCOMPRESSED) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+
+    uint8_t pixel_depth = tga->header.image_pixel_depth;
+    size_t pixel_count = (size_t)tga->header.width * tga->header.height;
+
+    // Grayscale images get a 24-bit color map of grays
+    uint8_t color_map_depth = pixel_depth == 8 ? 24 : pixel_depth;
+    uint8_t color_map_pixel_size = (color_map_depth + 7) / 8;
+    uint16_t color_map_length;
+
+    const TgaAllocator *allocator = &tga->allocator;
+    uint8_t *indices = rtga_alloc(allocator, pixel_count ? pixel_count : 1);
+    uint8_t *color_map_data = rtga_alloc(allocator, MAX_PALETTE_SIZE * color_map_pixel_size);
+    if (!indices || !color_map_data) {
+        rtga_free(allocator, color_map_data);
+        rtga_free(allocator, indices);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    int result = rtga_build_color_map(tga->image_data, pixel_count, pixel_depth, indices, color_map_data, &color_map_length, allocator);
+    if (result != TGA_SUCCESS) {
+        rtga_free(allocator, color_map_data);
+        rtga_free(allocator, indices);
+        return result;
+    }
+
+    // Replace the true color buffers
+    if (rtga_replace_buffers(tga, indices, color_map_data) != TGA_SUCCESS) {
+        rtga_free(allocator, color_map_data);
+        rtga_free(allocator, indices);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    // Update header and state
+    tga->header.image_type = tga_is_rle(tga->header.image_type)
+        ? RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE
+        : UNCOMPRESSED_COLOR_MAPPED_IMAGE;
+    tga->header.color_map_type = true;
+    tga->header.color_map_first_index = 0;
+    tga->header.color_map_length = color_map_length;
+    tga->header.color_map_pixel_depth = color_map_depth;
+    tga->header.image_pixel_depth = 8;
+    tga->state = IS_COLOR_MAPPED;
+
+    return TGA_SUCCESS;
+}
+
+//
+// Color map expansion
+//
+
+// Builds a table of the color map entry for every 8-bit index. Indices
+// outside of the color map become zero.
+static void expansion_table(uint32_t *table, const TgaHeader *header, const uint8_t *color_map_data) {
+    uint8_t entry_size = (header->color_map_pixel_depth + 7) / 8;
+    size_t length = entry_size ? rtga_color_map_size(header) / entry_size : 0;
+
+    for (uint32_t index = 0; index < MAX_PALETTE_SIZE; ++index) {
+        uint32_t entry = index - header->color_map_first_index;
+        table[index] = entry < length ? rtga_load_pixel(color_map_data + entry * entry_size, entry_size) : 0;
+    }
+}
+
+#ifdef RTGA_AVX2
+// Expands 8 indices at a time with gathers from the table. Returns the
+// number of pixels expanded, the rest are left to the scalar loop.
+RTGA_TARGET_AVX2
+static size_t expand_avx2(uint8_t *dst, const uint8_t *indices, size_t pixel_count, const uint32_t *table, uint8_t entry_size) {
+    size_t i = 0;
+
+    switch (entry_size) {
+    case 2: {
+        // Keep the low two bytes of every entry, then join both lanes
+        const __m256i shuffle = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+        for (; i + 8 <= pixel_count; i += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+            __m256i pixels = _mm256_i32gather_epi32((const int *)table, index, 4);
+            pixels = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(pixels, shuffle), 0x08);
+            _mm_storeu_si128((__m128i *)(dst + i * 2), _mm256_castsi256_si128(pixels));
+        }
+        break;
+    }
+    case 3: {
+        // Keep the low three bytes of every entry in each lane. Each lane
+        // stores 16 bytes for 12, so the loop stops while the extra 4 bytes
+        // still land on pixels that are expanded later.
+        const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; i + 10 <= pixel_count; i += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+            __m256i pixels = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)table, index, 4), shuffle);
+            _mm_storeu_si128((__m128i *)(dst + i * 3), _mm256_castsi256_si128(pixels));
+            _mm_storeu_si128((__m128i *)(dst + i * 3 + 12), _mm256_extracti128_si256(pixels, 1));
+        }
+        break;
+    }
+    case 4:
+        for (; i + 8 <= pixel_count; i += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+            __m256i pixels = _mm256_i32gather_epi32((const int *)table, index, 4);
+            _mm256_storeu_si256((__m256i *)(dst + i * 4), pixels);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return i;
+}
+#endif
+
+static void expand_indices(uint8_t *dst, const uint8_t *indices, size_t pixel_count, const TgaHeader *header, const uint8_t *color_map_data) {
+    uint8_t entry_size = (header->color_map_pixel_depth + 7) / 8;
+    uint8_t index_size = tga_pixel_size(header);
+
+    // 16-bit indices are looked up in the color map directly
+    if (index_size != 1) {
+        size_t length = rtga_color_map_size(header) / entry_size;
+        for (size_t i = 0; i < pixel_count; ++i) {
+            uint32_t entry = rtga_load_pixel(indices + i * index_size, index_size) - header->color_map_first_index;
+            uint32_t value = entry < length ? rtga_load_pixel(color_map_data + entry * entry_size, entry_size) : 0;
+            rtga_store_pixel(dst + i * entry_size, value, entry_size);
+        }
+        return;
+    }
+
+    uint32_t table[MAX_PALETTE_SIZE];
+    expansion_table(table, header, color_map_data);
+
+    size_t i = 0;
+#ifdef RTGA_AVX2
+    if (rtga_has_avx2()) {
+        i = expand_avx2(dst, indices, pixel_count, table, entry_size);
+    }
+#endif
+
+#ifdef RTGA_LITTLE_ENDIAN
+    switch (entry_size) {
+    case 3:
+        // Store four bytes per pixel and let the next pixel overwrite the
+        // extra one, except for the last pixel
+        for (; i + 1 < pixel_count; ++i) {
+            memcpy(dst + i * 3, &table[indices[i]], 4);
+        }
+        break;
+    case 4:
+        for (; i < pixel_count; ++i) {
+            memcpy(dst + i * 4, &table[indices[i]], 4);
+        }
+        break;
+    default:
+        break;
+    }
+#endif
+
+    for (; i < pixel_count; ++i) {
+        rtga_store_pixel(dst + i * entry_size, table[indices[i]], entry_size);
+    }
+}
+
+void tga_color_map_expand(uint8_t *dst, const uint8_t *indices, size_t pixel_count, const TgaHeader *header, const uint8_t *color_map_data) {
+    assert(dst || pixel_count == 0);
+    assert(indices || pixel_count == 0);
+    assert(header);
+    assert(tga_valid_depth(header->color_map_pixel_depth));
+
+    RTGA_STATS_BEGIN(start);
+    expand_indices(dst, indices, pixel_count, header, color_map_data);
+    RTGA_STATS_END(start, TGA_PHASE_DECODE, pixel_count * ((header->color_map_pixel_depth + 7) / 8));
+}
+
+int tga_from_color_map(TgaImage *tga) {
+    assert(tga);
+
+    if (tga->state != IS_COLOR_MAPPED) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (!tga_valid_depth(tga->header.color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    uint8_t entry_size = (tga->header.color_map_pixel_depth + 7) / 8;
+    size_t pixel_count = (size_t)tga->header.width * tga->header.height;
+
+    uint8_t *pixels = rtga_alloc(&tga->allocator, pixel_count * entry_size + 1);
+    if (!pixels) return TGA_ALLOCATION_ERROR;
+
+    tga_color_map_expand(pixels, tga->image_data, pixel_count, &tga->header, tga->color_map_data);
+
+    // Replace the color mapped buffers
+    if (rtga_replace_buffers(tga, pixels, NULL) != TGA_SUCCESS) {
+        rtga_free(&tga->allocator, pixels);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    // Update header and state
+    tga->header.image_type = tga_is_rle(tga->header.image_type)
+        ? RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE
+        : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    tga->header.color_map_type = false;
+    tga->header.color_map_first_index = 0;
+    tga->header.color_map_length = 0;
+    tga->header.image_pixel_depth = tga->header.color_map_pixel_depth;
+    tga->header.color_map_pixel_depth = 0;
+    tga->state = IS_UNCOMPRESSED;
+
+    return TGA_SUCCESS;
+}
@@ -0,0 +1,489 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+// Rows of pixels compared per task
+#define BAND_ROWS 16
+
+// Structural similarity windows, their spacing, and windows per tile
+#define WINDOW_SIZE 8
+#define WINDOW_STEP 4
+#define TILE_WINDOWS 32
+
+// Stabilizing constants of the structural similarity, (0.01 * 255)^2 and
+// (0.03 * 255)^2
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+//
+// Equality
+//
+
+// Pattern of the bits that count in each byte of a row, repeated every 32
+// bytes, which every pixel size but 3 divides
+typedef struct {
+    uint8_t bytes[32];
+} Mask;
+
+// Makes the mask of pixels of depth, where attribute bits only count if
+// they hold alpha
+static void make_mask(Mask *mask, uint8_t depth, bool alpha) {
+    memset(mask->bytes, 0xff, sizeof(mask->bytes));
+    for (size_t i = 0; i < sizeof(mask->bytes); ++i) {
+        if ((depth == 15 || (depth == 16 && !alpha)) && i % 2 == 1) mask->bytes[i] = 0x7f;
+        if (depth == 32 && !alpha && i % 4 == 3) mask->bytes[i] = 0;
+    }
+}
+
+static bool rows_differ_scalar(const uint8_t *a, const uint8_t *b, size_t size, const Mask *mask) {
+    for (size_t i = 0; i < size; ++i) {
+        if ((a[i] ^ b[i]) & mask->bytes[i & 31]) return true;
+    }
+    return false;
+}
+
+#ifdef RTGA_SSE2
+static bool rows_differ_sse2(const uint8_t *a, const uint8_t *b, size_t size, const Mask *mask) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bits = _mm_loadu_si128((const __m128i *)mask->bytes);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i diff = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(diff, bits), zero)) != 0xffff) return true;
+    }
+    return rows_differ_scalar(a + i, b + i, size - i, mask);
+}
+#endif
+
+#ifdef RTGA_AVX2
+RTGA_TARGET_AVX2
+static bool rows_differ_avx2(const uint8_t *a, const uint8_t *b, size_t size, const Mask *mask) {
+    const __m256i bits = _mm256_loadu_si256((const __m256i *)mask->bytes);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+        if (!_mm256_testz_si256(diff, bits)) return true;
+    }
+    return rows_differ_scalar(a + i, b + i, size - i, mask);
+}
+#endif
+
+// Returns whether any bit that counts differs between size bytes of a and b
+static bool rows_differ(const uint8_t *a, const uint8_t *b, size_t size, const Mask *mask) {
+#ifdef RTGA_AVX2
+    if (rtga_has_avx2()) return rows_differ_avx2(a, b, size, mask);
+#endif
+#ifdef RTGA_SSE2
+    return rows_differ_sse2(a, b, size, mask);
+#else
+    return rows_differ_scalar(a, b, size, mask);
+#endif
+}
+
+// Returns the index of the first or, from the end, the last of count pixels
+// that differ between rows that are known to differ
+static uint16_t find_pixel(const uint8_t *a, const uint8_t *b, uint16_t count, uint8_t pixel_size, const Mask *mask, bool from_end) {
+    for (uint16_t n = 0; n < count; ++n) {
+        uint16_t i = from_end ? count - 1 - n : n;
+        if (rows_differ_scalar(a + (size_t)i * pixel_size, b + (size_t)i * pixel_size, pixel_size, mask)) return i;
+    }
+    return 0;
+}
+
+// Whether the stored pixels of both images can be compared as they are
+static bool same_format(const TgaImage *a, const TgaImage *b, const RtgaPixelRows *rows_a, const RtgaPixelRows *rows_b) {
+    return !rows_a->color_mapped && !rows_b->color_mapped && a->header.image_pixel_depth == b->header.image_pixel_depth &&
+           rows_a->alpha == rows_b->alpha && rows_a->orientation.flip_rows == rows_b->orientation.flip_rows &&
+           rows_a->orientation.flip_columns == rows_b->orientation.flip_columns;
+}
+
+// Returns the scratch memory that rows of either image need
+static size_t scratch_size_of(const RtgaPixelRows *a, const RtgaPixelRows *b) {
+    size_t size_a = rtga_pixel_rows_scratch_size(a), size_b = rtga_pixel_rows_scratch_size(b);
+    return size_a > size_b ? size_a : size_b;
+}
+
+int tga_equal(const TgaImage *a, const TgaImage *b, bool *equal, uint16_t *x, uint16_t *y) {
+    assert(a);
+    assert(b);
+    assert(equal);
+
+    RtgaPixelRows rows_a, rows_b;
+    int result = rtga_pixel_rows_init(&rows_a, a);
+    if (result == TGA_SUCCESS) result = rtga_pixel_rows_init(&rows_b, b);
+    if (result != TGA_SUCCESS) return result;
+
+    const TgaHeader *header = &a->header;
+    *equal = false;
+    if (x) *x = 0;
+    if (y) *y = 0;
+    if (header->width != b->header.width || header->height != b->header.height) return TGA_SUCCESS;
+
+    // Images stored alike are compared without converting a pixel, skipping
+    // bits that hold no alpha
+    bool raw = same_format(a, b, &rows_a, &rows_b);
+    uint8_t *scratch = NULL;
+    size_t scratch_size = 0;
+    if (!raw) {
+        scratch_size = scratch_size_of(&rows_a, &rows_b);
+        if (scratch_size > 0) scratch = rtga_alloc(&a->allocator, scratch_size * 2);
+        if (!scratch && scratch_size > 0) return TGA_ALLOCATION_ERROR;
+    }
+
+    Mask mask;
+    uint8_t pixel_size = raw ? tga_pixel_size(header) : 4;
+    make_mask(&mask, raw ? header->image_pixel_depth : 32, rows_a.alpha || rows_b.alpha);
+    size_t row_size = (size_t)header->width * pixel_size;
+
+    bool found = false;
+    for (uint16_t row = 0; !found && row < header->height; ++row) {
+        const uint8_t *row_a, *row_b;
+        if (raw) {
+            size_t stored = rows_a.orientation.flip_rows ? (size_t)(header->height - 1 - row) : row;
+            row_a = a->image_data + stored * row_size;
+            row_b = b->image_data + stored * row_size;
+        } else {
+            row_a = rtga_pixel_row(&rows_a, row, scratch);
+            row_b = rtga_pixel_row(&rows_b, row, scratch + scratch_size);
+        }
+        if (!rows_differ(row_a, row_b, row_size, &mask)) continue;
+
+        // Rows stored right to left differ first at their last stored pixel
+        bool from_end = raw && rows_a.orientation.flip_columns;
+        uint16_t column = find_pixel(row_a, row_b, header->width, pixel_size, &mask, from_end);
+        if (x) *x = from_end ? header->width - 1 - column : column;
+        if (y) *y = row;
+        found = true;
+    }
+
+    rtga_free(&a->allocator, scratch);
+    *equal = !found;
+    return TGA_SUCCESS;
+}
+
+//
+// Errors
+//
+
+// Sums of the differences of the channels that count
+typedef struct {
+    uint64_t error_sum;
+    uint64_t square_sum;
+    uint64_t different_pixels;
+    uint8_t max_error;
+} Errors;
+
+static void add_errors_scalar(Errors *errors, const uint8_t *a, const uint8_t *b, size_t count, uint32_t channels) {
+    for (size_t i = 0; i < count; ++i) {
+        bool different = false;
+        for (int c = 0; c < 4; ++c) {
+            if (!(channels >> (c * 8) & 0xff)) continue;
+            int difference = a[i * 4 + c] - b[i * 4 + c];
+            uint8_t error = (uint8_t)(difference < 0 ? -difference : difference);
+            errors->error_sum += error;
+            errors->square_sum += (uint64_t)error * error;
+            if (error > errors->max_error) errors->max_error = error;
+            different = different || error != 0;
+        }
+        errors->different_pixels += different;
+    }
+}
+
+#ifdef RTGA_SSE2
+// Pixels per flush of the 32-bit sums, which each step of 4 pixels grows by
+// up to 2 * 2 * 255^2 per lane
+#define FLUSH_PIXELS 16384
+
+static void add_errors_sse2(Errors *errors, const uint8_t *a, const uint8_t *b, size_t count, uint32_t channels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32((int)channels);
+    __m128i error_sums = zero;
+    __m128i max_errors = zero;
+
+    size_t i = 0;
+    while (i + 4 <= count) {
+        size_t end = i + FLUSH_PIXELS < count ? i + FLUSH_PIXELS : count;
+        __m128i square_sums = zero;
+        __m128i equal_pixels = zero;
+        size_t start = i;
+        for (; i + 4 <= end; i += 4) {
+            __m128i pixels_a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + i * 4)), mask);
+            __m128i pixels_b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(b + i * 4)), mask);
+            __m128i error = _mm_or_si128(_mm_subs_epu8(pixels_a, pixels_b), _mm_subs_epu8(pixels_b, pixels_a));
+            error_sums = _mm_add_epi64(error_sums, _mm_sad_epu8(error, zero));
+            max_errors = _mm_max_epu8(max_errors, error);
+            __m128i low = _mm_unpacklo_epi8(error, zero);
+            __m128i high = _mm_unpackhi_epi8(error, zero);
+            square_sums = _mm_add_epi32(square_sums, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+            // Equal pixels are -1, so subtracting counts them
+            equal_pixels = _mm_sub_epi32(equal_pixels, _mm_cmpeq_epi32(error, zero));
+        }
+
+        uint32_t squares[4], equals[4];
+        _mm_storeu_si128((__m128i *)squares, square_sums);
+        _mm_storeu_si128((__m128i *)equals, equal_pixels);
+        uint64_t equal_count = 0;
+        for (int k = 0; k < 4; ++k) {
+            errors->square_sum += squares[k];
+            equal_count += equals[k];
+        }
+        errors->different_pixels += (i - start) - equal_count;
+    }
+
+    uint64_t sums[2];
+    uint8_t maxes[16];
+    _mm_storeu_si128((__m128i *)sums, error_sums);
+    _mm_storeu_si128((__m128i *)maxes, max_errors);
+    errors->error_sum += sums[0] + sums[1];
+    for (int k = 0; k < 16; ++k) {
+        if (maxes[k] > errors->max_error) errors->max_error = maxes[k];
+    }
+    add_errors_scalar(errors, a + i * 4, b + i * 4, count - i, channels);
+}
+#endif
+
+// Adds the differences of count 32-bit pixels, where channels has a byte of
+// ones for each channel that counts
+static void add_errors(Errors *errors, const uint8_t *a, const uint8_t *b, size_t count, uint32_t channels) {
+#ifdef RTGA_SSE2
+    add_errors_sse2(errors, a, b, count, channels);
+#else
+    add_errors_scalar(errors, a, b, count, channels);
+#endif
+}
+
+//
+// Structural similarity
+//
+
+// Sums over a window of both luma planes
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+    uint32_t aa;
+    uint32_t bb;
+    uint32_t ab;
+} WindowSums;
+
+static void window_sums_scalar(WindowSums *sums, const uint8_t *a, const uint8_t *b, size_t stride, uint16_t width, uint16_t height) {
+    memset(sums, 0, sizeof(WindowSums));
+    for (uint16_t y = 0; y < height; ++y) {
+        for (uint16_t x = 0; x < width; ++x) {
+            uint32_t value_a = a[y * stride + x], value_b = b[y * stride + x];
+            sums->a += value_a;
+            sums->b += value_b;
+            sums->aa += value_a * value_a;
+            sums->bb += value_b * value_b;
+            sums->ab += value_a * value_b;
+        }
+    }
+}
+
+#ifdef RTGA_SSE2
+static inline uint32_t sum_epi32(__m128i value) {
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(value);
+}
+
+// Sums a window of 8 by 8 pixels
+static void window_sums_sse2(WindowSums *sums, const uint8_t *a, const uint8_t *b, size_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i bytes_a = zero, bytes_b = zero;
+    __m128i squares_a = zero, squares_b = zero, products = zero;
+    for (int y = 0; y < WINDOW_SIZE; ++y) {
+        __m128i row_a = _mm_loadl_epi64((const __m128i *)(a + y * stride));
+        __m128i row_b = _mm_loadl_epi64((const __m128i *)(b + y * stride));
+        bytes_a = _mm_add_epi64(bytes_a, _mm_sad_epu8(row_a, zero));
+        bytes_b = _mm_add_epi64(bytes_b, _mm_sad_epu8(row_b, zero));
+        row_a = _mm_unpacklo_epi8(row_a, zero);
+        row_b = _mm_unpacklo_epi8(row_b, zero);
+        squares_a = _mm_add_epi32(squares_a, _mm_madd_epi16(row_a, row_a));
+        squares_b = _mm_add_epi32(squares_b, _mm_madd_epi16(row_b, row_b));
+        products = _mm_add_epi32(products, _mm_madd_epi16(row_a, row_b));
+    }
+    sums->a = (uint32_t)_mm_cvtsi128_si32(bytes_a);
+    sums->b = (uint32_t)_mm_cvtsi128_si32(bytes_b);
+    sums->aa = sum_epi32(squares_a);
+    sums->bb = sum_epi32(squares_b);
+    sums->ab = sum_epi32(products);
+}
+#endif
+
+static double window_ssim(const WindowSums *sums, unsigned count) {
+    double mean_a = (double)sums->a / count;
+    double mean_b = (double)sums->b / count;
+    double variance_a = (double)sums->aa / count - mean_a * mean_a;
+    double variance_b = (double)sums->bb / count - mean_b * mean_b;
+    double covariance = (double)sums->ab / count - mean_a * mean_b;
+    return (2 * mean_a * mean_b + SSIM_C1) * (2 * covariance + SSIM_C2) /
+           ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) * (variance_a + variance_b + SSIM_C2));
+}
+
+//
+// Comparing
+//
+
+typedef struct {
+    const RtgaPixelRows *rows_a;
+    const RtgaPixelRows *rows_b;
+    uint16_t width;
+    uint16_t height;
+    uint32_t channels;
+    Errors errors[RTGA_MAX_THREADS];
+    // Two rows per worker to convert pixels into
+    uint8_t *scratch;
+    size_t scratch_size;
+    // Luma of both images, if the structural similarity was asked for
+    uint8_t *luma_a;
+    uint8_t *luma_b;
+    // Windows, their size, and the sum of the similarity of every tile
+    uint16_t window_width;
+    uint16_t window_height;
+    size_t windows_x;
+    size_t windows_y;
+    size_t tiles_x;
+    double *tile_ssim;
+} Compare;
+
+static void errors_task(void *context, unsigned worker, size_t index) {
+    Compare *compare = context;
+    uint8_t *scratch_a = compare->scratch + worker * compare->scratch_size * 2;
+    uint8_t *scratch_b = scratch_a + compare->scratch_size;
+
+    uint32_t first = (uint32_t)index * BAND_ROWS;
+    uint32_t end = first + BAND_ROWS < compare->height ? first + BAND_ROWS : compare->height;
+    for (uint32_t y = first; y < end; ++y) {
+        const uint8_t *row_a = rtga_pixel_row(compare->rows_a, (uint16_t)y, scratch_a);
+        const uint8_t *row_b = rtga_pixel_row(compare->rows_b, (uint16_t)y, scratch_b);
+        add_errors(&compare->errors[worker], row_a, row_b, compare->width, compare->channels);
+        if (compare->luma_a) {
+            size_t offset = (size_t)y * compare->width;
+            rtga_convert_pixels(compare->luma_a + offset, 8, row_a, 32, compare->width, true);
+            rtga_convert_pixels(compare->luma_b + offset, 8, row_b, 32, compare->width, true);
+        }
+    }
+}
+
+static void ssim_task(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    Compare *compare = context;
+    size_t first_x = index % compare->tiles_x * TILE_WINDOWS;
+    size_t first_y = index / compare->tiles_x * TILE_WINDOWS;
+    size_t end_x = first_x + TILE_WINDOWS < compare->windows_x ? first_x + TILE_WINDOWS : compare->windows_x;
+    size_t end_y = first_y + TILE_WINDOWS < compare->windows_y ? first_y + TILE_WINDOWS : compare->windows_y;
+    unsigned count = (unsigned)compare->window_width * compare->window_height;
+
+    double sum = 0;
+    for (size_t wy = first_y; wy < end_y; ++wy) {
+        for (size_t wx = first_x; wx < end_x; ++wx) {
+            size_t offset = wy * WINDOW_STEP * compare->width + wx * WINDOW_STEP;
+            const uint8_t *a = compare->luma_a + offset;
+            const uint8_t *b = compare->luma_b + offset;
+            WindowSums sums;
+#ifdef RTGA_SSE2
+            if (compare->window_width == WINDOW_SIZE && compare->window_height == WINDOW_SIZE) {
+                window_sums_sse2(&sums, a, b, compare->width);
+            } else {
+                window_sums_scalar(&sums, a, b, compare->width, compare->window_width, compare->window_height);
+            }
+#else
+            window_sums_scalar(&sums, a, b, compare->width, compare->window_width, compare->window_height);
+#endif
+            sum += window_ssim(&sums, count);
+        }
+    }
+    compare->tile_ssim[index] = sum;
+}
+
+// Returns the bytes of channels that count when comparing a and b
+static uint32_t compared_channels(const RtgaPixelRows *a, const RtgaPixelRows *b, uint8_t *count) {
+    bool alpha_a = a->alpha && (a->depth == 16 || a->depth == 32);
+    bool alpha_b = b->alpha && (b->depth == 16 || b->depth == 32);
+    if (a->depth == 8 && b->depth == 8) {
+        *count = 1;
+        return 0xffu;
+    }
+    *count = alpha_a || alpha_b ? 4 : 3;
+    return alpha_a || alpha_b ? 0xffffffffu : 0xffffffu;
+}
+
+int tga_compare(const TgaImage *a, const TgaImage *b, const TgaCompareOptions *options, TgaCompareResult *result) {
+    assert(a);
+    assert(b);
+    assert(result);
+
+    RtgaPixelRows rows_a, rows_b;
+    int status = rtga_pixel_rows_init(&rows_a, a);
+    if (status == TGA_SUCCESS) status = rtga_pixel_rows_init(&rows_b, b);
+    if (status != TGA_SUCCESS) return status;
+    if (a->header.width != b->header.width || a->header.height != b->header.height) return TGA_SIZE_MISMATCH_ERROR;
+
+    Compare compare;
+    memset(&compare, 0, sizeof(compare));
+    compare.rows_a = &rows_a;
+    compare.rows_b = &rows_b;
+    compare.width = a->header.width;
+    compare.height = a->header.height;
+    compare.channels = compared_channels(&rows_a, &rows_b, &result->channels);
+    unsigned thread_count = rtga_thread_count(options ? options->thread_count : 0);
+    bool ssim = options && options->ssim && compare.width > 0 && compare.height > 0;
+
+    // Every worker converts rows of both images into its own scratch
+    const TgaAllocator *allocator = &a->allocator;
+    compare.scratch_size = scratch_size_of(&rows_a, &rows_b);
+    if (compare.scratch_size > 0) {
+        compare.scratch = rtga_alloc(allocator, thread_count * compare.scratch_size * 2);
+        if (!compare.scratch) status = TGA_ALLOCATION_ERROR;
+    }
+    if (status == TGA_SUCCESS && ssim) {
+        size_t plane_size = (size_t)compare.width * compare.height;
+        compare.window_width = compare.width < WINDOW_SIZE ? compare.width : WINDOW_SIZE;
+        compare.window_height = compare.height < WINDOW_SIZE ? compare.height : WINDOW_SIZE;
+        compare.windows_x = (compare.width - compare.window_width) / WINDOW_STEP + 1;
+        compare.windows_y = (compare.height - compare.window_height) / WINDOW_STEP + 1;
+        compare.tiles_x = (compare.windows_x + TILE_WINDOWS - 1) / TILE_WINDOWS;
+        size_t tile_count = compare.tiles_x * ((compare.windows_y + TILE_WINDOWS - 1) / TILE_WINDOWS);
+        compare.luma_a = rtga_alloc(allocator, plane_size * 2);
+        compare.tile_ssim = rtga_alloc(allocator, tile_count * sizeof(double));
+        if (!compare.luma_a || !compare.tile_ssim) status = TGA_ALLOCATION_ERROR;
+        if (compare.luma_a) compare.luma_b = compare.luma_a + plane_size;
+    }
+
+    if (status == TGA_SUCCESS) {
+        rtga_parallel_for((compare.height + BAND_ROWS - 1) / BAND_ROWS, thread_count, errors_task, &compare);
+
+        Errors errors = {0, 0, 0, 0};
+        for (unsigned worker = 0; worker < thread_count; ++worker) {
+            const Errors *band = &compare.errors[worker];
+            errors.error_sum += band->error_sum;
+            errors.square_sum += band->square_sum;
+            errors.different_pixels += band->different_pixels;
+            if (band->max_error > errors.max_error) errors.max_error = band->max_error;
+        }
+        double samples = (double)compare.width * compare.height * result->channels;
+        result->different_pixels = errors.different_pixels;
+        result->max_error = errors.max_error;
+        result->mean_error = samples > 0 ? errors.error_sum / samples : 0;
+        result->mse = samples > 0 ? errors.square_sum / samples : 0;
+        result->psnr = result->mse > 0 ? 10 * log10(255.0 * 255.0 / result->mse) : INFINITY;
+        result->ssim = 1;
+
+        // Tiles are summed in order, so the result does not depend on the
+        // number of threads
+        if (ssim) {
+            size_t tile_count = compare.tiles_x * ((compare.windows_y + TILE_WINDOWS - 1) / TILE_WINDOWS);
+            rtga_parallel_for(tile_count, thread_count, ssim_task, &compare);
+            double sum = 0;
+            for (size_t tile = 0; tile < tile_count; ++tile) sum += compare.tile_ssim[tile];
+            result->ssim = sum / ((double)compare.windows_x * compare.windows_y);
+        }
+    }
+
+    rtga_free(allocator, compare.tile_ssim);
+    rtga_free(allocator, compare.luma_a);
+    rtga_free(allocator, compare.scratch);
+    return status;
+}
@@ -0,0 +1,508 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Pixels converted at a time through 32-bit BGRA
+#define CONVERT_CHUNK 256
+
+// 4x4 ordered dither matrix
+static const uint8_t BAYER[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+// Threshold that rounds to nearest when quantizing 8-bit channels to 5 bits
+#define ROUND_THRESHOLD 127
+
+// Returns x / 255 for x up to 65534
+static inline uint32_t div255(uint32_t x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+// Returns the thresholds of a row for each x & 3. Quantizing a channel c to
+// 5 bits gives (c * 31 + threshold) / 255, so the threshold picks the point
+// between two 5-bit levels where the channel rounds up.
+static void row_thresholds(uint32_t *thresholds, uint16_t y, bool dither) {
+    for (int x = 0; x < 4; ++x) {
+        thresholds[x] = dither ? (2 * BAYER[y & 3][x] + 1) * 255 / 32 : ROUND_THRESHOLD;
+    }
+}
+
+//
+// Unpacking into 32-bit BGRA
+//
+
+// Widens a 5-bit channel to the nearest 8-bit value, c * 255 / 31
+static inline uint32_t widen5(uint32_t c) {
+    return (c * 527 + 23) >> 6;
+}
+
+static void unpack_scalar(uint32_t *bgra, const uint8_t *src, uint8_t depth, size_t count, bool alpha) {
+    uint8_t pixel_size = (depth + 7) / 8;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t value = rtga_load_pixel(src + i * pixel_size, pixel_size);
+        switch (depth) {
+        case 8:
+            bgra[i] = 0xff000000u | value * 0x010101u;
+            break;
+        case 15:
+        case 16: {
+            uint32_t a = depth == 15 || !alpha || (value & 0x8000) ? 0xff : 0;
+            bgra[i] = widen5(value & 0x1f) | widen5((value >> 5) & 0x1f) << 8 |
+                      widen5((value >> 10) & 0x1f) << 16 | a << 24;
+            break;
+        }
+        case 24:
+            bgra[i] = 0xff000000u | value;
+            break;
+        default:
+            bgra[i] = alpha ? value : 0xff000000u | value;
+            break;
+        }
+    }
+}
+
+#ifdef RTGA_AVX2
+RTGA_TARGET_AVX2
+static inline __m256i widen5_avx2(__m256i c) {
+    __m256i x = _mm256_add_epi32(_mm256_mullo_epi32(c, _mm256_set1_epi32(527)), _mm256_set1_epi32(23));
+    return _mm256_srli_epi32(x, 6);
+}
+
+RTGA_TARGET_AVX2
+static size_t unpack_avx2(uint32_t *bgra, const uint8_t *src, uint8_t depth, size_t count, bool alpha) {
+    const __m256i opaque = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+
+    switch (depth) {
+    case 8:
+        for (; i + 8 <= count; i += 8) {
+            __m256i gray = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+            gray = _mm256_mullo_epi32(gray, _mm256_set1_epi32(0x010101));
+            _mm256_storeu_si256((__m256i *)(bgra + i), _mm256_or_si256(gray, opaque));
+        }
+        break;
+    case 15:
+    case 16: {
+        const __m256i mask = _mm256_set1_epi32(0x1f);
+        bool keep_alpha = depth == 16 && alpha;
+        for (; i + 8 <= count; i += 8) {
+            __m256i value = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i * 2)));
+            __m256i b = _mm256_and_si256(value, mask);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(value, 5), mask);
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(value, 10), mask);
+            b = widen5_avx2(b);
+            g = widen5_avx2(g);
+            r = widen5_avx2(r);
+            // Spread the attribute bit over the alpha byte
+            __m256i a = keep_alpha ? _mm256_and_si256(_mm256_srai_epi32(_mm256_slli_epi32(value, 16), 31), opaque) : opaque;
+            __m256i pixels = _mm256_or_si256(_mm256_or_si256(b, _mm256_slli_epi32(g, 8)),
+                                             _mm256_or_si256(_mm256_slli_epi32(r, 16), a));
+            _mm256_storeu_si256((__m256i *)(bgra + i), pixels);
+        }
+        break;
+    }
+    case 24: {
+        // Each lane widens four pixels. The second load reads 4 bytes past
+        // the eighth pixel, so the loop stops while they are in the buffer.
+        const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        for (; i + 10 <= count; i += 8) {
+            __m256i pixels = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i * 3))),
+                _mm_loadu_si128((const __m128i *)(src + i * 3 + 12)), 1);
+            pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), opaque);
+            _mm256_storeu_si256((__m256i *)(bgra + i), pixels);
+        }
+        break;
+    }
+    default: {
+        const __m256i fill = alpha ? _mm256_setzero_si256() : opaque;
+        for (; i + 8 <= count; i += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+            _mm256_storeu_si256((__m256i *)(bgra + i), _mm256_or_si256(pixels, fill));
+        }
+        break;
+    }
+    }
+
+    return i;
+}
+#endif
+
+static void unpack(uint32_t *bgra, const uint8_t *src, uint8_t depth, size_t count, bool alpha) {
+    size_t i = 0;
+
+#ifdef RTGA_AVX2
+    if (rtga_has_avx2()) i = unpack_avx2(bgra, src, depth, count, alpha);
+#endif
+
+    unpack_scalar(bgra + i, src + i * ((depth + 7) / 8), depth, count - i, alpha);
+}
+
+//
+// Packing from 32-bit BGRA
+//
+
+static void pack_scalar(uint8_t *dst, const uint32_t *bgra, uint8_t depth, size_t count, const uint32_t *thresholds, size_t x) {
+    uint8_t pixel_size = (depth + 7) / 8;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t value = bgra[i];
+        uint32_t b = value & 0xff;
+        uint32_t g = (value >> 8) & 0xff;
+        uint32_t r = (value >> 16) & 0xff;
+        uint32_t a = value >> 24;
+        uint32_t packed;
+
+        switch (depth) {
+        case 8:
+            // Rec. 601 luma with weights that sum to 256
+            packed = (77 * r + 150 * g + 29 * b + 128) >> 8;
+            break;
+        case 15:
+        case 16: {
+            uint32_t t = thresholds[(x + i) & 3];
+            packed = div255(b * 31 + t) | div255(g * 31 + t) << 5 | div255(r * 31 + t) << 10;
+            if (depth == 16 && a >= 128) packed |= 0x8000;
+            break;
+        }
+        default:
+            packed = value;
+            break;
+        }
+        rtga_store_pixel(dst + i * pixel_size, packed, pixel_size);
+    }
+}
+
+#ifdef RTGA_AVX2
+RTGA_TARGET_AVX2
+static inline __m256i quantize5_avx2(__m256i channel, __m256i threshold) {
+    // (c * 31 + t) / 255 with the same rounding as div255
+    __m256i x = _mm256_add_epi32(_mm256_mullo_epi32(channel, _mm256_set1_epi32(31)), threshold);
+    x = _mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(1)), _mm256_srli_epi32(x, 8));
+    return _mm256_srli_epi32(x, 8);
+}
+
+RTGA_TARGET_AVX2
+static size_t pack_avx2(uint8_t *dst, const uint32_t *bgra, uint8_t depth, size_t count, const uint32_t *thresholds, size_t x) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    size_t i = 0;
+
+    switch (depth) {
+    case 8: {
+        // Blue and red, then green, as 16-bit pairs that madd weighs and sums
+        const __m256i blue_red = _mm256_set1_epi32(29 | 77 << 16);
+        const __m256i green = _mm256_set1_epi32(150);
+        const __m256i word_mask = _mm256_set1_epi32(0x00ff00ff);
+        for (; i + 8 <= count; i += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *)(bgra + i));
+            __m256i luma = _mm256_add_epi32(_mm256_madd_epi16(_mm256_and_si256(pixels, word_mask), blue_red),
+                                            _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), word_mask), green));
+            luma = _mm256_srli_epi32(_mm256_add_epi32(luma, _mm256_set1_epi32(128)), 8);
+            __m256i words = _mm256_packus_epi32(luma, luma);
+            __m256i bytes = _mm256_packus_epi16(words, words);
+            uint32_t low = (uint32_t)_mm256_extract_epi32(bytes, 0);
+            uint32_t high = (uint32_t)_mm256_extract_epi32(bytes, 4);
+            memcpy(dst + i, &low, 4);
+            memcpy(dst + i + 4, &high, 4);
+        }
+        break;
+    }
+    case 15:
+    case 16: {
+        // Groups of 8 pixels start at the same x & 3, so one vector of
+        // thresholds serves every group
+        __m256i threshold = _mm256_setr_epi32((int)thresholds[x & 3], (int)thresholds[(x + 1) & 3],
+                                              (int)thresholds[(x + 2) & 3], (int)thresholds[(x + 3) & 3],
+                                              (int)thresholds[x & 3], (int)thresholds[(x + 1) & 3],
+                                              (int)thresholds[(x + 2) & 3], (int)thresholds[(x + 3) & 3]);
+        for (; i + 8 <= count; i += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *)(bgra + i));
+            __m256i b = quantize5_avx2(_mm256_and_si256(pixels, byte_mask), threshold);
+            __m256i g = quantize5_avx2(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte_mask), threshold);
+            __m256i r = quantize5_avx2(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte_mask), threshold);
+            __m256i packed = _mm256_or_si256(b, _mm256_or_si256(_mm256_slli_epi32(g, 5), _mm256_slli_epi32(r, 10)));
+            if (depth == 16) {
+                // The top alpha bit is the attribute bit
+                packed = _mm256_or_si256(packed, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), _mm256_set1_epi32(0x8000)));
+            }
+            __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(packed, packed), 0x08);
+            _mm_storeu_si128((__m128i *)(dst + i * 2), _mm256_castsi256_si128(words));
+        }
+        break;
+    }
+    case 24: {
+        // Each lane drops the alpha of four pixels into 12 bytes
+        const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; i + 8 <= count; i += 8) {
+            __m256i pixels = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(bgra + i)), shuffle);
+            // dst has room for a whole vector past every group
+            _mm_storeu_si128((__m128i *)(dst + i * 3), _mm256_castsi256_si128(pixels));
+            _mm_storeu_si128((__m128i *)(dst + i * 3 + 12), _mm256_extracti128_si256(pixels, 1));
+        }
+        break;
+    }
+    default:
+        memcpy(dst, bgra, count / 8 * 8 * 4);
+        i = count / 8 * 8;
+        break;
+    }
+
+    return i;
+}
+#endif
+
+// Packs count pixels into dst, which must have room for 16 bytes more than
+// the pixels themselves. x is the column of the first pixel.
+static void pack(uint8_t *dst, const uint32_t *bgra, uint8_t depth, size_t count, const uint32_t *thresholds, size_t x) {
+    size_t i = 0;
+
+#ifdef RTGA_AVX2
+    if (rtga_has_avx2()) i = pack_avx2(dst, bgra, depth, count, thresholds, x);
+#endif
+
+    pack_scalar(dst + i * ((depth + 7) / 8), bgra + i, depth, count - i, thresholds, x + i);
+}
+
+//
+// Conversion
+//
+
+// Converts count pixels starting at column x of a row. Pixels go through
+// 32-bit BGRA in a buffer, so dst may overlap src as long as each chunk is
+// read before it is written.
+static void convert_span(uint8_t *dst, uint8_t dst_depth, const uint8_t *src, uint8_t src_depth, size_t count, bool src_alpha, const uint32_t *thresholds, size_t x) {
+    uint32_t bgra[CONVERT_CHUNK];
+    uint8_t packed[CONVERT_CHUNK * 4 + 16];
+    uint8_t dst_size = (dst_depth + 7) / 8;
+    uint8_t src_size = (src_depth + 7) / 8;
+
+    for (size_t i = 0; i < count; i += CONVERT_CHUNK) {
+        size_t chunk = count - i < CONVERT_CHUNK ? count - i : CONVERT_CHUNK;
+        unpack(bgra, src + i * src_size, src_depth, chunk, src_alpha);
+        pack(packed, bgra, dst_depth, chunk, thresholds, x + i);
+        memmove(dst + i * dst_size, packed, chunk * dst_size);
+    }
+}
+
+// Same as convert_span, going from the last chunk to the first so pixels
+// can grow in place
+static void convert_span_backward(uint8_t *dst, uint8_t dst_depth, const uint8_t *src, uint8_t src_depth, size_t count, bool src_alpha, const uint32_t *thresholds, size_t x) {
+    uint32_t bgra[CONVERT_CHUNK];
+    uint8_t packed[CONVERT_CHUNK * 4 + 16];
+    uint8_t dst_size = (dst_depth + 7) / 8;
+    uint8_t src_size = (src_depth + 7) / 8;
+
+    size_t end = count;
+    while (end > 0) {
+        size_t chunk = end < CONVERT_CHUNK ? end : CONVERT_CHUNK;
+        size_t i = end - chunk;
+        unpack(bgra, src + i * src_size, src_depth, chunk, src_alpha);
+        pack(packed, bgra, dst_depth, chunk, thresholds, x + i);
+        memmove(dst + i * dst_size, packed, chunk * dst_size);
+        end = i;
+    }
+}
+
+void rtga_convert_pixels(uint8_t *dst, uint8_t dst_depth, const uint8_t *src, uint8_t src_depth, size_t pixel_count, bool src_alpha) {
+    uint32_t thresholds[4];
+
+    assert(tga_valid_depth(dst_depth) && tga_valid_depth(src_depth));
+    assert(dst || pixel_count == 0);
+    assert(src || pixel_count == 0);
+
+    row_thresholds(thresholds, 0, false);
+    convert_span(dst, dst_depth, src, src_depth, pixel_count, src_alpha, thresholds, 0);
+}
+
+// Converts rows of pixels in place or into a separate buffer, where rows
+// are dst_stride and src_stride bytes apart
+static void convert_rows(uint8_t *dst, uint8_t dst_depth, size_t dst_stride, const uint8_t *src, uint8_t src_depth, size_t src_stride, uint16_t width, uint16_t height, bool src_alpha, bool dither) {
+    uint32_t thresholds[4];
+    bool in_place = dst == src;
+
+    // Growing in place has to go from the end, both for rows and for the
+    // pixels of a row, so no pixel is overwritten before it is read
+    bool backward_rows = in_place && dst_stride > src_stride;
+    bool backward_spans = in_place && (dst_depth + 7) / 8 > (src_depth + 7) / 8;
+
+    for (size_t i = 0; i < height; ++i) {
+        size_t y = backward_rows ? height - 1 - i : i;
+        row_thresholds(thresholds, (uint16_t)y, dither);
+        if (backward_spans) {
+            convert_span_backward(dst + y * dst_stride, dst_depth, src + y * src_stride, src_depth, width, src_alpha, thresholds, 0);
+        } else {
+            convert_span(dst + y * dst_stride, dst_depth, src + y * src_stride, src_depth, width, src_alpha, thresholds, 0);
+        }
+    }
+}
+
+// Converts the packed rows of an image
+static void convert_image_rows(uint8_t *dst, uint8_t dst_depth, const uint8_t *src, uint8_t src_depth, uint16_t width, uint16_t height, bool src_alpha, bool dither) {
+    size_t dst_row = (size_t)width * ((dst_depth + 7) / 8);
+    size_t src_row = (size_t)width * ((src_depth + 7) / 8);
+
+    convert_rows(dst, dst_depth, dst_row, src, src_depth, src_row, width, height, src_alpha, dither);
+}
+
+int tga_view_convert(const TgaView *dst, const TgaView *src, bool src_alpha, bool dither) {
+    assert(dst);
+    assert(src);
+
+    if (!tga_valid_depth(dst->pixel_depth) || !tga_valid_depth(src->pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    uint16_t width = dst->width < src->width ? dst->width : src->width;
+    uint16_t height = dst->height < src->height ? dst->height : src->height;
+    if (width == 0 || height == 0) return TGA_SUCCESS;
+
+    convert_rows(dst->data, dst->pixel_depth, dst->stride, src->data, src->pixel_depth, src->stride, width, height, src_alpha, dither);
+    return TGA_SUCCESS;
+}
+
+// Returns the alpha bits of the descriptor of a converted image
+static uint8_t converted_alpha_bits(uint8_t descriptor, uint8_t pixel_depth) {
+    bool alpha = (descriptor & 0x0f) != 0;
+    if (!alpha) return 0;
+    if (pixel_depth == 32) return 8;
+    if (pixel_depth == 16) return 1;
+    return 0;
+}
+
+// Converts the entries of the color map of tga
+static int convert_color_map(TgaImage *tga, uint8_t pixel_depth) {
+    TgaHeader *header = &tga->header;
+    if (!tga_valid_depth(header->color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    bool alpha = (header->descriptor & 0x0f) != 0;
+    size_t size = (size_t)header->color_map_length * ((pixel_depth + 7) / 8);
+    uint8_t *color_map_data = rtga_alloc(&tga->allocator, size ? size : 1);
+    uint8_t *image_data = rtga_owned_copy(tga, tga->image_data, tga_image_size(header));
+    if (!color_map_data || !image_data) {
+        rtga_free(&tga->allocator, color_map_data);
+        if (image_data != tga->image_data) rtga_free(&tga->allocator, image_data);
+        return TGA_ALLOCATION_ERROR;
+    }
+    rtga_convert_pixels(color_map_data, pixel_depth, tga->color_map_data, header->color_map_pixel_depth, header->color_map_length, alpha);
+
+    if (rtga_replace_buffers(tga, image_data, color_map_data) != TGA_SUCCESS) {
+        rtga_free(&tga->allocator, color_map_data);
+        if (image_data != tga->image_data) rtga_free(&tga->allocator, image_data);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    header->color_map_pixel_depth = pixel_depth;
+    header->descriptor = (uint8_t)((header->descriptor & 0xf0) | converted_alpha_bits(header->descriptor, pixel_depth));
+
+    return TGA_SUCCESS;
+}
+
+int tga_convert_depth(TgaImage *tga, uint8_t pixel_depth, bool dither) {
+    assert(tga);
+
+    if (!tga_valid_depth(pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (tga->state == IS_RLE) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+
+    // Color mapped images keep their indices and convert their color map
+    if (tga->state == IS_COLOR_MAPPED) return convert_color_map(tga, pixel_depth);
+
+    TgaHeader *header = &tga->header;
+    uint8_t src_depth = header->image_pixel_depth;
+    if (!tga_valid_depth(src_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (src_depth == pixel_depth) return TGA_SUCCESS;
+
+    bool alpha = (header->descriptor & 0x0f) != 0;
+    size_t pixel_count = (size_t)header->width * header->height;
+    size_t src_size = pixel_count * ((src_depth + 7) / 8);
+    size_t dst_size = pixel_count * ((pixel_depth + 7) / 8);
+
+    if (dst_size <= src_size) {
+        // Shrink in place, which also works inside a private file mapping
+        convert_image_rows(tga->image_data, pixel_depth, tga->image_data, src_depth, header->width, header->height, alpha, dither);
+        if (!tga->mapping && dst_size > 0) {
+            uint8_t *image_data = rtga_realloc(&tga->allocator, tga->image_data, dst_size);
+            if (image_data) tga->image_data = image_data;
+        }
+    } else if (!tga->mapping) {
+        // Grow the buffer, then the pixels inside it
+        uint8_t *image_data = rtga_realloc(&tga->allocator, tga->image_data, dst_size);
+        if (!image_data) return TGA_ALLOCATION_ERROR;
+        tga->image_data = image_data;
+        convert_image_rows(image_data, pixel_depth, image_data, src_depth, header->width, header->height, alpha, dither);
+    } else {
+        // Mapped pixels are converted out of the mapping into a new buffer
+        uint8_t *image_data = rtga_alloc(&tga->allocator, dst_size);
+        uint8_t *color_map_data = rtga_owned_copy(tga, tga->color_map_data, rtga_color_map_size(header));
+        if (!image_data || (tga->color_map_data && !color_map_data)) {
+            rtga_free(&tga->allocator, image_data);
+            rtga_free(&tga->allocator, color_map_data);
+            return TGA_ALLOCATION_ERROR;
+        }
+        convert_image_rows(image_data, pixel_depth, tga->image_data, src_depth, header->width, header->height, alpha, dither);
+        if (rtga_replace_buffers(tga, image_data, color_map_data) != TGA_SUCCESS) {
+            rtga_free(&tga->allocator, image_data);
+            rtga_free(&tga->allocator, color_map_data);
+            return TGA_ALLOCATION_ERROR;
+        }
+    }
+
+    // Grayscale and true color images change type with their depth
+    bool rle = tga_is_rle(header->image_type);
+    if (pixel_depth == 8) {
+        header->image_type = rle ? RUN_LENGTH_ENCODED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_BLACK_AND_WHITE_IMAGE;
+    } else {
+        header->image_type = rle ? RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    }
+    header->image_pixel_depth = pixel_depth;
+    header->descriptor = (uint8_t)((header->descriptor & 0xf0) | converted_alpha_bits(header->descriptor, pixel_depth));
+
+    return TGA_SUCCESS;
+}
+
+//
+// Normalized pixels
+//
+
+int rtga_pixel_rows_init(RtgaPixelRows *rows, const TgaImage *tga) {
+    const TgaHeader *header = &tga->header;
+    rows->tga = tga;
+    rows->color_mapped = tga->state == IS_COLOR_MAPPED;
+    if (tga->state == IS_RLE) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (!tga_valid_depth(header->image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (rows->color_mapped && !tga_valid_depth(header->color_map_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    rows->depth = rows->color_mapped ? header->color_map_pixel_depth : header->image_pixel_depth;
+    rows->alpha = (header->descriptor & 0x0f) != 0;
+    rows->orientation = rtga_read_orientation(header, true);
+    rows->row_size = (size_t)header->width * tga_pixel_size(header);
+    rows->in_place = !rows->color_mapped && rows->depth == 32 && rows->alpha && !rows->orientation.flip_columns;
+    return TGA_SUCCESS;
+}
+
+size_t rtga_pixel_rows_scratch_size(const RtgaPixelRows *rows) {
+    // Color mapped rows are expanded into the first half before they are
+    // converted into the second
+    return rows->in_place ? 0 : (size_t)rows->tga->header.width * 8 + 1;
+}
+
+const uint8_t *rtga_pixel_row(const RtgaPixelRows *rows, uint16_t y, uint8_t *scratch) {
+    const TgaImage *tga = rows->tga;
+    const TgaHeader *header = &tga->header;
+    size_t row = rows->orientation.flip_rows ? (size_t)(header->height - 1 - y) : y;
+    const uint8_t *pixels = tga->image_data + row * rows->row_size;
+    if (rows->in_place) return pixels;
+
+    uint8_t *converted = scratch + (size_t)header->width * 4;
+    if (rows->color_mapped) {
+        tga_color_map_expand(scratch, pixels, header->width, header, tga->color_map_data);
+        pixels = scratch;
+    }
+    rtga_convert_pixels(converted, 32, pixels, rows->depth, header->width, rows->alpha);
+    if (rows->orientation.flip_columns) rtga_reverse_pixels(converted, header->width, 4);
+    return converted;
+}
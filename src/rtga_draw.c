@@ -0,0 +1,239 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+// Farthest a coordinate of a line may lie outside an image, which keeps the
+// error terms of clipping it within 64 bits
+#define COORDINATE_LIMIT ((int64_t)1 << 29)
+
+// Image data and pixel that every primitive draws with
+typedef struct {
+    uint8_t *data;
+    size_t stride;
+    uint16_t width;
+    uint16_t height;
+    uint8_t pixel_size;
+    const uint8_t *pixel;
+} Canvas;
+
+static Canvas canvas_of(TgaImage *tga, const TgaColor *color) {
+    assert(tga->state != IS_RLE);
+    assert(tga_pixel_size(&tga->header) == color->bit_size / 8);
+
+    Canvas canvas;
+    canvas.data = tga->image_data;
+    canvas.pixel_size = tga_pixel_size(&tga->header);
+    canvas.stride = (size_t)tga->header.width * canvas.pixel_size;
+    canvas.width = tga->header.width;
+    canvas.height = tga->header.height;
+    canvas.pixel = color->bgra;
+    return canvas;
+}
+
+static uint8_t *pixel_at(const Canvas *canvas, int64_t x, int64_t y) {
+    return canvas->data + (size_t)y * canvas->stride + (size_t)x * canvas->pixel_size;
+}
+
+//
+// Kernels
+//
+
+// Every kernel is inlined into a switch over the pixel size, so each pixel
+// is stored with a copy of constant size
+
+static inline void store_pixel(uint8_t *dst, const uint8_t *pixel, uint8_t pixel_size) {
+    switch (pixel_size) {
+    case 1:
+        *dst = *pixel;
+        break;
+    case 2:
+        memcpy(dst, pixel, 2);
+        break;
+    case 3:
+        memcpy(dst, pixel, 3);
+        break;
+    default:
+        memcpy(dst, pixel, 4);
+        break;
+    }
+}
+
+// Steps count pixels along the major axis, and along the minor axis as well
+// whenever error reaches limit
+static inline void line_kernel(uint8_t *dst, ptrdiff_t major_step, ptrdiff_t minor_step, size_t count, uint64_t error, uint64_t error_step, uint64_t limit, const uint8_t *pixel, uint8_t pixel_size) {
+    for (size_t i = 0; i < count; ++i) {
+        store_pixel(dst, pixel, pixel_size);
+        dst += major_step;
+        error += error_step;
+        if (error >= limit) {
+            error -= limit;
+            dst += minor_step;
+        }
+    }
+}
+
+static inline void points_kernel(const Canvas *canvas, const int32_t *xs, const int32_t *ys, size_t count, uint8_t pixel_size) {
+    for (size_t i = 0; i < count; ++i) {
+        // Negative coordinates wrap around to beyond any image
+        if ((uint32_t)xs[i] >= canvas->width || (uint32_t)ys[i] >= canvas->height) continue;
+        store_pixel(canvas->data + (size_t)ys[i] * canvas->stride + (size_t)xs[i] * pixel_size, canvas->pixel, pixel_size);
+    }
+}
+
+// Draws a run of count pixels from dst with line_kernel
+static void draw_run(const Canvas *canvas, uint8_t *dst, ptrdiff_t major_step, ptrdiff_t minor_step, size_t count, uint64_t error, uint64_t error_step, uint64_t limit) {
+    switch (canvas->pixel_size) {
+    case 1:
+        line_kernel(dst, major_step, minor_step, count, error, error_step, limit, canvas->pixel, 1);
+        break;
+    case 2:
+        line_kernel(dst, major_step, minor_step, count, error, error_step, limit, canvas->pixel, 2);
+        break;
+    case 3:
+        line_kernel(dst, major_step, minor_step, count, error, error_step, limit, canvas->pixel, 3);
+        break;
+    default:
+        line_kernel(dst, major_step, minor_step, count, error, error_step, limit, canvas->pixel, 4);
+        break;
+    }
+}
+
+//
+// Primitives
+//
+
+// Clips a range of coordinates to [0, size)
+static bool clip_range(int64_t *first, int64_t *end, uint16_t size) {
+    if (*first < 0) *first = 0;
+    if (*end > size) *end = size;
+    return *first < *end;
+}
+
+void tga_draw_span(TgaImage *tga, int32_t x, int32_t y, int32_t length, TgaColor color) {
+    assert(tga);
+
+    Canvas canvas = canvas_of(tga, &color);
+    int64_t first = x, end = (int64_t)x + (length > 0 ? length : 0);
+    if (y < 0 || y >= canvas.height || !clip_range(&first, &end, canvas.width)) return;
+    rtga_replicate_pixel(pixel_at(&canvas, first, y), canvas.pixel, (size_t)(end - first), canvas.pixel_size);
+}
+
+// Returns floor(a / b) for b > 0
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b < 0);
+}
+
+// Returns ceil(a / b) for b > 0
+static int64_t ceil_div(int64_t a, int64_t b) {
+    return -floor_div(-a, b);
+}
+
+// Narrows the steps first to last of a line to those whose minor offset,
+// floor((2 * step * minor + major) / (2 * major)), lies within low to high
+static void clip_minor(int64_t *first, int64_t *last, int64_t low, int64_t high, int64_t major, int64_t minor) {
+    if (low < 0) low = 0;
+    if (high > minor) high = minor;
+    if (low > high) {
+        *last = *first - 1;
+        return;
+    }
+    if (minor == 0) return;
+
+    if (low > 0) {
+        int64_t step = ceil_div(major * (2 * low - 1), 2 * minor);
+        if (step > *first) *first = step;
+    }
+    int64_t step = floor_div(major * (2 * high + 1) - 1, 2 * minor);
+    if (step < *last) *last = step;
+}
+
+void tga_draw_line(TgaImage *tga, int32_t x0, int32_t y0, int32_t x1, int32_t y1, TgaColor color) {
+    assert(tga);
+    assert(x0 >= -COORDINATE_LIMIT && x0 <= COORDINATE_LIMIT && y0 >= -COORDINATE_LIMIT && y0 <= COORDINATE_LIMIT);
+    assert(x1 >= -COORDINATE_LIMIT && x1 <= COORDINATE_LIMIT && y1 >= -COORDINATE_LIMIT && y1 <= COORDINATE_LIMIT);
+
+    Canvas canvas = canvas_of(tga, &color);
+    if (canvas.width == 0 || canvas.height == 0) return;
+
+    // Lines step one pixel at a time along their major axis, from 0 to
+    // major, and the minor offset of each step rounds to nearest
+    int64_t dx = (int64_t)x1 - x0, dy = (int64_t)y1 - y0;
+    int sign_x = dx < 0 ? -1 : 1, sign_y = dy < 0 ? -1 : 1;
+    dx *= sign_x;
+    dy *= sign_y;
+    bool steep = dy > dx;
+    int64_t major = steep ? dy : dx, minor = steep ? dx : dy;
+
+    // Offsets along each axis that stay inside the image
+    int64_t x_low = sign_x > 0 ? -(int64_t)x0 : (int64_t)x0 - (canvas.width - 1);
+    int64_t y_low = sign_y > 0 ? -(int64_t)y0 : (int64_t)y0 - (canvas.height - 1);
+    int64_t x_high = x_low + canvas.width - 1, y_high = y_low + canvas.height - 1;
+    int64_t first = steep ? y_low : x_low, last = steep ? y_high : x_high;
+    if (first < 0) first = 0;
+    if (last > major) last = major;
+    clip_minor(&first, &last, steep ? x_low : y_low, steep ? x_high : y_high, major, minor);
+    if (first > last) return;
+
+    // Start at the first step inside the image with the error it has there
+    uint64_t limit = 2 * (uint64_t)(major > 0 ? major : 1);
+    uint64_t numerator = 2 * (uint64_t)first * (uint64_t)minor + (uint64_t)major;
+    int64_t minor_offset = (int64_t)(numerator / limit);
+    int64_t x = x0 + sign_x * (steep ? minor_offset : first);
+    int64_t y = y0 + sign_y * (steep ? first : minor_offset);
+
+    ptrdiff_t step_x = sign_x * (ptrdiff_t)canvas.pixel_size, step_y = sign_y * (ptrdiff_t)canvas.stride;
+    draw_run(&canvas, pixel_at(&canvas, x, y), steep ? step_y : step_x, steep ? step_x : step_y, (size_t)(last - first + 1),
+             numerator % limit, 2 * (uint64_t)minor, limit);
+}
+
+void tga_draw_rect(TgaImage *tga, int32_t x, int32_t y, int32_t width, int32_t height, bool filled, TgaColor color) {
+    assert(tga);
+
+    Canvas canvas = canvas_of(tga, &color);
+    if (width <= 0 || height <= 0) return;
+    int64_t left = x, right = (int64_t)x + width, top = y, bottom = (int64_t)y + height;
+
+    if (filled) {
+        if (!clip_range(&left, &right, canvas.width) || !clip_range(&top, &bottom, canvas.height)) return;
+        TgaView view = tga_image_view(tga);
+        TgaView rect = tga_subview(&view, (uint16_t)left, (uint16_t)top, (uint16_t)(right - left), (uint16_t)(bottom - top));
+        tga_view_fill(&rect, color);
+        return;
+    }
+
+    // Rows at the top and bottom, then the columns between them
+    tga_draw_span(tga, x, y, width, color);
+    if (height > 1) tga_draw_span(tga, x, (int32_t)(bottom - 1), width, color);
+    top++;
+    bottom--;
+    if (!clip_range(&top, &bottom, canvas.height)) return;
+    if (left >= 0 && left < canvas.width) {
+        draw_run(&canvas, pixel_at(&canvas, left, top), (ptrdiff_t)canvas.stride, 0, (size_t)(bottom - top), 0, 0, 1);
+    }
+    if (width > 1 && right - 1 >= 0 && right - 1 < canvas.width) {
+        draw_run(&canvas, pixel_at(&canvas, right - 1, top), (ptrdiff_t)canvas.stride, 0, (size_t)(bottom - top), 0, 0, 1);
+    }
+}
+
+void tga_draw_points(TgaImage *tga, const int32_t *xs, const int32_t *ys, size_t count, TgaColor color) {
+    assert(tga);
+    assert((xs && ys) || count == 0);
+
+    Canvas canvas = canvas_of(tga, &color);
+    switch (canvas.pixel_size) {
+    case 1:
+        points_kernel(&canvas, xs, ys, count, 1);
+        break;
+    case 2:
+        points_kernel(&canvas, xs, ys, count, 2);
+        break;
+    case 3:
+        points_kernel(&canvas, xs, ys, count, 3);
+        break;
+    default:
+        points_kernel(&canvas, xs, ys, count, 4);
+        break;
+    }
+}
@@ -0,0 +1,280 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Data is hashed in stripes of 64 bytes, one 64-bit lane per accumulator.
+// The accumulators are scrambled after every block of stripes, so that
+// their high bits reach the low bits before sums carry them away.
+#define STRIPE_SIZE 64
+#define BLOCK_STRIPES 16
+
+#define PRIME32 0x9e3779b1u
+#define PRIME64_1 0x9e3779b185ebca87u
+#define PRIME64_2 0xc2b2ae3d27d4eb4fu
+
+// Keys mixed into every stripe, into the scrambles and into the final merge
+static const uint64_t STRIPE_KEYS[8] = {
+    0xbe4ba423396cfeb8u, 0x1cad21f72c81017cu, 0xdb979083e96dd4deu, 0x1f67b3b7a4a44072u,
+    0x78e5c0cc4ee679cbu, 0x2172ffcc7dd05a82u, 0x8e2443f7744608b8u, 0x4c263a81e69035e0u,
+};
+static const uint64_t SCRAMBLE_KEYS[8] = {
+    0xcb00c391bb52283cu, 0xa32e531b8b65d088u, 0x4ef90da297486471u, 0xd8acdea946ef1938u,
+    0x3f349ce33f76faa8u, 0x1d4f0bc7c7bbdcf9u, 0x3159b4cd4be0518au, 0x647378d9c97e9fc8u,
+};
+static const uint64_t MERGE_KEYS[8] = {
+    0xc3ebd33483acc5eau, 0xeb6313faffa081c5u, 0x49daf0b751dd0d17u, 0x9e68d429265516d3u,
+    0xfca1477d58be162bu, 0xce31d07ad1b8f88fu, 0x280416958f3acb45u, 0x7e404bbbcafbd7afu,
+};
+
+static inline uint64_t load64(const uint8_t *src) {
+#ifdef RTGA_LITTLE_ENDIAN
+    uint64_t value;
+    memcpy(&value, src, 8);
+    return value;
+#else
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) value = value << 8 | src[i];
+    return value;
+#endif
+}
+
+//
+// Kernels
+//
+
+// Every kernel gives the same accumulators, and scrambles them whenever
+// *stripes reaches BLOCK_STRIPES
+
+static void scramble_scalar(uint64_t *acc) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t value = acc[i] ^ acc[i] >> 47;
+        acc[i] = (value ^ SCRAMBLE_KEYS[i]) * PRIME32;
+    }
+}
+
+static void accumulate_scalar(uint64_t *acc, const uint8_t *data, size_t stripe_count, unsigned *stripes) {
+    for (size_t s = 0; s < stripe_count; ++s, data += STRIPE_SIZE) {
+        for (int i = 0; i < 8; ++i) {
+            uint64_t value = load64(data + i * 8);
+            uint64_t keyed = value ^ STRIPE_KEYS[i];
+            acc[i ^ 1] += value;
+            acc[i] += (keyed & 0xffffffffu) * (keyed >> 32);
+        }
+        if (++*stripes == BLOCK_STRIPES) {
+            scramble_scalar(acc);
+            *stripes = 0;
+        }
+    }
+}
+
+#ifdef RTGA_SSE2
+// Multiplies the 64-bit lanes of value by a 32-bit prime, keeping the low
+// 64 bits of each product
+static inline __m128i mul_prime_sse2(__m128i value, __m128i prime) {
+    __m128i low = _mm_mul_epu32(value, prime);
+    __m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+    return _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+}
+
+static void accumulate_sse2(uint64_t *acc, const uint8_t *data, size_t stripe_count, unsigned *stripes) {
+    const __m128i prime = _mm_set1_epi32((int)PRIME32);
+    __m128i sums[4];
+    for (int k = 0; k < 4; ++k) sums[k] = _mm_loadu_si128((const __m128i *)(acc + k * 2));
+
+    for (size_t s = 0; s < stripe_count; ++s, data += STRIPE_SIZE) {
+        for (int k = 0; k < 4; ++k) {
+            __m128i value = _mm_loadu_si128((const __m128i *)(data + k * 16));
+            __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128((const __m128i *)(STRIPE_KEYS + k * 2)));
+            __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            sums[k] = _mm_add_epi64(sums[k], _mm_add_epi64(swapped, product));
+        }
+        if (++*stripes == BLOCK_STRIPES) {
+            for (int k = 0; k < 4; ++k) {
+                __m128i value = _mm_xor_si128(sums[k], _mm_srli_epi64(sums[k], 47));
+                value = _mm_xor_si128(value, _mm_loadu_si128((const __m128i *)(SCRAMBLE_KEYS + k * 2)));
+                sums[k] = mul_prime_sse2(value, prime);
+            }
+            *stripes = 0;
+        }
+    }
+
+    for (int k = 0; k < 4; ++k) _mm_storeu_si128((__m128i *)(acc + k * 2), sums[k]);
+}
+#endif
+
+#ifdef RTGA_AVX2
+RTGA_TARGET_AVX2
+static void accumulate_avx2(uint64_t *acc, const uint8_t *data, size_t stripe_count, unsigned *stripes) {
+    const __m256i prime = _mm256_set1_epi32((int)PRIME32);
+    __m256i sums[2];
+    for (int k = 0; k < 2; ++k) sums[k] = _mm256_loadu_si256((const __m256i *)(acc + k * 4));
+
+    for (size_t s = 0; s < stripe_count; ++s, data += STRIPE_SIZE) {
+        for (int k = 0; k < 2; ++k) {
+            __m256i value = _mm256_loadu_si256((const __m256i *)(data + k * 32));
+            __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(STRIPE_KEYS + k * 4)));
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+            __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            sums[k] = _mm256_add_epi64(sums[k], _mm256_add_epi64(swapped, product));
+        }
+        if (++*stripes == BLOCK_STRIPES) {
+            for (int k = 0; k < 2; ++k) {
+                __m256i value = _mm256_xor_si256(sums[k], _mm256_srli_epi64(sums[k], 47));
+                value = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(SCRAMBLE_KEYS + k * 4)));
+                __m256i low = _mm256_mul_epu32(value, prime);
+                __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+                sums[k] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+            }
+            *stripes = 0;
+        }
+    }
+
+    for (int k = 0; k < 2; ++k) _mm256_storeu_si256((__m256i *)(acc + k * 4), sums[k]);
+}
+#endif
+
+static void accumulate(uint64_t *acc, const uint8_t *data, size_t stripe_count, unsigned *stripes) {
+#ifdef RTGA_AVX2
+    if (rtga_has_avx2()) {
+        accumulate_avx2(acc, data, stripe_count, stripes);
+        return;
+    }
+#endif
+#ifdef RTGA_SSE2
+    accumulate_sse2(acc, data, stripe_count, stripes);
+#else
+    accumulate_scalar(acc, data, stripe_count, stripes);
+#endif
+}
+
+//
+// Streaming
+//
+
+void rtga_hash_init(RtgaHash *hash, uint64_t seed) {
+    assert(hash);
+
+    for (int i = 0; i < 8; ++i) {
+        hash->acc[i] = STRIPE_KEYS[7 - i] + (i % 2 ? seed : 0u - seed);
+    }
+    hash->buffered = 0;
+    hash->stripes = 0;
+    hash->length = 0;
+}
+
+void rtga_hash_update(RtgaHash *hash, const void *data, size_t size) {
+    assert(hash);
+    assert(data || size == 0);
+
+    const uint8_t *bytes = data;
+    if (size == 0) return;
+    hash->length += size;
+
+    // Finish the stripe started by the last update
+    if (hash->buffered > 0) {
+        size_t count = STRIPE_SIZE - hash->buffered < size ? STRIPE_SIZE - hash->buffered : size;
+        memcpy(hash->buffer + hash->buffered, bytes, count);
+        hash->buffered += count;
+        bytes += count;
+        size -= count;
+        if (hash->buffered < STRIPE_SIZE) return;
+        accumulate(hash->acc, hash->buffer, 1, &hash->stripes);
+        hash->buffered = 0;
+    }
+
+    // Whole stripes straight out of the data, and the rest for later
+    size_t stripe_count = size / STRIPE_SIZE;
+    accumulate(hash->acc, bytes, stripe_count, &hash->stripes);
+    hash->buffered = size - stripe_count * STRIPE_SIZE;
+    memcpy(hash->buffer, bytes + stripe_count * STRIPE_SIZE, hash->buffered);
+}
+
+// Returns the high 64 bits of a 128-bit product folded onto the low 64 bits
+static uint64_t multiply_fold(uint64_t a, uint64_t b) {
+    uint64_t a_low = a & 0xffffffffu, a_high = a >> 32;
+    uint64_t b_low = b & 0xffffffffu, b_high = b >> 32;
+    uint64_t low_low = a_low * b_low;
+    uint64_t high_low = a_high * b_low;
+    uint64_t low_high = a_low * b_high;
+    uint64_t high_high = a_high * b_high;
+
+    uint64_t cross = (low_low >> 32) + (high_low & 0xffffffffu) + low_high;
+    uint64_t low = (cross << 32) | (low_low & 0xffffffffu);
+    uint64_t high = high_high + (high_low >> 32) + (cross >> 32);
+    return low ^ high;
+}
+
+uint64_t rtga_hash_final(const RtgaHash *hash) {
+    assert(hash);
+
+    uint64_t acc[8];
+    unsigned stripes = hash->stripes;
+    memcpy(acc, hash->acc, sizeof(acc));
+
+    // The last partial stripe is padded with zeros, which the length tells
+    // apart from data that ends in zeros
+    if (hash->buffered > 0) {
+        uint8_t last[STRIPE_SIZE] = {0};
+        memcpy(last, hash->buffer, hash->buffered);
+        accumulate_scalar(acc, last, 1, &stripes);
+    }
+
+    uint64_t result = hash->length * PRIME64_1;
+    for (int i = 0; i < 8; i += 2) {
+        result += multiply_fold(acc[i] ^ MERGE_KEYS[i], acc[i + 1] ^ MERGE_KEYS[i + 1]);
+    }
+
+    // Let every bit of the result depend on every other
+    result ^= result >> 37;
+    result *= PRIME64_2;
+    result ^= result >> 32;
+    return result;
+}
+
+//
+// Hashes
+//
+
+uint64_t tga_hash(const void *data, size_t size) {
+    assert(data || size == 0);
+
+    RtgaHash hash;
+    rtga_hash_init(&hash, 0);
+    rtga_hash_update(&hash, data, size);
+    return rtga_hash_final(&hash);
+}
+
+int tga_content_hash(const TgaImage *tga, uint64_t *hash) {
+    assert(tga);
+    assert(hash);
+
+    RtgaPixelRows rows;
+    int result = rtga_pixel_rows_init(&rows, tga);
+    if (result != TGA_SUCCESS) return result;
+
+    const TgaHeader *header = &tga->header;
+    uint8_t *scratch = NULL;
+    size_t scratch_size = rtga_pixel_rows_scratch_size(&rows);
+    if (scratch_size > 0) {
+        scratch = rtga_alloc(&tga->allocator, scratch_size);
+        if (!scratch) return TGA_ALLOCATION_ERROR;
+    }
+
+    // Pixels are hashed as 32-bit pixels from the top left corner, and rows
+    // that already hold them in order are hashed at once
+    RtgaHash state;
+    rtga_hash_init(&state, (uint64_t)header->width << 16 | header->height);
+    if (rows.in_place && !rows.orientation.flip_rows) {
+        rtga_hash_update(&state, tga->image_data, tga_image_size(header));
+    } else {
+        for (uint16_t y = 0; y < header->height; ++y) {
+            rtga_hash_update(&state, rtga_pixel_row(&rows, y, scratch), (size_t)header->width * 4);
+        }
+    }
+
+    rtga_free(&tga->allocator, scratch);
+    *hash = rtga_hash_final(&state);
+    return TGA_SUCCESS;
+}
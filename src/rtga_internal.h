@@ -0,0 +1,298 @@
+#ifndef RTGA_INTERNAL_H
+#define RTGA_INTERNAL_H
+
+#include "rtga/rtga.h"
+
+#include <string.h>
+
+// SIMD support
+//
+// Kernels use SSE2 when the compiler targets it and fall back to portable
+// scalar code otherwise. Defining RTGA_NO_SIMD forces the scalar paths.
+#if !defined(RTGA_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RTGA_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled with a target attribute and only used after
+// checking the CPU at run time
+#if !defined(RTGA_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RTGA_AVX2 1
+#include <immintrin.h>
+#define RTGA_TARGET_AVX2 __attribute__((target("avx2")))
+
+static inline bool rtga_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// Whole pixels can be copied to and from integers on little-endian hosts
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_X64) || defined(_M_IX86)
+#define RTGA_LITTLE_ENDIAN 1
+#endif
+
+// Returns the index of the lowest set bit in value (value must not be 0)
+static inline unsigned rtga_ctz(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(value);
+#else
+    unsigned index = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+// Returns the pixel_size byte little-endian pixel at src as an integer
+static inline uint32_t rtga_load_pixel(const uint8_t *src, uint8_t pixel_size) {
+    switch (pixel_size) {
+    case 1:
+        return src[0];
+    case 2:
+        return (uint32_t)src[0] | (uint32_t)src[1] << 8;
+    case 3:
+        return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16;
+    default:
+        return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+    }
+}
+
+// Stores value as a pixel_size byte little-endian pixel at dst
+static inline void rtga_store_pixel(uint8_t *dst, uint32_t value, uint8_t pixel_size) {
+    dst[0] = (uint8_t)value;
+    if (pixel_size > 1) dst[1] = (uint8_t)(value >> 8);
+    if (pixel_size > 2) dst[2] = (uint8_t)(value >> 16);
+    if (pixel_size > 3) dst[3] = (uint8_t)(value >> 24);
+}
+
+// Allocates, reallocates and frees memory with allocator, which may be NULL
+// for the general heap
+void *rtga_alloc(const TgaAllocator *allocator, size_t size);
+void *rtga_realloc(const TgaAllocator *allocator, void *ptr, size_t size);
+void rtga_free(const TgaAllocator *allocator, void *ptr);
+
+// Opens a reader or writer whose buffers come from allocator
+int rtga_reader_open(TgaReader *reader, const char *filename, const TgaAllocator *allocator);
+int rtga_reader_open_io(TgaReader *reader, const TgaIo *io, const TgaAllocator *allocator);
+int rtga_writer_open(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const char *filename, const TgaAllocator *allocator);
+int rtga_writer_open_io(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const TgaIo *io, const TgaAllocator *allocator);
+
+// Converts the TGA_HEADER_SIZE bytes at the start of a file into header
+void rtga_parse_header(TgaHeader *header, const uint8_t *bytes);
+
+// Converts header into the TGA_HEADER_SIZE bytes at the start of a file
+void rtga_serialize_header(uint8_t *bytes, const TgaHeader *header);
+
+// Returns the size of the color map in bytes, or 0 if there is none
+size_t rtga_color_map_size(const TgaHeader *header);
+
+// Checks the fields of a header that the rest of the file is read by: the
+// image type, the pixel depths and whether a color mapped image has a color
+// map. Sizes are checked against the data by each reader, since only it
+// knows how much data there is.
+int rtga_check_header(const TgaHeader *header);
+
+// Returns the fewest bytes of image data that can hold the pixels of header,
+// which lets readers that know the size of their data turn down a header
+// before allocating the image it asks for
+uint64_t rtga_min_data_size(const TgaHeader *header);
+
+// TGA 2.0 extension area fields that rtga uses
+typedef struct {
+    uint32_t postage_stamp_offset;
+    uint32_t scan_line_offset;
+    uint8_t attributes_type;
+} RtgaExtension;
+
+// Converts extension into the TGA_EXTENSION_SIZE bytes of an extension area.
+// Every field that rtga does not use is left empty.
+void rtga_serialize_extension(uint8_t *bytes, const RtgaExtension *extension);
+
+// Converts the TGA_EXTENSION_SIZE bytes of an extension area into extension
+void rtga_parse_extension(RtgaExtension *extension, const uint8_t *bytes);
+
+// Converts an extension area offset into the TGA_FOOTER_SIZE bytes at the end of a file
+void rtga_serialize_footer(uint8_t *bytes, uint32_t extension_offset);
+
+// Reads the extension area offset out of a footer. Returns false if bytes
+// are not a TGA 2.0 footer.
+bool rtga_parse_footer(const uint8_t *bytes, uint32_t *extension_offset);
+
+// Returns the size of the postage stamp written for tga with sides of at
+// most max_size pixels, and stores its width and height, or returns 0 if
+// none is written: max_size is 0, the image is empty or its pixels are
+// still run-length encoded.
+size_t rtga_postage_stamp_size(const TgaImage *tga, uint8_t max_size, uint8_t *width, uint8_t *height);
+
+// Allocates and fills the postage stamp of tga, laid out as TGA 2.0 stores
+// it: a byte each for width and height, then uncompressed pixels in the
+// depth and orientation of the image. Color mapped pixels are sampled, since
+// indices can not be averaged, and other pixels are box filtered.
+int rtga_make_postage_stamp(const TgaImage *tga, uint8_t max_size, unsigned thread_count, uint8_t **stamp, size_t *size);
+
+// Maps a whole file into memory, private and copy-on-write, so pixels can
+// be changed in memory without touching the file or costing memory until
+// they are. Reads it into one buffer from allocator where mmap is not
+// available.
+int rtga_map_file_data(const char *filename, const TgaAllocator *allocator, void **mapping, size_t *size);
+
+// Releases memory from rtga_map_file_data
+void rtga_unmap_file_data(void *mapping, size_t size, const TgaAllocator *allocator);
+
+//
+// Threads
+//
+
+// Most threads a single parallel loop uses
+#define RTGA_MAX_THREADS 64
+
+// Returns the number of threads to use, where thread_count 0 means one per
+// CPU, capped at RTGA_MAX_THREADS
+unsigned rtga_thread_count(unsigned thread_count);
+
+// Calls task for every index below count on up to thread_count threads,
+// including the calling thread, and returns once every call is done. worker
+// identifies the thread a task runs on, from 0 to thread_count - 1, so tasks
+// can reuse per-thread state.
+void rtga_parallel_for(size_t count, unsigned thread_count, void (*task)(void *context, unsigned worker, size_t index), void *context);
+
+//
+// Band parallel run-length encoding
+//
+
+// Encodes the image data of tga in bands of scanlines on thread_count
+// threads and writes the bands in order to the writer. If row_offsets is
+// not NULL, the offset of every scanline from the start of the image data is
+// stored in it. The total size of the image data is stored in data_size.
+int rtga_write_rle_bands(TgaWriter *writer, const uint8_t *image_data, unsigned thread_count, uint64_t *row_offsets, uint64_t *data_size);
+
+// Reads the run-length encoded file filename, which reader has just been
+// opened on, by mapping it and decoding bands of scanlines on thread_count
+// threads if it has a scan line table, storing them from the top left corner
+// if top_left. Otherwise handled is set to false and the reader is left at
+// the start of the image data for the serial reader.
+int rtga_read_rle_bands(TgaImage *tga, TgaReader *reader, const char *filename, unsigned thread_count, bool top_left, bool *handled);
+
+// Decodes size bytes of run-length encoded file data with a scan line table
+// in bands on thread_count threads. handled is set to false, and nothing is
+// decoded, if the file can not be read this way.
+int rtga_decode_rle_bands(TgaImage *tga, const uint8_t *file, size_t size, unsigned thread_count, const TgaAllocator *allocator, bool top_left, bool *handled);
+
+// Builds a color map of at most 256 entries for pixel_count pixels of
+// pixel_depth and stores the index of every pixel in indices. color_map_data
+// must hold 256 entries, which are 24-bit for grayscale pixels and
+// pixel_depth otherwise. Scratch memory comes from allocator.
+int rtga_build_color_map(const uint8_t *src, size_t pixel_count, uint8_t pixel_depth, uint8_t *indices, uint8_t *color_map_data, uint16_t *color_map_length, const TgaAllocator *allocator);
+
+// Converts pixel_count pixels between pixel depths. src_alpha tells whether
+// the attribute bits of 16-bit and 32-bit source pixels hold alpha; without
+// it, converted pixels are opaque.
+void rtga_convert_pixels(uint8_t *dst, uint8_t dst_depth, const uint8_t *src, uint8_t src_depth, size_t pixel_count, bool src_alpha);
+
+// Replaces the image data and color map of tga, freeing the old buffers
+// that are not kept. A mapped image keeps a copy of its image id but no
+// longer uses the mapping, so neither buffer may point into it.
+int rtga_replace_buffers(TgaImage *tga, uint8_t *image_data, uint8_t *color_map_data);
+
+// Returns a copy of size bytes at data from the allocator of tga, or data
+// itself when tga owns its buffers
+uint8_t *rtga_owned_copy(TgaImage *tga, uint8_t *data, size_t size);
+
+// Writes count copies of the pixel_size byte pixel into dst
+void rtga_replicate_pixel(uint8_t *dst, const uint8_t *pixel, size_t count, uint8_t pixel_size);
+
+//
+// Orientation
+//
+
+// Flips that store the scanlines of a file from the top left corner. Scanline
+// y of the file goes to row height - 1 - y if flip_rows, with its pixels
+// reversed if flip_columns.
+typedef struct {
+    bool flip_rows;
+    bool flip_columns;
+} RtgaOrientation;
+
+// Returns the flips that a file with header needs to be read from the top
+// left corner, which are none unless top_left
+RtgaOrientation rtga_read_orientation(const TgaHeader *header, bool top_left);
+
+// Returns descriptor with its origin moved to the top left corner
+uint8_t rtga_top_left_descriptor(uint8_t descriptor);
+
+// Reverses the order of count pixels of pixel_size bytes
+void rtga_reverse_pixels(uint8_t *row, size_t count, uint8_t pixel_size);
+
+//
+// Normalized pixels
+//
+
+// Rows of an image read as 32-bit pixels from the top left corner, with
+// opaque alpha where the image has no alpha bits and color mapped pixels
+// looked up, so that images of any depth and orientation compare
+typedef struct {
+    const TgaImage *tga;
+    uint8_t depth;
+    bool alpha;
+    bool color_mapped;
+    RtgaOrientation orientation;
+    size_t row_size;
+    // Whether rows already hold such pixels and are used where they are
+    bool in_place;
+} RtgaPixelRows;
+
+// Returns why the pixels of tga can not be read as 32-bit rows, if they can not
+int rtga_pixel_rows_init(RtgaPixelRows *rows, const TgaImage *tga);
+
+// Returns the bytes of scratch memory that rtga_pixel_row needs
+size_t rtga_pixel_rows_scratch_size(const RtgaPixelRows *rows);
+
+// Returns row y counted from the top, converted into scratch unless the
+// image already holds it as 32-bit pixels
+const uint8_t *rtga_pixel_row(const RtgaPixelRows *rows, uint16_t y, uint8_t *scratch);
+
+//
+// Hashing
+//
+
+// Streaming state of tga_hash, which gives the same hash however the data
+// is split between updates
+typedef struct {
+    uint64_t acc[8];
+    // Bytes of a stripe that is not complete yet
+    uint8_t buffer[64];
+    size_t buffered;
+    // Stripes since the accumulators were last scrambled
+    unsigned stripes;
+    uint64_t length;
+} RtgaHash;
+
+void rtga_hash_init(RtgaHash *hash, uint64_t seed);
+void rtga_hash_update(RtgaHash *hash, const void *data, size_t size);
+uint64_t rtga_hash_final(const RtgaHash *hash);
+
+//
+// Instrumentation
+//
+
+// RTGA_STATS_BEGIN(start) notes the time a phase starts in a new variable
+// start, and RTGA_STATS_END(start, phase, bytes) counts the call. Both
+// compile to nothing unless RTGA_STATS is defined.
+#ifdef RTGA_STATS
+// Returns a monotonic time in nanoseconds
+uint64_t rtga_stats_now(void);
+
+// Counts a call of phase that began at start and handled bytes bytes for
+// the calling thread, and records a trace event while tracing
+void rtga_stats_record(TgaPhase phase, uint64_t start, uint64_t bytes);
+
+#define RTGA_STATS_BEGIN(start) uint64_t start = rtga_stats_now()
+#define RTGA_STATS_END(start, phase, bytes) rtga_stats_record((phase), (start), (bytes))
+#else
+#define RTGA_STATS_BEGIN(start) ((void)0)
+#define RTGA_STATS_END(start, phase, bytes) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,711 @@
+// syscall, which io_uring is reached through, is a GNU extension
+#define _GNU_SOURCE
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_PTHREADS 1
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// io_uring needs Linux headers that know about it, and is only used when the
+// kernel turns out to support every operation at run time
+#if defined(RTGA_PTHREADS) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define RTGA_IO_URING 1
+#endif
+#endif
+#endif
+
+// Files in flight when the options leave it at 0, and the most allowed
+#define DEFAULT_QUEUE_DEPTH 64
+#define MAX_QUEUE_DEPTH 4096
+
+// Largest read submitted at once, since the length of a read is 32 bits
+#define MAX_READ_SIZE (1u << 30)
+
+// File from the time it is submitted until its result is taken
+typedef struct Request {
+    struct Request *next;
+    TgaLoadResult load;
+    // Whole file, once it has been read
+    uint8_t *data;
+    size_t size;
+#ifdef RTGA_IO_URING
+    // Progress through the ring: the open file, operations still to
+    // complete before the file can be read, and bytes read so far
+    int fd;
+    unsigned waiting;
+    bool sized;
+    size_t bytes_read;
+    struct statx statx;
+#endif
+#ifdef RTGA_STATS
+    uint64_t io_start;
+#endif
+    char filename[];
+} Request;
+
+// First in, first out list of requests
+typedef struct {
+    Request *head;
+    Request *tail;
+} Queue;
+
+static void push(Queue *queue, Request *request) {
+    request->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = request;
+    } else {
+        queue->head = request;
+    }
+    queue->tail = request;
+}
+
+static Request *pop(Queue *queue) {
+    Request *request = queue->head;
+    if (request) {
+        queue->head = request->next;
+        if (!queue->head) queue->tail = NULL;
+    }
+    return request;
+}
+
+// Moves every request of from to the end of to
+static void append(Queue *to, Queue *from) {
+    if (!from->head) return;
+    if (to->tail) {
+        to->tail->next = from->head;
+    } else {
+        to->head = from->head;
+    }
+    to->tail = from->tail;
+    from->head = NULL;
+    from->tail = NULL;
+}
+
+#ifdef RTGA_IO_URING
+// Submission and completion queues shared with the kernel, which only the
+// I/O thread touches
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // Operations written but not yet submitted, and written but not yet
+    // completed
+    unsigned queued;
+    unsigned ops;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Ring;
+
+// Operation of a completion, kept in the low bits of its user data next to
+// the request it belongs to
+enum { OP_OPEN, OP_STATX, OP_READ, OP_CLOSE, OP_MASK = 3 };
+#endif
+
+struct TgaLoader {
+    TgaLoaderOptions options;
+    TgaAllocator allocator;
+    unsigned queue_depth;
+    // Files submitted but not yet done, and files done but not yet taken
+    size_t outstanding;
+    Queue completed;
+#ifdef RTGA_PTHREADS
+    pthread_mutex_t lock;
+    // Signaled when there is work for the workers, when a result is done,
+    // and when the I/O thread can start more files
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_cond_t io_wake;
+    // Files waiting to be read, and files read or failed waiting to be
+    // decoded
+    Queue pending;
+    Queue ready;
+    bool stopping;
+    pthread_t threads[RTGA_MAX_THREADS];
+    unsigned thread_count;
+#endif
+#ifdef RTGA_IO_URING
+    bool uring;
+    Ring ring;
+    pthread_t io_thread;
+    // Files that hold a place in the queue depth, from the start of reading
+    // until they are decoded
+    unsigned loading;
+#endif
+};
+
+#ifdef RTGA_PTHREADS
+#define LOCK(loader) pthread_mutex_lock(&(loader)->lock)
+#define UNLOCK(loader) pthread_mutex_unlock(&(loader)->lock)
+#else
+#define LOCK(loader) ((void)0)
+#define UNLOCK(loader) ((void)0)
+#endif
+
+//
+// Loading
+//
+
+// Decodes the data of a read file into its image, then frees the data
+static void decode(TgaLoader *loader, Request *request) {
+    if (request->load.result == TGA_SUCCESS) {
+        TgaReadOptions options = loader->options.read;
+        options.thread_count = 1;
+        request->load.result = tga_decode_memory(&request->load.image, request->data, request->size, &options);
+    }
+    rtga_free(&loader->allocator, request->data);
+    request->data = NULL;
+    if (request->load.result != TGA_SUCCESS) memset(&request->load.image, 0, sizeof(TgaImage));
+}
+
+// Hands a loaded file to the callback, or queues it for tga_loader_poll
+static void deliver(TgaLoader *loader, Request *request) {
+    if (loader->options.callback) {
+        loader->options.callback(loader->options.context, &request->load);
+        rtga_free(&loader->allocator, request);
+        request = NULL;
+    }
+
+    LOCK(loader);
+    if (request) push(&loader->completed, request);
+    loader->outstanding--;
+#ifdef RTGA_PTHREADS
+    pthread_cond_broadcast(&loader->done);
+#endif
+    UNLOCK(loader);
+}
+
+#ifdef RTGA_PTHREADS
+// Reads a whole file with blocking calls
+static int read_blocking(TgaLoader *loader, Request *request) {
+    RTGA_STATS_BEGIN(open_start);
+    int fd = open(request->filename, O_RDONLY);
+    RTGA_STATS_END(open_start, TGA_PHASE_OPEN, 0);
+    if (fd < 0) return TGA_FILE_OPEN_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TGA_HEADER_SIZE || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return TGA_FILE_READ_ERROR;
+    }
+    size_t size = (size_t)st.st_size;
+    request->data = rtga_alloc(&loader->allocator, size);
+    if (!request->data) {
+        close(fd);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    RTGA_STATS_BEGIN(read_start);
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        ssize_t count = pread(fd, request->data + bytes_read, size - bytes_read, (off_t)bytes_read);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;
+        bytes_read += (size_t)count;
+    }
+    RTGA_STATS_END(read_start, TGA_PHASE_IO, bytes_read);
+    close(fd);
+    if (bytes_read != size) return TGA_FILE_READ_ERROR;
+
+    request->size = size;
+    return TGA_SUCCESS;
+}
+
+// Decodes files as their data arrives, and reads them first when there is
+// no I/O thread
+static void *worker_main(void *argument) {
+    TgaLoader *loader = argument;
+
+    LOCK(loader);
+    for (;;) {
+        Request *request = pop(&loader->ready);
+        bool blocking = false;
+#ifdef RTGA_IO_URING
+        if (!request && !loader->uring) {
+#else
+        if (!request) {
+#endif
+            request = pop(&loader->pending);
+            blocking = request != NULL;
+        }
+        if (!request) {
+            if (loader->stopping) break;
+            pthread_cond_wait(&loader->work, &loader->lock);
+            continue;
+        }
+        UNLOCK(loader);
+
+        if (blocking) request->load.result = read_blocking(loader, request);
+        decode(loader, request);
+#ifdef RTGA_IO_URING
+        // Decoded files give their place in the queue depth to the next
+        if (!blocking) {
+            LOCK(loader);
+            loader->loading--;
+            pthread_cond_signal(&loader->io_wake);
+            UNLOCK(loader);
+        }
+#endif
+        deliver(loader, request);
+
+        LOCK(loader);
+    }
+    UNLOCK(loader);
+
+    return NULL;
+}
+#endif
+
+#ifdef RTGA_IO_URING
+//
+// io_uring
+//
+
+static int ring_setup(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(Ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return -1;
+
+    // Opening, sizing and reading files arrived together in Linux 5.6, and
+    // the probe that tells which operations a kernel supports with them
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    bool supported = probe && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    static const uint8_t OPS[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE};
+    for (size_t i = 0; supported && i < sizeof(OPS); ++i) {
+        supported = OPS[i] <= probe->last_op && (probe->ops[OPS[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = MAP_FAILED;
+    ring->cq_ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    if (supported) {
+        // Newer kernels map both rings at once
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+        if (single) {
+            ring->cq_ring = ring->sq_ring;
+            ring->cq_ring_size = 0;
+        } else if (ring->sq_ring != MAP_FAILED) {
+            ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        }
+        if (ring->cq_ring != MAP_FAILED) {
+            ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+        }
+    }
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != MAP_FAILED && ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Every slot of the submission queue always names its own entry
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i) array[i] = i;
+    return 0;
+}
+
+static void ring_free(Ring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Returns a cleared entry at the tail of the submission queue. There is
+// always one, since no more operations are started than the queue holds.
+static struct io_uring_sqe *ring_sqe(Ring *ring, uint8_t opcode, Request *request, unsigned op) {
+    unsigned tail = *ring->sq_tail;
+    assert(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) < ring->entries);
+
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = (uint64_t)(uintptr_t)request | op;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    ring->ops++;
+    return sqe;
+}
+
+// Submits every queued operation and waits for at least one to complete
+static void ring_enter(Ring *ring) {
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted >= 0) {
+            ring->queued -= (unsigned)submitted;
+            return;
+        }
+        // Interrupted waits and a kernel short of memory are tried again
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return;
+    }
+}
+
+// Opens and sizes a file at once
+static void start_file(Ring *ring, Request *request) {
+    request->fd = -1;
+    request->waiting = 2;
+    request->sized = false;
+    request->bytes_read = 0;
+#ifdef RTGA_STATS
+    request->io_start = rtga_stats_now();
+#endif
+
+    struct io_uring_sqe *sqe = ring_sqe(ring, IORING_OP_OPENAT, request, OP_OPEN);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)request->filename;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    sqe = ring_sqe(ring, IORING_OP_STATX, request, OP_STATX);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)request->filename;
+    sqe->len = STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&request->statx;
+}
+
+static void read_next(Ring *ring, Request *request) {
+    size_t remaining = request->size - request->bytes_read;
+    struct io_uring_sqe *sqe = ring_sqe(ring, IORING_OP_READ, request, OP_READ);
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(request->data + request->bytes_read);
+    sqe->len = remaining < MAX_READ_SIZE ? (unsigned)remaining : MAX_READ_SIZE;
+    sqe->off = request->bytes_read;
+}
+
+// Closes the file of a request, which is done with the ring, and moves it
+// to the files ready to decode
+static void finish_file(TgaLoader *loader, Request *request, int result, Queue *ready) {
+    if (request->fd >= 0) {
+        // Nothing waits for the file to close
+        struct io_uring_sqe *sqe = ring_sqe(&loader->ring, IORING_OP_CLOSE, NULL, OP_CLOSE);
+        sqe->fd = request->fd;
+        request->fd = -1;
+    }
+    if (result != TGA_SUCCESS) {
+        rtga_free(&loader->allocator, request->data);
+        request->data = NULL;
+    }
+    request->load.result = result;
+    push(ready, request);
+}
+
+// Moves a request along after one of its operations completed with res
+static void complete(TgaLoader *loader, Request *request, unsigned op, int res, Queue *ready) {
+    Ring *ring = &loader->ring;
+
+    if (op == OP_OPEN || op == OP_STATX) {
+        if (op == OP_OPEN && res >= 0) request->fd = res;
+        if (op == OP_STATX && res >= 0) request->sized = true;
+        if (op == OP_OPEN && res < 0) request->load.result = TGA_FILE_OPEN_ERROR;
+        if (--request->waiting > 0) return;
+
+#ifdef RTGA_STATS
+        rtga_stats_record(TGA_PHASE_OPEN, request->io_start, 0);
+        request->io_start = rtga_stats_now();
+#endif
+        if (request->load.result != TGA_SUCCESS) {
+            finish_file(loader, request, request->load.result, ready);
+        } else if (!request->sized || request->statx.stx_size < TGA_HEADER_SIZE || request->statx.stx_size > SIZE_MAX) {
+            finish_file(loader, request, TGA_FILE_READ_ERROR, ready);
+        } else {
+            request->size = (size_t)request->statx.stx_size;
+            request->data = rtga_alloc(&loader->allocator, request->size);
+            if (request->data) {
+                read_next(ring, request);
+            } else {
+                finish_file(loader, request, TGA_ALLOCATION_ERROR, ready);
+            }
+        }
+    } else if (op == OP_READ) {
+        if (res == -EINTR || res == -EAGAIN) {
+            read_next(ring, request);
+            return;
+        }
+        // A file that ends early has shrunk since it was sized
+        if (res <= 0) {
+            finish_file(loader, request, TGA_FILE_READ_ERROR, ready);
+            return;
+        }
+        request->bytes_read += (size_t)res;
+        if (request->bytes_read < request->size) {
+            read_next(ring, request);
+        } else {
+#ifdef RTGA_STATS
+            rtga_stats_record(TGA_PHASE_IO, request->io_start, request->size);
+#endif
+            finish_file(loader, request, TGA_SUCCESS, ready);
+        }
+    }
+}
+
+// Takes every completion off the completion queue
+static void reap(TgaLoader *loader, Queue *ready) {
+    Ring *ring = &loader->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        ++head;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        ring->ops--;
+
+        Request *request = (Request *)(uintptr_t)(user_data & ~(uint64_t)OP_MASK);
+        if (request) complete(loader, request, (unsigned)(user_data & OP_MASK), res, ready);
+
+        // Completions may have queued more while the loop ran
+        if (head == tail) tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Starts pending files while the queue depth allows, submits their
+// operations in one call and passes read files to the workers
+static void *io_main(void *argument) {
+    TgaLoader *loader = argument;
+    Ring *ring = &loader->ring;
+
+    LOCK(loader);
+    for (;;) {
+        // Every file has at most two operations in flight at once
+        while (loader->loading < loader->queue_depth && ring->ops + 2 <= ring->entries && loader->pending.head) {
+            loader->loading++;
+            start_file(ring, pop(&loader->pending));
+        }
+        if (ring->ops == 0) {
+            if (loader->stopping) break;
+            pthread_cond_wait(&loader->io_wake, &loader->lock);
+            continue;
+        }
+        UNLOCK(loader);
+
+        Queue ready = {NULL, NULL};
+        ring_enter(ring);
+        reap(loader, &ready);
+
+        LOCK(loader);
+        if (ready.head) {
+            append(&loader->ready, &ready);
+            pthread_cond_broadcast(&loader->work);
+        }
+    }
+    UNLOCK(loader);
+
+    return NULL;
+}
+#endif
+
+//
+// Loader
+//
+
+int tga_loader_create(const TgaLoaderOptions *options, TgaLoader **loader) {
+    assert(loader);
+
+    const TgaAllocator *allocator = options ? options->read.allocator : NULL;
+    TgaLoader *created = rtga_alloc(allocator, sizeof(TgaLoader));
+    *loader = created;
+    if (!created) return TGA_ALLOCATION_ERROR;
+
+    memset(created, 0, sizeof(TgaLoader));
+    if (options) created->options = *options;
+    if (allocator) created->allocator = *allocator;
+    created->options.read.allocator = &created->allocator;
+    unsigned queue_depth = created->options.queue_depth;
+    created->queue_depth = queue_depth == 0 ? DEFAULT_QUEUE_DEPTH : queue_depth < MAX_QUEUE_DEPTH ? queue_depth : MAX_QUEUE_DEPTH;
+
+#ifdef RTGA_PTHREADS
+    pthread_mutex_init(&created->lock, NULL);
+    pthread_cond_init(&created->work, NULL);
+    pthread_cond_init(&created->done, NULL);
+    pthread_cond_init(&created->io_wake, NULL);
+
+    bool blocking = true;
+#ifdef RTGA_IO_URING
+    // Room for two operations of every file in flight
+    if (!created->options.blocking_io && ring_setup(&created->ring, created->queue_depth * 2) == 0) {
+        created->uring = pthread_create(&created->io_thread, NULL, io_main, created) == 0;
+        if (!created->uring) ring_free(&created->ring);
+    }
+    blocking = !created->uring;
+#endif
+
+    // Workers that wait on reads as well as decoding are doubled, like
+    // threads that probe files
+    unsigned thread_count = created->options.thread_count;
+    if (thread_count == 0) thread_count = rtga_thread_count(0) * (blocking ? 2 : 1);
+    thread_count = rtga_thread_count(thread_count);
+    while (created->thread_count < thread_count &&
+           pthread_create(&created->threads[created->thread_count], NULL, worker_main, created) == 0) {
+        ++created->thread_count;
+    }
+    if (created->thread_count == 0) {
+        tga_loader_destroy(created);
+        *loader = NULL;
+        return TGA_ALLOCATION_ERROR;
+    }
+#endif
+
+    return TGA_SUCCESS;
+}
+
+int tga_loader_submit(TgaLoader *loader, const char *filename, void *user_data) {
+    assert(loader);
+    assert(filename);
+
+    size_t length = strlen(filename);
+    Request *request = rtga_alloc(&loader->allocator, sizeof(Request) + length + 1);
+    if (!request) return TGA_ALLOCATION_ERROR;
+    memset(request, 0, sizeof(Request));
+    memcpy(request->filename, filename, length + 1);
+    request->load.user_data = user_data;
+#ifdef RTGA_IO_URING
+    // The operation of a completion is stored in the low bits of its address
+    assert(((uintptr_t)request & OP_MASK) == 0);
+#endif
+
+    LOCK(loader);
+    loader->outstanding++;
+#ifdef RTGA_PTHREADS
+    push(&loader->pending, request);
+#ifdef RTGA_IO_URING
+    if (loader->uring) {
+        pthread_cond_signal(&loader->io_wake);
+    } else
+#endif
+    {
+        pthread_cond_signal(&loader->work);
+    }
+    UNLOCK(loader);
+#else
+    UNLOCK(loader);
+
+    // Without threads the file is loaded before submitting returns
+    request->load.result = tga_read_file_ex(&request->load.image, filename, &loader->options.read);
+    if (request->load.result != TGA_SUCCESS) memset(&request->load.image, 0, sizeof(TgaImage));
+    deliver(loader, request);
+#endif
+
+    return TGA_SUCCESS;
+}
+
+bool tga_loader_poll(TgaLoader *loader, bool wait, TgaLoadResult *result) {
+    assert(loader);
+    assert(result);
+
+    LOCK(loader);
+#ifdef RTGA_PTHREADS
+    while (wait && !loader->completed.head && loader->outstanding > 0) {
+        pthread_cond_wait(&loader->done, &loader->lock);
+    }
+#else
+    (void)wait;
+#endif
+    Request *request = pop(&loader->completed);
+    UNLOCK(loader);
+    if (!request) return false;
+
+    *result = request->load;
+    rtga_free(&loader->allocator, request);
+    return true;
+}
+
+void tga_loader_wait(TgaLoader *loader) {
+    assert(loader);
+
+#ifdef RTGA_PTHREADS
+    LOCK(loader);
+    while (loader->outstanding > 0) pthread_cond_wait(&loader->done, &loader->lock);
+    UNLOCK(loader);
+#endif
+}
+
+bool tga_loader_uses_io_uring(const TgaLoader *loader) {
+    assert(loader);
+
+#ifdef RTGA_IO_URING
+    return loader->uring;
+#else
+    return false;
+#endif
+}
+
+void tga_loader_destroy(TgaLoader *loader) {
+    if (!loader) return;
+
+    tga_loader_wait(loader);
+#ifdef RTGA_PTHREADS
+    LOCK(loader);
+    loader->stopping = true;
+    pthread_cond_broadcast(&loader->work);
+    pthread_cond_broadcast(&loader->io_wake);
+    UNLOCK(loader);
+    for (unsigned i = 0; i < loader->thread_count; ++i) {
+        pthread_join(loader->threads[i], NULL);
+    }
+#ifdef RTGA_IO_URING
+    if (loader->uring) {
+        pthread_join(loader->io_thread, NULL);
+        ring_free(&loader->ring);
+    }
+#endif
+    pthread_cond_destroy(&loader->io_wake);
+    pthread_cond_destroy(&loader->done);
+    pthread_cond_destroy(&loader->work);
+    pthread_mutex_destroy(&loader->lock);
+#endif
+
+    Request *request;
+    while ((request = pop(&loader->completed))) {
+        tga_free(&request->load.image);
+        rtga_free(&loader->allocator, request);
+    }
+    TgaAllocator allocator = loader->allocator;
+    rtga_free(&allocator, loader);
+}
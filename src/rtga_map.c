@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int rtga_map_file_data(const char *filename, const TgaAllocator *allocator, void **mapping, size_t *size) {
+    RTGA_STATS_BEGIN(start);
+
+#ifdef RTGA_MMAP
+    (void)allocator;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return TGA_FILE_OPEN_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TGA_HEADER_SIZE) {
+        close(fd);
+        return TGA_FILE_READ_ERROR;
+    }
+
+    void *address = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (address == MAP_FAILED) return TGA_FILE_READ_ERROR;
+
+    *mapping = address;
+    *size = (size_t)st.st_size;
+    // Pages are read as they are touched, so mapping only counts as opening
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+#else
+    // Without mmap, the file is read into a single buffer with the same layout
+    FILE *fp = fopen(filename, "rb");
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+    if (!fp) return TGA_FILE_OPEN_ERROR;
+
+    long end;
+    if (fseek(fp, 0, SEEK_END) != 0 || (end = ftell(fp)) < TGA_HEADER_SIZE || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return TGA_FILE_READ_ERROR;
+    }
+
+    void *buffer = rtga_alloc(allocator, (size_t)end);
+    if (!buffer) {
+        fclose(fp);
+        return TGA_ALLOCATION_ERROR;
+    }
+    RTGA_STATS_BEGIN(read_start);
+    size_t count = fread(buffer, 1, (size_t)end, fp);
+    RTGA_STATS_END(read_start, TGA_PHASE_IO, count);
+    if (count != (size_t)end) {
+        rtga_free(allocator, buffer);
+        fclose(fp);
+        return TGA_FILE_READ_ERROR;
+    }
+    fclose(fp);
+
+    *mapping = buffer;
+    *size = (size_t)end;
+#endif
+
+    return TGA_SUCCESS;
+}
+
+void rtga_unmap_file_data(void *mapping, size_t size, const TgaAllocator *allocator) {
+#ifdef RTGA_MMAP
+    (void)allocator;
+    munmap(mapping, size);
+#else
+    (void)size;
+    rtga_free(allocator, mapping);
+#endif
+}
+
+int tga_map_file(TgaImage *tga, const char *filename) {
+    void *mapping;
+    size_t mapping_size;
+
+    assert(tga);
+    assert(filename);
+
+    int result = rtga_map_file_data(filename, NULL, &mapping, &mapping_size);
+    if (result != TGA_SUCCESS) return result;
+
+    const uint8_t *bytes = mapping;
+    TgaHeader header;
+    rtga_parse_header(&header, bytes);
+
+    // Only uncompressed image data can be used in place
+    if (tga_is_rle(header.image_type)) {
+        rtga_unmap_file_data(mapping, mapping_size, NULL);
+        return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    }
+    result = rtga_check_header(&header);
+    if (result != TGA_SUCCESS) {
+        rtga_unmap_file_data(mapping, mapping_size, NULL);
+        return result;
+    }
+
+    // Make sure every section lies within the file
+    size_t color_map_offset = TGA_HEADER_SIZE + header.id_length;
+    size_t image_data_offset = color_map_offset + rtga_color_map_size(&header);
+    if (image_data_offset > mapping_size || mapping_size - image_data_offset < tga_image_size(&header)) {
+        rtga_unmap_file_data(mapping, mapping_size, NULL);
+        return TGA_FILE_READ_ERROR;
+    }
+
+    // Point every section straight into the mapping
+    uint8_t *base = mapping;
+    tga->header = header;
+    tga->state = header.image_type == UNCOMPRESSED_COLOR_MAPPED_IMAGE ? IS_COLOR_MAPPED : IS_UNCOMPRESSED;
+    tga->image_id = header.id_length > 0 ? base + TGA_HEADER_SIZE : NULL;
+    tga->color_map_data = rtga_color_map_size(&header) > 0 ? base + color_map_offset : NULL;
+    tga->image_data = base + image_data_offset;
+    tga->mapping = mapping;
+    tga->mapping_size = mapping_size;
+    memset(&tga->allocator, 0, sizeof(TgaAllocator));
+
+    return TGA_SUCCESS;
+}
+
+void tga_unmap_file(TgaImage *tga) {
+    assert(tga);
+
+    if (tga->mapping) {
+        rtga_unmap_file_data(tga->mapping, tga->mapping_size, NULL);
+    }
+
+    // Assign NULL to all pointers into the mapping
+    tga->image_id = NULL;
+    tga->color_map_data = NULL;
+    tga->image_data = NULL;
+    tga->mapping = NULL;
+    tga->mapping_size = 0;
+}
+
+uint8_t *rtga_owned_copy(TgaImage *tga, uint8_t *data, size_t size) {
+    if (!tga->mapping || !data) return data;
+
+    uint8_t *copy = rtga_alloc(&tga->allocator, size ? size : 1);
+    if (copy) memcpy(copy, data, size);
+    return copy;
+}
+
+int rtga_replace_buffers(TgaImage *tga, uint8_t *image_data, uint8_t *color_map_data) {
+    if (tga->mapping) {
+        uint8_t *image_id = NULL;
+        if (tga->header.id_length > 0) {
+            image_id = rtga_alloc(&tga->allocator, tga->header.id_length);
+            if (!image_id) return TGA_ALLOCATION_ERROR;
+            memcpy(image_id, tga->image_id, tga->header.id_length);
+        }
+        tga_unmap_file(tga);
+        tga->image_id = image_id;
+    } else {
+        if (tga->color_map_data != color_map_data) rtga_free(&tga->allocator, tga->color_map_data);
+        if (tga->image_data != image_data) rtga_free(&tga->allocator, tga->image_data);
+    }
+
+    tga->image_data = image_data;
+    tga->color_map_data = color_map_data;
+
+    return TGA_SUCCESS;
+}
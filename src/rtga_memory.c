@@ -0,0 +1,226 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Bands of scanlines whose run-length encoded sizes are measured in parallel
+#define SIZE_BANDS (RTGA_MAX_THREADS * 4)
+
+//
+// Memory callbacks
+//
+
+static size_t memory_read(void *context, void *buffer, size_t size) {
+    TgaMemoryIo *memory = context;
+    size_t available = memory->size - memory->position;
+    if (size > available) size = available;
+
+    if (size > 0) memcpy(buffer, memory->data + memory->position, size);
+    memory->position += size;
+    return size;
+}
+
+static size_t memory_write(void *context, const void *buffer, size_t size) {
+    TgaMemoryIo *memory = context;
+    size_t available = memory->size - memory->position;
+    if (size > available) size = available;
+
+    if (size > 0) memcpy(memory->data + memory->position, buffer, size);
+    memory->position += size;
+    return size;
+}
+
+static int memory_seek(void *context, int64_t offset, int origin) {
+    TgaMemoryIo *memory = context;
+    int64_t base;
+
+    switch (origin) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (int64_t)memory->position;
+        break;
+    case SEEK_END:
+        base = (int64_t)memory->size;
+        break;
+    default:
+        return -1;
+    }
+
+    // Positions stay within the buffer
+    if (offset < -base || offset > (int64_t)memory->size - base) return -1;
+    memory->position = (size_t)(base + offset);
+    return 0;
+}
+
+void tga_memory_io_init(TgaMemoryIo *memory, void *data, size_t size) {
+    assert(memory);
+    assert(data || size == 0);
+
+    memory->data = data;
+    memory->size = size;
+    memory->position = 0;
+}
+
+TgaIo tga_memory_io(TgaMemoryIo *memory) {
+    assert(memory);
+
+    TgaIo io = {memory_read, memory_write, memory_seek, memory};
+    return io;
+}
+
+//
+// Decoding
+//
+
+int tga_decode_memory(TgaImage *tga, const void *data, size_t size, const TgaReadOptions *options) {
+    assert(tga);
+    assert(data || size == 0);
+
+    const uint8_t *file = data;
+    const TgaAllocator *allocator = options ? options->allocator : NULL;
+
+    if (size < TGA_HEADER_SIZE) return TGA_FILE_READ_ERROR;
+    TgaHeader header;
+    rtga_parse_header(&header, file);
+    int result = rtga_check_header(&header);
+    if (result != TGA_SUCCESS) return result;
+
+    // Data too short for the image it claims is turned down before the
+    // image is allocated
+    size_t color_map_size = rtga_color_map_size(&header);
+    size_t data_start = TGA_HEADER_SIZE + header.id_length + color_map_size;
+    if (data_start > size) return TGA_FILE_READ_ERROR;
+    if (size - data_start < rtga_min_data_size(&header)) {
+        return tga_is_rle(header.image_type) ? TGA_RLE_DECODE_ERROR : TGA_FILE_READ_ERROR;
+    }
+    bool color_mapped = header.image_type == UNCOMPRESSED_COLOR_MAPPED_IMAGE ||
+                        header.image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE;
+
+    // Color maps are expanded by the streaming reader, which never writes to
+    // the buffer it reads
+    bool expand = color_mapped && options && options->expand_color_map;
+    bool top_left = options && options->top_left;
+    if (!expand) {
+        // Decode bands of scanlines in parallel when the data has a scan line table
+        bool handled;
+        result = rtga_decode_rle_bands(tga, file, size, options ? options->thread_count : 0, allocator, top_left, &handled);
+        if (result != TGA_SUCCESS || handled) return result;
+    }
+
+    // So are images that change orientation, since the reader can place
+    // every scanline, even when packets run from one scanline into the next
+    RtgaOrientation orientation = rtga_read_orientation(&header, top_left);
+    if (expand || orientation.flip_rows || orientation.flip_columns) {
+        TgaMemoryIo memory;
+        tga_memory_io_init(&memory, (void *)file, size);
+        TgaIo io = tga_memory_io(&memory);
+        return tga_read_io(tga, &io, options);
+    }
+
+    // Allocate TGA image and copy the image id and color map out of the data
+    if (tga_alloc_ex(header.image_type, header.width, header.height, header.image_pixel_depth, allocator, tga) != TGA_SUCCESS) {
+        return TGA_ALLOCATION_ERROR;
+    }
+    tga->header = header;
+    tga->image_id = header.id_length > 0 ? rtga_alloc(allocator, header.id_length) : NULL;
+    tga->color_map_data = color_map_size > 0 ? rtga_alloc(allocator, color_map_size) : NULL;
+    if ((header.id_length > 0 && !tga->image_id) || (color_map_size > 0 && !tga->color_map_data)) {
+        tga_free(tga);
+        return TGA_ALLOCATION_ERROR;
+    }
+    if (header.id_length > 0) memcpy(tga->image_id, file + TGA_HEADER_SIZE, header.id_length);
+    if (color_map_size > 0) memcpy(tga->color_map_data, file + TGA_HEADER_SIZE + header.id_length, color_map_size);
+    if (color_mapped) tga->state = IS_COLOR_MAPPED;
+
+    // Decode image data straight out of the buffer
+    size_t image_size = tga_image_size(&header);
+    if (tga_is_rle(header.image_type)) {
+        size_t pixel_count = (size_t)header.width * header.height;
+        result = tga_rle_decode(tga->image_data, pixel_count, file + data_start, size - data_start, tga_pixel_size(&header), NULL);
+    } else {
+        memcpy(tga->image_data, file + data_start, image_size);
+    }
+
+    if (result != TGA_SUCCESS) tga_free(tga);
+    return result;
+}
+
+//
+// Encoding
+//
+
+typedef struct {
+    const TgaImage *tga;
+    uint16_t rows_per_band;
+    size_t sizes[SIZE_BANDS];
+} SizeJob;
+
+static void measure_band(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    SizeJob *job = context;
+    const TgaHeader *header = &job->tga->header;
+    uint8_t pixel_size = tga_pixel_size(header);
+    size_t row_size = (size_t)header->width * pixel_size;
+    size_t first_row = index * job->rows_per_band;
+    size_t end_row = first_row + job->rows_per_band < header->height ? first_row + job->rows_per_band : header->height;
+
+    // Scanlines are encoded separately, so they are measured separately
+    size_t size = 0;
+    for (size_t y = first_row; y < end_row; ++y) {
+        size += tga_rle_encoded_size(job->tga->image_data + y * row_size, header->width, pixel_size);
+    }
+    job->sizes[index] = size;
+}
+
+size_t tga_encoded_size(const TgaImage *tga, const TgaWriteOptions *options) {
+    assert(tga);
+
+    const TgaHeader *header = &tga->header;
+    if (!tga_valid_depth(header->image_pixel_depth)) return 0;
+
+    uint64_t size = TGA_HEADER_SIZE + header->id_length + rtga_color_map_size(header);
+    if (tga_is_rle(header->image_type)) {
+        unsigned thread_count = rtga_thread_count(options ? options->thread_count : 0);
+        SizeJob job;
+        job.tga = tga;
+        job.rows_per_band = (uint16_t)((header->height + SIZE_BANDS - 1) / SIZE_BANDS);
+        if (job.rows_per_band == 0) job.rows_per_band = 1;
+
+        size_t band_count = (header->height + job.rows_per_band - 1) / job.rows_per_band;
+        rtga_parallel_for(band_count, thread_count, measure_band, &job);
+        for (size_t b = 0; b < band_count; ++b) {
+            size += job.sizes[b];
+        }
+    } else {
+        size += tga_image_size(header);
+    }
+
+    // The postage stamp, scan line table, extension area and footer follow
+    // the image data when their offsets fit in 32 bits
+    uint8_t stamp_width, stamp_height;
+    size_t stamp_size = options ? rtga_postage_stamp_size(tga, options->postage_stamp, &stamp_width, &stamp_height) : 0;
+    bool scan_line_table = options && options->scan_line_table;
+    if (scan_line_table || stamp_size > 0) {
+        uint64_t extension_offset = size + stamp_size + (scan_line_table ? (uint64_t)header->height * 4 : 0);
+        if (extension_offset <= UINT32_MAX) size = extension_offset + TGA_EXTENSION_SIZE + TGA_FOOTER_SIZE;
+    }
+
+    return (size_t)size;
+}
+
+int tga_encode_memory(TgaImage *tga, void *dst, size_t dst_size, const TgaWriteOptions *options, size_t *encoded_size) {
+    assert(tga);
+    assert(dst || dst_size == 0);
+
+    TgaMemoryIo memory;
+    tga_memory_io_init(&memory, dst, dst_size);
+    TgaIo io = tga_memory_io(&memory);
+
+    int result = tga_write_io(tga, &io, options);
+    if (encoded_size) *encoded_size = result == TGA_SUCCESS ? memory.position : 0;
+
+    return result;
+}
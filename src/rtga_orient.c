@@ -0,0 +1,281 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Descriptor bits that give the corner of the first pixel
+#define ORIGIN_RIGHT 0x10
+#define ORIGIN_TOP 0x20
+
+// Side of the square tiles that transposes work on. Two tiles of 32-bit
+// pixels take 8 KiB, so both stay in L1 while a tile is copied.
+#define TILE 32
+
+// Bytes of the rows swapped at a time by a vertical flip
+#define FLIP_CHUNK 4096
+
+RtgaOrientation rtga_read_orientation(const TgaHeader *header, bool top_left) {
+    RtgaOrientation orientation = {false, false};
+
+    if (top_left) {
+        orientation.flip_rows = !(header->descriptor & ORIGIN_TOP);
+        orientation.flip_columns = (header->descriptor & ORIGIN_RIGHT) != 0;
+    }
+    return orientation;
+}
+
+uint8_t rtga_top_left_descriptor(uint8_t descriptor) {
+    return (uint8_t)((descriptor & ~(ORIGIN_RIGHT | ORIGIN_TOP)) | ORIGIN_TOP);
+}
+
+//
+// Kernels
+//
+
+#ifdef RTGA_SSE2
+// Reverses the order of the pixels in a vector
+static inline __m128i reverse_vector(__m128i vec, uint8_t pixel_size) {
+    if (pixel_size == 4) return _mm_shuffle_epi32(vec, _MM_SHUFFLE(0, 1, 2, 3));
+
+    // Bytes are swapped within words, then words are reversed
+    if (pixel_size == 1) vec = _mm_or_si128(_mm_slli_epi16(vec, 8), _mm_srli_epi16(vec, 8));
+    vec = _mm_shufflelo_epi16(vec, _MM_SHUFFLE(0, 1, 2, 3));
+    vec = _mm_shufflehi_epi16(vec, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(vec, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+void rtga_reverse_pixels(uint8_t *row, size_t count, uint8_t pixel_size) {
+    size_t left = 0;
+    size_t right = count;
+
+#ifdef RTGA_SSE2
+    // Swap a vector from each end at a time. 24-bit pixels do not fit a
+    // vector evenly and are swapped one at a time.
+    if (pixel_size != 3) {
+        size_t lanes = 16 / pixel_size;
+        while (right - left >= 2 * lanes) {
+            uint8_t *front = row + left * pixel_size;
+            uint8_t *back = row + (right - lanes) * pixel_size;
+            __m128i front_vec = _mm_loadu_si128((const __m128i *)front);
+            __m128i back_vec = _mm_loadu_si128((const __m128i *)back);
+            _mm_storeu_si128((__m128i *)front, reverse_vector(back_vec, pixel_size));
+            _mm_storeu_si128((__m128i *)back, reverse_vector(front_vec, pixel_size));
+            left += lanes;
+            right -= lanes;
+        }
+    }
+#endif
+
+    while (right - left >= 2) {
+        --right;
+        uint32_t front = rtga_load_pixel(row + left * pixel_size, pixel_size);
+        uint32_t back = rtga_load_pixel(row + right * pixel_size, pixel_size);
+        rtga_store_pixel(row + left * pixel_size, back, pixel_size);
+        rtga_store_pixel(row + right * pixel_size, front, pixel_size);
+        ++left;
+    }
+}
+
+// Swaps two rows of size bytes through a buffer that stays in L1
+static void swap_rows(uint8_t *a, uint8_t *b, size_t size) {
+    uint8_t buffer[FLIP_CHUNK];
+
+    for (size_t offset = 0; offset < size; offset += FLIP_CHUNK) {
+        size_t chunk = size - offset < FLIP_CHUNK ? size - offset : FLIP_CHUNK;
+        memcpy(buffer, a + offset, chunk);
+        memcpy(a + offset, b + offset, chunk);
+        memcpy(b + offset, buffer, chunk);
+    }
+}
+
+// Transposes a square image in place, swapping each tile above the
+// diagonal with its mirror below it. pixel_size is a constant wherever this
+// is inlined, so every pixel depth gets its own loop.
+static inline void transpose_square(uint8_t *data, size_t side, uint8_t pixel_size) {
+    size_t stride = side * pixel_size;
+
+    for (size_t tile_y = 0; tile_y < side; tile_y += TILE) {
+        size_t end_y = tile_y + TILE < side ? tile_y + TILE : side;
+        for (size_t tile_x = tile_y; tile_x < side; tile_x += TILE) {
+            size_t end_x = tile_x + TILE < side ? tile_x + TILE : side;
+            for (size_t y = tile_y; y < end_y; ++y) {
+                // Tiles on the diagonal only swap pixels above it
+                size_t x = tile_x == tile_y ? y + 1 : tile_x;
+                for (; x < end_x; ++x) {
+                    uint8_t *a = data + y * stride + x * pixel_size;
+                    uint8_t *b = data + x * stride + y * pixel_size;
+                    uint32_t pixel = rtga_load_pixel(a, pixel_size);
+                    rtga_store_pixel(a, rtga_load_pixel(b, pixel_size), pixel_size);
+                    rtga_store_pixel(b, pixel, pixel_size);
+                }
+            }
+        }
+    }
+}
+
+// Copies src, which is width by height pixels, into dst turned on its side
+// one tile at a time. dst is height pixels wide and its pixel (x, y) comes
+// from src pixel (y, x), with x mirrored if flip_x and y mirrored if flip_y.
+static inline void transpose_copy(uint8_t *dst, const uint8_t *src, size_t width, size_t height, uint8_t pixel_size, bool flip_x, bool flip_y) {
+    size_t src_stride = width * pixel_size;
+    size_t dst_stride = height * pixel_size;
+
+    for (size_t tile_y = 0; tile_y < width; tile_y += TILE) {
+        size_t end_y = tile_y + TILE < width ? tile_y + TILE : width;
+        for (size_t tile_x = 0; tile_x < height; tile_x += TILE) {
+            size_t end_x = tile_x + TILE < height ? tile_x + TILE : height;
+            for (size_t y = tile_y; y < end_y; ++y) {
+                uint8_t *dst_row = dst + y * dst_stride;
+                size_t src_x = flip_y ? width - 1 - y : y;
+                for (size_t x = tile_x; x < end_x; ++x) {
+                    size_t src_y = flip_x ? height - 1 - x : x;
+                    uint32_t pixel = rtga_load_pixel(src + src_y * src_stride + src_x * pixel_size, pixel_size);
+                    rtga_store_pixel(dst_row + x * pixel_size, pixel, pixel_size);
+                }
+            }
+        }
+    }
+}
+
+static void transpose_square_depth(uint8_t *data, size_t side, uint8_t pixel_size) {
+    switch (pixel_size) {
+    case 1:
+        transpose_square(data, side, 1);
+        break;
+    case 2:
+        transpose_square(data, side, 2);
+        break;
+    case 3:
+        transpose_square(data, side, 3);
+        break;
+    default:
+        transpose_square(data, side, 4);
+        break;
+    }
+}
+
+static void transpose_copy_depth(uint8_t *dst, const uint8_t *src, size_t width, size_t height, uint8_t pixel_size, bool flip_x, bool flip_y) {
+    switch (pixel_size) {
+    case 1:
+        transpose_copy(dst, src, width, height, 1, flip_x, flip_y);
+        break;
+    case 2:
+        transpose_copy(dst, src, width, height, 2, flip_x, flip_y);
+        break;
+    case 3:
+        transpose_copy(dst, src, width, height, 3, flip_x, flip_y);
+        break;
+    default:
+        transpose_copy(dst, src, width, height, 4, flip_x, flip_y);
+        break;
+    }
+}
+
+//
+// Image operations
+//
+
+// Returns why the pixels of tga can not be moved around, if they can not
+static int check_image(const TgaImage *tga) {
+    if (tga->state == IS_RLE) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (!tga_valid_depth(tga->header.image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    return TGA_SUCCESS;
+}
+
+int tga_flip_vertical(TgaImage *tga) {
+    assert(tga);
+
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+
+    size_t row_size = (size_t)tga->header.width * tga_pixel_size(&tga->header);
+    uint16_t height = tga->header.height;
+    for (uint16_t y = 0; y < height / 2; ++y) {
+        swap_rows(tga->image_data + y * row_size, tga->image_data + (size_t)(height - 1 - y) * row_size, row_size);
+    }
+
+    return TGA_SUCCESS;
+}
+
+int tga_flip_horizontal(TgaImage *tga) {
+    assert(tga);
+
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+
+    uint8_t pixel_size = tga_pixel_size(&tga->header);
+    size_t row_size = (size_t)tga->header.width * pixel_size;
+    for (uint16_t y = 0; y < tga->header.height; ++y) {
+        rtga_reverse_pixels(tga->image_data + y * row_size, tga->header.width, pixel_size);
+    }
+
+    return TGA_SUCCESS;
+}
+
+// Turns the image data of tga on its side, then swaps its width and height.
+// Square images are turned in place. Other images are copied into a new
+// buffer, since turning them in place would visit pixels in an order no
+// cache can follow.
+static int turn(TgaImage *tga, bool flip_x, bool flip_y) {
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+
+    TgaHeader *header = &tga->header;
+    uint8_t pixel_size = tga_pixel_size(header);
+
+    if (header->width == header->height) {
+        transpose_square_depth(tga->image_data, header->width, pixel_size);
+        // A mirrored axis of the copy is a flip of the transposed image
+        if (flip_x) tga_flip_horizontal(tga);
+        if (flip_y) tga_flip_vertical(tga);
+        return TGA_SUCCESS;
+    }
+
+    uint8_t *image_data = rtga_alloc(&tga->allocator, tga_image_size(header));
+    uint8_t *color_map_data = rtga_owned_copy(tga, tga->color_map_data, rtga_color_map_size(header));
+    if (!image_data || (tga->color_map_data && !color_map_data)) {
+        rtga_free(&tga->allocator, image_data);
+        if (color_map_data != tga->color_map_data) rtga_free(&tga->allocator, color_map_data);
+        return TGA_ALLOCATION_ERROR;
+    }
+    transpose_copy_depth(image_data, tga->image_data, header->width, header->height, pixel_size, flip_x, flip_y);
+    if (rtga_replace_buffers(tga, image_data, color_map_data) != TGA_SUCCESS) {
+        rtga_free(&tga->allocator, image_data);
+        if (color_map_data != tga->color_map_data) rtga_free(&tga->allocator, color_map_data);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    uint16_t width = header->width;
+    header->width = header->height;
+    header->height = width;
+    return TGA_SUCCESS;
+}
+
+int tga_transpose(TgaImage *tga) {
+    assert(tga);
+
+    return turn(tga, false, false);
+}
+
+int tga_rotate_90(TgaImage *tga, bool clockwise) {
+    assert(tga);
+
+    // Clockwise, the first row becomes the last column, which is the
+    // transpose with its rows reversed. Counterclockwise reverses the columns.
+    return turn(tga, clockwise, !clockwise);
+}
+
+int tga_normalize_orientation(TgaImage *tga) {
+    assert(tga);
+
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+
+    TgaHeader *header = &tga->header;
+    if (!(header->descriptor & ORIGIN_TOP)) tga_flip_vertical(tga);
+    if (header->descriptor & ORIGIN_RIGHT) tga_flip_horizontal(tga);
+    header->descriptor = rtga_top_left_descriptor(header->descriptor);
+
+    return TGA_SUCCESS;
+}
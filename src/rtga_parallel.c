@@ -0,0 +1,401 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_PTHREADS 1
+#include <pthread.h>
+#endif
+
+// Fewest scanlines in a band, so that small images stay on one thread
+#define MIN_BAND_ROWS 64
+
+// Bands per thread, so that threads that finish early can take more work
+#define BANDS_PER_THREAD 4
+
+// Most bands an image can be split into
+#define MAX_BANDS ((UINT16_MAX + MIN_BAND_ROWS - 1) / MIN_BAND_ROWS)
+
+// Returns the number of scanlines in each band of an image
+static uint16_t band_rows(uint16_t height, unsigned thread_count) {
+    size_t rows = height / ((size_t)thread_count * BANDS_PER_THREAD);
+    if (rows < MIN_BAND_ROWS) rows = MIN_BAND_ROWS;
+    return (uint16_t)(rows < height ? rows : height);
+}
+
+//
+// Encoding
+//
+
+// Most image data held in encode buffers at once, so that wide images on
+// many threads stay within the bounded memory of the streaming writer
+#define MAX_BAND_MEMORY ((size_t)16 << 20)
+
+// Encode buffers per thread, so that threads can encode ahead while earlier
+// bands wait to be written
+#define SLOTS_PER_THREAD 2
+
+// Buffer that one band at a time is encoded into
+typedef struct {
+    uint8_t *encoded;
+    size_t encoded_size;
+    // Offset of each scanline within the band
+    uint64_t *row_offsets;
+    bool ready;
+} EncodeSlot;
+
+typedef struct {
+    TgaWriter *writer;
+    const uint8_t *image_data;
+    uint16_t rows_per_band;
+    EncodeSlot *slots;
+    unsigned slot_count;
+    uint64_t *row_offsets;
+    // Next band to write, bytes written so far and whether a thread is
+    // writing, all guarded by lock
+    size_t next_band;
+    uint64_t total;
+    bool writing;
+    int result;
+#ifdef RTGA_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t written;
+#endif
+} EncodeJob;
+
+#ifdef RTGA_PTHREADS
+#define LOCK(job) pthread_mutex_lock(&(job)->lock)
+#define UNLOCK(job) pthread_mutex_unlock(&(job)->lock)
+#else
+#define LOCK(job) ((void)0)
+#define UNLOCK(job) ((void)0)
+#endif
+
+// Writes every encoded band that is next in order. The caller holds the
+// lock, which is let go while writing.
+static void write_ready_bands(EncodeJob *job) {
+    TgaWriter *writer = job->writer;
+    uint16_t height = writer->header.height;
+
+    job->writing = true;
+    for (;;) {
+        EncodeSlot *slot = &job->slots[job->next_band % job->slot_count];
+        if (job->result != TGA_SUCCESS || !slot->ready) break;
+
+        size_t first_row = job->next_band * job->rows_per_band;
+        size_t row_count = height - first_row < job->rows_per_band ? height - first_row : job->rows_per_band;
+        uint64_t total = job->total;
+        UNLOCK(job);
+        bool written = writer->io.write(writer->io.context, slot->encoded, slot->encoded_size) == slot->encoded_size;
+        if (job->row_offsets) {
+            for (size_t row = 0; row < row_count; ++row) {
+                job->row_offsets[first_row + row] = total + slot->row_offsets[row];
+            }
+        }
+        LOCK(job);
+
+        if (!written) job->result = TGA_FILE_WRITE_ERROR;
+        job->total += slot->encoded_size;
+        slot->ready = false;
+        job->next_band++;
+#ifdef RTGA_PTHREADS
+        pthread_cond_broadcast(&job->written);
+#endif
+    }
+    job->writing = false;
+}
+
+static void encode_band(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    EncodeJob *job = context;
+    const TgaHeader *header = &job->writer->header;
+    uint8_t pixel_size = job->writer->pixel_size;
+    size_t row_size = (size_t)header->width * pixel_size;
+    size_t first_row = index * job->rows_per_band;
+    size_t row_count = header->height - first_row < job->rows_per_band ? header->height - first_row : job->rows_per_band;
+    const uint8_t *src = job->image_data + first_row * row_size;
+    EncodeSlot *slot = &job->slots[index % job->slot_count];
+
+    // Wait until the band that last used the slot has been written. Bands
+    // are handed out in order, so that band is always being worked on.
+    LOCK(job);
+#ifdef RTGA_PTHREADS
+    while (job->result == TGA_SUCCESS && job->next_band + job->slot_count <= index) {
+        pthread_cond_wait(&job->written, &job->lock);
+    }
+#endif
+    bool failed = job->result != TGA_SUCCESS;
+    UNLOCK(job);
+    if (failed) return;
+
+    // Packets never cross scanlines, so bands can be encoded independently
+    slot->encoded_size = 0;
+    for (size_t y = 0; y < row_count; ++y) {
+        slot->row_offsets[y] = slot->encoded_size;
+        slot->encoded_size += tga_rle_encode(slot->encoded + slot->encoded_size, src + y * row_size, header->width, pixel_size);
+    }
+
+    // Whichever thread finds the next band ready writes it
+    LOCK(job);
+    slot->ready = true;
+    if (!job->writing) write_ready_bands(job);
+    UNLOCK(job);
+}
+
+int rtga_write_rle_bands(TgaWriter *writer, const uint8_t *image_data, unsigned thread_count, uint64_t *row_offsets, uint64_t *data_size) {
+    assert(writer);
+    assert(writer->rows_written == 0);
+    assert(tga_is_rle(writer->header.image_type));
+
+    const TgaHeader *header = &writer->header;
+    thread_count = rtga_thread_count(thread_count);
+    int result = TGA_SUCCESS;
+
+    // Every band is encoded in one parallel loop into a bounded set of
+    // slots, which are written out in order as they are encoded
+    EncodeSlot slots[RTGA_MAX_THREADS * SLOTS_PER_THREAD];
+    unsigned slot_count = thread_count * SLOTS_PER_THREAD;
+    size_t row_size = (size_t)header->width * writer->pixel_size;
+    uint16_t rows_per_band = band_rows(header->height, thread_count);
+    size_t max_rows = MAX_BAND_MEMORY / slot_count / (row_size > 0 ? row_size : 1);
+    if (rows_per_band > max_rows) rows_per_band = (uint16_t)(max_rows > 0 ? max_rows : 1);
+    if (rows_per_band == 0) rows_per_band = 1;
+    size_t band_count = (header->height + (size_t)rows_per_band - 1) / rows_per_band;
+    if (slot_count > band_count) slot_count = band_count > 0 ? (unsigned)band_count : 1;
+    size_t band_bound = tga_rle_bound((size_t)header->width * rows_per_band, writer->pixel_size) + rows_per_band;
+
+    memset(slots, 0, sizeof(slots));
+    for (unsigned s = 0; s < slot_count; ++s) {
+        slots[s].encoded = rtga_alloc(&writer->allocator, band_bound);
+        slots[s].row_offsets = rtga_alloc(&writer->allocator, rows_per_band * sizeof(uint64_t));
+        if (!slots[s].encoded || !slots[s].row_offsets) result = TGA_ALLOCATION_ERROR;
+    }
+
+    EncodeJob job;
+    job.writer = writer;
+    job.image_data = image_data;
+    job.rows_per_band = rows_per_band;
+    job.slots = slots;
+    job.slot_count = slot_count;
+    job.row_offsets = row_offsets;
+    job.next_band = 0;
+    job.total = 0;
+    job.writing = false;
+    job.result = result;
+
+    if (result == TGA_SUCCESS && header->height > 0) {
+#ifdef RTGA_PTHREADS
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.written, NULL);
+#endif
+        rtga_parallel_for(band_count, thread_count, encode_band, &job);
+#ifdef RTGA_PTHREADS
+        pthread_cond_destroy(&job.written);
+        pthread_mutex_destroy(&job.lock);
+#endif
+        result = job.result;
+    }
+
+    for (unsigned s = 0; s < slot_count; ++s) {
+        rtga_free(&writer->allocator, slots[s].encoded);
+        rtga_free(&writer->allocator, slots[s].row_offsets);
+    }
+
+    if (result == TGA_SUCCESS) {
+        writer->rows_written = header->height;
+        *data_size = job.total;
+    }
+
+    return result;
+}
+
+//
+// Decoding
+//
+
+typedef struct {
+    const uint8_t *file;
+    size_t file_size;
+    // Offset of the image data, where the first scanline may start
+    size_t data_start;
+    const uint8_t *table;
+    uint8_t *image_data;
+    const TgaHeader *header;
+    RtgaOrientation orientation;
+    uint8_t pixel_size;
+    uint16_t rows_per_band;
+    // Result of every band
+    int results[MAX_BANDS];
+} DecodeJob;
+
+static uint32_t table_entry(const uint8_t *table, size_t row) {
+    const uint8_t *bytes = table + row * 4;
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void decode_band(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    DecodeJob *job = context;
+    const uint8_t *table = job->table;
+    uint16_t height = job->header->height;
+    size_t first_row = index * job->rows_per_band;
+    size_t row_count = height - first_row < job->rows_per_band ? height - first_row : job->rows_per_band;
+    size_t row_size = (size_t)job->header->width * job->pixel_size;
+
+    // A band may only use the bytes up to the start of the next band
+    size_t start = table_entry(table, first_row);
+    size_t end = first_row + row_count < height ? table_entry(table, first_row + row_count) : job->file_size;
+    int result = TGA_RLE_DECODE_ERROR;
+    if (start < job->data_start || start > end || end > job->file_size) {
+        // The table is broken
+    } else if (!job->orientation.flip_rows && !job->orientation.flip_columns) {
+        result = tga_rle_decode(job->image_data + first_row * row_size, row_count * job->header->width,
+                                job->file + start, end - start, job->pixel_size, NULL);
+    } else {
+        // Every scanline starts where the table says, so each one is decoded
+        // straight into the row it ends up in
+        result = TGA_SUCCESS;
+        for (size_t y = first_row; result == TGA_SUCCESS && y < first_row + row_count; ++y) {
+            size_t row_start = table_entry(table, y);
+            size_t row_end = y + 1 < first_row + row_count ? table_entry(table, y + 1) : end;
+            size_t row = job->orientation.flip_rows ? height - 1 - y : y;
+            uint8_t *dst = job->image_data + row * row_size;
+            result = TGA_RLE_DECODE_ERROR;
+            if (row_start <= row_end && row_end <= end) {
+                result = tga_rle_decode(dst, job->header->width, job->file + row_start, row_end - row_start, job->pixel_size, NULL);
+            }
+            if (result == TGA_SUCCESS && job->orientation.flip_columns) {
+                rtga_reverse_pixels(dst, job->header->width, job->pixel_size);
+            }
+        }
+    }
+
+    job->results[index] = result;
+}
+
+int rtga_decode_rle_bands(TgaImage *tga, const uint8_t *file, size_t size, unsigned thread_count, const TgaAllocator *allocator, bool top_left, bool *handled) {
+    assert(tga);
+    assert(file);
+    assert(handled);
+
+    *handled = false;
+    if (size < TGA_HEADER_SIZE) return TGA_SUCCESS;
+
+    TgaHeader header;
+    rtga_parse_header(&header, file);
+    thread_count = rtga_thread_count(thread_count);
+
+    // Only run-length encoded files with a scan line table past the image
+    // data and enough scanlines to split are read here
+    size_t data_start = TGA_HEADER_SIZE + header.id_length + rtga_color_map_size(&header);
+    uint32_t extension_offset;
+    RtgaExtension extension;
+    if (!tga_is_rle(header.image_type) || rtga_check_header(&header) != TGA_SUCCESS ||
+        thread_count < 2 || header.height < 2 * MIN_BAND_ROWS ||
+        size < data_start + TGA_FOOTER_SIZE ||
+        !rtga_parse_footer(file + size - TGA_FOOTER_SIZE, &extension_offset) ||
+        extension_offset < data_start || (uint64_t)extension_offset + TGA_EXTENSION_SIZE > size - TGA_FOOTER_SIZE) {
+        return TGA_SUCCESS;
+    }
+    rtga_parse_extension(&extension, file + extension_offset);
+    if (extension.scan_line_offset < data_start || (size_t)header.height * 4 > size ||
+        extension.scan_line_offset > size - (size_t)header.height * 4) {
+        return TGA_SUCCESS;
+    }
+    *handled = true;
+    if (extension.scan_line_offset - data_start < rtga_min_data_size(&header)) return TGA_RLE_DECODE_ERROR;
+
+    // Allocate TGA image and copy the image id and color map out of the file
+    size_t color_map_size = rtga_color_map_size(&header);
+    if (tga_alloc_ex(header.image_type, header.width, header.height, header.image_pixel_depth, allocator, tga) != TGA_SUCCESS) {
+        return TGA_ALLOCATION_ERROR;
+    }
+    tga->header = header;
+    tga->image_id = header.id_length > 0 ? rtga_alloc(allocator, header.id_length) : NULL;
+    tga->color_map_data = color_map_size > 0 ? rtga_alloc(allocator, color_map_size) : NULL;
+    if ((header.id_length > 0 && !tga->image_id) || (color_map_size > 0 && !tga->color_map_data)) {
+        tga_free(tga);
+        return TGA_ALLOCATION_ERROR;
+    }
+    if (header.id_length > 0) memcpy(tga->image_id, file + TGA_HEADER_SIZE, header.id_length);
+    if (color_map_size > 0) memcpy(tga->color_map_data, file + TGA_HEADER_SIZE + header.id_length, color_map_size);
+    if (header.image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE) tga->state = IS_COLOR_MAPPED;
+
+    // Decode the bands in parallel
+    DecodeJob job;
+    job.file = file;
+    job.file_size = size;
+    job.data_start = data_start;
+    job.table = file + extension.scan_line_offset;
+    job.image_data = tga->image_data;
+    job.header = &header;
+    job.orientation = rtga_read_orientation(&header, top_left);
+    job.pixel_size = tga_pixel_size(&header);
+    job.rows_per_band = band_rows(header.height, thread_count);
+
+    size_t band_count = (header.height + job.rows_per_band - 1) / job.rows_per_band;
+    rtga_parallel_for(band_count, thread_count, decode_band, &job);
+
+    // Any band that fails fails the whole image
+    int result = TGA_SUCCESS;
+    for (size_t b = 0; b < band_count; ++b) {
+        if (job.results[b] != TGA_SUCCESS) result = job.results[b];
+    }
+    if (result != TGA_SUCCESS) {
+        tga_free(tga);
+    } else if (job.orientation.flip_rows || job.orientation.flip_columns) {
+        tga->header.descriptor = rtga_top_left_descriptor(header.descriptor);
+    }
+
+    return result;
+}
+
+int rtga_read_rle_bands(TgaImage *tga, TgaReader *reader, const char *filename, unsigned thread_count, bool top_left, bool *handled) {
+    assert(reader);
+    assert(handled);
+
+    *handled = false;
+
+    // Files that are not worth splitting are left to the serial reader
+    // before anything else is read
+    const TgaHeader *header = &reader->header;
+    const TgaIo *io = &reader->io;
+    if (!tga_is_rle(header->image_type) || rtga_thread_count(thread_count) < 2 ||
+        header->height < 2 * MIN_BAND_ROWS || !io->seek) {
+        return TGA_SUCCESS;
+    }
+
+    // Streams that can not seek, such as pipes, fail here without losing
+    // any data
+    uint8_t footer[TGA_FOOTER_SIZE];
+    if (io->seek(io->context, -TGA_FOOTER_SIZE, SEEK_END) != 0) return TGA_SUCCESS;
+
+    // Look for a scan line table through the footer and extension area
+    uint8_t extension_bytes[TGA_EXTENSION_SIZE];
+    uint32_t extension_offset;
+    RtgaExtension extension;
+    bool table = io->read(io->context, footer, TGA_FOOTER_SIZE) == TGA_FOOTER_SIZE &&
+                 rtga_parse_footer(footer, &extension_offset) &&
+                 io->seek(io->context, extension_offset, SEEK_SET) == 0 &&
+                 io->read(io->context, extension_bytes, TGA_EXTENSION_SIZE) == TGA_EXTENSION_SIZE;
+    if (table) {
+        rtga_parse_extension(&extension, extension_bytes);
+        table = extension.scan_line_offset != 0;
+    }
+
+    // Only a file with a table is mapped, and one that can not be mapped is
+    // read serially like any other
+    void *mapping;
+    size_t size;
+    if (table && rtga_map_file_data(filename, &reader->allocator, &mapping, &size) == TGA_SUCCESS) {
+        int result = rtga_decode_rle_bands(tga, mapping, size, thread_count, &reader->allocator, top_left, handled);
+        rtga_unmap_file_data(mapping, size, &reader->allocator);
+        if (*handled) return result;
+    }
+
+    // Go back to the image data for the serial reader
+    int64_t data_start = TGA_HEADER_SIZE + header->id_length + (int64_t)rtga_color_map_size(header);
+    return io->seek(io->context, data_start, SEEK_SET) == 0 ? TGA_SUCCESS : TGA_FILE_READ_ERROR;
+}
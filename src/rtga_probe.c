@@ -0,0 +1,441 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_POSIX_FILES 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bytes at the end of a file that hold an extension area written right
+// before the footer, which is where rtga and most writers put it
+#define TAIL_SIZE (TGA_EXTENSION_SIZE + TGA_FOOTER_SIZE)
+
+//
+// Validation
+//
+
+// Checks a header against the size of its file and fills in probe
+static int check_header(TgaProbe *probe, const uint8_t *header_bytes, uint64_t file_size) {
+    memset(probe, 0, sizeof(*probe));
+    TgaHeader *header = &probe->header;
+    rtga_parse_header(header, header_bytes);
+    probe->file_size = file_size;
+
+    int result = rtga_check_header(header);
+    if (result != TGA_SUCCESS) return result;
+
+    // The color map and uncompressed image data must fit in the file, while
+    // run-length encoded data can only be checked in full by decoding it
+    probe->data_offset = TGA_HEADER_SIZE + header->id_length + (uint64_t)rtga_color_map_size(header);
+    if (probe->data_offset > file_size) return TGA_FILE_READ_ERROR;
+    if (file_size - probe->data_offset < rtga_min_data_size(header)) return TGA_FILE_READ_ERROR;
+
+    return TGA_SUCCESS;
+}
+
+// Returns the extension area offset of footer if it points to an extension
+// area between the image data and the footer, or 0 otherwise
+static uint32_t find_extension(const TgaProbe *probe, const uint8_t *footer) {
+    uint32_t extension_offset;
+    if (probe->file_size < probe->data_offset + TGA_FOOTER_SIZE) return 0;
+    if (!rtga_parse_footer(footer, &extension_offset) || extension_offset < probe->data_offset) return 0;
+    if ((uint64_t)extension_offset + TGA_EXTENSION_SIZE > probe->file_size - TGA_FOOTER_SIZE) return 0;
+
+    return extension_offset;
+}
+
+// Fills in the extension fields of probe from an extension area, which is
+// only trusted if it gives its own size correctly
+static void check_extension(TgaProbe *probe, uint32_t extension_offset, const uint8_t *bytes) {
+    if ((bytes[0] | bytes[1] << 8) != TGA_EXTENSION_SIZE) return;
+
+    RtgaExtension extension;
+    rtga_parse_extension(&extension, bytes);
+    probe->has_extension = true;
+    probe->extension_offset = extension_offset;
+    probe->postage_stamp_offset = extension.postage_stamp_offset;
+    probe->scan_line_offset = extension.scan_line_offset;
+    probe->attributes_type = extension.attributes_type;
+}
+
+int tga_probe_memory(const void *data, size_t size, bool extension, TgaProbe *probe) {
+    assert(data || size == 0);
+    assert(probe);
+
+    const uint8_t *file = data;
+    if (size < TGA_HEADER_SIZE) return TGA_FILE_READ_ERROR;
+    int result = check_header(probe, file, size);
+    if (result != TGA_SUCCESS || !extension) return result;
+
+    uint32_t extension_offset = find_extension(probe, file + size - TGA_FOOTER_SIZE);
+    if (extension_offset) check_extension(probe, extension_offset, file + extension_offset);
+
+    return TGA_SUCCESS;
+}
+
+//
+// Files
+//
+
+#ifdef RTGA_POSIX_FILES
+typedef int ProbeFile;
+#else
+typedef FILE *ProbeFile;
+#endif
+
+// Reads size bytes at offset, with a single positioned read where possible
+// so probing a file costs one system call per region
+static bool read_at(ProbeFile file, uint64_t offset, uint8_t *buffer, size_t size) {
+    RTGA_STATS_BEGIN(start);
+    size_t done = 0;
+
+#ifdef RTGA_POSIX_FILES
+    while (done < size) {
+        ssize_t count = pread(file, buffer + done, size - done, (off_t)(offset + done));
+        if (count <= 0) break;
+        done += (size_t)count;
+    }
+#else
+    if (offset <= LONG_MAX && fseek(file, (long)offset, SEEK_SET) == 0) done = fread(buffer, 1, size, file);
+#endif
+
+    RTGA_STATS_END(start, TGA_PHASE_IO, done);
+    return done == size;
+}
+
+// Opens a file for read_at and gets its size
+static int open_file(const char *filename, ProbeFile *file, uint64_t *file_size) {
+    RTGA_STATS_BEGIN(start);
+#ifdef RTGA_POSIX_FILES
+    *file = open(filename, O_RDONLY);
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+    if (*file < 0) return TGA_FILE_OPEN_ERROR;
+
+    struct stat st;
+    if (fstat(*file, &st) != 0) {
+        close(*file);
+        return TGA_FILE_READ_ERROR;
+    }
+    *file_size = (uint64_t)st.st_size;
+#else
+    *file = fopen(filename, "rb");
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+    if (!*file) return TGA_FILE_OPEN_ERROR;
+
+    long end;
+    if (fseek(*file, 0, SEEK_END) != 0 || (end = ftell(*file)) < 0) {
+        fclose(*file);
+        return TGA_FILE_READ_ERROR;
+    }
+    *file_size = (uint64_t)end;
+#endif
+
+    return TGA_SUCCESS;
+}
+
+static void close_file(ProbeFile file) {
+#ifdef RTGA_POSIX_FILES
+    close(file);
+#else
+    fclose(file);
+#endif
+}
+
+// Probes an open file of file_size bytes
+static int probe_open_file(ProbeFile file, uint64_t file_size, bool extension, TgaProbe *probe) {
+    uint8_t header_bytes[TGA_HEADER_SIZE];
+    int result = TGA_FILE_READ_ERROR;
+    if (file_size >= TGA_HEADER_SIZE && read_at(file, 0, header_bytes, TGA_HEADER_SIZE)) {
+        result = check_header(probe, header_bytes, file_size);
+    }
+
+    // Read the footer together with the extension area that usually comes
+    // right before it, and only read elsewhere if it does not
+    if (result == TGA_SUCCESS && extension && file_size >= probe->data_offset + TGA_FOOTER_SIZE) {
+        uint8_t tail[TAIL_SIZE];
+        size_t tail_size = file_size - probe->data_offset < TAIL_SIZE ? (size_t)(file_size - probe->data_offset) : TAIL_SIZE;
+        uint64_t tail_offset = file_size - tail_size;
+        uint32_t extension_offset = 0;
+        if (read_at(file, tail_offset, tail, tail_size)) {
+            extension_offset = find_extension(probe, tail + tail_size - TGA_FOOTER_SIZE);
+        }
+
+        if (extension_offset >= tail_offset) {
+            check_extension(probe, extension_offset, tail + (extension_offset - tail_offset));
+        } else if (extension_offset) {
+            uint8_t extension_bytes[TGA_EXTENSION_SIZE];
+            if (read_at(file, extension_offset, extension_bytes, TGA_EXTENSION_SIZE)) {
+                check_extension(probe, extension_offset, extension_bytes);
+            }
+        }
+    }
+
+    return result;
+}
+
+int tga_probe_file(const char *filename, bool extension, TgaProbe *probe) {
+    assert(filename);
+    assert(probe);
+
+    ProbeFile file;
+    uint64_t file_size;
+    int result = open_file(filename, &file, &file_size);
+    if (result != TGA_SUCCESS) return result;
+
+    result = probe_open_file(file, file_size, extension, probe);
+    close_file(file);
+    return result;
+}
+
+//
+// Thumbnails
+//
+
+// Reads the color map and postage stamp of a probed file into a small
+// uncompressed TGA file in memory, and decodes that with options
+static int read_stamp(TgaImage *thumbnail, ProbeFile file, const TgaProbe *probe, const TgaReadOptions *options) {
+    uint64_t offset = probe->postage_stamp_offset;
+    if (!probe->has_extension || offset == 0) return TGA_NO_POSTAGE_STAMP_ERROR;
+
+    uint8_t stamp_size[2];
+    if (offset < TGA_HEADER_SIZE || offset + 2 > probe->file_size || !read_at(file, offset, stamp_size, 2)) {
+        return TGA_FILE_READ_ERROR;
+    }
+    if (stamp_size[0] == 0 || stamp_size[1] == 0) return TGA_NO_POSTAGE_STAMP_ERROR;
+
+    // The stamp keeps the pixel depth, color map and orientation of the image
+    TgaHeader header = probe->header;
+    header.id_length = 0;
+    if (tga_is_rle(header.image_type)) header.image_type = (TgaImageType)(header.image_type - 8);
+    header.x_origin = 0;
+    header.y_origin = 0;
+    header.width = stamp_size[0];
+    header.height = stamp_size[1];
+    size_t color_map_size = rtga_color_map_size(&header);
+    size_t pixels_size = tga_image_size(&header);
+    if (offset + 2 + pixels_size > probe->file_size) return TGA_FILE_READ_ERROR;
+
+    const TgaAllocator *allocator = options ? options->allocator : NULL;
+    size_t size = TGA_HEADER_SIZE + color_map_size + pixels_size;
+    uint8_t *buffer = rtga_alloc(allocator, size);
+    if (!buffer) return TGA_ALLOCATION_ERROR;
+    rtga_serialize_header(buffer, &header);
+    bool read = (color_map_size == 0 || read_at(file, TGA_HEADER_SIZE + probe->header.id_length, buffer + TGA_HEADER_SIZE, color_map_size)) &&
+                read_at(file, offset + 2, buffer + TGA_HEADER_SIZE + color_map_size, pixels_size);
+
+    int result = read ? tga_decode_memory(thumbnail, buffer, size, options) : TGA_FILE_READ_ERROR;
+    rtga_free(allocator, buffer);
+    return result;
+}
+
+int tga_read_thumbnail(TgaImage *thumbnail, const char *filename, const TgaReadOptions *options) {
+    assert(thumbnail);
+    assert(filename);
+
+    ProbeFile file;
+    uint64_t file_size;
+    int result = open_file(filename, &file, &file_size);
+    if (result != TGA_SUCCESS) return result;
+
+    TgaProbe probe;
+    result = probe_open_file(file, file_size, true, &probe);
+    if (result == TGA_SUCCESS) result = read_stamp(thumbnail, file, &probe, options);
+    close_file(file);
+    return result;
+}
+
+//
+// Directory scanning
+//
+
+// Paths found while walking directories, stored back to back in one pool
+typedef struct {
+    char *pool;
+    size_t pool_size;
+    size_t pool_capacity;
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+typedef struct {
+    TgaScanEntry *entries;
+    bool extension;
+} ScanJob;
+
+static bool grow(void **buffer, size_t *capacity, size_t size, size_t element_size) {
+    if (size <= *capacity) return true;
+
+    size_t new_capacity = *capacity * 2 > size ? *capacity * 2 : size;
+    void *new_buffer = realloc(*buffer, new_capacity * element_size);
+    if (!new_buffer) return false;
+
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Adds path to the list of paths
+static bool push_path(PathList *paths, const char *path, size_t length) {
+    if (!grow((void **)&paths->pool, &paths->pool_capacity, paths->pool_size + length + 1, 1) ||
+        !grow((void **)&paths->offsets, &paths->capacity, paths->count + 1, sizeof(size_t))) {
+        return false;
+    }
+
+    memcpy(paths->pool + paths->pool_size, path, length + 1);
+    paths->offsets[paths->count++] = paths->pool_size;
+    paths->pool_size += length + 1;
+    return true;
+}
+
+static bool has_tga_extension(const char *name) {
+    size_t length = strlen(name);
+    if (length < 4) return false;
+
+    const char *suffix = name + length - 4;
+    return suffix[0] == '.' && (suffix[1] | 0x20) == 't' && (suffix[2] | 0x20) == 'g' && (suffix[3] | 0x20) == 'a';
+}
+
+#ifdef RTGA_POSIX_FILES
+// Adds the .tga files in the directory at the first length bytes of path to
+// paths. path is a buffer of capacity bytes that names of entries are
+// appended to, and grows as the walk goes deeper.
+static int walk_directory(PathList *paths, char **path, size_t *capacity, size_t length, bool recursive) {
+    DIR *dir = opendir(*path);
+    if (!dir) return TGA_FILE_OPEN_ERROR;
+
+    int result = TGA_SUCCESS;
+    struct dirent *entry;
+    while (result == TGA_SUCCESS && (entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        size_t name_length = strlen(name);
+        size_t entry_length = length + 1 + name_length;
+        if (!grow((void **)path, capacity, entry_length + 1, 1)) {
+            result = TGA_ALLOCATION_ERROR;
+            break;
+        }
+        (*path)[length] = '/';
+        memcpy(*path + length + 1, name, name_length + 1);
+
+        // Most file systems give the type of an entry without another system
+        // call. Symbolic links to directories are not followed, so every walk
+        // ends.
+        bool is_file = has_tga_extension(name);
+        bool is_directory = false;
+#ifdef DT_DIR
+        if (entry->d_type != DT_UNKNOWN) {
+            is_directory = entry->d_type == DT_DIR;
+        } else
+#endif
+        if (recursive || is_file) {
+            struct stat st;
+            is_directory = lstat(*path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        if (is_directory && recursive) {
+            // Subdirectories that can not be opened are skipped
+            result = walk_directory(paths, path, capacity, entry_length, recursive);
+            if (result == TGA_FILE_OPEN_ERROR) result = TGA_SUCCESS;
+        } else if (is_file && !is_directory && !push_path(paths, *path, entry_length)) {
+            result = TGA_ALLOCATION_ERROR;
+        }
+        (*path)[length] = '\0';
+    }
+
+    closedir(dir);
+    return result;
+}
+#endif
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const TgaScanEntry *)a)->path, ((const TgaScanEntry *)b)->path);
+}
+
+static void probe_entry(void *context, unsigned worker, size_t index) {
+    (void)worker;
+    ScanJob *job = context;
+    TgaScanEntry *entry = &job->entries[index];
+    entry->result = tga_probe_file(entry->path, job->extension, &entry->probe);
+}
+
+int tga_scan_directory(const char *directory, const TgaScanOptions *options, TgaScanEntry **entries, size_t *entry_count) {
+    assert(directory);
+    assert(entries);
+    assert(entry_count);
+
+    *entries = NULL;
+    *entry_count = 0;
+
+#ifdef RTGA_POSIX_FILES
+    // Walk the directory tree on one thread, since listing directories is
+    // cheap next to opening every file
+    PathList paths;
+    memset(&paths, 0, sizeof(paths));
+    size_t length = strlen(directory);
+    size_t capacity = length + 1;
+    char *path = malloc(capacity);
+    if (!path) return TGA_ALLOCATION_ERROR;
+    memcpy(path, directory, capacity);
+
+    int result = walk_directory(&paths, &path, &capacity, length, options && options->recursive);
+    free(path);
+    if (result != TGA_SUCCESS || paths.count == 0) {
+        free(paths.pool);
+        free(paths.offsets);
+        return result;
+    }
+
+    // Entries and their paths share one allocation, so a single free
+    // releases them
+    size_t entries_size = paths.count * sizeof(TgaScanEntry);
+    TgaScanEntry *block = malloc(entries_size + paths.pool_size);
+    if (!block) {
+        free(paths.pool);
+        free(paths.offsets);
+        return TGA_ALLOCATION_ERROR;
+    }
+    char *pool = (char *)block + entries_size;
+    memcpy(pool, paths.pool, paths.pool_size);
+    for (size_t i = 0; i < paths.count; ++i) {
+        memset(&block[i], 0, sizeof(TgaScanEntry));
+        block[i].path = pool + paths.offsets[i];
+    }
+    size_t count = paths.count;
+    free(paths.pool);
+    free(paths.offsets);
+    qsort(block, count, sizeof(TgaScanEntry), compare_entries);
+
+    // Probing waits on the file system far more than on the CPU, so twice as
+    // many threads as CPUs keep more requests in flight
+    unsigned thread_count = options ? options->thread_count : 0;
+    if (thread_count == 0) thread_count = rtga_thread_count(0) * 2;
+    thread_count = rtga_thread_count(thread_count);
+
+    ScanJob job = {block, options && options->extension};
+    rtga_parallel_for(count, thread_count, probe_entry, &job);
+
+    *entries = block;
+    *entry_count = count;
+    return TGA_SUCCESS;
+#else
+    (void)options;
+    return TGA_FILE_OPEN_ERROR;
+#endif
+}
+
+void tga_scan_free(TgaScanEntry *entries) {
+    free(entries);
+}
@@ -0,0 +1,675 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+// Fraction bits of the fixed point filter weights. Weights are 16-bit so
+// that SSE2 multiplies and adds them in pairs, and 14 bits leave room for
+// the lobes of Lanczos weights to go above 1.
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define WEIGHT_HALF (1 << (WEIGHT_BITS - 1))
+
+// Rows resampled by one task of a parallel pass
+#define BAND_ROWS 16
+
+#define PI 3.14159265358979323846
+
+//
+// Filters
+//
+
+static double box_filter(double x) {
+    return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+}
+
+static double bilinear_filter(double x) {
+    x = fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= PI;
+    return sin(x) / x;
+}
+
+static double lanczos_filter(double x) {
+    return x > -3.0 && x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+typedef struct {
+    double (*function)(double x);
+    // Distance from the center beyond which the filter is 0
+    double support;
+} Filter;
+
+static const Filter FILTERS[] = {
+    [TGA_FILTER_BOX] = {box_filter, 0.5},
+    [TGA_FILTER_BILINEAR] = {bilinear_filter, 1.0},
+    [TGA_FILTER_LANCZOS] = {lanczos_filter, 3.0},
+};
+
+// Weights of the source pixels that make up each pixel along one axis.
+// Output pixel i is the sum of count[i] source pixels from first[i], each
+// multiplied by the weights at i * taps.
+typedef struct {
+    int16_t *weights;
+    uint32_t *first;
+    uint32_t *count;
+    size_t taps;
+} Axis;
+
+// Builds the weights that resample in_size pixels into out_size pixels.
+// Downscaling stretches the filter over the source pixels that each output
+// pixel covers, so every source pixel counts.
+static int build_axis(Axis *axis, uint32_t in_size, uint32_t out_size, const Filter *filter, const TgaAllocator *allocator) {
+    double scale = (double)in_size / out_size;
+    double filter_scale = scale > 1.0 ? scale : 1.0;
+    double support = filter->support * filter_scale;
+    size_t taps = (size_t)ceil(support) * 2 + 1;
+
+    axis->taps = taps;
+    axis->weights = rtga_alloc(allocator, out_size * taps * sizeof(int16_t));
+    axis->first = rtga_alloc(allocator, out_size * sizeof(uint32_t));
+    axis->count = rtga_alloc(allocator, out_size * sizeof(uint32_t));
+    double *scratch = rtga_alloc(allocator, taps * sizeof(double));
+    if (!axis->weights || !axis->first || !axis->count || !scratch) {
+        rtga_free(allocator, scratch);
+        return TGA_ALLOCATION_ERROR;
+    }
+
+    for (uint32_t i = 0; i < out_size; ++i) {
+        double center = (i + 0.5) * scale;
+        double low = center - support + 0.5;
+        double high = center + support + 0.5;
+        uint32_t first = low > 0.0 ? (uint32_t)low : 0;
+        uint32_t end = high < in_size ? (uint32_t)high : in_size;
+        if (end - first > taps) end = first + (uint32_t)taps;
+
+        double sum = 0.0;
+        for (uint32_t j = first; j < end; ++j) {
+            scratch[j - first] = filter->function((j + 0.5 - center) / filter_scale);
+            sum += scratch[j - first];
+        }
+
+        // Round to fixed point and give the rounding error to the largest
+        // weight, so weights add up to exactly 1 and flat areas stay flat
+        int16_t *weights = axis->weights + i * taps;
+        int32_t total = 0;
+        uint32_t largest = 0;
+        for (uint32_t j = 0; j < end - first; ++j) {
+            double weight = sum != 0.0 ? scratch[j] / sum : 0.0;
+            weights[j] = (int16_t)lround(weight * WEIGHT_ONE);
+            total += weights[j];
+            if (weights[j] > weights[largest]) largest = j;
+        }
+        weights[largest] = (int16_t)(weights[largest] + WEIGHT_ONE - total);
+
+        // Drop zero weights from both ends
+        uint32_t count = end - first;
+        uint32_t skip = 0;
+        while (count > 1 && weights[skip] == 0) {
+            ++skip;
+            --count;
+        }
+        while (count > 1 && weights[skip + count - 1] == 0) --count;
+        memmove(weights, weights + skip, count * sizeof(int16_t));
+
+        axis->first[i] = first + skip;
+        axis->count[i] = count;
+    }
+
+    rtga_free(allocator, scratch);
+    return TGA_SUCCESS;
+}
+
+static void free_axis(Axis *axis, const TgaAllocator *allocator) {
+    rtga_free(allocator, axis->weights);
+    rtga_free(allocator, axis->first);
+    rtga_free(allocator, axis->count);
+}
+
+// Returns a fixed point sum as a byte
+static inline uint8_t clamp_sum(int32_t sum) {
+    sum >>= WEIGHT_BITS;
+    return (uint8_t)(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+}
+
+//
+// Horizontal kernels
+//
+
+// Resamples one row of pixels of pixel_size bytes along axis into width
+// pixels
+static inline void resample_row_scalar(uint8_t *dst, const uint8_t *src, const Axis *axis, size_t start, size_t width, uint8_t pixel_size) {
+    for (size_t x = start; x < width; ++x) {
+        const int16_t *weights = axis->weights + x * axis->taps;
+        const uint8_t *pixels = src + (size_t)axis->first[x] * pixel_size;
+        int32_t sums[4] = {WEIGHT_HALF, WEIGHT_HALF, WEIGHT_HALF, WEIGHT_HALF};
+
+        for (uint32_t k = 0; k < axis->count[x]; ++k) {
+            for (uint8_t c = 0; c < pixel_size; ++c) {
+                sums[c] += weights[k] * pixels[k * pixel_size + c];
+            }
+        }
+        for (uint8_t c = 0; c < pixel_size; ++c) {
+            dst[x * pixel_size + c] = clamp_sum(sums[c]);
+        }
+    }
+}
+
+#ifdef RTGA_SSE2
+// Returns a pair of weights in every 32-bit lane, the way madd expects them
+static inline __m128i weight_pair(int16_t a, int16_t b) {
+    return _mm_set1_epi32((int)((uint32_t)(uint16_t)a | (uint32_t)(uint16_t)b << 16));
+}
+
+// Resamples pixels of 3 or 4 bytes with every channel in its own 32-bit
+// lane, taking two source pixels at a time
+static inline size_t resample_row_sse2(uint8_t *dst, const uint8_t *src, const Axis *axis, size_t width, uint8_t pixel_size) {
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t x = 0; x < width; ++x) {
+        const int16_t *weights = axis->weights + x * axis->taps;
+        const uint8_t *pixels = src + (size_t)axis->first[x] * pixel_size;
+        uint32_t count = axis->count[x];
+        __m128i sum = _mm_set1_epi32(WEIGHT_HALF);
+
+        uint32_t k = 0;
+        for (; k + 1 < count; k += 2) {
+            // The first pixel of a pair has another after it, so a 24-bit
+            // pixel can be loaded as 4 bytes, whose last lane is dropped
+            uint32_t first;
+            memcpy(&first, pixels + k * pixel_size, 4);
+            __m128i a = _mm_cvtsi32_si128((int)first);
+            __m128i b = _mm_cvtsi32_si128((int)rtga_load_pixel(pixels + (k + 1) * pixel_size, pixel_size));
+            __m128i pair = _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, b), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, weight_pair(weights[k], weights[k + 1])));
+        }
+        if (k < count) {
+            __m128i a = _mm_cvtsi32_si128((int)rtga_load_pixel(pixels + k * pixel_size, pixel_size));
+            __m128i single = _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, zero), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(single, weight_pair(weights[k], 0)));
+        }
+
+        sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+        sum = _mm_packs_epi32(sum, sum);
+        rtga_store_pixel(dst + x * pixel_size, (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)), pixel_size);
+    }
+    return width;
+}
+
+// Resamples 8-bit pixels eight source pixels at a time, which pays off
+// when downscaling stretches the filter over many of them
+static inline size_t resample_gray_sse2(uint8_t *dst, const uint8_t *src, const Axis *axis, size_t width) {
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t x = 0; x < width; ++x) {
+        const int16_t *weights = axis->weights + x * axis->taps;
+        const uint8_t *pixels = src + axis->first[x];
+        uint32_t count = axis->count[x];
+        __m128i sums = _mm_setzero_si128();
+
+        uint32_t k = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m128i values = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pixels + k)), zero);
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(values, _mm_loadu_si128((const __m128i *)(weights + k))));
+        }
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        int32_t sum = WEIGHT_HALF + _mm_cvtsi128_si32(sums);
+        for (; k < count; ++k) {
+            sum += weights[k] * pixels[k];
+        }
+        dst[x] = clamp_sum(sum);
+    }
+    return width;
+}
+#endif
+
+// Resamples a row of pixels of pixel_size bytes, which is 1, 3 or 4
+static void resample_row(uint8_t *dst, const uint8_t *src, const Axis *axis, size_t width, uint8_t pixel_size) {
+    size_t x = 0;
+
+    switch (pixel_size) {
+    case 1:
+#ifdef RTGA_SSE2
+        x = resample_gray_sse2(dst, src, axis, width);
+#endif
+        resample_row_scalar(dst, src, axis, x, width, 1);
+        break;
+    case 3:
+#ifdef RTGA_SSE2
+        x = resample_row_sse2(dst, src, axis, width, 3);
+#endif
+        resample_row_scalar(dst, src, axis, x, width, 3);
+        break;
+    default:
+#ifdef RTGA_SSE2
+        x = resample_row_sse2(dst, src, axis, width, 4);
+#endif
+        resample_row_scalar(dst, src, axis, x, width, 4);
+        break;
+    }
+}
+
+//
+// Vertical kernels
+//
+
+#ifdef RTGA_SSE2
+// Returns the weighted sum of 16 bytes of rows a and b in four vectors of
+// 32-bit lanes
+static inline void madd_rows(__m128i sums[4], __m128i a, __m128i b, __m128i weights) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(a, b);
+    __m128i high = _mm_unpackhi_epi8(a, b);
+
+    sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), weights));
+    sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), weights));
+    sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), weights));
+    sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), weights));
+}
+
+// Sums count rows stride bytes apart, 16 bytes and two rows at a time
+static size_t resample_column_sse2(uint8_t *dst, const uint8_t *src, size_t stride, const int16_t *weights, uint32_t count, size_t size) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i sums[4];
+        sums[0] = sums[1] = sums[2] = sums[3] = _mm_set1_epi32(WEIGHT_HALF);
+
+        uint32_t k = 0;
+        for (; k + 1 < count; k += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + k * stride + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + (k + 1) * stride + i));
+            madd_rows(sums, a, b, weight_pair(weights[k], weights[k + 1]));
+        }
+        if (k < count) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + k * stride + i));
+            madd_rows(sums, a, _mm_setzero_si128(), weight_pair(weights[k], 0));
+        }
+
+        __m128i low = _mm_packs_epi32(_mm_srai_epi32(sums[0], WEIGHT_BITS), _mm_srai_epi32(sums[1], WEIGHT_BITS));
+        __m128i high = _mm_packs_epi32(_mm_srai_epi32(sums[2], WEIGHT_BITS), _mm_srai_epi32(sums[3], WEIGHT_BITS));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(low, high));
+    }
+    return i;
+}
+#endif
+
+// Resamples size bytes of a row from count rows stride bytes apart. Every
+// byte is a channel on its own, so pixels need no special handling.
+static void resample_column(uint8_t *dst, const uint8_t *src, size_t stride, const int16_t *weights, uint32_t count, size_t size) {
+    size_t i = 0;
+
+#ifdef RTGA_SSE2
+    i = resample_column_sse2(dst, src, stride, weights, count, size);
+#endif
+    for (; i < size; ++i) {
+        int32_t sum = WEIGHT_HALF;
+        for (uint32_t k = 0; k < count; ++k) {
+            sum += weights[k] * src[k * stride + i];
+        }
+        dst[i] = clamp_sum(sum);
+    }
+}
+
+//
+// Passes
+//
+
+// State shared by the tasks of a resize. 15-bit and 16-bit pixels are
+// resampled as 32-bit pixels, so that every channel is a whole byte.
+typedef struct {
+    const TgaView *dst;
+    const TgaView *src;
+    Axis horizontal;
+    Axis vertical;
+    bool resample_rows;
+    bool resample_columns;
+    bool unpack;
+    bool src_alpha;
+    // Pixel size that the kernels work on
+    uint8_t pixel_size;
+    // Source rows that the vertical pass reads, from rows_first up to
+    // rows_end, resampled horizontally into rows
+    uint32_t rows_first;
+    uint32_t rows_end;
+    uint8_t *rows;
+    size_t rows_stride;
+    // Two rows per worker, to unpack source pixels and pack results into
+    uint8_t *scratch;
+    size_t scratch_size;
+} Resize;
+
+static void horizontal_task(void *context, unsigned worker, size_t index) {
+    Resize *resize = context;
+    const TgaView *src = resize->src;
+    const TgaView *dst = resize->dst;
+    uint8_t *unpacked = resize->scratch + worker * resize->scratch_size * 2;
+    uint8_t *packed = unpacked + resize->scratch_size;
+
+    uint32_t first = resize->rows_first + (uint32_t)index * BAND_ROWS;
+    uint32_t end = first + BAND_ROWS < resize->rows_end ? first + BAND_ROWS : resize->rows_end;
+    for (uint32_t y = first; y < end; ++y) {
+        const uint8_t *src_row = src->data + y * src->stride;
+        if (resize->unpack) {
+            rtga_convert_pixels(unpacked, 32, src_row, src->pixel_depth, src->width, resize->src_alpha);
+            src_row = unpacked;
+        }
+
+        if (resize->resample_columns) {
+            uint8_t *row = resize->rows + (y - resize->rows_first) * resize->rows_stride;
+            resample_row(row, src_row, &resize->horizontal, dst->width, resize->pixel_size);
+        } else if (resize->unpack) {
+            resample_row(packed, src_row, &resize->horizontal, dst->width, 4);
+            rtga_convert_pixels(dst->data + y * dst->stride, dst->pixel_depth, packed, 32, dst->width, true);
+        } else {
+            resample_row(dst->data + y * dst->stride, src_row, &resize->horizontal, dst->width, resize->pixel_size);
+        }
+    }
+}
+
+static void vertical_task(void *context, unsigned worker, size_t index) {
+    Resize *resize = context;
+    const TgaView *dst = resize->dst;
+    uint8_t *packed = resize->scratch + worker * resize->scratch_size * 2;
+
+    // Columns of an image as wide as the source come straight from it
+    const uint8_t *rows = resize->resample_rows ? resize->rows : resize->src->data;
+    size_t rows_stride = resize->resample_rows ? resize->rows_stride : resize->src->stride;
+    size_t row_size = (size_t)dst->width * resize->pixel_size;
+
+    uint32_t first = (uint32_t)index * BAND_ROWS;
+    uint32_t end = first + BAND_ROWS < dst->height ? first + BAND_ROWS : dst->height;
+    for (uint32_t y = first; y < end; ++y) {
+        const Axis *axis = &resize->vertical;
+        const uint8_t *src = rows + (axis->first[y] - resize->rows_first) * rows_stride;
+        uint8_t *dst_row = dst->data + y * dst->stride;
+
+        if (resize->unpack) {
+            resample_column(packed, src, rows_stride, axis->weights + y * axis->taps, axis->count[y], row_size);
+            rtga_convert_pixels(dst_row, dst->pixel_depth, packed, 32, dst->width, true);
+        } else {
+            resample_column(dst_row, src, rows_stride, axis->weights + y * axis->taps, axis->count[y], row_size);
+        }
+    }
+}
+
+static size_t band_count(uint32_t row_count) {
+    return (row_count + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+// Resamples src into dst, horizontally into a buffer of rows and then
+// vertically into dst, skipping either pass along an axis that keeps its size
+static int resize_view(const TgaView *dst, const TgaView *src, TgaFilter filter, unsigned thread_count, bool src_alpha, const TgaAllocator *allocator) {
+    if (!tga_valid_depth(src->pixel_depth) || dst->pixel_depth != src->pixel_depth) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (!dst->width || !dst->height || !src->width || !src->height) return TGA_SUCCESS;
+
+    Resize resize;
+    memset(&resize, 0, sizeof(resize));
+    resize.dst = dst;
+    resize.src = src;
+    resize.unpack = src->pixel_depth == 15 || src->pixel_depth == 16;
+    resize.src_alpha = src_alpha;
+    resize.pixel_size = resize.unpack ? 4 : (uint8_t)((src->pixel_depth + 7) / 8);
+    resize.resample_rows = resize.unpack || dst->width != src->width;
+    resize.resample_columns = dst->height != src->height;
+
+    if (!resize.resample_rows && !resize.resample_columns) {
+        for (uint16_t y = 0; y < dst->height; ++y) {
+            memmove(dst->data + y * dst->stride, src->data + y * src->stride, (size_t)dst->width * resize.pixel_size);
+        }
+        return TGA_SUCCESS;
+    }
+
+    // Unknown filters fall back to the cheapest one
+    assert((unsigned)filter <= TGA_FILTER_LANCZOS);
+    const Filter *kernel = &FILTERS[(unsigned)filter <= TGA_FILTER_LANCZOS ? filter : TGA_FILTER_BOX];
+    thread_count = rtga_thread_count(thread_count);
+
+    int result = TGA_SUCCESS;
+    if (resize.resample_rows) result = build_axis(&resize.horizontal, src->width, dst->width, kernel, allocator);
+    resize.rows_end = src->height;
+    if (result == TGA_SUCCESS && resize.resample_columns) {
+        result = build_axis(&resize.vertical, src->height, dst->height, kernel, allocator);
+    }
+
+    // Only the source rows that some output row reads are resampled
+    if (result == TGA_SUCCESS && resize.resample_columns) {
+        resize.rows_first = src->height;
+        resize.rows_end = 0;
+        for (uint16_t y = 0; y < dst->height; ++y) {
+            uint32_t end = resize.vertical.first[y] + resize.vertical.count[y];
+            if (resize.vertical.first[y] < resize.rows_first) resize.rows_first = resize.vertical.first[y];
+            if (end > resize.rows_end) resize.rows_end = end;
+        }
+    }
+    if (result == TGA_SUCCESS && resize.resample_rows && resize.resample_columns) {
+        resize.rows_stride = (size_t)dst->width * resize.pixel_size;
+        resize.rows = rtga_alloc(allocator, (resize.rows_end - resize.rows_first) * resize.rows_stride);
+        if (!resize.rows) result = TGA_ALLOCATION_ERROR;
+    }
+    if (result == TGA_SUCCESS && resize.unpack) {
+        resize.scratch_size = (size_t)(src->width > dst->width ? src->width : dst->width) * 4;
+        resize.scratch = rtga_alloc(allocator, thread_count * resize.scratch_size * 2);
+        if (!resize.scratch) result = TGA_ALLOCATION_ERROR;
+    }
+
+    if (result == TGA_SUCCESS) {
+        if (resize.resample_rows) {
+            rtga_parallel_for(band_count(resize.rows_end - resize.rows_first), thread_count, horizontal_task, &resize);
+        }
+        if (resize.resample_columns) {
+            rtga_parallel_for(band_count(dst->height), thread_count, vertical_task, &resize);
+        }
+    }
+
+    rtga_free(allocator, resize.scratch);
+    rtga_free(allocator, resize.rows);
+    free_axis(&resize.vertical, allocator);
+    free_axis(&resize.horizontal, allocator);
+    return result;
+}
+
+//
+// Images
+//
+
+int tga_resize_view(const TgaView *dst, const TgaView *src, TgaFilter filter, unsigned thread_count) {
+    assert(dst);
+    assert(src);
+
+    return resize_view(dst, src, filter, thread_count, true, NULL);
+}
+
+// Returns why the pixels of tga can not be resampled, if they can not
+static int check_image(const TgaImage *tga) {
+    if (tga->state != IS_UNCOMPRESSED) return TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    if (!tga_valid_depth(tga->header.image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    return TGA_SUCCESS;
+}
+
+int tga_resize(TgaImage *tga, uint16_t width, uint16_t height, TgaFilter filter, unsigned thread_count) {
+    assert(tga);
+
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+
+    TgaHeader *header = &tga->header;
+    if (header->width == width && header->height == height) return TGA_SUCCESS;
+
+    TgaView src = tga_image_view(tga);
+    TgaView dst;
+    size_t size = (size_t)width * height * tga_pixel_size(header);
+    uint8_t *image_data = rtga_alloc(&tga->allocator, size);
+    uint8_t *color_map_data = rtga_owned_copy(tga, tga->color_map_data, rtga_color_map_size(header));
+    if ((!image_data && size > 0) || (tga->color_map_data && !color_map_data)) {
+        result = TGA_ALLOCATION_ERROR;
+    } else {
+        tga_view_init(&dst, image_data, width, height, 0, header->image_pixel_depth);
+        result = resize_view(&dst, &src, filter, thread_count, (header->descriptor & 0x0f) != 0, &tga->allocator);
+    }
+    if (result == TGA_SUCCESS) result = rtga_replace_buffers(tga, image_data, color_map_data);
+    if (result != TGA_SUCCESS) {
+        rtga_free(&tga->allocator, image_data);
+        if (color_map_data != tga->color_map_data) rtga_free(&tga->allocator, color_map_data);
+        return result;
+    }
+
+    header->width = width;
+    header->height = height;
+    return TGA_SUCCESS;
+}
+
+//
+// Mipmaps
+//
+
+unsigned tga_mipmap_count(uint16_t width, uint16_t height) {
+    unsigned count = 0;
+    unsigned size = width > height ? width : height;
+
+    if (!width || !height) return 0;
+    while (size) {
+        ++count;
+        size >>= 1;
+    }
+    return count;
+}
+
+// Returns image_type uncompressed, or run-length encoded if rle
+static TgaImageType level_type(TgaImageType image_type, bool rle) {
+    TgaImageType base = tga_is_rle(image_type) ? (TgaImageType)(image_type - 8) : image_type;
+    return rle ? (TgaImageType)(base + 8) : base;
+}
+
+// Writes a level with the image type that options ask for
+static int write_level(const TgaImage *level, const char *filename, bool rle) {
+    TgaImage file = *level;
+    file.header.image_type = level_type(level->header.image_type, rle);
+    return tga_write_file(&file, filename);
+}
+
+int tga_generate_mipmaps(TgaImage *tga, const TgaMipmapOptions *options, TgaImage *levels, const char *const *filenames) {
+    static const TgaMipmapOptions default_options = {TGA_FILTER_BOX, 0, false};
+
+    assert(tga);
+
+    int result = check_image(tga);
+    if (result != TGA_SUCCESS) return result;
+    if (!options) options = &default_options;
+
+    const TgaHeader *header = &tga->header;
+    unsigned count = tga_mipmap_count(header->width, header->height);
+    bool alpha = (header->descriptor & 0x0f) != 0;
+    if (count > 0 && filenames && filenames[0]) {
+        result = write_level(tga, filenames[0], options->rle);
+        if (result != TGA_SUCCESS) return result;
+    }
+
+    // Each level is resampled from the one before it. Without levels to
+    // keep, two images take turns, and each reuses the buffer of the
+    // larger level two steps up.
+    TgaImage scratch[2];
+    memset(scratch, 0, sizeof(scratch));
+    const TgaImage *previous = tga;
+    unsigned allocated = 0;
+    for (unsigned level = 1; level < count && result == TGA_SUCCESS; ++level) {
+        uint16_t width = previous->header.width > 1 ? previous->header.width / 2 : 1;
+        uint16_t height = previous->header.height > 1 ? previous->header.height / 2 : 1;
+        TgaImage *image = levels ? &levels[level - 1] : &scratch[level % 2];
+
+        if (!levels && image->image_data) {
+            image->header.width = width;
+            image->header.height = height;
+        } else {
+            result = tga_alloc_ex(level_type(header->image_type, false), width, height, header->image_pixel_depth, &tga->allocator, image);
+            if (result != TGA_SUCCESS) break;
+            image->header.descriptor = header->descriptor;
+            ++allocated;
+        }
+
+        TgaView src = tga_image_view((TgaImage *)previous);
+        TgaView dst = tga_image_view(image);
+        result = resize_view(&dst, &src, options->filter, options->thread_count, alpha, &tga->allocator);
+        if (result == TGA_SUCCESS && filenames && filenames[level]) {
+            result = write_level(image, filenames[level], options->rle);
+        }
+        previous = image;
+    }
+
+    tga_free(&scratch[0]);
+    tga_free(&scratch[1]);
+    if (result != TGA_SUCCESS && levels) {
+        for (unsigned i = 0; i < allocated; ++i) {
+            tga_free(&levels[i]);
+        }
+    }
+    return result;
+}
+
+//
+// Postage stamps
+//
+
+size_t rtga_postage_stamp_size(const TgaImage *tga, uint8_t max_size, uint8_t *width, uint8_t *height) {
+    const TgaHeader *header = &tga->header;
+    if (max_size == 0 || !header->width || !header->height || tga->state == IS_RLE) return 0;
+    if (!tga_valid_depth(header->image_pixel_depth)) return 0;
+
+    // The longer side shrinks to max_size and the other keeps the aspect
+    // ratio, rounded and at least a pixel
+    uint32_t long_side = header->width > header->height ? header->width : header->height;
+    uint32_t long_stamp = long_side < max_size ? long_side : max_size;
+    uint32_t stamp_width = (header->width * long_stamp * 2 + long_side) / (long_side * 2);
+    uint32_t stamp_height = (header->height * long_stamp * 2 + long_side) / (long_side * 2);
+    *width = (uint8_t)(stamp_width > 0 ? stamp_width : 1);
+    *height = (uint8_t)(stamp_height > 0 ? stamp_height : 1);
+
+    return 2 + (size_t)*width * *height * tga_pixel_size(header);
+}
+
+int rtga_make_postage_stamp(const TgaImage *tga, uint8_t max_size, unsigned thread_count, uint8_t **stamp, size_t *size) {
+    const TgaHeader *header = &tga->header;
+    uint8_t width, height;
+    *stamp = NULL;
+    *size = rtga_postage_stamp_size(tga, max_size, &width, &height);
+    if (*size == 0) return TGA_SUCCESS;
+
+    uint8_t *data = rtga_alloc(&tga->allocator, *size);
+    if (!data) return TGA_ALLOCATION_ERROR;
+    data[0] = width;
+    data[1] = height;
+
+    int result = TGA_SUCCESS;
+    TgaView dst;
+    tga_view_init(&dst, data + 2, width, height, 0, header->image_pixel_depth);
+    bool color_mapped = tga->state == IS_COLOR_MAPPED || header->image_type == UNCOMPRESSED_COLOR_MAPPED_IMAGE ||
+                        header->image_type == RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE;
+    if (color_mapped) {
+        // Each index is taken from the middle of the pixels it stands for
+        uint8_t pixel_size = tga_pixel_size(header);
+        size_t row_size = (size_t)header->width * pixel_size;
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t *src = tga->image_data + ((y * 2 + 1) * header->height / (height * 2)) * row_size;
+            for (uint32_t x = 0; x < width; ++x) {
+                memcpy(dst.data + y * dst.stride + x * pixel_size, src + ((x * 2 + 1) * header->width / (width * 2)) * pixel_size, pixel_size);
+            }
+        }
+    } else {
+        TgaView src = tga_image_view((TgaImage *)tga);
+        result = resize_view(&dst, &src, TGA_FILTER_BOX, thread_count, (header->descriptor & 0x0f) != 0, &tga->allocator);
+    }
+
+    if (result != TGA_SUCCESS) {
+        rtga_free(&tga->allocator, data);
+        return result;
+    }
+    *stamp = data;
+    return TGA_SUCCESS;
+}
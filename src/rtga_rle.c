@@ -0,0 +1,203 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Largest number of pixels a single RLE packet can hold
+#define RLE_MAX_PACKET 128
+
+// Packet header bit that marks a run-length packet
+#define RLE_RUN_BIT 0x80
+
+//
+// Run detection
+//
+
+// Returns the number of pixels starting at index that equal the pixel at
+// index, stopping at limit.
+static size_t rle_run_length(const uint8_t *src, size_t index, size_t limit, uint8_t pixel_size) {
+    // A run continues for as long as every byte equals the byte one pixel back
+    size_t byte = (index + 1) * pixel_size;
+    size_t end = limit * pixel_size;
+
+#ifdef RTGA_SSE2
+    while (end - byte >= 16) {
+        __m128i current = _mm_loadu_si128((const __m128i *)(src + byte));
+        __m128i previous = _mm_loadu_si128((const __m128i *)(src + byte - pixel_size));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(current, previous));
+        if (mask != 0xffff) {
+            byte += rtga_ctz(~mask);
+            return byte / pixel_size - index;
+        }
+        byte += 16;
+    }
+#endif
+
+    while (byte < end && src[byte] == src[byte - pixel_size]) {
+        ++byte;
+    }
+    return byte / pixel_size - index;
+}
+
+#ifdef RTGA_SSE2
+// Reduces a byte equality mask to one bit per pixel that is set when every
+// byte of that pixel matched. Only pixels that fit entirely within the 16
+// bytes are kept.
+static inline uint32_t rle_pixel_mask(uint32_t mask, uint8_t pixel_size) {
+    switch (pixel_size) {
+    case 1:
+        return mask;
+    case 2:
+        return mask & (mask >> 1) & 0x5555;
+    case 3:
+        return mask & (mask >> 1) & (mask >> 2) & 0x1249;
+    default:
+        return mask & (mask >> 1) & (mask >> 2) & (mask >> 3) & 0x1111;
+    }
+}
+#endif
+
+// Returns the first index in [index, limit) whose pixel equals the pixel
+// after it, or limit if there is none. The pixel at limit must exist.
+static size_t rle_find_repeat(const uint8_t *src, size_t index, size_t limit, uint8_t pixel_size) {
+#ifdef RTGA_SSE2
+    size_t pixels_per_vec = 16 / pixel_size;
+
+    // Loads reach one byte past the last whole pixel for 24-bit pixels
+    while (limit - index > pixels_per_vec) {
+        const uint8_t *next = src + (index + 1) * pixel_size;
+        __m128i current = _mm_loadu_si128((const __m128i *)next);
+        __m128i previous = _mm_loadu_si128((const __m128i *)(next - pixel_size));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(current, previous));
+        mask = rle_pixel_mask(mask, pixel_size);
+        if (mask) {
+            return index + rtga_ctz(mask) / pixel_size;
+        }
+        index += pixels_per_vec;
+    }
+#endif
+
+    for (; index < limit; ++index) {
+        const uint8_t *pixel = src + index * pixel_size;
+        if (memcmp(pixel, pixel + pixel_size, pixel_size) == 0) break;
+    }
+    return index;
+}
+
+//
+// Encoding
+//
+
+size_t tga_rle_bound(size_t pixel_count, uint8_t pixel_size) {
+    return pixel_count * pixel_size + (pixel_count + RLE_MAX_PACKET - 1) / RLE_MAX_PACKET;
+}
+
+// Encodes packets into dst, or only counts their bytes when dst is NULL
+static size_t rle_encode(uint8_t *dst, const uint8_t *src, size_t pixel_count, uint8_t pixel_size) {
+    size_t out = 0;
+    size_t index = 0;
+
+    // A run of two 1-byte pixels costs as much as the raw pixels, and ending
+    // a raw packet for it costs an extra packet header
+    size_t min_run = pixel_size == 1 ? 3 : 2;
+
+    while (index < pixel_count) {
+        size_t limit = pixel_count - index > RLE_MAX_PACKET ? index + RLE_MAX_PACKET : pixel_count;
+        size_t run = rle_run_length(src, index, limit, pixel_size);
+
+        if (run >= min_run) {
+            // Run-length packet
+            if (dst) {
+                dst[out] = (uint8_t)(RLE_RUN_BIT | (run - 1));
+                memcpy(dst + out + 1, src + index * pixel_size, pixel_size);
+            }
+            out += 1 + pixel_size;
+            index += run;
+        } else {
+            // Raw packet up to the start of the next run. The last pixel has
+            // no successor, so it is never the start of a run.
+            size_t search_limit = limit < pixel_count ? limit : pixel_count - 1;
+            size_t end = index + 1 < search_limit
+                ? rle_find_repeat(src, index + 1, search_limit, pixel_size)
+                : search_limit;
+            while (end < search_limit && rle_run_length(src, end, limit, pixel_size) < min_run) {
+                end = end + 1 < search_limit ? rle_find_repeat(src, end + 1, search_limit, pixel_size) : search_limit;
+            }
+            if (end == search_limit) end = limit;
+            size_t count = end - index;
+
+            if (dst) {
+                dst[out] = (uint8_t)(count - 1);
+                memcpy(dst + out + 1, src + index * pixel_size, count * pixel_size);
+            }
+            out += 1 + count * pixel_size;
+            index = end;
+        }
+    }
+
+    return out;
+}
+
+size_t tga_rle_encode(uint8_t *dst, const uint8_t *src, size_t pixel_count, uint8_t pixel_size) {
+    assert(dst);
+    assert(src || pixel_count == 0);
+    assert(pixel_size >= 1 && pixel_size <= 4);
+
+    RTGA_STATS_BEGIN(start);
+    size_t size = rle_encode(dst, src, pixel_count, pixel_size);
+    RTGA_STATS_END(start, TGA_PHASE_ENCODE, pixel_count * pixel_size);
+    return size;
+}
+
+size_t tga_rle_encoded_size(const uint8_t *src, size_t pixel_count, uint8_t pixel_size) {
+    assert(src || pixel_count == 0);
+    assert(pixel_size >= 1 && pixel_size <= 4);
+
+    return rle_encode(NULL, src, pixel_count, pixel_size);
+}
+
+//
+// Decoding
+//
+
+static int rle_decode(uint8_t *dst, size_t pixel_count, const uint8_t *src, size_t src_size, uint8_t pixel_size, size_t *bytes_read) {
+    size_t in = 0;
+    size_t remaining = pixel_count;
+
+    while (remaining > 0) {
+        // Bounds are checked once per packet
+        if (in >= src_size) return TGA_RLE_DECODE_ERROR;
+        uint8_t packet = src[in++];
+        size_t count = (packet & ~RLE_RUN_BIT) + 1;
+        if (count > remaining) return TGA_RLE_DECODE_ERROR;
+
+        if (packet & RLE_RUN_BIT) {
+            if (src_size - in < pixel_size) return TGA_RLE_DECODE_ERROR;
+            rtga_replicate_pixel(dst, src + in, count, pixel_size);
+            in += pixel_size;
+        } else {
+            size_t size = count * pixel_size;
+            if (src_size - in < size) return TGA_RLE_DECODE_ERROR;
+            memcpy(dst, src + in, size);
+            in += size;
+        }
+
+        dst += count * pixel_size;
+        remaining -= count;
+    }
+
+    if (bytes_read) *bytes_read = in;
+
+    return TGA_SUCCESS;
+}
+
+int tga_rle_decode(uint8_t *dst, size_t pixel_count, const uint8_t *src, size_t src_size, uint8_t pixel_size, size_t *bytes_read) {
+    assert(dst || pixel_count == 0);
+    assert(src || src_size == 0);
+    assert(pixel_size >= 1 && pixel_size <= 4);
+
+    RTGA_STATS_BEGIN(start);
+    int result = rle_decode(dst, pixel_count, src, src_size, pixel_size, bytes_read);
+    RTGA_STATS_END(start, TGA_PHASE_DECODE, pixel_count * pixel_size);
+    return result;
+}
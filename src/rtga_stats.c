@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const PHASE_NAMES[TGA_PHASE_COUNT] = {
+    [TGA_PHASE_OPEN] = "open",
+    [TGA_PHASE_HEADER] = "header",
+    [TGA_PHASE_IO] = "io",
+    [TGA_PHASE_DECODE] = "decode",
+    [TGA_PHASE_ENCODE] = "encode",
+    [TGA_PHASE_ALLOC] = "alloc",
+};
+
+const char *tga_phase_name(TgaPhase phase) {
+    return (unsigned)phase < TGA_PHASE_COUNT ? PHASE_NAMES[phase] : "unknown";
+}
+
+#ifdef RTGA_STATS
+
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_PTHREADS 1
+#include <pthread.h>
+#endif
+
+// Most trace events one thread keeps, so that a forgotten trace can not
+// take all memory
+#define TRACE_MAX_EVENTS (1 << 20)
+
+typedef struct {
+    uint64_t start;
+    uint64_t duration;
+    uint64_t bytes;
+    TgaPhase phase;
+} TraceEvent;
+
+// Counters and trace events of one thread. Blocks are never freed. When a
+// thread exits, its counters move to the retired totals and its block goes
+// to the next thread that needs one, so short-lived workers do not pile up
+// blocks. The owner and anyone reading the block from another thread hold
+// its lock, which is only ever contended while stats are read.
+typedef struct ThreadStats {
+#ifdef RTGA_PTHREADS
+    pthread_mutex_t lock;
+#endif
+    TgaStats stats;
+    // Trace thread id
+    unsigned id;
+    bool in_use;
+    TraceEvent *events;
+    size_t event_count;
+    size_t event_capacity;
+    struct ThreadStats *next;
+} ThreadStats;
+
+static ThreadStats *registry = NULL;
+static unsigned next_id = 1;
+// Counters of threads that have exited
+static TgaStats retired;
+// Whether trace events are recorded, and when recording began, which
+// every thread reads without a lock
+static bool tracing = false;
+static uint64_t trace_start = 0;
+
+#ifdef __GNUC__
+#define LOAD(variable) __atomic_load_n(&(variable), __ATOMIC_ACQUIRE)
+#define STORE(variable, value) __atomic_store_n(&(variable), (value), __ATOMIC_RELEASE)
+#else
+#define LOAD(variable) (variable)
+#define STORE(variable, value) ((variable) = (value))
+#endif
+
+#ifdef RTGA_PTHREADS
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+#define LOCK() pthread_mutex_lock(&registry_lock)
+#define UNLOCK() pthread_mutex_unlock(&registry_lock)
+#define LOCK_BLOCK(block) pthread_mutex_lock(&(block)->lock)
+#define UNLOCK_BLOCK(block) pthread_mutex_unlock(&(block)->lock)
+#else
+#define LOCK() ((void)0)
+#define UNLOCK() ((void)0)
+#define LOCK_BLOCK(block) ((void)0)
+#define UNLOCK_BLOCK(block) ((void)0)
+#endif
+
+uint64_t rtga_stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void add_stats(TgaStats *total, const TgaStats *stats) {
+    for (int i = 0; i < TGA_PHASE_COUNT; ++i) {
+        total->phases[i].calls += stats->phases[i].calls;
+        total->phases[i].bytes += stats->phases[i].bytes;
+        total->phases[i].nanoseconds += stats->phases[i].nanoseconds;
+    }
+}
+
+#ifdef RTGA_PTHREADS
+// Retires the block of an exiting thread
+static void release_thread(void *value) {
+    ThreadStats *block = value;
+
+    LOCK();
+    LOCK_BLOCK(block);
+    add_stats(&retired, &block->stats);
+    memset(&block->stats, 0, sizeof(TgaStats));
+    UNLOCK_BLOCK(block);
+    block->in_use = false;
+    UNLOCK();
+}
+
+static void create_thread_key(void) {
+    pthread_key_create(&thread_key, release_thread);
+}
+#endif
+
+// Returns the block of the calling thread, taking one on its first call, or
+// NULL if there is no memory for one
+static ThreadStats *thread_stats(void) {
+#ifdef RTGA_PTHREADS
+    pthread_once(&thread_key_once, create_thread_key);
+    ThreadStats *block = pthread_getspecific(thread_key);
+    if (block) return block;
+#else
+    static ThreadStats *block = NULL;
+    if (block) return block;
+#endif
+
+    LOCK();
+    for (block = registry; block && block->in_use; block = block->next) {
+    }
+    if (!block) {
+        // Blocks come from calloc, since rtga_alloc is itself counted
+        block = calloc(1, sizeof(ThreadStats));
+        if (block) {
+#ifdef RTGA_PTHREADS
+            pthread_mutex_init(&block->lock, NULL);
+#endif
+            block->id = next_id++;
+            block->next = registry;
+            registry = block;
+        }
+    }
+    if (block) block->in_use = true;
+    UNLOCK();
+
+#ifdef RTGA_PTHREADS
+    if (block) pthread_setspecific(thread_key, block);
+#endif
+    return block;
+}
+
+// The caller holds the lock of block
+static void add_event(ThreadStats *block, TgaPhase phase, uint64_t start, uint64_t duration, uint64_t bytes) {
+    if (block->event_count == block->event_capacity) {
+        if (block->event_capacity >= TRACE_MAX_EVENTS) return;
+        size_t capacity = block->event_capacity ? block->event_capacity * 2 : 256;
+        TraceEvent *events = realloc(block->events, capacity * sizeof(TraceEvent));
+        if (!events) return;
+        block->events = events;
+        block->event_capacity = capacity;
+    }
+
+    TraceEvent *event = &block->events[block->event_count++];
+    event->start = start;
+    event->duration = duration;
+    event->bytes = bytes;
+    event->phase = phase;
+}
+
+void rtga_stats_record(TgaPhase phase, uint64_t start, uint64_t bytes) {
+    uint64_t duration = rtga_stats_now() - start;
+    ThreadStats *block = thread_stats();
+    if (!block) return;
+
+    LOCK_BLOCK(block);
+    TgaPhaseStats *stats = &block->stats.phases[phase];
+    ++stats->calls;
+    stats->bytes += bytes;
+    stats->nanoseconds += duration;
+    if (LOAD(tracing) && start >= LOAD(trace_start)) add_event(block, phase, start, duration, bytes);
+    UNLOCK_BLOCK(block);
+}
+
+bool tga_stats_enabled(void) {
+    return true;
+}
+
+void tga_stats_get(TgaStats *stats) {
+    assert(stats);
+
+    LOCK();
+    *stats = retired;
+    for (ThreadStats *block = registry; block; block = block->next) {
+        LOCK_BLOCK(block);
+        add_stats(stats, &block->stats);
+        UNLOCK_BLOCK(block);
+    }
+    UNLOCK();
+}
+
+void tga_stats_get_thread(TgaStats *stats) {
+    assert(stats);
+
+    ThreadStats *block = thread_stats();
+    if (block) {
+        LOCK_BLOCK(block);
+        *stats = block->stats;
+        UNLOCK_BLOCK(block);
+    } else {
+        memset(stats, 0, sizeof(TgaStats));
+    }
+}
+
+void tga_stats_reset(void) {
+    LOCK();
+    memset(&retired, 0, sizeof(TgaStats));
+    for (ThreadStats *block = registry; block; block = block->next) {
+        LOCK_BLOCK(block);
+        memset(&block->stats, 0, sizeof(TgaStats));
+        UNLOCK_BLOCK(block);
+    }
+    UNLOCK();
+}
+
+void tga_trace_begin(void) {
+    LOCK();
+    for (ThreadStats *block = registry; block; block = block->next) {
+        LOCK_BLOCK(block);
+        block->event_count = 0;
+        UNLOCK_BLOCK(block);
+    }
+    STORE(trace_start, rtga_stats_now());
+    STORE(tracing, true);
+    UNLOCK();
+}
+
+int tga_trace_end(const char *filename) {
+    assert(filename);
+
+    LOCK();
+    STORE(tracing, false);
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        UNLOCK();
+        return TGA_FILE_OPEN_ERROR;
+    }
+
+    // Complete events with times in microseconds from the start of the trace
+    bool first = true;
+    fprintf(fp, "{\"traceEvents\": [");
+    uint64_t start = LOAD(trace_start);
+    for (ThreadStats *block = registry; block; block = block->next) {
+        LOCK_BLOCK(block);
+        for (size_t i = 0; i < block->event_count; ++i) {
+            const TraceEvent *event = &block->events[i];
+            fprintf(fp, "%s\n  {\"name\": \"%s\", \"cat\": \"rtga\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %llu}}",
+                    first ? "" : ",", PHASE_NAMES[event->phase], block->id, (event->start - start) / 1000.0,
+                    event->duration / 1000.0, (unsigned long long)event->bytes);
+            first = false;
+        }
+        block->event_count = 0;
+        UNLOCK_BLOCK(block);
+    }
+    fprintf(fp, "\n], \"displayTimeUnit\": \"ns\"}\n");
+    UNLOCK();
+
+    bool failed = ferror(fp) != 0;
+    failed = fclose(fp) != 0 || failed;
+    return failed ? TGA_FILE_WRITE_ERROR : TGA_SUCCESS;
+}
+
+#else
+
+// Without instrumentation every counter stays 0 and traces are empty
+
+bool tga_stats_enabled(void) {
+    return false;
+}
+
+void tga_stats_get(TgaStats *stats) {
+    assert(stats);
+
+    memset(stats, 0, sizeof(TgaStats));
+}
+
+void tga_stats_get_thread(TgaStats *stats) {
+    assert(stats);
+
+    memset(stats, 0, sizeof(TgaStats));
+}
+
+void tga_stats_reset(void) {
+}
+
+void tga_trace_begin(void) {
+}
+
+int tga_trace_end(const char *filename) {
+    assert(filename);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return TGA_FILE_OPEN_ERROR;
+    fprintf(fp, "{\"traceEvents\": [], \"displayTimeUnit\": \"ns\"}\n");
+    bool failed = ferror(fp) != 0;
+    failed = fclose(fp) != 0 || failed;
+    return failed ? TGA_FILE_WRITE_ERROR : TGA_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,397 @@
+#include "rtga_internal.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+// Size of the buffer a reader keeps run-length encoded file data in
+#define READER_BUFFER_SIZE 65536
+
+// Packet header bit that marks a run-length packet
+#define RLE_RUN_BIT 0x80
+
+//
+// File callbacks
+//
+
+static size_t file_read(void *context, void *buffer, size_t size) {
+    RTGA_STATS_BEGIN(start);
+    size_t count = fread(buffer, 1, size, context);
+    RTGA_STATS_END(start, TGA_PHASE_IO, count);
+    return count;
+}
+
+static size_t file_write(void *context, const void *buffer, size_t size) {
+    RTGA_STATS_BEGIN(start);
+    size_t count = fwrite(buffer, 1, size, context);
+    RTGA_STATS_END(start, TGA_PHASE_IO, count);
+    return count;
+}
+
+static int file_seek(void *context, int64_t offset, int origin) {
+    if (offset < LONG_MIN || offset > LONG_MAX) return -1;
+    return fseek(context, (long)offset, origin);
+}
+
+static TgaIo file_io(FILE *fp) {
+    TgaIo io = {file_read, file_write, file_seek, fp};
+    return io;
+}
+
+// Reads exactly size bytes
+static inline bool io_read(const TgaIo *io, void *buffer, size_t size) {
+    return io->read(io->context, buffer, size) == size;
+}
+
+// Writes exactly size bytes
+static inline bool io_write(const TgaIo *io, const void *buffer, size_t size) {
+    return io->write(io->context, buffer, size) == size;
+}
+
+//
+// Reader
+//
+
+// Closes the file the reader opened and frees everything it owns
+static void reader_release(TgaReader *reader) {
+    if (reader->fp) fclose(reader->fp);
+    rtga_free(&reader->allocator, reader->image_id);
+    rtga_free(&reader->allocator, reader->color_map_data);
+    rtga_free(&reader->allocator, reader->buffer);
+
+    reader->fp = NULL;
+    memset(&reader->io, 0, sizeof(TgaIo));
+    reader->image_id = NULL;
+    reader->color_map_data = NULL;
+    reader->buffer = NULL;
+}
+
+// Makes sure at least min_bytes of file data are buffered
+static int reader_fill(TgaReader *reader, size_t min_bytes) {
+    size_t available = reader->buffer_end - reader->buffer_start;
+    if (available >= min_bytes) return TGA_SUCCESS;
+
+    // Move the unread bytes to the front and read as much as fits after them
+    memmove(reader->buffer, reader->buffer + reader->buffer_start, available);
+    reader->buffer_start = 0;
+    reader->buffer_end = available;
+    reader->buffer_end += reader->io.read(reader->io.context, reader->buffer + available, READER_BUFFER_SIZE - available);
+
+    if (reader->buffer_end < min_bytes) return TGA_FILE_READ_ERROR;
+
+    return TGA_SUCCESS;
+}
+
+int tga_reader_open(TgaReader *reader, const char *filename) {
+    return rtga_reader_open(reader, filename, NULL);
+}
+
+int tga_reader_open_io(TgaReader *reader, const TgaIo *io) {
+    return rtga_reader_open_io(reader, io, NULL);
+}
+
+int rtga_reader_open(TgaReader *reader, const char *filename, const TgaAllocator *allocator) {
+    assert(reader);
+    assert(filename);
+
+    RTGA_STATS_BEGIN(start);
+    FILE *fp = fopen(filename, "rb");
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+    if (!fp) {
+        memset(reader, 0, sizeof(TgaReader));
+        return TGA_FILE_OPEN_ERROR;
+    }
+
+    TgaIo io = file_io(fp);
+    int result = rtga_reader_open_io(reader, &io, allocator);
+    if (result != TGA_SUCCESS) {
+        fclose(fp);
+        return result;
+    }
+    reader->fp = fp;
+
+    return TGA_SUCCESS;
+}
+
+int rtga_reader_open_io(TgaReader *reader, const TgaIo *io, const TgaAllocator *allocator) {
+    uint8_t header_bytes[TGA_HEADER_SIZE];
+
+    assert(reader);
+    assert(io && io->read);
+
+    memset(reader, 0, sizeof(TgaReader));
+    reader->io = *io;
+    if (allocator) reader->allocator = *allocator;
+
+    // Read header
+    if (!io_read(io, header_bytes, TGA_HEADER_SIZE)) {
+        reader_release(reader);
+        return TGA_FILE_READ_ERROR;
+    }
+    rtga_parse_header(&reader->header, header_bytes);
+
+    int result = rtga_check_header(&reader->header);
+    if (result != TGA_SUCCESS) {
+        reader_release(reader);
+        return result;
+    }
+    reader->pixel_size = tga_pixel_size(&reader->header);
+
+    // Read image id if it exists
+    if (reader->header.id_length > 0) {
+        reader->image_id = rtga_alloc(&reader->allocator, reader->header.id_length);
+        if (!reader->image_id) {
+            reader_release(reader);
+            return TGA_ALLOCATION_ERROR;
+        }
+        if (!io_read(io, reader->image_id, reader->header.id_length)) {
+            reader_release(reader);
+            return TGA_FILE_READ_ERROR;
+        }
+    }
+
+    // Read color map if it exists
+    size_t color_map_size = rtga_color_map_size(&reader->header);
+    if (color_map_size > 0) {
+        reader->color_map_data = rtga_alloc(&reader->allocator, color_map_size);
+        if (!reader->color_map_data) {
+            reader_release(reader);
+            return TGA_ALLOCATION_ERROR;
+        }
+        if (!io_read(io, reader->color_map_data, color_map_size)) {
+            reader_release(reader);
+            return TGA_FILE_READ_ERROR;
+        }
+    }
+
+    // Run-length encoded data is decoded out of a buffer
+    if (tga_is_rle(reader->header.image_type)) {
+        reader->buffer = rtga_alloc(&reader->allocator, READER_BUFFER_SIZE);
+        if (!reader->buffer) {
+            reader_release(reader);
+            return TGA_ALLOCATION_ERROR;
+        }
+    }
+
+    return TGA_SUCCESS;
+}
+
+// Decodes pixel_count pixels of run-length encoded data into dst. Packets
+// that cross into the next call are carried in the reader.
+static int reader_decode(TgaReader *reader, uint8_t *dst, size_t pixel_count) {
+    uint8_t pixel_size = reader->pixel_size;
+    int result;
+
+    while (pixel_count > 0) {
+        // Start the next packet
+        if (reader->packet_remaining == 0) {
+            if ((result = reader_fill(reader, 1)) != TGA_SUCCESS) return result;
+            uint8_t packet = reader->buffer[reader->buffer_start++];
+            reader->packet_remaining = (packet & ~RLE_RUN_BIT) + 1;
+            reader->packet_is_run = (packet & RLE_RUN_BIT) != 0;
+
+            if (reader->packet_is_run) {
+                if ((result = reader_fill(reader, pixel_size)) != TGA_SUCCESS) return result;
+                memcpy(reader->packet_pixel, reader->buffer + reader->buffer_start, pixel_size);
+                reader->buffer_start += pixel_size;
+            }
+        }
+
+        size_t count = reader->packet_remaining < pixel_count ? reader->packet_remaining : pixel_count;
+
+        if (reader->packet_is_run) {
+            rtga_replicate_pixel(dst, reader->packet_pixel, count, pixel_size);
+        } else {
+            // Copy as many whole pixels as are buffered
+            if ((result = reader_fill(reader, pixel_size)) != TGA_SUCCESS) return result;
+            size_t buffered = (reader->buffer_end - reader->buffer_start) / pixel_size;
+            if (count > buffered) count = buffered;
+            memcpy(dst, reader->buffer + reader->buffer_start, count * pixel_size);
+            reader->buffer_start += count * pixel_size;
+        }
+
+        reader->packet_remaining -= (uint8_t)count;
+        dst += count * pixel_size;
+        pixel_count -= count;
+    }
+
+    return TGA_SUCCESS;
+}
+
+int tga_reader_read_rows(TgaReader *reader, uint8_t *dst, uint16_t row_count) {
+    assert(reader);
+    assert(reader->io.read);
+    assert(dst || row_count == 0);
+
+    if (row_count > reader->header.height - reader->rows_read) return TGA_FILE_READ_ERROR;
+
+    size_t pixel_count = (size_t)row_count * reader->header.width;
+
+    if (tga_is_rle(reader->header.image_type)) {
+        RTGA_STATS_BEGIN(start);
+        int result = reader_decode(reader, dst, pixel_count);
+        RTGA_STATS_END(start, TGA_PHASE_DECODE, pixel_count * reader->pixel_size);
+        if (result != TGA_SUCCESS) return result;
+
+        // The last packet must not run past the end of the image
+        if (reader->rows_read + row_count == reader->header.height && reader->packet_remaining > 0) {
+            return TGA_RLE_DECODE_ERROR;
+        }
+    } else {
+        size_t size = pixel_count * reader->pixel_size;
+        if (!io_read(&reader->io, dst, size)) return TGA_FILE_READ_ERROR;
+    }
+
+    reader->rows_read += row_count;
+
+    return TGA_SUCCESS;
+}
+
+void tga_reader_close(TgaReader *reader) {
+    assert(reader);
+
+    reader_release(reader);
+}
+
+//
+// Writer
+//
+
+int tga_writer_open(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const char *filename) {
+    return rtga_writer_open(writer, header, image_id, color_map_data, filename, NULL);
+}
+
+int tga_writer_open_io(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const TgaIo *io) {
+    return rtga_writer_open_io(writer, header, image_id, color_map_data, io, NULL);
+}
+
+int rtga_writer_open(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const char *filename, const TgaAllocator *allocator) {
+    assert(writer);
+    assert(header);
+    assert(filename);
+
+    // Check the pixel depth before the file is created
+    if (!tga_valid_depth(header->image_pixel_depth)) {
+        memset(writer, 0, sizeof(TgaWriter));
+        return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    }
+
+    RTGA_STATS_BEGIN(start);
+    FILE *fp = fopen(filename, "wb");
+    RTGA_STATS_END(start, TGA_PHASE_OPEN, 0);
+    if (!fp) {
+        memset(writer, 0, sizeof(TgaWriter));
+        return TGA_FILE_OPEN_ERROR;
+    }
+
+    TgaIo io = file_io(fp);
+    int result = rtga_writer_open_io(writer, header, image_id, color_map_data, &io, allocator);
+    if (result != TGA_SUCCESS) {
+        fclose(fp);
+        return result;
+    }
+    writer->fp = fp;
+
+    return TGA_SUCCESS;
+}
+
+int rtga_writer_open_io(TgaWriter *writer, const TgaHeader *header, const uint8_t *image_id, const uint8_t *color_map_data, const TgaIo *io, const TgaAllocator *allocator) {
+    uint8_t header_bytes[TGA_HEADER_SIZE];
+
+    assert(writer);
+    assert(header);
+    assert(io && io->write);
+    assert(image_id || header->id_length == 0);
+    assert(color_map_data || rtga_color_map_size(header) == 0);
+
+    memset(writer, 0, sizeof(TgaWriter));
+    writer->header = *header;
+    writer->io = *io;
+    if (allocator) writer->allocator = *allocator;
+
+    if (!tga_valid_depth(header->image_pixel_depth)) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    writer->pixel_size = tga_pixel_size(header);
+
+    // Run-length encoded data is encoded one scanline at a time
+    if (tga_is_rle(header->image_type)) {
+        writer->row_buffer = rtga_alloc(&writer->allocator, tga_rle_bound(header->width, writer->pixel_size) + 1);
+        if (!writer->row_buffer) return TGA_ALLOCATION_ERROR;
+    }
+
+    // Write header, image id and color map
+    size_t color_map_size = rtga_color_map_size(header);
+    rtga_serialize_header(header_bytes, header);
+    if (!io_write(io, header_bytes, TGA_HEADER_SIZE) ||
+        (header->id_length > 0 && !io_write(io, image_id, header->id_length)) ||
+        (color_map_size > 0 && !io_write(io, color_map_data, color_map_size))) {
+        rtga_free(&writer->allocator, writer->row_buffer);
+        writer->row_buffer = NULL;
+        return TGA_FILE_WRITE_ERROR;
+    }
+
+    return TGA_SUCCESS;
+}
+
+// Writes row_count scanlines that are stride bytes apart
+static int write_rows(TgaWriter *writer, const uint8_t *src, size_t stride, uint16_t row_count) {
+    if (row_count > writer->header.height - writer->rows_written) return TGA_FILE_WRITE_ERROR;
+
+    uint16_t width = writer->header.width;
+    size_t row_size = (size_t)width * writer->pixel_size;
+
+    if (tga_is_rle(writer->header.image_type)) {
+        // Encode one scanline at a time so packets never cross scanlines
+        for (uint16_t y = 0; y < row_count; ++y) {
+            size_t encoded_size = tga_rle_encode(writer->row_buffer, src + y * stride, width, writer->pixel_size);
+            if (!io_write(&writer->io, writer->row_buffer, encoded_size)) return TGA_FILE_WRITE_ERROR;
+        }
+    } else if (stride == row_size) {
+        size_t size = row_count * row_size;
+        if (!io_write(&writer->io, src, size)) return TGA_FILE_WRITE_ERROR;
+    } else {
+        for (uint16_t y = 0; y < row_count; ++y) {
+            if (!io_write(&writer->io, src + y * stride, row_size)) return TGA_FILE_WRITE_ERROR;
+        }
+    }
+
+    writer->rows_written += row_count;
+
+    return TGA_SUCCESS;
+}
+
+int tga_writer_write_rows(TgaWriter *writer, const uint8_t *src, uint16_t row_count) {
+    assert(writer);
+    assert(writer->io.write);
+    assert(src || row_count == 0);
+
+    return write_rows(writer, src, (size_t)writer->header.width * writer->pixel_size, row_count);
+}
+
+int tga_writer_write_view(TgaWriter *writer, const TgaView *view) {
+    assert(writer);
+    assert(writer->io.write);
+    assert(view);
+
+    if (view->pixel_depth != writer->header.image_pixel_depth) return TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (view->width != writer->header.width) return TGA_FILE_WRITE_ERROR;
+
+    return write_rows(writer, view->data, view->stride, view->height);
+}
+
+int tga_writer_close(TgaWriter *writer) {
+    assert(writer);
+
+    int result = TGA_SUCCESS;
+
+    // Every scanline must have been written for the file to be complete
+    if (writer->rows_written != writer->header.height) result = TGA_FILE_WRITE_ERROR;
+    if (writer->fp && fclose(writer->fp) != 0) result = TGA_FILE_WRITE_ERROR;
+    rtga_free(&writer->allocator, writer->row_buffer);
+
+    writer->fp = NULL;
+    memset(&writer->io, 0, sizeof(TgaIo));
+    writer->row_buffer = NULL;
+
+    return result;
+}
@@ -0,0 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rtga_internal.h"
+
+#include <assert.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTGA_PTHREADS 1
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+unsigned rtga_thread_count(unsigned thread_count) {
+    if (thread_count == 0) {
+#ifdef RTGA_PTHREADS
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (unsigned)cpus : 1;
+#else
+        thread_count = 1;
+#endif
+    }
+
+    return thread_count < RTGA_MAX_THREADS ? thread_count : RTGA_MAX_THREADS;
+}
+
+#ifdef RTGA_PTHREADS
+// Work shared by every thread of a parallel loop
+typedef struct {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t count;
+    void (*task)(void *context, unsigned worker, size_t index);
+    void *context;
+} ParallelLoop;
+
+// One thread of a parallel loop
+typedef struct {
+    ParallelLoop *loop;
+    unsigned worker;
+} ParallelWorker;
+
+// Runs tasks until every index has been taken
+static void *parallel_worker(void *argument) {
+    ParallelWorker *self = argument;
+    ParallelLoop *loop = self->loop;
+
+    for (;;) {
+        pthread_mutex_lock(&loop->lock);
+        size_t index = loop->next < loop->count ? loop->next++ : loop->count;
+        pthread_mutex_unlock(&loop->lock);
+
+        if (index == loop->count) break;
+        loop->task(loop->context, self->worker, index);
+    }
+
+    return NULL;
+}
+#endif
+
+void rtga_parallel_for(size_t count, unsigned thread_count, void (*task)(void *context, unsigned worker, size_t index), void *context) {
+    assert(task);
+
+    thread_count = rtga_thread_count(thread_count);
+    if (thread_count > count) thread_count = (unsigned)count;
+
+#ifdef RTGA_PTHREADS
+    if (thread_count > 1) {
+        ParallelLoop loop;
+        pthread_t threads[RTGA_MAX_THREADS];
+        ParallelWorker workers[RTGA_MAX_THREADS];
+        unsigned started = 0;
+
+        pthread_mutex_init(&loop.lock, NULL);
+        loop.next = 0;
+        loop.count = count;
+        loop.task = task;
+        loop.context = context;
+
+        // The calling thread is worker 0. If a thread can not be started, the
+        // threads that did start take over its share.
+        for (unsigned i = 0; i < thread_count; ++i) {
+            workers[i].loop = &loop;
+            workers[i].worker = i;
+        }
+        while (started + 1 < thread_count &&
+               pthread_create(&threads[started], NULL, parallel_worker, &workers[started + 1]) == 0) {
+            ++started;
+        }
+        parallel_worker(&workers[0]);
+        for (unsigned i = 0; i < started; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&loop.lock);
+        return;
+    }
+#endif
+
+    for (size_t index = 0; index < count; ++index) {
+        task(context, 0, index);
+    }
+}
@@ -0,0 +1,733 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtga/rtga.h"
+#include "rtga/rtga_version.h"
+
+/*
+ * Benchmark settings
+ *
+ */
+
+// Default number of timed repetitions of each benchmark
+#define BENCH_REPETITIONS 9
+
+// Every timed repetition covers at least this many pixels, so small images
+// repeat the benchmark until their times are long enough to measure
+#define BENCH_MIN_PIXELS (1 << 20)
+
+// File written and read by the file benchmarks
+#define BENCH_FILENAME "bench.tga"
+
+typedef struct {
+    const char *name;
+    uint16_t width;
+    uint16_t height;
+} BenchSize;
+
+static const BenchSize BENCH_SIZES[] = {
+    {"small", 64, 64},
+    {"medium", 512, 512},
+    {"large", 1920, 1080},
+};
+
+static const uint8_t BENCH_DEPTHS[] = {8, 16, 24, 32};
+
+// How compressible the pixels of an image are
+typedef enum {
+    // Every pixel is the same
+    BENCH_FLAT,
+    // Runs of random length mixed with noise
+    BENCH_RUNS,
+    // Every byte is random
+    BENCH_NOISE,
+} BenchEntropy;
+
+static const char *const BENCH_ENTROPY_NAMES[] = {"flat", "runs", "noise"};
+
+// An image to benchmark, with its pixels run-length encoded row by row
+typedef struct {
+    const BenchSize *size;
+    BenchEntropy entropy;
+    TgaImage tga;
+    uint8_t *encoded;
+    size_t encoded_size;
+} BenchCase;
+
+// Returns the seconds one run of a benchmark took, leaving out its setup,
+// or a negative number if it failed
+typedef double (*BenchFunction)(BenchCase *bench);
+
+FILE *output;
+int repetitions = BENCH_REPETITIONS;
+int first_result = 1;
+
+// Returns a monotonic time in seconds
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the median of the timed repetitions in seconds
+double median(double *times, int count) {
+    qsort(times, count, sizeof(double), compare_doubles);
+    return times[count / 2];
+}
+
+static uint32_t bench_seed = 1;
+
+uint32_t bench_random() {
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return bench_seed >> 8;
+}
+
+// Fills pixel_count pixels with pixels of the given entropy
+void fill_entropy(uint8_t *buffer, size_t pixel_count, uint8_t pixel_size, BenchEntropy entropy) {
+    size_t size = pixel_count * pixel_size;
+
+    if (entropy == BENCH_FLAT) {
+        for (size_t i = 0; i < size; ++i) buffer[i] = (uint8_t)(0x5a + i % pixel_size);
+    } else if (entropy == BENCH_NOISE) {
+        for (size_t i = 0; i < size; ++i) buffer[i] = (uint8_t)bench_random();
+    } else {
+        // Runs of 1 to 64 pixels, half of them runs of a single repeated pixel
+        size_t i = 0;
+        while (i < pixel_count) {
+            size_t length = 1 + bench_random() % 64;
+            if (length > pixel_count - i) length = pixel_count - i;
+            bool repeat = bench_random() & 1;
+            for (size_t j = 0; j < length; ++j) {
+                for (uint8_t k = 0; k < pixel_size; ++k) {
+                    uint8_t *byte = buffer + (i + j) * pixel_size + k;
+                    *byte = repeat && j > 0 ? byte[-(int)pixel_size] : (uint8_t)bench_random();
+                }
+            }
+            i += length;
+        }
+    }
+}
+
+/*
+ * Benchmarks
+ *
+ */
+
+double bench_write_file(BenchCase *bench, TgaImageType image_type) {
+    TgaImageType old_type = bench->tga.header.image_type;
+    bench->tga.header.image_type = image_type;
+
+    double start = bench_now();
+    int result = tga_write_file(&bench->tga, BENCH_FILENAME);
+    double seconds = bench_now() - start;
+
+    bench->tga.header.image_type = old_type;
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+TgaImageType uncompressed_type(const BenchCase *bench) {
+    return bench->tga.header.image_pixel_depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+}
+
+double bench_write_uncompressed(BenchCase *bench) {
+    return bench_write_file(bench, uncompressed_type(bench));
+}
+
+double bench_write_rle(BenchCase *bench) {
+    return bench_write_file(bench, (TgaImageType)(uncompressed_type(bench) + 8));
+}
+
+double bench_read_file(void) {
+    TgaImage tga = {0};
+
+    double start = bench_now();
+    int result = tga_read_file(&tga, BENCH_FILENAME);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Writes the file outside of the timing and reads it back
+double bench_read_uncompressed(BenchCase *bench) {
+    if (bench_write_uncompressed(bench) < 0) return -1.0;
+    return bench_read_file();
+}
+
+double bench_read_rle(BenchCase *bench) {
+    if (bench_write_rle(bench) < 0) return -1.0;
+    return bench_read_file();
+}
+
+double bench_fill(BenchCase *bench) {
+    TgaColor color = COLOR32(0x12, 0x34, 0x56, 0x78);
+    color.bit_size = bench->tga.header.image_pixel_depth;
+
+    double start = bench_now();
+    tga_fill(&bench->tga, color);
+    return bench_now() - start;
+}
+
+// Fills every pixel with tga_set_pixel, the way tga_fill used to
+double bench_fill_loop(BenchCase *bench) {
+    TgaColor color = COLOR32(0x12, 0x34, 0x56, 0x78);
+    color.bit_size = bench->tga.header.image_pixel_depth;
+
+    double start = bench_now();
+    for (uint16_t y = 0; y < bench->size->height; ++y) {
+        for (uint16_t x = 0; x < bench->size->width; ++x) {
+            tga_set_pixel(&bench->tga, x, y, color);
+        }
+    }
+    return bench_now() - start;
+}
+
+// Sets one scattered point per pixel, a tenth of them outside the image
+int make_points(const BenchCase *bench, int32_t **xs, int32_t **ys, size_t *count) {
+    *count = (size_t)bench->size->width * bench->size->height;
+    *xs = malloc(*count * sizeof(int32_t));
+    *ys = malloc(*count * sizeof(int32_t));
+    if (!*xs || !*ys) {
+        free(*xs);
+        free(*ys);
+        return 1;
+    }
+
+    uint32_t state = 1;
+    for (size_t i = 0; i < *count; ++i) {
+        state = state * 1664525u + 1013904223u;
+        (*xs)[i] = (int32_t)((state >> 8) % (bench->size->width + bench->size->width / 10 + 1));
+        state = state * 1664525u + 1013904223u;
+        (*ys)[i] = (int32_t)((state >> 8) % bench->size->height);
+    }
+    return 0;
+}
+
+double bench_draw_points(BenchCase *bench) {
+    TgaColor color = COLOR32(0x12, 0x34, 0x56, 0x78);
+    color.bit_size = bench->tga.header.image_pixel_depth;
+    int32_t *xs, *ys;
+    size_t count;
+    if (make_points(bench, &xs, &ys, &count) != 0) return -1.0;
+
+    double start = bench_now();
+    tga_draw_points(&bench->tga, xs, ys, count, color);
+    double seconds = bench_now() - start;
+
+    free(xs);
+    free(ys);
+    return seconds;
+}
+
+// Sets the same points with tga_set_pixel, clipping each one
+double bench_draw_points_loop(BenchCase *bench) {
+    TgaColor color = COLOR32(0x12, 0x34, 0x56, 0x78);
+    color.bit_size = bench->tga.header.image_pixel_depth;
+    int32_t *xs, *ys;
+    size_t count;
+    if (make_points(bench, &xs, &ys, &count) != 0) return -1.0;
+
+    double start = bench_now();
+    for (size_t i = 0; i < count; ++i) {
+        if (xs[i] < 0 || ys[i] < 0 || xs[i] >= bench->size->width || ys[i] >= bench->size->height) continue;
+        tga_set_pixel(&bench->tga, (uint16_t)xs[i], (uint16_t)ys[i], color);
+    }
+    double seconds = bench_now() - start;
+
+    free(xs);
+    free(ys);
+    return seconds;
+}
+
+// Draws a line across the image from every row, about one pixel per pixel
+double bench_draw_lines(BenchCase *bench) {
+    TgaColor color = COLOR32(0x12, 0x34, 0x56, 0x78);
+    color.bit_size = bench->tga.header.image_pixel_depth;
+    int32_t right = bench->size->width - 1, bottom = bench->size->height - 1;
+
+    double start = bench_now();
+    for (int32_t y = 0; y <= bottom; ++y) {
+        tga_draw_line(&bench->tga, 0, y, right, bottom - y, color);
+    }
+    return bench_now() - start;
+}
+
+double bench_rle_encode(BenchCase *bench) {
+    uint8_t pixel_size = tga_pixel_size(&bench->tga.header);
+    size_t row_size = (size_t)bench->size->width * pixel_size;
+    uint8_t *dst = bench->encoded;
+
+    double start = bench_now();
+    for (uint16_t y = 0; y < bench->size->height; ++y) {
+        dst += tga_rle_encode(dst, bench->tga.image_data + y * row_size, bench->size->width, pixel_size);
+    }
+    double seconds = bench_now() - start;
+
+    return (size_t)(dst - bench->encoded) == bench->encoded_size ? seconds : -1.0;
+}
+
+double bench_rle_decode(BenchCase *bench) {
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    uint8_t *pixels = malloc(tga_image_size(&bench->tga.header));
+    if (!pixels) return -1.0;
+
+    double start = bench_now();
+    int result = tga_rle_decode(pixels, pixel_count, bench->encoded, bench->encoded_size, tga_pixel_size(&bench->tga.header), NULL);
+    double seconds = bench_now() - start;
+
+    free(pixels);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Copies the pixels of bench into a new image that an operation can replace
+int copy_image(const BenchCase *bench, TgaImage *tga) {
+    const TgaHeader *header = &bench->tga.header;
+    if (tga_alloc(header->image_type, header->width, header->height, header->image_pixel_depth, tga) != TGA_SUCCESS) {
+        return TGA_ALLOCATION_ERROR;
+    }
+    memcpy(tga->image_data, bench->tga.image_data, tga_image_size(header));
+    return TGA_SUCCESS;
+}
+
+double bench_to_color_map(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+
+    double start = bench_now();
+    int result = tga_to_color_map(&tga);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Converts 24-bit images to 32 bits and every other depth to 24 bits
+double bench_convert_depth(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+
+    double start = bench_now();
+    int result = tga_convert_depth(&tga, tga.header.image_pixel_depth == 24 ? 32 : 24, false);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Blends a copy of the image over itself, so that half of the noise image
+// has to be mixed and flat images take the opaque or transparent shortcut
+double bench_blend_image(BenchCase *bench, bool premultiplied) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    TgaView dst = tga_image_view(&tga);
+    TgaView src = tga_image_view(&bench->tga);
+
+    double start = bench_now();
+    int result = tga_blend(&dst, &src, 0, 0, premultiplied);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+double bench_blend(BenchCase *bench) {
+    return bench_blend_image(bench, false);
+}
+
+double bench_blend_premultiplied(BenchCase *bench) {
+    return bench_blend_image(bench, true);
+}
+
+// Blends one pixel at a time with integer division
+double bench_blend_naive(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    const uint8_t *src = bench->tga.image_data;
+    uint8_t *dst = tga.image_data;
+
+    double start = bench_now();
+    for (size_t i = 0; i < pixel_count * 4; i += 4) {
+        unsigned src_alpha = src[i + 3];
+        unsigned dst_alpha = dst[i + 3] * (255 - src_alpha) / 255;
+        unsigned alpha = src_alpha + dst_alpha;
+        if (alpha == 0) continue;
+        for (int c = 0; c < 3; ++c) {
+            dst[i + c] = (uint8_t)((src[i + c] * src_alpha + dst[i + c] * dst_alpha + alpha / 2) / alpha);
+        }
+        dst[i + 3] = (uint8_t)alpha;
+    }
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return seconds;
+}
+
+double bench_blend_premultiplied_naive(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    const uint8_t *src = bench->tga.image_data;
+    uint8_t *dst = tga.image_data;
+
+    double start = bench_now();
+    for (size_t i = 0; i < pixel_count * 4; i += 4) {
+        unsigned inverse = 255 - src[i + 3];
+        for (int c = 0; c < 4; ++c) {
+            unsigned value = src[i + c] + (dst[i + c] * inverse + 127) / 255;
+            dst[i + c] = (uint8_t)(value > 255 ? 255 : value);
+        }
+    }
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return seconds;
+}
+
+// Premultiplies or unpremultiplies a copy of the image with 8 alpha bits
+double bench_alpha_pass(BenchCase *bench, int (*pass)(TgaImage *)) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    tga.header.descriptor = 8;
+
+    double start = bench_now();
+    int result = pass(&tga);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+double bench_premultiply(BenchCase *bench) {
+    return bench_alpha_pass(bench, tga_premultiply);
+}
+
+double bench_unpremultiply(BenchCase *bench) {
+    return bench_alpha_pass(bench, tga_unpremultiply);
+}
+
+double bench_premultiply_naive(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    uint8_t *pixels = tga.image_data;
+
+    double start = bench_now();
+    for (size_t i = 0; i < pixel_count * 4; i += 4) {
+        for (int c = 0; c < 3; ++c) {
+            pixels[i + c] = (uint8_t)((pixels[i + c] * pixels[i + 3] + 127) / 255);
+        }
+    }
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return seconds;
+}
+
+double bench_unpremultiply_naive(BenchCase *bench) {
+    TgaImage tga = {0};
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    uint8_t *pixels = tga.image_data;
+
+    double start = bench_now();
+    for (size_t i = 0; i < pixel_count * 4; i += 4) {
+        unsigned alpha = pixels[i + 3];
+        for (int c = 0; c < 3; ++c) {
+            unsigned value = alpha ? (pixels[i + c] * 255 + alpha / 2) / alpha : 0;
+            pixels[i + c] = (uint8_t)(value > 255 ? 255 : value);
+        }
+    }
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return seconds;
+}
+
+// Resizes the image to half its width and height into a separate image
+double bench_resize_half(BenchCase *bench, TgaFilter filter) {
+    const TgaHeader *header = &bench->tga.header;
+    TgaImage half = {0};
+    if (tga_alloc(header->image_type, header->width / 2, header->height / 2, header->image_pixel_depth, &half) != TGA_SUCCESS) {
+        return -1.0;
+    }
+    TgaView dst = tga_image_view(&half);
+    TgaView src = tga_image_view(&bench->tga);
+
+    double start = bench_now();
+    int result = tga_resize_view(&dst, &src, filter, 1);
+    double seconds = bench_now() - start;
+
+    tga_free(&half);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+double bench_resize_box(BenchCase *bench) {
+    return bench_resize_half(bench, TGA_FILTER_BOX);
+}
+
+double bench_resize_bilinear(BenchCase *bench) {
+    return bench_resize_half(bench, TGA_FILTER_BILINEAR);
+}
+
+double bench_resize_lanczos(BenchCase *bench) {
+    return bench_resize_half(bench, TGA_FILTER_LANCZOS);
+}
+
+// Generates the whole mipmap chain without keeping or writing levels
+double bench_mipmaps(BenchCase *bench) {
+    TgaMipmapOptions options = {TGA_FILTER_BOX, 1, false};
+
+    double start = bench_now();
+    int result = tga_generate_mipmaps(&bench->tga, &options, NULL, NULL);
+    double seconds = bench_now() - start;
+
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Hashes the image as 32-bit pixels, which converts all but 32-bit images
+double bench_content_hash(BenchCase *bench) {
+    uint64_t hash;
+
+    double start = bench_now();
+    int result = tga_content_hash(&bench->tga, &hash);
+    double seconds = bench_now() - start;
+
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Times finding that the image equals a copy of it, which reads every pixel
+// of both
+double bench_equal(BenchCase *bench) {
+    TgaImage tga;
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    bool equal = false;
+
+    double start = bench_now();
+    int result = tga_equal(&bench->tga, &tga, &equal, NULL, NULL);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS && equal ? seconds : -1.0;
+}
+
+// Times measuring the errors and structural similarity against a copy
+double bench_compare(BenchCase *bench) {
+    TgaImage tga;
+    if (copy_image(bench, &tga) != TGA_SUCCESS) return -1.0;
+    TgaCompareOptions options = {0, true};
+    TgaCompareResult compared;
+
+    double start = bench_now();
+    int result = tga_compare(&bench->tga, &tga, &options, &compared);
+    double seconds = bench_now() - start;
+
+    tga_free(&tga);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+// Encodes the image once, then times copying it out of the cache, which
+// costs a hash of the image and a copy of the file
+double bench_cache_hit(BenchCase *bench) {
+    const TgaHeader *header = &bench->tga.header;
+    size_t size = TGA_HEADER_SIZE + tga_image_size(header);
+    uint8_t *dst = malloc(size);
+    TgaCache *cache;
+    if (!dst || tga_cache_create(2 * size, NULL, &cache) != TGA_SUCCESS) {
+        free(dst);
+        return -1.0;
+    }
+    size_t encoded_size;
+    int result = tga_cache_encode_memory(cache, &bench->tga, dst, size, NULL, &encoded_size);
+
+    double start = bench_now();
+    if (result == TGA_SUCCESS) result = tga_cache_encode_memory(cache, &bench->tga, dst, size, NULL, &encoded_size);
+    double seconds = bench_now() - start;
+
+    tga_cache_destroy(cache);
+    free(dst);
+    return result == TGA_SUCCESS ? seconds : -1.0;
+}
+
+/*
+ * Reporting
+ *
+ */
+
+// Times a benchmark and writes its result as a JSON object
+int run(BenchCase *bench, const char *name, BenchFunction function) {
+    size_t pixel_count = (size_t)bench->size->width * bench->size->height;
+    size_t iterations = pixel_count < BENCH_MIN_PIXELS ? BENCH_MIN_PIXELS / pixel_count : 1;
+    double *times = malloc(repetitions * sizeof(double));
+    if (!times) return 1;
+
+    // Warm up caches and page tables before timing
+    int failed = function(bench) < 0;
+    for (int i = 0; !failed && i < repetitions; ++i) {
+        times[i] = 0;
+        for (size_t j = 0; !failed && j < iterations; ++j) {
+            double seconds = function(bench);
+            failed = seconds < 0;
+            times[i] += seconds;
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "Benchmark %s failed on %s %u-bit %s image\n", name, bench->size->name,
+                bench->tga.header.image_pixel_depth, BENCH_ENTROPY_NAMES[bench->entropy]);
+        free(times);
+        return 1;
+    }
+
+    // Throughput counts the uncompressed bytes of the image
+    double seconds = median(times, repetitions) / iterations;
+    double megabytes = tga_image_size(&bench->tga.header) * 1e-6;
+    fprintf(output, "%s\n    {\"benchmark\": \"%s\", \"size\": \"%s\", \"width\": %u, \"height\": %u, "
+            "\"depth\": %u, \"entropy\": \"%s\", \"ns_per_pixel\": %.4f, \"mb_per_s\": %.2f}",
+            first_result ? "" : ",", name, bench->size->name, bench->size->width, bench->size->height,
+            bench->tga.header.image_pixel_depth, BENCH_ENTROPY_NAMES[bench->entropy],
+            seconds * 1e9 / pixel_count, megabytes / seconds);
+    first_result = 0;
+
+    free(times);
+    return 0;
+}
+
+int bench_case(const BenchSize *size, uint8_t pixel_depth, BenchEntropy entropy) {
+    BenchCase bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.size = size;
+    bench.entropy = entropy;
+    TgaImageType image_type = pixel_depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    if (tga_alloc(image_type, size->width, size->height, pixel_depth, &bench.tga) != TGA_SUCCESS) {
+        fprintf(stderr, "Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+
+    // Encode the image once for the decode benchmark and to check encoding
+    uint8_t pixel_size = tga_pixel_size(&bench.tga.header);
+    size_t row_size = (size_t)size->width * pixel_size;
+    fill_entropy(bench.tga.image_data, (size_t)size->width * size->height, pixel_size, entropy);
+    bench.encoded = malloc(tga_rle_bound(size->width, pixel_size) * size->height);
+    if (!bench.encoded) {
+        fprintf(stderr, "Memory allocation error in function %s\n", __func__);
+        tga_free(&bench.tga);
+        return 1;
+    }
+    for (uint16_t y = 0; y < size->height; ++y) {
+        bench.encoded_size += tga_rle_encode(bench.encoded + bench.encoded_size, bench.tga.image_data + y * row_size, size->width, pixel_size);
+    }
+
+    int failures = 0;
+    failures += run(&bench, "write_file", bench_write_uncompressed);
+    failures += run(&bench, "write_file_rle", bench_write_rle);
+    failures += run(&bench, "read_file", bench_read_uncompressed);
+    failures += run(&bench, "read_file_rle", bench_read_rle);
+    failures += run(&bench, "rle_encode", bench_rle_encode);
+    failures += run(&bench, "rle_decode", bench_rle_decode);
+    failures += run(&bench, "to_color_map", bench_to_color_map);
+    failures += run(&bench, "convert_depth", bench_convert_depth);
+    failures += run(&bench, "resize_box", bench_resize_box);
+    failures += run(&bench, "resize_bilinear", bench_resize_bilinear);
+    failures += run(&bench, "resize_lanczos", bench_resize_lanczos);
+    failures += run(&bench, "mipmaps", bench_mipmaps);
+    failures += run(&bench, "content_hash", bench_content_hash);
+    failures += run(&bench, "cache_hit", bench_cache_hit);
+    failures += run(&bench, "equal", bench_equal);
+    failures += run(&bench, "compare", bench_compare);
+
+    // Blending and alpha passes only take 32-bit pixels
+    if (pixel_depth == 32) {
+        failures += run(&bench, "blend", bench_blend);
+        failures += run(&bench, "blend_naive", bench_blend_naive);
+        failures += run(&bench, "blend_premultiplied", bench_blend_premultiplied);
+        failures += run(&bench, "blend_premultiplied_naive", bench_blend_premultiplied_naive);
+        failures += run(&bench, "premultiply", bench_premultiply);
+        failures += run(&bench, "premultiply_naive", bench_premultiply_naive);
+        failures += run(&bench, "unpremultiply", bench_unpremultiply);
+        failures += run(&bench, "unpremultiply_naive", bench_unpremultiply_naive);
+    }
+
+    // Filling and drawing overwrite pixels, so they go last and only once
+    // per depth
+    if (entropy == BENCH_FLAT) {
+        failures += run(&bench, "fill", bench_fill);
+        failures += run(&bench, "fill_loop", bench_fill_loop);
+        failures += run(&bench, "draw_points", bench_draw_points);
+        failures += run(&bench, "draw_points_loop", bench_draw_points_loop);
+        failures += run(&bench, "draw_lines", bench_draw_lines);
+    }
+
+    free(bench.encoded);
+    tga_free(&bench.tga);
+    return failures;
+}
+
+void usage(const char *program) {
+    printf("Usage: %s [-r repetitions] [-o file]\n", program);
+    printf("\n");
+    printf("Times reading, writing, filling, drawing, run-length encoding,\n");
+    printf("palette conversion, resizing, alpha blending, hashing, cached\n");
+    printf("encoding and comparison of synthetic images and writes the median\n");
+    printf("ns/pixel and MB/s of each benchmark as JSON to the file or standard\n");
+    printf("output.\n");
+}
+
+/*
+ *  RTGA Benchmark
+ *
+ *  Measures throughput for every combination of image size, pixel depth
+ *  and entropy and reports the results as JSON so that runs can be
+ *  compared.
+ *
+ */
+int main(int argc, char **argv) {
+    const char *filename = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            filename = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (repetitions < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    output = filename ? fopen(filename, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 1;
+    }
+
+    fprintf(output, "{\n  \"version\": \"%s\",\n  \"repetitions\": %d,\n  \"results\": [", RTGA_VERSION, repetitions);
+
+    int failures = 0;
+    for (size_t s = 0; s < sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]); ++s) {
+        for (size_t d = 0; d < sizeof(BENCH_DEPTHS); ++d) {
+            for (int e = BENCH_FLAT; e <= BENCH_NOISE; ++e) {
+                failures += bench_case(&BENCH_SIZES[s], BENCH_DEPTHS[d], (BenchEntropy)e);
+            }
+        }
+    }
+
+    fprintf(output, "\n  ]\n}\n");
+    if (filename) fclose(output);
+    remove(BENCH_FILENAME);
+
+    return failures != 0;
+}
@@ -0,0 +1,135 @@
+// Fuzz target for every way rtga reads a file out of untrusted bytes
+//
+// With Clang, RTGA_ENABLE_FUZZER links this against libFuzzer. Other
+// compilers get a main that runs each file named on the command line through
+// the target once, so a corpus or a crashing input can be replayed under any
+// sanitizer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtga/rtga.h"
+
+// Largest allocation the target allows. Headers can ask for 16 GiB of
+// pixels, which would only measure the machine, not the decoder.
+#define MAX_ALLOCATION (64u << 20)
+
+static void *limited_alloc(void *context, size_t size) {
+    (void)context;
+    return size <= MAX_ALLOCATION ? malloc(size) : NULL;
+}
+
+static void *limited_realloc(void *context, void *ptr, size_t size) {
+    (void)context;
+    return size <= MAX_ALLOCATION ? realloc(ptr, size) : NULL;
+}
+
+static void limited_free(void *context, void *ptr) {
+    (void)context;
+    free(ptr);
+}
+
+static const TgaAllocator allocator = {limited_alloc, limited_realloc, limited_free, NULL};
+
+// Touches every byte of a decoded image, so that sanitizers see any that
+// were never written
+static unsigned touch(const TgaImage *tga) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < tga_image_size(&tga->header); ++i) sum += tga->image_data[i];
+    return sum;
+}
+
+// Decodes data in memory with options, then expands its color map if it
+// still has one
+static void decode(const uint8_t *data, size_t size, const TgaReadOptions *options) {
+    TgaImage tga;
+    if (tga_decode_memory(&tga, data, size, options) != TGA_SUCCESS) return;
+    if (tga.state == IS_COLOR_MAPPED) tga_from_color_map(&tga);
+    volatile unsigned sum = touch(&tga);
+    (void)sum;
+    tga_free(&tga);
+}
+
+// Reads data through callbacks, both whole and a scanline at a time
+static void stream(const uint8_t *data, size_t size) {
+    TgaMemoryIo memory;
+    TgaIo io;
+
+    TgaReadOptions options = {false, 1, &allocator, false};
+    TgaImage tga;
+    tga_memory_io_init(&memory, (void *)data, size);
+    io = tga_memory_io(&memory);
+    if (tga_read_io(&tga, &io, &options) == TGA_SUCCESS) tga_free(&tga);
+
+    TgaReader reader;
+    tga_memory_io_init(&memory, (void *)data, size);
+    io = tga_memory_io(&memory);
+    if (tga_reader_open_io(&reader, &io) != TGA_SUCCESS) return;
+    size_t row_size = (size_t)reader.header.width * tga_pixel_size(&reader.header);
+    uint8_t *row = row_size <= MAX_ALLOCATION ? malloc(row_size + 1) : NULL;
+    for (uint16_t y = 0; row && y < reader.header.height; ++y) {
+        if (tga_reader_read_rows(&reader, row, 1) != TGA_SUCCESS) break;
+    }
+    free(row);
+    tga_reader_close(&reader);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    TgaProbe probe;
+    tga_probe_memory(data, size, true, &probe);
+
+    // Serial, expanded and flipped to the top left, and banded over a scan
+    // line table when the data has one
+    TgaReadOptions serial = {false, 1, &allocator, false};
+    TgaReadOptions expanded = {true, 1, &allocator, true};
+    TgaReadOptions banded = {false, 2, &allocator, true};
+    decode(data, size, &serial);
+    decode(data, size, &expanded);
+    decode(data, size, &banded);
+
+    stream(data, size);
+    return 0;
+}
+
+#ifndef RTGA_LIBFUZZER
+int main(int argc, char **argv) {
+    int failures = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (!fp) {
+            printf("Could not open %s\n", argv[i]);
+            ++failures;
+            continue;
+        }
+
+        // Read the whole input, however it is stored
+        uint8_t *data = NULL;
+        size_t size = 0;
+        size_t capacity = 0;
+        for (;;) {
+            if (size == capacity) {
+                capacity = capacity ? capacity * 2 : 65536;
+                uint8_t *grown = realloc(data, capacity);
+                if (!grown) break;
+                data = grown;
+            }
+            size_t count = fread(data + size, 1, capacity - size, fp);
+            if (count == 0) break;
+            size += count;
+        }
+        fclose(fp);
+
+        // Give the target exactly the input, so that sanitizers catch any
+        // read past its end as libFuzzer would
+        uint8_t *exact = size > 0 ? realloc(data, size) : data;
+        if (exact) data = exact;
+
+        LLVMFuzzerTestOneInput(data ? data : (const uint8_t *)"", size);
+        free(data);
+    }
+
+    return failures != 0;
+}
+#endif
@@ -1,126 +1,3024 @@
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 #include "rtga/rtga.h"
 #include "rtga/rtga_version.h"
 
-/*
- * All filenames
- *
- */
+/*
+ * All filenames
+ *
+ */
+
+// Color test filenames
+#define FILENAME8 "color8.tga"
+#define FILENAME16 "color16.tga"
+#define FILENAME24 "color24.tga"
+#define FILENAME32 "color32.tga"
+
+// Gradient test filenames
+#define FILENAME8_GRADIENT "gradient8.tga"
+#define FILENAME16_GRADIENT "gradient16.tga"
+#define FILENAME24_GRADIENT "gradient24.tga"
+#define FILENAME32_GRADIENT "gradient32.tga"
+
+// RLE test filenames
+#define FILENAME_RLE "rle.tga"
+
+// Mapped file test filenames
+#define FILENAME_MAPPED "mapped.tga"
+
+// Color map test filenames
+#define FILENAME_COLOR_MAPPED "color_mapped.tga"
+#define FILENAME_RLE_COLOR_MAPPED "rle_color_mapped.tga"
+
+// Parallel test filenames
+#define FILENAME_PARALLEL "parallel.tga"
+#define FILENAME_SERIAL "serial.tga"
+
+// Batch test filenames
+#define FILENAME_BATCH_RLE "batch_rle.tga"
+#define FILENAME_BATCH_ALPHA "batch_alpha.tga"
+#define FILENAME_BATCH_MAPPED "batch_mapped.tga"
+#define FILENAME_BATCH_MISSING "batch_missing.tga"
+#define FILENAME_BATCH_OUT_RLE "batch_out_rle.tga"
+#define FILENAME_BATCH_OUT_ALPHA "batch_out_alpha.tga"
+#define FILENAME_BATCH_OUT_MAPPED "batch_out_mapped.tga"
+#define FILENAME_BATCH_OUT_MISSING "batch_out_missing.tga"
+
+// Allocator test filenames
+#define FILENAME_ALLOCATOR "allocator.tga"
+#define FILENAME_ALLOCATOR_OUT "allocator_out.tga"
+
+// Streaming test filenames
+#define FILENAME_STREAM_READ "stream_read.tga"
+#define FILENAME_STREAM_WRITE "stream_write.tga"
+
+// Depth conversion test filenames
+#define FILENAME_CONVERT "convert.tga"
+
+// In-memory encode and decode test filenames
+#define FILENAME_MEMORY "memory.tga"
+
+// Probe test filenames
+#define DIRECTORY_PROBE "probe"
+#define DIRECTORY_PROBE_NESTED "probe/nested"
+#define FILENAME_PROBE "probe/probe.tga"
+#define FILENAME_PROBE_RLE "probe/nested/probe_rle.TGA"
+#define FILENAME_PROBE_SHORT "probe/short.tga"
+#define FILENAME_PROBE_TEXT "probe/notes.txt"
+
+// View test filenames
+#define FILENAME_VIEW "view.tga"
+
+// Orientation test filenames
+#define FILENAME_ORIENTATION "orientation.tga"
+
+// Mipmap test filenames
+#define FILENAME_MIPMAP_FORMAT "mipmap%u.tga"
+#define FILENAME_MIPMAP_STREAM_FORMAT "mipmap_stream%u.tga"
+
+// Instrumentation test filenames
+#define FILENAME_STATS "stats.tga"
+#define FILENAME_TRACE "trace.json"
+
+// Hash and cache test filenames
+#define FILENAME_CACHE "cache.tga"
+#define FILENAME_CACHE_DIRECT "cache_direct.tga"
+
+// Hashes of the bytes (i * 7 + (i >> 8)) % 256 for i from 0, with 0, 5 and
+// 3000 bytes
+#define HASH_EMPTY 0x1b1150ff409c2529u
+#define HASH_SHORT 0x3b661f4522ad6b97u
+#define HASH_LONG 0x16d2f4b7f19f1c99u
+
+// Hardened decoder test filenames
+#define FILENAME_HARDENED "hardened.tga"
+#define FILENAME_HARDENED_SOURCE "hardened_source.tga"
+
+// Loader test directories, on tmpfs where there is one, and files
+#define DIRECTORY_LOADER_TMPFS "/dev/shm/rtga_loader"
+#define DIRECTORY_LOADER "loader"
+#define FILENAME_LOADER_FORMAT "%s/load%u.tga"
+#define LOADER_FILE_COUNT 40
+
+// Thumbnail test filenames
+#define FILENAME_THUMBNAIL "thumbnail.tga"
+#define FILENAME_THUMBNAIL_MAPPED "thumbnail_mapped.tga"
+#define FILENAME_THUMBNAIL_NONE "thumbnail_none.tga"
+
+// Atlas test filenames
+#define FILENAME_ATLAS_FORMAT "atlas%u.tga"
+#define FILENAME_ATLAS_MISSING "atlas_missing.tga"
+#define FILENAME_ATLAS_TABLE "atlas.json"
+#define ATLAS_IMAGE_COUNT 5
+
+// Image
+TgaImage tga;
+// Image specifications
+uint16_t width, height;
+uint8_t pixel_depth;
+
+void write_file(const char *filename) {
+    int success = tga_write_file(&tga, filename);
+    if (success == TGA_FILE_OPEN_ERROR) {
+        printf("File opening error\n");
+    } else if (success == TGA_FILE_WRITE_ERROR) {
+        printf("File write error\n");
+    } else {
+        printf("Wrote %s with Width{%u},Height{%u},Depth{%u}\n", filename, width, height, pixel_depth);
+    }
+}
+
+int test_color8() {
+    width = 9;
+    height = 9;
+    pixel_depth = 8;
+    if (tga_alloc(UNCOMPRESSED_BLACK_AND_WHITE_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+
+    // Fill with white
+    tga_fill(&tga, WHITE8);
+    // Explicit greyscale colors
+    tga_set_pixel(&tga, 2, 2, LIGHT_GRAY8);
+    tga_set_pixel(&tga, 4, 4, GRAY8);
+    tga_set_pixel(&tga, 6, 6, DARK_GRAY8);
+    tga_set_pixel(&tga, 8, 8, BLACK8);
+    
+    write_file(FILENAME8);
+    tga_free(&tga);
+
+    return 0;
+}
+
+int test_color16() {
+    width = 13;
+    height = 13;
+    pixel_depth = 16;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+
+    // Fill with white
+    tga_fill(&tga, WHITE16);
+    // Explicit greyscale colors
+    tga_set_pixel(&tga, 1, 1, RED16);
+    tga_set_pixel(&tga, 2, 2, BLUE16);
+    tga_set_pixel(&tga, 3, 3, GREEN16);
+    tga_set_pixel(&tga, 4, 4, YELLOW16);
+    tga_set_pixel(&tga, 5, 5, MAGENTA16);
+    tga_set_pixel(&tga, 6, 6, CYAN16);
+    tga_set_pixel(&tga, 7, 7, PURPLE16);
+    tga_set_pixel(&tga, 8, 8, ROSE16);
+    tga_set_pixel(&tga, 9, 9, ORANGE16);
+    tga_set_pixel(&tga, 10, 10, LIME16);
+    tga_set_pixel(&tga, 11, 11, MINT16);
+    tga_set_pixel(&tga, 10, 10, AZURE16);
+    tga_set_pixel(&tga, 12, 12, BLACK16);
+    
+    write_file(FILENAME16);
+    tga_free(&tga);
+
+    return 0;
+}
+
+int test_color24() {
+    width = 13;
+    height = 13;
+    pixel_depth = 24;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+
+    // Fill with white
+    tga_fill(&tga, WHITE24);
+    // Explicit greyscale colors
+    tga_set_pixel(&tga, 1, 1, RED24);
+    tga_set_pixel(&tga, 2, 2, BLUE24);
+    tga_set_pixel(&tga, 3, 3, GREEN24);
+    tga_set_pixel(&tga, 4, 4, YELLOW24);
+    tga_set_pixel(&tga, 5, 5, MAGENTA24);
+    tga_set_pixel(&tga, 6, 6, CYAN24);
+    tga_set_pixel(&tga, 7, 7, PURPLE24);
+    tga_set_pixel(&tga, 8, 8, ROSE24);
+    tga_set_pixel(&tga, 9, 9, ORANGE24);
+    tga_set_pixel(&tga, 10, 10, LIME24);
+    tga_set_pixel(&tga, 11, 11, MINT24);
+    tga_set_pixel(&tga, 10, 10, AZURE24);
+    tga_set_pixel(&tga, 12, 12, BLACK24);
+    
+    write_file(FILENAME24);
+    tga_free(&tga);
+
+    return 0;
+}
+
+// Deterministic pseudo-random numbers for test images
+static uint32_t test_seed = 1;
+
+uint32_t test_random() {
+    test_seed = test_seed * 1664525u + 1013904223u;
+    return test_seed >> 8;
+}
+
+// Fills buffer with a mix of pixel runs, repeated pixel pairs and noise
+void fill_runs_and_noise(uint8_t *buffer, size_t pixel_count, uint8_t pixel_size) {
+    size_t index = 0;
+    while (index < pixel_count) {
+        size_t length = 1 + test_random() % 300;
+        uint32_t kind = test_random() % 3;
+        if (length > pixel_count - index) length = pixel_count - index;
+
+        uint8_t pixel[4];
+        for (uint8_t b = 0; b < pixel_size; ++b) pixel[b] = test_random();
+        for (size_t i = 0; i < length; ++i) {
+            for (uint8_t b = 0; b < pixel_size; ++b) {
+                // Runs repeat one pixel, noise changes a single byte every other pixel
+                buffer[(index + i) * pixel_size + b] = kind == 0 ? pixel[b] :
+                    kind == 1 && i % 2 ? buffer[(index + i - 1) * pixel_size + b] :
+                    (b == i % pixel_size ? (uint8_t)test_random() : pixel[b]);
+            }
+        }
+        index += length;
+    }
+}
+
+int test_rle_codec() {
+    const size_t pixel_count = 5000;
+
+    for (uint8_t pixel_size = 1; pixel_size <= 4; ++pixel_size) {
+        uint8_t *pixels = malloc(pixel_count * pixel_size);
+        uint8_t *decoded = malloc(pixel_count * pixel_size);
+        // Room past the bound, so an encoder that overruns it is caught below
+        uint8_t *encoded = malloc(2 * tga_rle_bound(pixel_count, pixel_size));
+        if (!pixels || !decoded || !encoded) {
+            printf("Memory allocation error in function %s\n", __func__);
+            return 1;
+        }
+
+        fill_runs_and_noise(pixels, pixel_count, pixel_size);
+        size_t encoded_size = tga_rle_encode(encoded, pixels, pixel_count, pixel_size);
+        size_t bytes_read = 0;
+        int result = tga_rle_decode(decoded, pixel_count, encoded, encoded_size, pixel_size, &bytes_read);
+
+        int failed = encoded_size > tga_rle_bound(pixel_count, pixel_size) ||
+                     result != TGA_SUCCESS || bytes_read != encoded_size ||
+                     memcmp(pixels, decoded, pixel_count * pixel_size) != 0;
+
+        // Truncated input must be rejected
+        if (tga_rle_decode(decoded, pixel_count, encoded, encoded_size - 1, pixel_size, NULL) != TGA_RLE_DECODE_ERROR) {
+            failed = 1;
+        }
+
+        // Runs of two between single pixels are the worst case for the bound
+        for (size_t i = 0; i < pixel_count * pixel_size; ++i) {
+            pixels[i] = (i / pixel_size) % 3 == 2 ? pixels[i - pixel_size] : (uint8_t)test_random();
+        }
+        encoded_size = tga_rle_encode(encoded, pixels, pixel_count, pixel_size);
+        if (encoded_size > tga_rle_bound(pixel_count, pixel_size) ||
+            tga_rle_decode(decoded, pixel_count, encoded, encoded_size, pixel_size, NULL) != TGA_SUCCESS ||
+            memcmp(pixels, decoded, pixel_count * pixel_size) != 0) {
+            failed = 1;
+        }
+
+        free(pixels);
+        free(decoded);
+        free(encoded);
+
+        if (failed) {
+            printf("RLE codec mismatch with pixel size %u\n", pixel_size);
+            return 1;
+        }
+    }
+
+    printf("RLE codec round trip passed\n");
+    return 0;
+}
+
+int test_rle_file(uint8_t depth) {
+    TgaImage rle_tga = {0};
+    TgaImage read_tga = {0};
+    TgaImageType image_type = depth == 8 ? RUN_LENGTH_ENCODED_BLACK_AND_WHITE_IMAGE : RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+
+    width = 301;
+    height = 37;
+    pixel_depth = depth;
+    if (tga_alloc(image_type, width, height, pixel_depth, &rle_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(rle_tga.image_data, (size_t)width * height, tga_pixel_size(&rle_tga.header));
+
+    int failed = tga_write_file(&rle_tga, FILENAME_RLE) != TGA_SUCCESS ||
+                 tga_read_file(&read_tga, FILENAME_RLE) != TGA_SUCCESS ||
+                 read_tga.header.image_type != image_type ||
+                 read_tga.header.width != width ||
+                 read_tga.header.height != height ||
+                 memcmp(rle_tga.image_data, read_tga.image_data, tga_image_size(&rle_tga.header)) != 0;
+
+    tga_free(&rle_tga);
+    tga_free(&read_tga);
+
+    if (failed) {
+        printf("RLE file round trip failed with Depth{%u}\n", depth);
+        return 1;
+    }
+
+    printf("RLE file round trip passed with Depth{%u}\n", depth);
+    return 0;
+}
+
+int test_map_file() {
+    TgaImage written_tga = {0};
+    TgaImage mapped_tga = {0};
+    const char image_id[] = "mapped";
+
+    width = 64;
+    height = 48;
+    pixel_depth = 24;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &written_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(written_tga.image_data, (size_t)width * height, 3);
+    written_tga.header.id_length = sizeof(image_id) - 1;
+    written_tga.image_id = malloc(sizeof(image_id));
+    memcpy(written_tga.image_id, image_id, sizeof(image_id));
+
+    int failed = tga_write_file(&written_tga, FILENAME_MAPPED) != TGA_SUCCESS ||
+                 tga_map_file(&mapped_tga, FILENAME_MAPPED) != TGA_SUCCESS ||
+                 mapped_tga.header.width != width ||
+                 mapped_tga.header.height != height ||
+                 mapped_tga.header.image_pixel_depth != pixel_depth ||
+                 memcmp(mapped_tga.image_id, image_id, sizeof(image_id) - 1) != 0 ||
+                 memcmp(mapped_tga.image_data, written_tga.image_data, tga_image_size(&written_tga.header)) != 0;
+
+    // Writes stay private to the mapping
+    if (!failed) {
+        tga_set_pixel(&mapped_tga, 0, 0, RED24);
+        tga_free(&mapped_tga);
+        failed = mapped_tga.image_data != NULL ||
+                 tga_map_file(&mapped_tga, FILENAME_MAPPED) != TGA_SUCCESS ||
+                 memcmp(mapped_tga.image_data, written_tga.image_data, 3) != 0;
+        tga_unmap_file(&mapped_tga);
+    }
+
+    // Run-length encoded files can not be mapped
+    if (tga_map_file(&mapped_tga, FILENAME_RLE) != TGA_UNSUPPORTED_IMAGE_TYPE_ERROR) {
+        failed = 1;
+    }
+
+    tga_free(&written_tga);
+
+    if (failed) {
+        printf("Mapped file test failed\n");
+        return 1;
+    }
+
+    printf("Mapped file test passed\n");
+    return 0;
+}
+
+int test_stream() {
+    TgaImage source_tga = {0};
+    TgaImage read_tga = {0};
+    TgaReader reader;
+    TgaWriter writer;
+    const uint16_t chunk_rows = 7;
+
+    // Large enough for the reader to refill its buffer mid-packet
+    width = 300;
+    height = 250;
+    pixel_depth = 24;
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &source_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    size_t pixel_count = (size_t)width * height;
+    size_t row_size = (size_t)width * 3;
+    fill_runs_and_noise(source_tga.image_data, pixel_count, 3);
+
+    // Encode the whole image at once so packets cross scanlines
+    uint8_t *encoded = malloc(tga_rle_bound(pixel_count, 3));
+    uint8_t *chunk = malloc(chunk_rows * row_size);
+    size_t encoded_size = tga_rle_encode(encoded, source_tga.image_data, pixel_count, 3);
+    uint8_t header_bytes[18] = {0, 0, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                (uint8_t)width, width >> 8, (uint8_t)height, height >> 8, pixel_depth, 0};
+    FILE *fp = fopen(FILENAME_STREAM_READ, "wb");
+    fwrite(header_bytes, 1, sizeof(header_bytes), fp);
+    fwrite(encoded, 1, encoded_size, fp);
+    fclose(fp);
+
+    // Read the image back a few scanlines at a time
+    int failed = tga_reader_open(&reader, FILENAME_STREAM_READ) != TGA_SUCCESS;
+    for (uint16_t y = 0; !failed && y < height; y += chunk_rows) {
+        uint16_t rows = height - y < chunk_rows ? height - y : chunk_rows;
+        failed = tga_reader_read_rows(&reader, chunk, rows) != TGA_SUCCESS ||
+                 memcmp(chunk, source_tga.image_data + y * row_size, rows * row_size) != 0;
+    }
+    tga_reader_close(&reader);
+
+    // Write the image a few scanlines at a time
+    if (!failed) {
+        failed = tga_writer_open(&writer, &source_tga.header, NULL, NULL, FILENAME_STREAM_WRITE) != TGA_SUCCESS;
+        for (uint16_t y = 0; !failed && y < height; y += chunk_rows) {
+            uint16_t rows = height - y < chunk_rows ? height - y : chunk_rows;
+            failed = tga_writer_write_rows(&writer, source_tga.image_data + y * row_size, rows) != TGA_SUCCESS;
+        }
+        failed = tga_writer_close(&writer) != TGA_SUCCESS || failed ||
+                 tga_read_file(&read_tga, FILENAME_STREAM_WRITE) != TGA_SUCCESS ||
+                 memcmp(read_tga.image_data, source_tga.image_data, pixel_count * 3) != 0;
+    }
+
+    free(encoded);
+    free(chunk);
+    tga_free(&source_tga);
+    tga_free(&read_tga);
+
+    if (failed) {
+        printf("Streaming test failed\n");
+        return 1;
+    }
+
+    printf("Streaming test passed\n");
+    return 0;
+}
+
+int test_fill_rect() {
+    TgaImage fill_tga = {0};
+    TgaImage reference_tga = {0};
+    const TgaColor colors[] = {GRAY8, ORANGE16, ROSE24, COLOR32(10, 20, 30, 40)};
+    const uint8_t depths[] = {8, 16, 24, 32};
+
+    width = 67;
+    height = 45;
+    for (int i = 0; i < 4; ++i) {
+        pixel_depth = depths[i];
+        if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &fill_tga) != TGA_SUCCESS ||
+            tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &reference_tga) != TGA_SUCCESS) {
+            printf("Memory allocation error in function %s\n", __func__);
+            return 1;
+        }
+        size_t size = tga_image_size(&fill_tga.header);
+        memset(fill_tga.image_data, 0, size);
+        memset(reference_tga.image_data, 0, size);
+
+        // Inner, full width and clipped rectangles
+        const uint16_t rects[][4] = {{3, 4, 20, 9}, {0, 15, width, 5}, {50, 30, 40, 40}};
+        for (int r = 0; r < 3; ++r) {
+            tga_fill_rect(&fill_tga, rects[r][0], rects[r][1], rects[r][2], rects[r][3], colors[i]);
+            for (uint16_t y = rects[r][1]; y < height && y < rects[r][1] + rects[r][3]; ++y) {
+                for (uint16_t x = rects[r][0]; x < width && x < rects[r][0] + rects[r][2]; ++x) {
+                    tga_set_pixel(&reference_tga, x, y, colors[i]);
+                }
+            }
+        }
+        int failed = memcmp(fill_tga.image_data, reference_tga.image_data, size) != 0;
+
+        // Whole image
+        tga_fill(&fill_tga, colors[i]);
+        for (uint16_t y = 0; y < height; ++y) {
+            for (uint16_t x = 0; x < width; ++x) {
+                tga_set_pixel(&reference_tga, x, y, colors[i]);
+            }
+        }
+        failed = failed || memcmp(fill_tga.image_data, reference_tga.image_data, size) != 0;
+
+        tga_free(&fill_tga);
+        tga_free(&reference_tga);
+
+        if (failed) {
+            printf("Fill test failed with Depth{%u}\n", pixel_depth);
+            return 1;
+        }
+    }
+
+    printf("Fill test passed\n");
+    return 0;
+}
+
+// Returns the mean absolute difference between the bytes of two buffers
+double mean_error(const uint8_t *a, const uint8_t *b, size_t size) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < size; ++i) {
+        total += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return size ? (double)total / size : 0.0;
+}
+
+int test_color_map_exact() {
+    TgaImage source_tga = {0};
+    TgaImage mapped_tga = {0};
+    TgaImage read_tga = {0};
+    const char *filenames[] = {FILENAME_COLOR_MAPPED, FILENAME_RLE_COLOR_MAPPED};
+    const TgaImageType image_types[] = {UNCOMPRESSED_TRUE_COLOR_IMAGE, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE};
+
+    width = 40;
+    height = 30;
+    pixel_depth = 24;
+    for (int i = 0; i < 2; ++i) {
+        if (tga_alloc(image_types[i], width, height, pixel_depth, &source_tga) != TGA_SUCCESS ||
+            tga_alloc(image_types[i], width, height, pixel_depth, &mapped_tga) != TGA_SUCCESS) {
+            printf("Memory allocation error in function %s\n", __func__);
+            return 1;
+        }
+
+        // 200 distinct colors in runs
+        for (uint16_t y = 0; y < height; ++y) {
+            for (uint16_t x = 0; x < width; ++x) {
+                uint8_t c = (uint8_t)((y * width + x) / 6);
+                tga_set_pixel(&source_tga, x, y, COLOR24(c, 255 - c, c / 2));
+            }
+        }
+        memcpy(mapped_tga.image_data, source_tga.image_data, tga_image_size(&source_tga.header));
+
+        int failed = tga_to_color_map(&mapped_tga) != TGA_SUCCESS ||
+                     mapped_tga.state != IS_COLOR_MAPPED ||
+                     mapped_tga.header.color_map_length != 200 ||
+                     mapped_tga.header.color_map_pixel_depth != 24 ||
+                     mapped_tga.header.image_pixel_depth != 8 ||
+                     tga_write_file(&mapped_tga, filenames[i]) != TGA_SUCCESS ||
+                     tga_read_file(&read_tga, filenames[i]) != TGA_SUCCESS ||
+                     read_tga.state != IS_COLOR_MAPPED ||
+                     tga_from_color_map(&read_tga) != TGA_SUCCESS ||
+                     read_tga.header.image_type != image_types[i] ||
+                     read_tga.header.image_pixel_depth != 24 ||
+                     memcmp(read_tga.image_data, source_tga.image_data, tga_image_size(&source_tga.header)) != 0;
+
+        // Expand while reading
+        TgaReadOptions options = {0};
+        options.expand_color_map = true;
+        tga_free(&read_tga);
+        failed = failed ||
+                 tga_read_file_ex(&read_tga, filenames[i], &options) != TGA_SUCCESS ||
+                 read_tga.state != IS_UNCOMPRESSED ||
+                 read_tga.header.image_type != image_types[i] ||
+                 read_tga.header.image_pixel_depth != 24 ||
+                 memcmp(read_tga.image_data, source_tga.image_data, tga_image_size(&source_tga.header)) != 0;
+
+        tga_free(&source_tga);
+        tga_free(&mapped_tga);
+        tga_free(&read_tga);
+
+        if (failed) {
+            printf("Exact color map test failed with ImageType{%u}\n", image_types[i]);
+            return 1;
+        }
+    }
+
+    printf("Exact color map test passed\n");
+    return 0;
+}
+
+int test_color_map_quantized(uint8_t depth) {
+    TgaImage source_tga = {0};
+    TgaImage mapped_tga = {0};
+
+    width = 256;
+    height = 256;
+    pixel_depth = depth;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &source_tga) != TGA_SUCCESS ||
+        tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &mapped_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+
+    // Smooth gradient with far more than 256 colors
+    for (uint16_t y = 0; y < height; ++y) {
+        for (uint16_t x = 0; x < width; ++x) {
+            TgaColor color = depth == 16 ? COLOR16(x / 8, y / 8, (x + y) / 16) :
+                             depth == 24 ? COLOR24(x, y, (x + y) / 2) :
+                             COLOR32(x, y, (x + y) / 2, 255 - x / 2);
+            tga_set_pixel(&source_tga, x, y, color);
+        }
+    }
+    size_t size = tga_image_size(&source_tga.header);
+    memcpy(mapped_tga.image_data, source_tga.image_data, size);
+
+    int failed = tga_to_color_map(&mapped_tga) != TGA_SUCCESS ||
+                 mapped_tga.header.color_map_length == 0 ||
+                 tga_from_color_map(&mapped_tga) != TGA_SUCCESS ||
+                 mapped_tga.header.image_pixel_depth != depth;
+    double error = failed ? 0.0 : mean_error(source_tga.image_data, mapped_tga.image_data, size);
+
+    tga_free(&source_tga);
+    tga_free(&mapped_tga);
+
+    // 16-bit bytes mix channels, so only deeper images are checked closely
+    if (failed || error > (depth == 16 ? 16.0 : 6.0)) {
+        printf("Quantized color map test failed with Depth{%u}\n", depth);
+        return 1;
+    }
+
+    printf("Quantized color map test passed with Depth{%u}, mean error %.2f\n", depth, error);
+    return 0;
+}
+
+int test_color_map_expand() {
+    const uint8_t depths[] = {15, 16, 24, 32};
+    const size_t pixel_count = 1001;
+    uint8_t indices[1001];
+    uint8_t color_map_data[200 * 4];
+    uint8_t expanded[1001 * 4];
+    uint8_t reference[1001 * 4];
+
+    for (size_t i = 0; i < pixel_count; ++i) indices[i] = (uint8_t)test_random();
+    for (size_t i = 0; i < sizeof(color_map_data); ++i) color_map_data[i] = (uint8_t)test_random();
+
+    for (int d = 0; d < 4; ++d) {
+        TgaHeader header = {0};
+        header.image_type = UNCOMPRESSED_COLOR_MAPPED_IMAGE;
+        header.image_pixel_depth = 8;
+        header.color_map_type = true;
+        header.color_map_first_index = 5;
+        header.color_map_length = 200;
+        header.color_map_pixel_depth = depths[d];
+        uint8_t entry_size = (depths[d] + 7) / 8;
+
+        // Indices below 5 and above 204 are outside of the color map
+        for (size_t i = 0; i < pixel_count; ++i) {
+            if (indices[i] >= 5 && indices[i] < 205) {
+                memcpy(reference + i * entry_size, color_map_data + (indices[i] - 5) * entry_size, entry_size);
+            } else {
+                memset(reference + i * entry_size, 0, entry_size);
+            }
+        }
+        tga_color_map_expand(expanded, indices, pixel_count, &header, color_map_data);
+
+        if (memcmp(expanded, reference, pixel_count * entry_size) != 0) {
+            printf("Color map expansion test failed with Depth{%u}\n", depths[d]);
+            return 1;
+        }
+    }
+
+    printf("Color map expansion test passed\n");
+    return 0;
+}
+
+// Reads a whole file into a new buffer
+uint8_t *read_bytes(const char *filename, size_t *size) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    long end = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *bytes = malloc(end > 0 ? (size_t)end : 1);
+    if (bytes && fread(bytes, 1, (size_t)end, fp) != (size_t)end) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(fp);
+
+    *size = (size_t)end;
+    return bytes;
+}
+
+// Fills size bytes with a run-length encoded image of 200 scanlines whose
+// footer points to an extension area at the start of its data, which is
+// too short to hold one
+void make_short_rle(uint8_t *file, size_t size) {
+    memset(file, 0, size);
+    file[2] = RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+    file[12] = 1;
+    file[14] = 200;
+    file[16] = 24;
+    file[size - TGA_FOOTER_SIZE] = TGA_HEADER_SIZE;
+    memcpy(file + size - 18, TGA_SIGNATURE, 18);
+}
+
+int test_parallel_rle() {
+    TgaImage written_tga = {0};
+    TgaImage parallel_tga = {0};
+    TgaImage serial_tga = {0};
+    TgaWriteOptions parallel_write = {4, true, 0};
+    TgaWriteOptions serial_write = {1, false, 0};
+    TgaReadOptions parallel_read = {false, 4, NULL, false};
+    TgaReadOptions serial_read = {false, 1, NULL, false};
+    const char image_id[] = "parallel";
+    uint8_t *parallel_bytes = NULL;
+    uint8_t *serial_bytes = NULL;
+    size_t parallel_size = 0, serial_size = 0;
+
+    width = 300;
+    height = 600;
+    pixel_depth = 24;
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &written_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(written_tga.image_data, (size_t)width * height, 3);
+    written_tga.header.id_length = sizeof(image_id) - 1;
+    written_tga.image_id = malloc(sizeof(image_id));
+    memcpy(written_tga.image_id, image_id, sizeof(image_id));
+
+    // The image data is the same for every thread count, followed by the
+    // scan line table, extension area and footer
+    int failed = tga_write_file_ex(&written_tga, FILENAME_PARALLEL, &parallel_write) != TGA_SUCCESS ||
+                 tga_write_file_ex(&written_tga, FILENAME_SERIAL, &serial_write) != TGA_SUCCESS ||
+                 !(parallel_bytes = read_bytes(FILENAME_PARALLEL, &parallel_size)) ||
+                 !(serial_bytes = read_bytes(FILENAME_SERIAL, &serial_size)) ||
+                 parallel_size != serial_size + (size_t)height * 4 + TGA_EXTENSION_SIZE + TGA_FOOTER_SIZE ||
+                 memcmp(parallel_bytes, serial_bytes, serial_size) != 0 ||
+                 memcmp(parallel_bytes + parallel_size - 18, TGA_SIGNATURE, 18) != 0;
+
+    // Bands decoded in parallel match the streaming reader
+    if (!failed) {
+        failed = tga_read_file_ex(&parallel_tga, FILENAME_PARALLEL, &parallel_read) != TGA_SUCCESS ||
+                 tga_read_file_ex(&serial_tga, FILENAME_PARALLEL, &serial_read) != TGA_SUCCESS ||
+                 parallel_tga.header.id_length != written_tga.header.id_length ||
+                 memcmp(parallel_tga.image_id, image_id, sizeof(image_id) - 1) != 0 ||
+                 memcmp(parallel_tga.image_data, written_tga.image_data, tga_image_size(&written_tga.header)) != 0 ||
+                 memcmp(serial_tga.image_data, written_tga.image_data, tga_image_size(&written_tga.header)) != 0;
+        tga_free(&parallel_tga);
+        tga_free(&serial_tga);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // A pipe can not seek to its scan line table, so it is read serially
+    if (!failed) {
+        TgaImage pipe_tga = {0};
+        uint8_t *pipe_bytes = NULL;
+        size_t pipe_size = 0;
+        char pipe_name[32];
+        int fds[2];
+        failed = tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, 16, 200, 24, &pipe_tga) != TGA_SUCCESS;
+        if (!failed) {
+            tga_fill(&pipe_tga, ORANGE24);
+            failed = tga_write_file_ex(&pipe_tga, FILENAME_PARALLEL, &parallel_write) != TGA_SUCCESS ||
+                     !(pipe_bytes = read_bytes(FILENAME_PARALLEL, &pipe_size)) ||
+                     pipe(fds) != 0;
+            tga_free(&pipe_tga);
+        }
+        if (!failed) {
+            // The whole file fits in the pipe buffer
+            failed = write(fds[1], pipe_bytes, pipe_size) != (ssize_t)pipe_size;
+            close(fds[1]);
+            snprintf(pipe_name, sizeof(pipe_name), "/dev/fd/%d", fds[0]);
+            failed = failed || tga_read_file_ex(&pipe_tga, pipe_name, &parallel_read) != TGA_SUCCESS ||
+                     memcmp(pipe_tga.image_data + tga_image_size(&pipe_tga.header) - 3, ORANGE24.bgra, 3) != 0;
+            close(fds[0]);
+            tga_free(&pipe_tga);
+        }
+        free(pipe_bytes);
+    }
+#endif
+
+    // A file too short for an extension area before its footer is read
+    // serially
+    if (!failed) {
+        uint8_t short_file[100];
+        make_short_rle(short_file, sizeof(short_file));
+        FILE *fp = fopen(FILENAME_PARALLEL, "wb");
+        failed = !fp || fwrite(short_file, 1, sizeof(short_file), fp) != sizeof(short_file);
+        if (fp) fclose(fp);
+        failed = failed || tga_read_file_ex(&parallel_tga, FILENAME_PARALLEL, &parallel_read) == TGA_SUCCESS;
+    }
+
+    // Bands that start past the end of the file are an error
+    if (!failed) {
+        memset(parallel_bytes + serial_size, 0xff, (size_t)height * 4);
+        FILE *fp = fopen(FILENAME_PARALLEL, "wb");
+        failed = !fp || fwrite(parallel_bytes, 1, parallel_size, fp) != parallel_size;
+        if (fp) fclose(fp);
+        failed = failed || tga_read_file_ex(&parallel_tga, FILENAME_PARALLEL, &parallel_read) != TGA_RLE_DECODE_ERROR;
+    }
+
+    free(parallel_bytes);
+    free(serial_bytes);
+    tga_free(&written_tga);
+
+    if (failed) {
+        printf("Parallel RLE test failed\n");
+        return 1;
+    }
+
+    printf("Parallel RLE test passed\n");
+    return 0;
+}
+
+int test_batch() {
+    TgaImage rle_tga = {0};
+    TgaImage alpha_tga = {0};
+    TgaImage mapped_tga = {0};
+    TgaImage read_tga = {0};
+    const char *inputs[] = {FILENAME_BATCH_RLE, FILENAME_BATCH_ALPHA, FILENAME_BATCH_MAPPED, FILENAME_BATCH_MISSING};
+    const char *outputs[] = {FILENAME_BATCH_OUT_RLE, FILENAME_BATCH_OUT_ALPHA, FILENAME_BATCH_OUT_MAPPED, FILENAME_BATCH_OUT_MISSING};
+    int results[4];
+    TgaBatchStats stats;
+
+    width = 97;
+    height = 45;
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, width, height, 24, &rle_tga) != TGA_SUCCESS ||
+        tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 32, &alpha_tga) != TGA_SUCCESS ||
+        tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 24, &mapped_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(rle_tga.image_data, (size_t)width * height, 3);
+    fill_runs_and_noise(alpha_tga.image_data, (size_t)width * height, 4);
+    alpha_tga.header.descriptor = 8;
+    tga_fill(&mapped_tga, ORANGE24);
+    tga_fill_rect(&mapped_tga, 10, 10, 20, 20, AZURE24);
+    int failed = tga_to_color_map(&mapped_tga) != TGA_SUCCESS ||
+                 tga_write_file(&rle_tga, FILENAME_BATCH_RLE) != TGA_SUCCESS ||
+                 tga_write_file(&alpha_tga, FILENAME_BATCH_ALPHA) != TGA_SUCCESS ||
+                 tga_write_file(&mapped_tga, FILENAME_BATCH_MAPPED) != TGA_SUCCESS;
+    remove(FILENAME_BATCH_MISSING);
+    if (!failed) failed = tga_from_color_map(&mapped_tga) != TGA_SUCCESS;
+
+    // Recompressing keeps every pixel and reports the missing file
+    TgaBatchOptions recompress = {TGA_BATCH_RECOMPRESS, true, 0, 2};
+    if (!failed) {
+        failed = tga_batch_convert(inputs, outputs, 4, &recompress, results, &stats) != TGA_FILE_OPEN_ERROR ||
+                 results[0] != TGA_SUCCESS || results[1] != TGA_SUCCESS || results[2] != TGA_SUCCESS ||
+                 results[3] != TGA_FILE_OPEN_ERROR ||
+                 stats.files_converted != 3 || stats.files_failed != 1 || stats.bytes_read == 0 ||
+                 tga_read_file(&read_tga, FILENAME_BATCH_OUT_ALPHA) != TGA_SUCCESS ||
+                 read_tga.header.image_type != RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE ||
+                 memcmp(read_tga.image_data, alpha_tga.image_data, tga_image_size(&alpha_tga.header)) != 0;
+        tga_free(&read_tga);
+    }
+
+    // Converting to 32 bits expands color maps and makes opaque pixels
+    TgaBatchOptions depth = {TGA_BATCH_CONVERT_DEPTH, false, 32, 2};
+    if (!failed) {
+        failed = tga_batch_convert(inputs, outputs, 3, &depth, NULL, &stats) != TGA_SUCCESS ||
+                 stats.files_converted != 3 ||
+                 tga_read_file(&read_tga, FILENAME_BATCH_OUT_MAPPED) != TGA_SUCCESS ||
+                 read_tga.header.image_type != UNCOMPRESSED_TRUE_COLOR_IMAGE ||
+                 read_tga.header.image_pixel_depth != 32;
+        for (size_t i = 0; !failed && i < (size_t)width * height; ++i) {
+            failed = memcmp(read_tga.image_data + i * 4, mapped_tga.image_data + i * 3, 3) != 0 ||
+                     read_tga.image_data[i * 4 + 3] != 255;
+        }
+        tga_free(&read_tga);
+    }
+
+    // Converting to 24 bits drops alpha
+    depth.pixel_depth = 24;
+    if (!failed) {
+        failed = tga_batch_convert(inputs, outputs, 2, &depth, NULL, NULL) != TGA_SUCCESS ||
+                 tga_read_file(&read_tga, FILENAME_BATCH_OUT_ALPHA) != TGA_SUCCESS ||
+                 read_tga.header.image_pixel_depth != 24 ||
+                 read_tga.header.descriptor != 0;
+        for (size_t i = 0; !failed && i < (size_t)width * height; ++i) {
+            failed = memcmp(read_tga.image_data + i * 3, alpha_tga.image_data + i * 4, 3) != 0;
+        }
+        tga_free(&read_tga);
+    }
+
+    // Palettizing an image with few colors keeps every pixel
+    TgaBatchOptions palettize = {TGA_BATCH_PALETTIZE, true, 0, 0};
+    if (!failed) {
+        failed = tga_batch_convert(outputs + 2, outputs + 2, 1, &palettize, NULL, NULL) != TGA_SUCCESS ||
+                 tga_read_file(&read_tga, FILENAME_BATCH_OUT_MAPPED) != TGA_SUCCESS ||
+                 read_tga.header.image_type != RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE ||
+                 read_tga.header.color_map_length != 2 ||
+                 tga_from_color_map(&read_tga) != TGA_SUCCESS;
+        for (size_t i = 0; !failed && i < (size_t)width * height; ++i) {
+            failed = memcmp(read_tga.image_data + i * 4, mapped_tga.image_data + i * 3, 3) != 0;
+        }
+        tga_free(&read_tga);
+    }
+
+    tga_free(&rle_tga);
+    tga_free(&alpha_tga);
+    tga_free(&mapped_tga);
+
+    if (failed) {
+        printf("Batch conversion test failed\n");
+        return 1;
+    }
+
+    printf("Batch conversion test passed\n");
+    return 0;
+}
+
+// Allocator that counts the blocks it has handed out
+void *counting_alloc(void *context, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr) ++*(int *)context;
+    return ptr;
+}
+
+void *counting_realloc(void *context, void *ptr, size_t size) {
+    if (!ptr) return counting_alloc(context, size);
+    return realloc(ptr, size);
+}
+
+void counting_free(void *context, void *ptr) {
+    if (ptr) --*(int *)context;
+    free(ptr);
+}
+
+// Returns true if every buffer of tga lies within buffer
+int within(const TgaImage *tga, const uint8_t *buffer, size_t size) {
+    const uint8_t *data = tga->image_data;
+    const uint8_t *color_map = tga->color_map_data;
+    return data >= buffer && data + tga_image_size(&tga->header) <= buffer + size &&
+           (!color_map || (color_map >= buffer && color_map < buffer + size));
+}
+
+int test_allocators() {
+    static uint8_t buffer[1 << 22];
+    TgaImage written_tga = {0};
+    TgaImage tga = {0};
+    int live_blocks = 0;
+    TgaAllocator counting = {counting_alloc, counting_realloc, counting_free, &live_blocks};
+
+    width = 200;
+    height = 150;
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, width, height, 24, &written_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(written_tga.image_data, (size_t)width * height, 3);
+    int failed = tga_write_file(&written_tga, FILENAME_ALLOCATOR) != TGA_SUCCESS;
+
+    // Every buffer of a decode, convert and encode pipeline goes through the allocator
+    TgaReadOptions options = {false, 1, &counting, false};
+    if (!failed) {
+        failed = tga_read_file_ex(&tga, FILENAME_ALLOCATOR, &options) != TGA_SUCCESS ||
+                 live_blocks != 1 ||
+                 tga_to_color_map(&tga) != TGA_SUCCESS ||
+                 live_blocks != 2 ||
+                 tga_write_file(&tga, FILENAME_ALLOCATOR_OUT) != TGA_SUCCESS ||
+                 tga_from_color_map(&tga) != TGA_SUCCESS ||
+                 live_blocks != 1;
+        tga_free(&tga);
+        failed = failed || live_blocks != 0;
+    }
+
+    // The same pipeline runs inside an arena
+    TgaArena arena;
+    TgaAllocator arena_allocator = tga_arena_allocator(&arena);
+    tga_arena_init(&arena, buffer, sizeof(buffer));
+    options.allocator = &arena_allocator;
+    if (!failed) {
+        failed = tga_read_file_ex(&tga, FILENAME_ALLOCATOR, &options) != TGA_SUCCESS ||
+                 memcmp(tga.image_data, written_tga.image_data, tga_image_size(&written_tga.header)) != 0 ||
+                 tga_to_color_map(&tga) != TGA_SUCCESS ||
+                 !within(&tga, buffer, sizeof(buffer)) ||
+                 tga_write_file(&tga, FILENAME_ALLOCATOR_OUT) != TGA_SUCCESS;
+        tga_free(&tga);
+        tga_arena_reset(&arena);
+    }
+
+    // A full arena fails cleanly
+    tga_arena_init(&arena, buffer, 1000);
+    if (!failed) {
+        failed = tga_read_file_ex(&tga, FILENAME_ALLOCATOR, &options) != TGA_ALLOCATION_ERROR;
+    }
+
+    // A pool reuses the blocks of each image for the next one
+    TgaPool pool;
+    TgaAllocator pool_allocator = tga_pool_allocator(&pool);
+    tga_pool_init(&pool, buffer, sizeof(buffer));
+    options.allocator = &pool_allocator;
+    size_t pool_used = 0;
+    for (int i = 0; !failed && i < 3; ++i) {
+        failed = tga_read_file_ex(&tga, FILENAME_ALLOCATOR, &options) != TGA_SUCCESS ||
+                 !within(&tga, buffer, sizeof(buffer)) ||
+                 tga_to_color_map(&tga) != TGA_SUCCESS ||
+                 tga_from_color_map(&tga) != TGA_SUCCESS;
+        tga_free(&tga);
+        if (i == 0) pool_used = pool.arena.used;
+        failed = failed || pool.arena.used != pool_used;
+    }
+
+    tga_free(&written_tga);
+
+    if (failed) {
+        printf("Allocator test failed\n");
+        return 1;
+    }
+
+    printf("Allocator test passed\n");
+    return 0;
+}
+
+// Reference unpacking of a pixel into 8-bit channels, written without the
+// bit tricks of the library
+void reference_unpack(uint32_t value, uint8_t depth, int alpha, uint32_t bgra[4]) {
+    if (depth == 8) {
+        bgra[0] = bgra[1] = bgra[2] = value;
+        bgra[3] = 255;
+    } else if (depth == 15 || depth == 16) {
+        for (int c = 0; c < 3; ++c) {
+            bgra[c] = (((value >> (5 * c)) & 31) * 255 + 15) / 31;
+        }
+        bgra[3] = depth == 16 && alpha && !(value & 0x8000) ? 0 : 255;
+    } else {
+        for (int c = 0; c < 4; ++c) {
+            bgra[c] = (value >> (8 * c)) & 255;
+        }
+        if (depth == 24 || !alpha) bgra[3] = 255;
+    }
+}
+
+// Reference packing of 8-bit channels, rounding to nearest
+uint32_t reference_pack(const uint32_t bgra[4], uint8_t depth) {
+    if (depth == 8) return (77 * bgra[2] + 150 * bgra[1] + 29 * bgra[0] + 128) / 256;
+    if (depth == 15 || depth == 16) {
+        uint32_t value = 0;
+        for (int c = 0; c < 3; ++c) {
+            value |= (bgra[c] * 62 + 255) / 510 << (5 * c);
+        }
+        if (depth == 16 && bgra[3] >= 128) value |= 0x8000;
+        return value;
+    }
+    return bgra[0] | bgra[1] << 8 | bgra[2] << 16 | (depth == 32 ? bgra[3] << 24 : 0);
+}
+
+uint32_t load_pixel(const uint8_t *data, uint8_t pixel_size) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < pixel_size; ++i) {
+        value |= (uint32_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+void store_pixel(uint8_t *data, uint32_t value, uint8_t pixel_size) {
+    for (uint8_t i = 0; i < pixel_size; ++i) {
+        data[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// Returns the source pixel at index i, covering every 8-bit and 16-bit
+// value and sweeps plus random values of deeper pixels
+uint32_t convert_source_pixel(uint8_t depth, size_t i) {
+    if (depth == 8) return i & 0xff;
+    if (depth == 15) return i & 0x7fff;
+    if (depth == 16) return i & 0xffff;
+    if (i < 256 * 4) {
+        // One channel at a time through every value
+        return (uint32_t)(i & 0xff) << (8 * (i >> 8)) | (depth == 32 && i >> 8 != 3 ? 0x80000000u : 0);
+    }
+    return depth == 24 ? test_random() & 0xffffff : test_random();
+}
+
+int test_convert_depth_pair(uint8_t src_depth, uint8_t dst_depth, int alpha) {
+    TgaImage convert_tga = {0};
+    const uint8_t depths_alpha[33] = {[16] = 1, [32] = 8};
+
+    // An odd width leaves partial vectors at the end of every row
+    width = 301;
+    height = 219;
+    TgaImageType type = src_depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    if (tga_alloc(type, width, height, src_depth, &convert_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    convert_tga.header.descriptor = 0x20 | (alpha ? depths_alpha[src_depth] : 0);
+
+    size_t pixel_count = (size_t)width * height;
+    uint8_t src_size = (src_depth + 7) / 8;
+    uint8_t dst_size = (dst_depth + 7) / 8;
+    uint32_t *source = malloc(pixel_count * sizeof(uint32_t));
+    if (!source) {
+        printf("Memory allocation error in function %s\n", __func__);
+        tga_free(&convert_tga);
+        return 1;
+    }
+    for (size_t i = 0; i < pixel_count; ++i) {
+        source[i] = convert_source_pixel(src_depth, i);
+        store_pixel(convert_tga.image_data + i * src_size, source[i], src_size);
+    }
+
+    int failed = tga_convert_depth(&convert_tga, dst_depth, false) != TGA_SUCCESS ||
+                 convert_tga.header.image_pixel_depth != dst_depth ||
+                 convert_tga.header.image_type != (dst_depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE) ||
+                 convert_tga.header.descriptor != (0x20 | (alpha ? depths_alpha[dst_depth] : 0));
+    for (size_t i = 0; !failed && i < pixel_count; ++i) {
+        uint32_t bgra[4];
+        reference_unpack(source[i], src_depth, alpha, bgra);
+        uint32_t value = load_pixel(convert_tga.image_data + i * dst_size, dst_size);
+        if (value != reference_pack(bgra, dst_depth)) {
+            printf("Pixel %zu: 0x%x became 0x%x instead of 0x%x\n", i, source[i], value, reference_pack(bgra, dst_depth));
+            failed = 1;
+        }
+    }
+
+    free(source);
+    tga_free(&convert_tga);
+
+    if (failed) {
+        printf("Depth conversion test failed from Depth{%u} to Depth{%u}, alpha %d\n", src_depth, dst_depth, alpha);
+        return 1;
+    }
+    return 0;
+}
+
+int test_convert_depth() {
+    const uint8_t depths[] = {8, 15, 16, 24, 32};
+    int failures = 0;
+
+    // Every pair of depths against the reference, with and without alpha
+    for (int s = 0; s < 5; ++s) {
+        for (int d = 0; d < 5; ++d) {
+            if (s == d) continue;
+            failures += test_convert_depth_pair(depths[s], depths[d], 0);
+            if (depths[s] == 16 || depths[s] == 32) failures += test_convert_depth_pair(depths[s], depths[d], 1);
+        }
+    }
+
+    // Dithering picks the level below or above each channel and averages
+    // to the channel over every 4x4 block
+    TgaImage convert_tga = {0};
+    width = 64;
+    height = 64;
+    pixel_depth = 24;
+    int failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &convert_tga) != TGA_SUCCESS;
+    for (uint16_t y = 0; !failed && y < height; ++y) {
+        for (uint16_t x = 0; x < width; ++x) {
+            tga_set_pixel(&convert_tga, x, y, COLOR24((y / 4) * 16 + x / 4, 100, 3));
+        }
+    }
+    failed = failed || tga_convert_depth(&convert_tga, 15, true) != TGA_SUCCESS;
+    for (uint16_t by = 0; !failed && by < height; by += 4) {
+        for (uint16_t bx = 0; bx < width; bx += 4) {
+            uint32_t channel = (by / 4) * 16 + bx / 4;
+            uint32_t sum = 0;
+            for (uint16_t y = by; y < by + 4; ++y) {
+                for (uint16_t x = bx; x < bx + 4; ++x) {
+                    uint32_t red = (load_pixel(convert_tga.image_data + ((size_t)y * width + x) * 2, 2) >> 10) & 31;
+                    if (red * 255 > channel * 31 + 254 || red * 255 + 255 < channel * 31 + 1) failed = 1;
+                    sum += red;
+                }
+            }
+            // The mean of 16 levels is within one sixteenth of the channel
+            if (sum * 255 + 255 < channel * 31 * 16 || sum * 255 > channel * 31 * 16 + 255) failed = 1;
+        }
+    }
+    tga_free(&convert_tga);
+
+    // Color mapped images convert their color map, which holds every color
+    // of the image exactly
+    TgaImage mapped_tga = {0};
+    width = 40;
+    height = 30;
+    if (!failed) {
+        failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 24, &convert_tga) != TGA_SUCCESS ||
+                 tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 24, &mapped_tga) != TGA_SUCCESS;
+    }
+    if (!failed) {
+        for (uint16_t y = 0; y < height; ++y) {
+            for (uint16_t x = 0; x < width; ++x) {
+                tga_set_pixel(&convert_tga, x, y, COLOR24(x * 6, (y % 6) * 40, 50));
+            }
+        }
+        memcpy(mapped_tga.image_data, convert_tga.image_data, tga_image_size(&convert_tga.header));
+        failed = tga_to_color_map(&mapped_tga) != TGA_SUCCESS ||
+                 tga_convert_depth(&mapped_tga, 16, false) != TGA_SUCCESS ||
+                 mapped_tga.header.color_map_pixel_depth != 16 ||
+                 tga_from_color_map(&mapped_tga) != TGA_SUCCESS ||
+                 tga_convert_depth(&convert_tga, 16, false) != TGA_SUCCESS ||
+                 memcmp(mapped_tga.image_data, convert_tga.image_data, tga_image_size(&convert_tga.header)) != 0;
+    }
+    tga_free(&mapped_tga);
+
+    // Mapped files shrink inside the mapping and grow out of it
+    if (!failed) failed = tga_write_file(&convert_tga, FILENAME_CONVERT) != TGA_SUCCESS;
+    tga_free(&convert_tga);
+    for (int grow = 0; !failed && grow < 2; ++grow) {
+        TgaImage read_tga = {0};
+        uint8_t depth = grow ? 32 : 8;
+        failed = tga_map_file(&mapped_tga, FILENAME_CONVERT) != TGA_SUCCESS ||
+                 tga_read_file(&read_tga, FILENAME_CONVERT) != TGA_SUCCESS ||
+                 tga_convert_depth(&mapped_tga, depth, false) != TGA_SUCCESS ||
+                 (mapped_tga.mapping != NULL) != !grow ||
+                 tga_convert_depth(&read_tga, depth, false) != TGA_SUCCESS ||
+                 memcmp(mapped_tga.image_data, read_tga.image_data, tga_image_size(&read_tga.header)) != 0;
+        tga_free(&mapped_tga);
+        tga_free(&read_tga);
+    }
+
+    if (tga_convert_depth(&convert_tga, 12, false) != TGA_INVALID_PIXEL_DEPTH_ERROR) failed = 1;
+
+    if (failed || failures) {
+        printf("Depth conversion test failed\n");
+        return 1;
+    }
+
+    printf("Depth conversion test passed\n");
+    return 0;
+}
+
+int test_memory() {
+    const char image_id[] = "memory";
+    const TgaImageType types[] = {UNCOMPRESSED_TRUE_COLOR_IMAGE, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE};
+    TgaImage written_tga = {0};
+    TgaImage decoded_tga = {0};
+
+    width = 200;
+    height = 300;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 24, &written_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(written_tga.image_data, (size_t)width * height, 3);
+    written_tga.header.id_length = sizeof(image_id) - 1;
+    written_tga.image_id = malloc(sizeof(image_id));
+    memcpy(written_tga.image_id, image_id, sizeof(image_id));
+    size_t image_size = tga_image_size(&written_tga.header);
+
+    // Uncompressed, run-length encoded, and run-length encoded on several
+    // threads with a scan line table
+    int failed = 0;
+    for (int i = 0; !failed && i < 3; ++i) {
+        TgaWriteOptions write_options = {i == 2 ? 3 : 1, i == 2, 0};
+        TgaReadOptions read_options = {false, 2, NULL, false};
+        written_tga.header.image_type = types[i];
+
+        // Encoding matches the file byte for byte, and its size is known first
+        size_t file_size = 0;
+        uint8_t *file = NULL;
+        if (tga_write_file_ex(&written_tga, FILENAME_MEMORY, &write_options) != TGA_SUCCESS ||
+            !(file = read_bytes(FILENAME_MEMORY, &file_size))) {
+            failed = 1;
+            break;
+        }
+        size_t size = tga_encoded_size(&written_tga, &write_options);
+        uint8_t *encoded = malloc(size + 1);
+        size_t encoded_size = 0;
+        failed = !encoded || size != file_size ||
+                 tga_encode_memory(&written_tga, encoded, size - 1, &write_options, &encoded_size) != TGA_FILE_WRITE_ERROR ||
+                 tga_encode_memory(&written_tga, encoded, size + 1, &write_options, &encoded_size) != TGA_SUCCESS ||
+                 encoded_size != size ||
+                 memcmp(encoded, file, size) != 0;
+
+        // Decoding gives back the image, and truncated data fails
+        if (!failed) {
+            failed = tga_decode_memory(&decoded_tga, encoded, size, &read_options) != TGA_SUCCESS ||
+                     decoded_tga.header.image_type != types[i] ||
+                     memcmp(decoded_tga.image_id, image_id, sizeof(image_id) - 1) != 0 ||
+                     memcmp(decoded_tga.image_data, written_tga.image_data, image_size) != 0;
+            tga_free(&decoded_tga);
+        }
+        if (!failed && i < 2) {
+            int result = tga_decode_memory(&decoded_tga, encoded, size - 1, &read_options);
+            failed = result != (i == 0 ? TGA_FILE_READ_ERROR : TGA_RLE_DECODE_ERROR);
+        }
+
+        // Callbacks over memory read and write the same data
+        TgaMemoryIo memory;
+        tga_memory_io_init(&memory, encoded, size);
+        TgaIo io = tga_memory_io(&memory);
+        if (!failed) {
+            failed = tga_read_io(&decoded_tga, &io, &read_options) != TGA_SUCCESS ||
+                     memcmp(decoded_tga.image_data, written_tga.image_data, image_size) != 0 ||
+                     io.seek(io.context, 0, SEEK_SET) != 0 ||
+                     tga_write_io(&decoded_tga, &io, &write_options) != TGA_SUCCESS ||
+                     memory.position != size ||
+                     memcmp(encoded, file, size) != 0 ||
+                     io.seek(io.context, 1, SEEK_END) == 0;
+            tga_free(&decoded_tga);
+        }
+
+        free(encoded);
+        free(file);
+    }
+
+    // Color mapped data can be expanded while it is decoded
+    if (!failed) {
+        TgaReadOptions expand_options = {true, 1, NULL, false};
+        TgaImage mapped_tga = {0};
+        written_tga.header.image_type = UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        failed = tga_decode_memory(&mapped_tga, NULL, 0, NULL) != TGA_FILE_READ_ERROR ||
+                 tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 16, 16, 24, &mapped_tga) != TGA_SUCCESS;
+        if (!failed) {
+            tga_fill(&mapped_tga, ROSE24);
+            tga_set_pixel(&mapped_tga, 3, 4, BLUE24);
+            uint8_t expected[16 * 16 * 3];
+            memcpy(expected, mapped_tga.image_data, sizeof(expected));
+            size_t size = 0;
+            uint8_t *encoded = NULL;
+            failed = tga_to_color_map(&mapped_tga) != TGA_SUCCESS ||
+                     !(encoded = malloc(tga_encoded_size(&mapped_tga, NULL))) ||
+                     tga_encode_memory(&mapped_tga, encoded, tga_encoded_size(&mapped_tga, NULL), NULL, &size) != TGA_SUCCESS;
+            tga_free(&mapped_tga);
+            failed = failed ||
+                     tga_decode_memory(&mapped_tga, encoded, size, &expand_options) != TGA_SUCCESS ||
+                     mapped_tga.header.image_pixel_depth != 24 ||
+                     memcmp(mapped_tga.image_data, expected, sizeof(expected)) != 0;
+            tga_free(&mapped_tga);
+            free(encoded);
+        }
+    }
+
+    // Data too short for an extension area before its footer fails on any
+    // number of threads
+    if (!failed) {
+        TgaReadOptions banded_options = {false, 4, NULL, false};
+        TgaImage short_tga = {0};
+        uint8_t *short_file = malloc(100);
+        failed = !short_file;
+        if (!failed) {
+            make_short_rle(short_file, 100);
+            failed = tga_decode_memory(&short_tga, short_file, 100, &banded_options) == TGA_SUCCESS;
+        }
+        free(short_file);
+    }
+
+    tga_free(&written_tga);
+
+    if (failed) {
+        printf("Memory encode and decode test failed\n");
+        return 1;
+    }
+
+    printf("Memory encode and decode test passed\n");
+    return 0;
+}
+
+int test_probe() {
+    TgaImage probe_tga = {0};
+    TgaProbe probe;
+    TgaProbe memory_probe;
+
+    width = 120;
+    height = 90;
+    mkdir(DIRECTORY_PROBE, 0755);
+    mkdir(DIRECTORY_PROBE_NESTED, 0755);
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 32, &probe_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(probe_tga.image_data, (size_t)width * height, 4);
+
+    // A plain file has no extension area, and an RLE file with a scan line
+    // table has one that points at the table
+    TgaWriteOptions table_options = {1, true, 0};
+    int failed = tga_write_file(&probe_tga, FILENAME_PROBE) != TGA_SUCCESS;
+    probe_tga.header.image_type = RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+    failed = failed || tga_write_file_ex(&probe_tga, FILENAME_PROBE_RLE, &table_options) != TGA_SUCCESS;
+    failed = failed ||
+             tga_probe_file(FILENAME_PROBE, true, &probe) != TGA_SUCCESS ||
+             probe.header.width != width || probe.header.height != height ||
+             probe.header.image_pixel_depth != 32 || probe.has_extension ||
+             probe.data_offset != TGA_HEADER_SIZE ||
+             probe.file_size != TGA_HEADER_SIZE + tga_image_size(&probe_tga.header);
+    failed = failed ||
+             tga_probe_file(FILENAME_PROBE_RLE, true, &probe) != TGA_SUCCESS ||
+             probe.header.image_type != RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE ||
+             !probe.has_extension || probe.scan_line_offset == 0 ||
+             probe.extension_offset != probe.file_size - TGA_EXTENSION_SIZE - TGA_FOOTER_SIZE ||
+             tga_probe_file(FILENAME_PROBE_RLE, false, &probe) != TGA_SUCCESS || probe.has_extension;
+
+    // Probing memory gives the same result as probing the file
+    size_t size = 0;
+    uint8_t *file = read_bytes(FILENAME_PROBE_RLE, &size);
+    failed = failed || !file ||
+             tga_probe_file(FILENAME_PROBE_RLE, true, &probe) != TGA_SUCCESS ||
+             tga_probe_memory(file, size, true, &memory_probe) != TGA_SUCCESS ||
+             memcmp(&probe, &memory_probe, sizeof(probe)) != 0;
+
+    // Truncated data, bad depths and unknown image types fail
+    if (!failed) {
+        uint8_t header[TGA_HEADER_SIZE];
+        memcpy(header, file, TGA_HEADER_SIZE);
+        header[2] = UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        failed = tga_probe_memory(header, TGA_HEADER_SIZE - 1, false, &probe) != TGA_FILE_READ_ERROR ||
+                 tga_probe_memory(header, TGA_HEADER_SIZE, false, &probe) != TGA_FILE_READ_ERROR;
+        header[2] = RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+        header[16] = 12;
+        failed = failed || tga_probe_memory(header, TGA_HEADER_SIZE, false, &probe) != TGA_INVALID_PIXEL_DEPTH_ERROR;
+        header[2] = 5;
+        failed = failed || tga_probe_memory(header, TGA_HEADER_SIZE, false, &probe) != TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+    }
+    free(file);
+
+    FILE *fp = fopen(FILENAME_PROBE_SHORT, "wb");
+    if (fp) {
+        fwrite("TGA", 1, 3, fp);
+        fclose(fp);
+    }
+    fp = fopen(FILENAME_PROBE_TEXT, "wb");
+    if (fp) fclose(fp);
+    failed = failed || tga_probe_file(FILENAME_PROBE_SHORT, false, &probe) != TGA_FILE_READ_ERROR ||
+             tga_probe_file("probe/missing.tga", false, &probe) != TGA_FILE_OPEN_ERROR;
+
+    // Scanning finds every .tga file, sorted by path, and only goes into
+    // subdirectories when asked to
+    TgaScanOptions scan_options = {true, true, 4};
+    TgaScanEntry *entries = NULL;
+    size_t entry_count = 0;
+    failed = failed ||
+             tga_scan_directory(DIRECTORY_PROBE, &scan_options, &entries, &entry_count) != TGA_SUCCESS ||
+             entry_count != 3 ||
+             strcmp(entries[0].path, FILENAME_PROBE_RLE) != 0 || entries[0].result != TGA_SUCCESS ||
+             !entries[0].probe.has_extension ||
+             strcmp(entries[1].path, FILENAME_PROBE) != 0 || entries[1].result != TGA_SUCCESS ||
+             entries[1].probe.header.width != width ||
+             strcmp(entries[2].path, FILENAME_PROBE_SHORT) != 0 || entries[2].result != TGA_FILE_READ_ERROR;
+    tga_scan_free(entries);
+
+    scan_options.recursive = false;
+    failed = failed ||
+             tga_scan_directory(DIRECTORY_PROBE, &scan_options, &entries, &entry_count) != TGA_SUCCESS ||
+             entry_count != 2 || strcmp(entries[0].path, FILENAME_PROBE) != 0;
+    tga_scan_free(entries);
+    failed = failed || tga_scan_directory("probe/missing", NULL, &entries, &entry_count) != TGA_FILE_OPEN_ERROR;
+
+    tga_free(&probe_tga);
+
+    if (failed) {
+        printf("Probe test failed\n");
+        return 1;
+    }
+
+    printf("Probe test passed\n");
+    return 0;
+}
+
+int test_view() {
+    TgaImage atlas_tga = {0};
+    TgaImage rect_tga = {0};
+    TgaImage read_tga = {0};
+    const uint16_t rect_x = 13, rect_y = 7, rect_width = 37, rect_height = 21;
+
+    width = 64;
+    height = 48;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, 32, &atlas_tga) != TGA_SUCCESS ||
+        tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, rect_width, rect_height, 32, &rect_tga) != TGA_SUCCESS) {
+        tga_free(&atlas_tga);
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(atlas_tga.image_data, (size_t)width * height, 4);
+
+    // Views of a sub-rectangle see the rows of the image, and are clipped to it
+    TgaView atlas = tga_image_view(&atlas_tga);
+    TgaView rect = tga_subview(&atlas, rect_x, rect_y, rect_width, rect_height);
+    TgaView corner = tga_subview(&atlas, width - 4, height - 8, 100, 100);
+    TgaView outside = tga_subview(&atlas, width, 0, 10, 10);
+    int failed = rect.stride != (size_t)width * 4 ||
+                 rect.data != atlas_tga.image_data + rect_y * rect.stride + rect_x * 4 ||
+                 corner.width != 4 || corner.height != 8 ||
+                 outside.width != 0;
+    for (uint16_t y = 0; y < rect_height; ++y) {
+        memcpy(rect_tga.image_data + (size_t)y * rect_width * 4, rect.data + y * rect.stride, (size_t)rect_width * 4);
+    }
+
+    // Converting the rectangle into packed memory gives the same pixels as
+    // converting a copy of it
+    uint8_t *packed = malloc((size_t)rect_width * rect_height * 2);
+    TgaView packed_view;
+    failed = failed || !packed ||
+             tga_view_init(&packed_view, packed, rect_width, rect_height, 0, 16) != TGA_SUCCESS ||
+             packed_view.stride != (size_t)rect_width * 2 ||
+             tga_view_init(&packed_view, packed, rect_width, rect_height, 0, 12) != TGA_INVALID_PIXEL_DEPTH_ERROR ||
+             tga_view_convert(&packed_view, &rect, false, true) != TGA_SUCCESS;
+    if (!failed) {
+        TgaImage converted_tga = {0};
+        failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, rect_width, rect_height, 32, &converted_tga) != TGA_SUCCESS;
+        if (!failed) {
+            memcpy(converted_tga.image_data, rect_tga.image_data, tga_image_size(&rect_tga.header));
+            failed = tga_convert_depth(&converted_tga, 16, true) != TGA_SUCCESS ||
+                     memcmp(converted_tga.image_data, packed, (size_t)rect_width * rect_height * 2) != 0;
+        }
+        tga_free(&converted_tga);
+    }
+    free(packed);
+
+    // Writing the rectangle gives the same file as writing a copy of it
+    TgaWriter writer;
+    rect_tga.header.image_type = RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+    failed = failed ||
+             tga_write_view(&rect, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, FILENAME_VIEW) != TGA_SUCCESS ||
+             tga_read_file(&read_tga, FILENAME_VIEW) != TGA_SUCCESS ||
+             read_tga.header.width != rect_width || read_tga.header.height != rect_height ||
+             memcmp(read_tga.image_data, rect_tga.image_data, tga_image_size(&rect_tga.header)) != 0;
+    tga_free(&read_tga);
+    if (!failed && tga_writer_open(&writer, &rect_tga.header, NULL, NULL, FILENAME_VIEW) == TGA_SUCCESS) {
+        failed = tga_writer_write_view(&writer, &corner) != TGA_FILE_WRITE_ERROR ||
+                 tga_writer_write_view(&writer, &rect) != TGA_SUCCESS ||
+                 tga_writer_close(&writer) != TGA_SUCCESS;
+    }
+
+    // Filling and converting in place only touch the rectangle
+    tga_view_fill(&rect, COLOR32(1, 2, 3, 4));
+    for (uint16_t y = 0; !failed && y < height; ++y) {
+        for (uint16_t x = 0; !failed && x < width; ++x) {
+            bool inside = x >= rect_x && x < rect_x + rect_width && y >= rect_y && y < rect_y + rect_height;
+            const uint8_t *pixel = atlas_tga.image_data + ((size_t)y * width + x) * 4;
+            failed = inside && memcmp(pixel, COLOR32(1, 2, 3, 4).bgra, 4) != 0;
+        }
+    }
+    uint8_t before[4];
+    uint8_t after[4];
+    memcpy(before, atlas_tga.image_data, 4);
+    memcpy(after, rect.data + (rect_width + 1) * 4 + rect.stride * rect_height, 4);
+    TgaView gray = rect;
+    gray.pixel_depth = 8;
+    failed = failed || tga_view_convert(&gray, &rect, false, false) != TGA_SUCCESS;
+    for (uint16_t y = 0; !failed && y < rect_height; ++y) {
+        for (uint16_t x = 0; !failed && x < rect_width; ++x) {
+            // Luma of (1, 2, 3) rounds to 2
+            failed = gray.data[y * gray.stride + x] != 2;
+        }
+    }
+    failed = failed || memcmp(before, atlas_tga.image_data, 4) != 0 ||
+             memcmp(after, rect.data + (rect_width + 1) * 4 + rect.stride * rect_height, 4) != 0;
+
+    tga_free(&atlas_tga);
+    tga_free(&rect_tga);
+
+    if (failed) {
+        printf("View test failed\n");
+        return 1;
+    }
+
+    printf("View test passed\n");
+    return 0;
+}
+
+// Stores the pixels of src, which start at the corner descriptor gives,
+// from the top left corner into dst
+void reference_top_left(uint8_t *dst, const uint8_t *src, uint16_t w, uint16_t h, uint8_t pixel_size, uint8_t descriptor) {
+    for (uint16_t y = 0; y < h; ++y) {
+        for (uint16_t x = 0; x < w; ++x) {
+            size_t row = (descriptor & 0x20) ? y : (size_t)(h - 1 - y);
+            size_t column = (descriptor & 0x10) ? (size_t)(w - 1 - x) : x;
+            memcpy(dst + (row * w + column) * pixel_size, src + ((size_t)y * w + x) * pixel_size, pixel_size);
+        }
+    }
+}
+
+// Checks that every way of reading a file with the top_left option gives
+// the pixels from the top left corner
+int test_orientation_read(uint8_t depth, uint8_t descriptor) {
+    TgaImage written_tga = {0};
+    TgaImage read_tga = {0};
+    uint8_t pixel_size = (depth + 7) / 8;
+
+    width = 67;
+    height = 45;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, depth, &written_tga) != TGA_SUCCESS) return 1;
+    size_t image_size = tga_image_size(&written_tga.header);
+    fill_runs_and_noise(written_tga.image_data, (size_t)width * height, pixel_size);
+    written_tga.header.descriptor = descriptor;
+    uint8_t *expected = malloc(image_size);
+    reference_top_left(expected, written_tga.image_data, width, height, pixel_size, descriptor);
+
+    // Uncompressed and run-length encoded files read serially, and run-length
+    // encoded files with a scan line table read in parallel bands
+    const TgaImageType types[] = {UNCOMPRESSED_TRUE_COLOR_IMAGE, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE};
+    int failed = !expected;
+    for (int i = 0; !failed && i < 3; ++i) {
+        TgaWriteOptions write_options = {1, i == 2, 0};
+        TgaReadOptions read_options = {false, i == 2 ? 4 : 1, NULL, true};
+        written_tga.header.image_type = types[i];
+        size_t size = 0;
+        uint8_t *file = NULL;
+        failed = tga_write_file_ex(&written_tga, FILENAME_ORIENTATION, &write_options) != TGA_SUCCESS ||
+                 tga_read_file_ex(&read_tga, FILENAME_ORIENTATION, &read_options) != TGA_SUCCESS ||
+                 (read_tga.header.descriptor & 0x30) != 0x20 ||
+                 memcmp(read_tga.image_data, expected, image_size) != 0;
+        tga_free(&read_tga);
+        failed = failed || !(file = read_bytes(FILENAME_ORIENTATION, &size)) ||
+                 tga_decode_memory(&read_tga, file, size, &read_options) != TGA_SUCCESS ||
+                 memcmp(read_tga.image_data, expected, image_size) != 0;
+        tga_free(&read_tga);
+        free(file);
+    }
+
+    // Color mapped files are placed while they are expanded, and images in
+    // memory are flipped the same way
+    written_tga.header.image_type = UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    if (!failed && depth == 24) {
+        TgaReadOptions expand_options = {true, 1, NULL, true};
+        for (size_t i = 0; i < (size_t)width * height; ++i) {
+            written_tga.image_data[i * 3] = 0;
+            written_tga.image_data[i * 3 + 1] = (uint8_t)(i % 200);
+            written_tga.image_data[i * 3 + 2] = 0;
+        }
+        reference_top_left(expected, written_tga.image_data, width, height, pixel_size, descriptor);
+        failed = tga_to_color_map(&written_tga) != TGA_SUCCESS ||
+                 tga_write_file(&written_tga, FILENAME_ORIENTATION) != TGA_SUCCESS ||
+                 tga_read_file_ex(&read_tga, FILENAME_ORIENTATION, &expand_options) != TGA_SUCCESS ||
+                 memcmp(read_tga.image_data, expected, image_size) != 0;
+        tga_free(&read_tga);
+        failed = failed || tga_from_color_map(&written_tga) != TGA_SUCCESS;
+    }
+    failed = failed ||
+             tga_normalize_orientation(&written_tga) != TGA_SUCCESS ||
+             written_tga.header.descriptor != ((descriptor & 0x0f) | 0x20) ||
+             memcmp(written_tga.image_data, expected, image_size) != 0;
+
+    free(expected);
+    tga_free(&written_tga);
+    return failed;
+}
+
+// Checks flips, transposes and rotations of a w by h image against the
+// position every pixel should end up in
+int test_orientation_turn(uint8_t depth, uint16_t w, uint16_t h) {
+    TgaImage tga = {0};
+    uint8_t pixel_size = (depth + 7) / 8;
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, w, h, depth, &tga) != TGA_SUCCESS) return 1;
+    size_t image_size = tga_image_size(&tga.header);
+    fill_runs_and_noise(tga.image_data, (size_t)w * h, pixel_size);
+    uint8_t *original = malloc(image_size);
+    if (!original) {
+        tga_free(&tga);
+        return 1;
+    }
+    memcpy(original, tga.image_data, image_size);
+
+    int failed = tga_flip_vertical(&tga) != TGA_SUCCESS || tga_flip_horizontal(&tga) != TGA_SUCCESS;
+    for (size_t i = 0; !failed && i < (size_t)w * h; ++i) {
+        // Both flips together turn the image half way around
+        failed = memcmp(tga.image_data + i * pixel_size, original + ((size_t)w * h - 1 - i) * pixel_size, pixel_size) != 0;
+    }
+    failed = failed || tga_flip_vertical(&tga) != TGA_SUCCESS || tga_flip_horizontal(&tga) != TGA_SUCCESS ||
+             memcmp(tga.image_data, original, image_size) != 0;
+
+    // Pixel (x, y) of the transpose is pixel (y, x), and pixel (x, y) turned
+    // clockwise is pixel (y, h - 1 - x)
+    failed = failed || tga_transpose(&tga) != TGA_SUCCESS || tga.header.width != h || tga.header.height != w;
+    for (uint16_t y = 0; !failed && y < w; ++y) {
+        for (uint16_t x = 0; !failed && x < h; ++x) {
+            failed = memcmp(tga.image_data + ((size_t)y * h + x) * pixel_size, original + ((size_t)x * w + y) * pixel_size, pixel_size) != 0;
+        }
+    }
+    failed = failed || tga_transpose(&tga) != TGA_SUCCESS || memcmp(tga.image_data, original, image_size) != 0;
+    failed = failed || tga_rotate_90(&tga, true) != TGA_SUCCESS;
+    for (uint16_t y = 0; !failed && y < w; ++y) {
+        for (uint16_t x = 0; !failed && x < h; ++x) {
+            failed = memcmp(tga.image_data + ((size_t)y * h + x) * pixel_size, original + ((size_t)(h - 1 - x) * w + y) * pixel_size, pixel_size) != 0;
+        }
+    }
+    failed = failed || tga_rotate_90(&tga, false) != TGA_SUCCESS || memcmp(tga.image_data, original, image_size) != 0;
+    for (int i = 0; !failed && i < 4; ++i) {
+        failed = tga_rotate_90(&tga, false) != TGA_SUCCESS;
+    }
+    failed = failed || tga.header.width != w || memcmp(tga.image_data, original, image_size) != 0;
+
+    free(original);
+    tga_free(&tga);
+    return failed;
+}
+
+int test_orientation() {
+    const uint8_t depths[] = {8, 16, 24, 32};
+    int failed = 0;
+
+    for (int d = 0; !failed && d < 4; ++d) {
+        for (uint8_t descriptor = 0; !failed && descriptor < 0x40; descriptor += 0x10) {
+            failed = test_orientation_read(depths[d], descriptor | (depths[d] == 32 ? 8 : 0));
+        }
+        failed = failed ||
+                 test_orientation_turn(depths[d], 77, 77) ||
+                 test_orientation_turn(depths[d], 101, 35) ||
+                 test_orientation_turn(depths[d], 1, 40);
+    }
+
+    // Run-length encoded image data can not be moved around
+    TgaImage rle_tga = {0};
+    if (!failed && tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 4, 4, 24, &rle_tga) == TGA_SUCCESS) {
+        rle_tga.state = IS_RLE;
+        failed = tga_flip_vertical(&rle_tga) != TGA_UNSUPPORTED_IMAGE_TYPE_ERROR ||
+                 tga_rotate_90(&rle_tga, true) != TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+        rle_tga.state = IS_UNCOMPRESSED;
+        tga_free(&rle_tga);
+    }
+
+    if (failed) {
+        printf("Orientation test failed\n");
+        return 1;
+    }
+
+    printf("Orientation test passed\n");
+    return 0;
+}
+
+// Blends one straight alpha pixel over another in doubles
+void reference_blend_straight(uint8_t *dst, const uint8_t *src) {
+    if (src[3] == 0) return;
+
+    double src_alpha = src[3];
+    double dst_alpha = dst[3] * (255.0 - src_alpha) / 255.0;
+    double alpha = src_alpha + dst_alpha;
+    for (int c = 0; c < 3; ++c) {
+        dst[c] = (uint8_t)((src[c] * src_alpha + dst[c] * dst_alpha) / alpha + 0.5);
+    }
+    dst[3] = (uint8_t)(alpha + 0.5);
+}
+
+void reference_blend_premultiplied(uint8_t *dst, const uint8_t *src) {
+    for (int c = 0; c < 4; ++c) {
+        unsigned value = src[c] + (dst[c] * (255u - src[3]) + 127) / 255;
+        dst[c] = (uint8_t)(value > 255 ? 255 : value);
+    }
+}
+
+// Checks tga_blend at an offset that clips the source on two sides
+int test_blend_offset(bool premultiplied) {
+    TgaImage dst_tga = {0};
+    TgaImage src_tga = {0};
+    const int32_t offset_x = -5, offset_y = 30;
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 53, 41, 32, &dst_tga) != TGA_SUCCESS ||
+        tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 29, 17, 32, &src_tga) != TGA_SUCCESS) {
+        tga_free(&dst_tga);
+        return 1;
+    }
+    fill_runs_and_noise(dst_tga.image_data, 53 * 41, 4);
+    fill_runs_and_noise(src_tga.image_data, 29 * 17, 4);
+    // Runs of transparent and opaque pixels take the shortcuts
+    for (size_t i = 0; i < 29 * 17; ++i) {
+        if (i % 64 < 12) src_tga.image_data[i * 4 + 3] = 0;
+        if (i % 64 >= 40 && i % 64 < 52) src_tga.image_data[i * 4 + 3] = 255;
+        if (premultiplied) {
+            for (int c = 0; c < 3; ++c) {
+                uint8_t *color = &src_tga.image_data[i * 4 + c];
+                *color = (uint8_t)(*color * src_tga.image_data[i * 4 + 3] / 255);
+            }
+        }
+    }
+    size_t dst_size = tga_image_size(&dst_tga.header);
+    uint8_t *expected = malloc(dst_size);
+    if (!expected) {
+        tga_free(&dst_tga);
+        tga_free(&src_tga);
+        return 1;
+    }
+    memcpy(expected, dst_tga.image_data, dst_size);
+    for (int32_t y = 0; y < 17; ++y) {
+        for (int32_t x = 0; x < 29; ++x) {
+            int32_t dst_x = x + offset_x, dst_y = y + offset_y;
+            if (dst_x < 0 || dst_y < 0 || dst_x >= 53 || dst_y >= 41) continue;
+            uint8_t *dst = expected + ((size_t)dst_y * 53 + dst_x) * 4;
+            const uint8_t *src = src_tga.image_data + ((size_t)y * 29 + x) * 4;
+            if (premultiplied) {
+                reference_blend_premultiplied(dst, src);
+            } else {
+                reference_blend_straight(dst, src);
+            }
+        }
+    }
+
+    TgaView dst_view = tga_image_view(&dst_tga);
+    TgaView src_view = tga_image_view(&src_tga);
+    int failed = tga_blend(&dst_view, &src_view, offset_x, offset_y, premultiplied) != TGA_SUCCESS;
+    for (size_t i = 0; !failed && i < dst_size; ++i) {
+        // Floats and doubles may round the other way
+        int difference = dst_tga.image_data[i] - expected[i];
+        failed = difference > 1 || difference < -1 || (premultiplied && difference != 0);
+    }
+
+    // Sources entirely outside leave the destination alone
+    memcpy(expected, dst_tga.image_data, dst_size);
+    failed = failed ||
+             tga_blend(&dst_view, &src_view, -29, 0, premultiplied) != TGA_SUCCESS ||
+             tga_blend(&dst_view, &src_view, 0, 41, premultiplied) != TGA_SUCCESS ||
+             tga_blend(&dst_view, &src_view, INT32_MAX - 2, INT32_MAX - 2, premultiplied) != TGA_SUCCESS ||
+             tga_blend(&dst_view, &src_view, INT32_MIN, INT32_MIN, premultiplied) != TGA_SUCCESS ||
+             memcmp(expected, dst_tga.image_data, dst_size) != 0;
+
+    free(expected);
+    tga_free(&dst_tga);
+    tga_free(&src_tga);
+    return failed;
+}
+
+int test_blend() {
+    int failed = test_blend_offset(false) || test_blend_offset(true);
+
+    // Premultiplying follows the alpha bits of the descriptor
+    TgaImage tga = {0};
+    if (!failed && tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 5, 32, &tga) == TGA_SUCCESS) {
+        size_t image_size = tga_image_size(&tga.header);
+        uint8_t *original = malloc(image_size);
+        fill_runs_and_noise(tga.image_data, 37 * 5, 4);
+        memcpy(original, tga.image_data, image_size);
+        failed = !original || tga_premultiply(&tga) != TGA_SUCCESS || memcmp(original, tga.image_data, image_size) != 0;
+
+        tga.header.descriptor = 8;
+        failed = failed || tga_premultiply(&tga) != TGA_SUCCESS;
+        for (size_t i = 0; !failed && i < image_size; ++i) {
+            uint8_t alpha = original[i | 3];
+            uint8_t expected = (i & 3) == 3 ? alpha : (uint8_t)((original[i] * alpha + 127) / 255);
+            failed = tga.image_data[i] != expected;
+        }
+
+        // Unpremultiplying gets back to within rounding of the original
+        failed = failed || tga_unpremultiply(&tga) != TGA_SUCCESS;
+        for (size_t i = 0; !failed && i < image_size; i += 4) {
+            uint8_t alpha = original[i + 3];
+            for (int c = 0; !failed && c < 3; ++c) {
+                int difference = tga.image_data[i + c] - original[i + c];
+                // One step of premultiplied color is 255 / alpha steps of color
+                int tolerance = alpha ? 1 + 128 / alpha : 0;
+                failed = alpha ? (difference > tolerance || difference < -tolerance) : tga.image_data[i + c] != 0;
+            }
+        }
+        free(original);
+
+        // 16-bit pixels lose their color without their alpha bit
+        tga_free(&tga);
+        failed = failed || tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 2, 1, 16, &tga) != TGA_SUCCESS;
+        if (!failed) {
+            const uint8_t pixels[] = {0x34, 0x92, 0x34, 0x12};
+            memcpy(tga.image_data, pixels, sizeof(pixels));
+            tga.header.descriptor = 1;
+            failed = tga_premultiply(&tga) != TGA_SUCCESS ||
+                     tga.image_data[0] != 0x34 || tga.image_data[1] != 0x92 ||
+                     tga.image_data[2] != 0 || tga.image_data[3] != 0;
+        }
+        tga_free(&tga);
+    }
+
+    // Blending needs 32-bit pixels on both sides
+    uint8_t pixels[4 * 4] = {0};
+    TgaView view32;
+    TgaView view24;
+    failed = failed ||
+             tga_view_init(&view32, pixels, 2, 2, 0, 32) != TGA_SUCCESS ||
+             tga_view_init(&view24, pixels, 2, 2, 0, 24) != TGA_SUCCESS ||
+             tga_blend(&view32, &view24, 0, 0, false) != TGA_INVALID_PIXEL_DEPTH_ERROR;
+
+    if (failed) {
+        printf("Blend test failed\n");
+        return 1;
+    }
+
+    printf("Blend test passed\n");
+    return 0;
+}
+
+// Checks that resizing a flat image of every depth keeps every pixel
+int test_resize_flat(uint8_t depth, TgaFilter filter) {
+    const uint32_t colors[] = {0x5a, 0xd5ab, 0x3c7a11, 0x80ff4020};
+    uint8_t pixel_size = (depth + 7) / 8;
+    uint32_t color = colors[pixel_size - 1];
+    TgaImage tga = {0};
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 23, depth, &tga) != TGA_SUCCESS) return 1;
+    for (size_t i = 0; i < 37 * 23; ++i) {
+        store_pixel(tga.image_data + i * pixel_size, color, pixel_size);
+    }
+
+    // Up one axis and down the other, then the other way around
+    int failed = tga_resize(&tga, 50, 11, filter, 0) != TGA_SUCCESS ||
+                 tga_resize(&tga, 13, 40, filter, 0) != TGA_SUCCESS ||
+                 tga.header.width != 13 || tga.header.height != 40;
+    for (size_t i = 0; !failed && i < 13 * 40; ++i) {
+        failed = load_pixel(tga.image_data + i * pixel_size, pixel_size) != color;
+    }
+
+    tga_free(&tga);
+    return failed;
+}
+
+// Resizes noise with a box filter along one axis at a time, which averages
+// pairs of pixels exactly
+int test_resize_box(uint8_t depth) {
+    uint8_t pixel_size = (depth + 7) / 8;
+    TgaImage tga = {0};
+    TgaImage half = {0};
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 64, 30, depth, &tga) != TGA_SUCCESS) return 1;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 32, 30, depth, &half) != TGA_SUCCESS) {
+        tga_free(&tga);
+        return 1;
+    }
+    fill_runs_and_noise(tga.image_data, 64 * 30, pixel_size);
+
+    TgaView src = tga_image_view(&tga);
+    TgaView dst = tga_image_view(&half);
+    int failed = tga_resize_view(&dst, &src, TGA_FILTER_BOX, 1) != TGA_SUCCESS;
+    for (size_t i = 0; !failed && i < 32 * 30 * (size_t)pixel_size; ++i) {
+        size_t pixel = i / pixel_size;
+        const uint8_t *pair = tga.image_data + pixel * 2 * pixel_size + i % pixel_size;
+        failed = half.image_data[i] != (pair[0] + pair[pixel_size] + 1) / 2;
+    }
+
+    // Columns of a view go through the vertical kernel
+    TgaView column;
+    tga_view_init(&column, half.image_data, 64, 15, 64 * pixel_size, depth);
+    failed = failed || tga_resize_view(&column, &src, TGA_FILTER_BOX, 1) != TGA_SUCCESS;
+    for (size_t y = 0; !failed && y < 15; ++y) {
+        for (size_t i = 0; !failed && i < 64 * (size_t)pixel_size; ++i) {
+            const uint8_t *pair = tga.image_data + y * 2 * 64 * pixel_size + i;
+            failed = half.image_data[y * 64 * pixel_size + i] != (pair[0] + pair[64 * pixel_size] + 1) / 2;
+        }
+    }
+
+    tga_free(&half);
+    tga_free(&tga);
+    return failed;
+}
+
+// Resizes noise on one thread and on several, which must agree
+int test_resize_threads(uint8_t depth, TgaFilter filter) {
+    uint8_t pixel_size = (depth + 7) / 8;
+    TgaImage serial = {0};
+    TgaImage parallel = {0};
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 301, 157, depth, &serial) != TGA_SUCCESS) return 1;
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 301, 157, depth, &parallel) != TGA_SUCCESS) {
+        tga_free(&serial);
+        return 1;
+    }
+    fill_runs_and_noise(serial.image_data, 301 * 157, pixel_size);
+    memcpy(parallel.image_data, serial.image_data, tga_image_size(&serial.header));
+
+    int failed = tga_resize(&serial, 123, 211, filter, 1) != TGA_SUCCESS ||
+                 tga_resize(&parallel, 123, 211, filter, 4) != TGA_SUCCESS ||
+                 memcmp(serial.image_data, parallel.image_data, tga_image_size(&serial.header)) != 0;
+
+    tga_free(&parallel);
+    tga_free(&serial);
+    return failed;
+}
+
+int test_resize() {
+    const uint8_t depths[] = {8, 16, 24, 32};
+    const TgaFilter filters[] = {TGA_FILTER_BOX, TGA_FILTER_BILINEAR, TGA_FILTER_LANCZOS};
+    int failed = 0;
+
+    for (int d = 0; !failed && d < 4; ++d) {
+        for (int f = 0; !failed && f < 3; ++f) {
+            failed = test_resize_flat(depths[d], filters[f]) || test_resize_threads(depths[d], filters[f]);
+        }
+        failed = failed || (depths[d] != 16 && test_resize_box(depths[d]));
+    }
+
+    // Views have to agree on pixel depth, and color maps can not be resampled
+    uint8_t pixels[4 * 4] = {0};
+    TgaView view32;
+    TgaView view24;
+    TgaImage tga = {0};
+    failed = failed ||
+             tga_view_init(&view32, pixels, 2, 2, 0, 32) != TGA_SUCCESS ||
+             tga_view_init(&view24, pixels, 2, 2, 0, 24) != TGA_SUCCESS ||
+             tga_resize_view(&view32, &view24, TGA_FILTER_BOX, 1) != TGA_INVALID_PIXEL_DEPTH_ERROR;
+    if (!failed && tga_alloc(UNCOMPRESSED_COLOR_MAPPED_IMAGE, 4, 4, 8, &tga) == TGA_SUCCESS) {
+        tga.state = IS_COLOR_MAPPED;
+        failed = tga_resize(&tga, 2, 2, TGA_FILTER_BOX, 1) != TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+        tga_free(&tga);
+    }
+
+    if (failed) {
+        printf("Resize test failed\n");
+        return 1;
+    }
+
+    printf("Resize test passed\n");
+    return 0;
+}
+
+int test_mipmaps() {
+    TgaImage tga = {0};
+    TgaImage levels[5];
+    char names[6][32];
+    char stream_names[6][32];
+    const char *filenames[6];
+    const char *stream_filenames[6];
+
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 20, 32, &tga) != TGA_SUCCESS) return 1;
+    fill_runs_and_noise(tga.image_data, 37 * 20, 4);
+    tga.header.descriptor = 8;
+    for (unsigned i = 0; i < 6; ++i) {
+        snprintf(names[i], sizeof(names[i]), FILENAME_MIPMAP_FORMAT, i);
+        snprintf(stream_names[i], sizeof(stream_names[i]), FILENAME_MIPMAP_STREAM_FORMAT, i);
+        filenames[i] = names[i];
+        stream_filenames[i] = stream_names[i];
+    }
+
+    // 37 by 20 halves down to 18x10, 9x5, 4x2, 2x1 and 1x1
+    const uint16_t widths[] = {18, 9, 4, 2, 1};
+    const uint16_t heights[] = {10, 5, 2, 1, 1};
+    TgaMipmapOptions options = {TGA_FILTER_LANCZOS, 2, true};
+    int failed = tga_mipmap_count(37, 20) != 6 || tga_mipmap_count(1, 1) != 1 || tga_mipmap_count(0, 5) != 0 ||
+                 tga_generate_mipmaps(&tga, &options, levels, filenames) != TGA_SUCCESS;
+    if (failed) {
+        tga_free(&tga);
+        printf("Mipmaps test failed\n");
+        return 1;
+    }
+
+    // Every level is the one before it resized, and its file holds it
+    TgaImage previous = {0};
+    failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 20, 32, &previous) != TGA_SUCCESS;
+    if (!failed) memcpy(previous.image_data, tga.image_data, tga_image_size(&tga.header));
+    for (unsigned i = 0; !failed && i < 5; ++i) {
+        TgaImage file = {0};
+        failed = levels[i].header.width != widths[i] || levels[i].header.height != heights[i] ||
+                 levels[i].header.descriptor != 8 ||
+                 tga_resize(&previous, widths[i], heights[i], TGA_FILTER_LANCZOS, 1) != TGA_SUCCESS ||
+                 memcmp(previous.image_data, levels[i].image_data, tga_image_size(&previous.header)) != 0 ||
+                 tga_read_file(&file, filenames[i + 1]) != TGA_SUCCESS ||
+                 file.header.image_type != RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE ||
+                 memcmp(file.image_data, levels[i].image_data, tga_image_size(&previous.header)) != 0;
+        tga_free(&file);
+    }
+    tga_free(&previous);
+
+    // Without levels to keep, the files come out the same
+    failed = failed || tga_generate_mipmaps(&tga, &options, NULL, stream_filenames) != TGA_SUCCESS;
+    for (unsigned i = 0; !failed && i < 6; ++i) {
+        size_t size = 0;
+        size_t stream_size = 0;
+        uint8_t *bytes = read_bytes(filenames[i], &size);
+        uint8_t *stream_bytes = read_bytes(stream_filenames[i], &stream_size);
+        failed = !bytes || !stream_bytes || size != stream_size || memcmp(bytes, stream_bytes, size) != 0;
+        free(bytes);
+        free(stream_bytes);
+    }
+
+    for (unsigned i = 0; i < 5; ++i) {
+        tga_free(&levels[i]);
+    }
+    tga_free(&tga);
+
+    if (failed) {
+        printf("Mipmaps test failed\n");
+        return 1;
+    }
+
+    printf("Mipmaps test passed\n");
+    return 0;
+}
+
+// Returns whether every counter of stats is 0
+bool stats_empty(const TgaStats *stats) {
+    for (int i = 0; i < TGA_PHASE_COUNT; ++i) {
+        const TgaPhaseStats *phase = &stats->phases[i];
+        if (phase->calls || phase->bytes || phase->nanoseconds) return false;
+    }
+    return true;
+}
+
+int test_stats() {
+    TgaImage written_tga = {0};
+    TgaImage read_tga = {0};
+    TgaStats thread_stats;
+    TgaStats stats;
+
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, 120, 80, 32, &written_tga) != TGA_SUCCESS) {
+        printf("Memory allocation error in function %s\n", __func__);
+        return 1;
+    }
+    fill_runs_and_noise(written_tga.image_data, 120 * 80, 4);
+    size_t image_size = tga_image_size(&written_tga.header);
+
+    // Count a write and a read on this thread, and an encode on several
+    tga_stats_reset();
+    tga_trace_begin();
+    TgaWriteOptions write_options = {3, true, 0};
+    int failed = tga_write_file(&written_tga, FILENAME_STATS) != TGA_SUCCESS ||
+                 tga_read_file(&read_tga, FILENAME_STATS) != TGA_SUCCESS ||
+                 tga_write_file_ex(&written_tga, FILENAME_STATS, &write_options) != TGA_SUCCESS ||
+                 tga_trace_end(FILENAME_TRACE) != TGA_SUCCESS;
+    tga_stats_get_thread(&thread_stats);
+    tga_stats_get(&stats);
+
+    size_t trace_size = 0;
+    char *trace = (char *)read_bytes(FILENAME_TRACE, &trace_size);
+    failed = failed || !trace || trace_size < 16 || memcmp(trace, "{\"traceEvents\": [", 17) != 0;
+
+    if (!failed && tga_stats_enabled()) {
+        const TgaPhaseStats *phases = thread_stats.phases;
+        failed = phases[TGA_PHASE_OPEN].calls < 3 ||
+                 phases[TGA_PHASE_HEADER].calls < 1 ||
+                 phases[TGA_PHASE_IO].bytes < image_size / 2 ||
+                 phases[TGA_PHASE_DECODE].calls < 1 ||
+                 phases[TGA_PHASE_DECODE].bytes != image_size ||
+                 phases[TGA_PHASE_ENCODE].calls < 80 ||
+                 phases[TGA_PHASE_ALLOC].bytes < image_size;
+
+        // Totals add the encodes of any worker threads, which have exited
+        for (int i = 0; !failed && i < TGA_PHASE_COUNT; ++i) {
+            failed = stats.phases[i].calls < thread_stats.phases[i].calls;
+        }
+        failed = failed || stats.phases[TGA_PHASE_ENCODE].calls < 160 ||
+                 stats.phases[TGA_PHASE_ENCODE].bytes < 2 * image_size;
+
+        // Every phase of the reads and writes shows up in the trace
+        for (int i = 0; !failed && i < TGA_PHASE_COUNT; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "\"name\": \"%s\"", tga_phase_name((TgaPhase)i));
+            trace[trace_size - 1] = '\0';
+            failed = strstr(trace, name) == NULL;
+        }
+
+        tga_stats_reset();
+        tga_stats_get(&stats);
+        failed = failed || !stats_empty(&stats);
+    } else if (!failed) {
+        failed = !stats_empty(&thread_stats) || !stats_empty(&stats);
+    }
 
-// Color test filenames
-#define FILENAME8 "color8.tga"
-#define FILENAME16 "color16.tga"
-#define FILENAME24 "color24.tga"
-#define FILENAME32 "color32.tga"
+    free(trace);
+    tga_free(&read_tga);
+    tga_free(&written_tga);
 
-// Gradient test filenames
-#define FILENAME8_GRADIENT "gradient8.tga"
-#define FILENAME16_GRADIENT "gradient16.tga"
-#define FILENAME24_GRADIENT "gradient24.tga"
-#define FILENAME32_GRADIENT "gradient32.tga"
+    if (failed) {
+        printf("Stats test failed\n");
+        return 1;
+    }
 
-// Image
-TgaImage tga;
-// Image specifications
-uint16_t width, height;
-uint8_t pixel_depth;
+    printf("Stats test passed\n");
+    return 0;
+}
 
-void write_file(const char *filename) {
-    int success = tga_write_file(&tga, filename);
-    if (success == TGA_FILE_OPEN_ERROR) {
-        printf("File opening error\n");
-    } else if (success == TGA_FILE_WRITE_ERROR) {
-        printf("File write error\n");
-    } else {
-        printf("Wrote %s with Width{%u},Height{%u},Depth{%u}\n", filename, width, height, pixel_depth);
+// Returns 0 if the content hash of tga is expected
+int test_content_hash_equal(const TgaImage *tga, uint64_t expected) {
+    uint64_t hash = 0;
+    return tga_content_hash(tga, &hash) != TGA_SUCCESS || hash != expected;
+}
+
+int test_hash() {
+    // Known hashes, which every build and host must give
+    uint8_t data[3000];
+    for (size_t i = 0; i < sizeof(data); ++i) data[i] = (uint8_t)(i * 7 + (i >> 8));
+    int failed = tga_hash(data, 0) != HASH_EMPTY || tga_hash(data, 5) != HASH_SHORT || tga_hash(data, sizeof(data)) != HASH_LONG;
+
+    // Changing any byte changes the hash
+    for (size_t i = 0; !failed && i < sizeof(data); i += 97) {
+        data[i] ^= 1;
+        failed = tga_hash(data, sizeof(data)) == HASH_LONG;
+        data[i] ^= 1;
+    }
+
+    // The same pixels at every pixel depth and orientation hash the same,
+    // and so do color mapped and grayscale pixels that look the same
+    TgaImage rgb_tga = {0};
+    TgaImage other_tga = {0};
+    uint64_t rgb_hash = 0;
+    failed = failed || tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 23, 24, &rgb_tga) != TGA_SUCCESS;
+    if (!failed) {
+        fill_runs_and_noise(rgb_tga.image_data, 37 * 23, 3);
+        failed = tga_content_hash(&rgb_tga, &rgb_hash) != TGA_SUCCESS;
+    }
+    for (int variant = 0; !failed && variant < 5; ++variant) {
+        failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 37, 23, 24, &other_tga) != TGA_SUCCESS;
+        if (failed) break;
+        memcpy(other_tga.image_data, rgb_tga.image_data, tga_image_size(&rgb_tga.header));
+        switch (variant) {
+        case 0:
+            // 32-bit without alpha bits, whose attribute bytes are ignored
+            failed = tga_convert_depth(&other_tga, 32, false) != TGA_SUCCESS;
+            other_tga.image_data[3] = 7;
+            break;
+        case 1:
+            // 32-bit with opaque alpha
+            failed = tga_convert_depth(&other_tga, 32, false) != TGA_SUCCESS;
+            other_tga.header.descriptor |= 8;
+            break;
+        case 2:
+            // Stored from the top right corner
+            failed = tga_flip_vertical(&other_tga) != TGA_SUCCESS || tga_flip_horizontal(&other_tga) != TGA_SUCCESS;
+            other_tga.header.descriptor |= 0x30;
+            break;
+        case 3:
+            // Color mapped
+            tga_fill(&other_tga, ROSE24);
+            tga_fill(&rgb_tga, ROSE24);
+            failed = tga_content_hash(&rgb_tga, &rgb_hash) != TGA_SUCCESS || tga_to_color_map(&other_tga) != TGA_SUCCESS;
+            break;
+        default:
+            // Grayscale and gray true color
+            tga_free(&other_tga);
+            failed = tga_alloc(UNCOMPRESSED_BLACK_AND_WHITE_IMAGE, 37, 23, 8, &other_tga) != TGA_SUCCESS;
+            if (!failed) {
+                tga_fill(&other_tga, COLOR8(90));
+                tga_fill(&rgb_tga, COLOR24(90, 90, 90));
+                failed = tga_content_hash(&rgb_tga, &rgb_hash) != TGA_SUCCESS;
+            }
+            break;
+        }
+        failed = failed || test_content_hash_equal(&other_tga, rgb_hash);
+        tga_free(&other_tga);
     }
+
+    // A changed pixel or a different shape of the same bytes does not
+    if (!failed) {
+        fill_runs_and_noise(rgb_tga.image_data, 37 * 23, 3);
+        failed = tga_content_hash(&rgb_tga, &rgb_hash) != TGA_SUCCESS;
+        rgb_tga.image_data[100] ^= 0x10;
+        failed = failed || !test_content_hash_equal(&rgb_tga, rgb_hash);
+        rgb_tga.image_data[100] ^= 0x10;
+        rgb_tga.header.width = 23;
+        rgb_tga.header.height = 37;
+        failed = failed || !test_content_hash_equal(&rgb_tga, rgb_hash);
+    }
+    tga_free(&rgb_tga);
+
+    if (failed) {
+        printf("Hash test failed\n");
+        return 1;
+    }
+
+    printf("Hash test passed\n");
+    return 0;
 }
 
-int test_color8() {
-    width = 9;
-    height = 9;
-    pixel_depth = 8;
-    if (tga_alloc(UNCOMPRESSED_BLACK_AND_WHITE_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
+int test_cache() {
+    TgaImage cache_tga = {0};
+    TgaCache *cache = NULL;
+    TgaCacheStats stats;
+    TgaWriteOptions options = {2, false, 0};
+    TgaWriteOptions table_options = {2, true, 0};
+    uint8_t *direct = NULL, *cached = NULL;
+    size_t direct_size = 0, cached_size = 0;
+
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, 64, 48, 32, &cache_tga) != TGA_SUCCESS) {
         printf("Memory allocation error in function %s\n", __func__);
         return 1;
     }
+    fill_runs_and_noise(cache_tga.image_data, 64 * 48, 4);
 
-    // Fill with white
-    tga_fill(&tga, WHITE8);
-    // Explicit greyscale colors
-    tga_set_pixel(&tga, 2, 2, LIGHT_GRAY8);
-    tga_set_pixel(&tga, 4, 4, GRAY8);
-    tga_set_pixel(&tga, 6, 6, DARK_GRAY8);
-    tga_set_pixel(&tga, 8, 8, BLACK8);
-    
-    write_file(FILENAME8);
-    tga_free(&tga);
+    // A second write of the same image is a hit and writes the same file
+    int failed = tga_write_file_ex(&cache_tga, FILENAME_CACHE_DIRECT, &options) != TGA_SUCCESS ||
+                 !(direct = read_bytes(FILENAME_CACHE_DIRECT, &direct_size)) ||
+                 tga_cache_create(direct_size * 2 + direct_size / 2, NULL, &cache) != TGA_SUCCESS;
+    for (int i = 0; !failed && i < 2; ++i) {
+        failed = tga_cache_write_file(cache, &cache_tga, FILENAME_CACHE, &options) != TGA_SUCCESS ||
+                 !(cached = read_bytes(FILENAME_CACHE, &cached_size)) ||
+                 cached_size != direct_size || memcmp(cached, direct, direct_size) != 0;
+        free(cached);
+        cached = NULL;
+    }
+    if (!failed) {
+        tga_cache_get_stats(cache, &stats);
+        failed = stats.hits != 1 || stats.misses != 1 || stats.entry_count != 1 || stats.size != direct_size;
+    }
+
+    // Memory too small for the file fails with the size it needs
+    if (!failed) {
+        uint8_t *buffer = malloc(direct_size);
+        size_t encoded_size = 0;
+        failed = !buffer ||
+                 tga_cache_encode_memory(cache, &cache_tga, buffer, direct_size - 1, &options, &encoded_size) != TGA_FILE_WRITE_ERROR ||
+                 encoded_size != direct_size ||
+                 tga_cache_encode_memory(cache, &cache_tga, buffer, direct_size, &options, &encoded_size) != TGA_SUCCESS ||
+                 encoded_size != direct_size || memcmp(buffer, direct, direct_size) != 0;
+        free(buffer);
+    }
+
+    // Another option, and a changed pixel, are misses, and the least
+    // recently used file makes room for them
+    if (!failed) {
+        failed = tga_cache_write_file(cache, &cache_tga, FILENAME_CACHE, &table_options) != TGA_SUCCESS;
+        cache_tga.image_data[0] ^= 1;
+        failed = failed || tga_cache_write_file(cache, &cache_tga, FILENAME_CACHE, &options) != TGA_SUCCESS;
+        cache_tga.image_data[0] ^= 1;
+        tga_cache_get_stats(cache, &stats);
+        failed = failed || stats.hits != 3 || stats.misses != 3 || stats.entry_count != 2 || stats.size > direct_size * 2 + direct_size / 2;
+    }
+    if (!failed) {
+        failed = tga_cache_write_file(cache, &cache_tga, FILENAME_CACHE, &options) != TGA_SUCCESS;
+        tga_cache_get_stats(cache, &stats);
+        failed = failed || stats.misses != 4;
+    }
+
+    // Files larger than the cache are written without being kept
+    if (!failed) {
+        TgaCache *small_cache = NULL;
+        failed = tga_cache_create(direct_size - 1, NULL, &small_cache) != TGA_SUCCESS ||
+                 tga_cache_write_file(small_cache, &cache_tga, FILENAME_CACHE, &options) != TGA_SUCCESS;
+        if (!failed) {
+            tga_cache_get_stats(small_cache, &stats);
+            failed = stats.entry_count != 0 || stats.size != 0 || stats.misses != 1;
+        }
+        tga_cache_destroy(small_cache);
+    }
+
+    free(direct);
+    tga_cache_destroy(cache);
+    tga_free(&cache_tga);
+
+    if (failed) {
+        printf("Cache test failed\n");
+        return 1;
+    }
 
+    printf("Cache test passed\n");
     return 0;
 }
 
-int test_color16() {
-    width = 13;
-    height = 13;
-    pixel_depth = 16;
-    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
-        printf("Memory allocation error in function %s\n", __func__);
+// Writes size bytes of data to filename and returns 0 on success
+int write_bytes(const char *filename, const uint8_t *data, size_t size) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return 1;
+    int failed = fwrite(data, 1, size, fp) != size;
+    return fclose(fp) != 0 || failed;
+}
+
+// Returns whether result is one that reading a damaged file may give
+bool damaged_result(int result) {
+    return result == TGA_SUCCESS || result == TGA_FILE_READ_ERROR || result == TGA_INVALID_PIXEL_DEPTH_ERROR ||
+           result == TGA_RLE_DECODE_ERROR || result == TGA_UNSUPPORTED_IMAGE_TYPE_ERROR;
+}
+
+// Reads a crafted file from memory and from disk, as is and with its color
+// map expanded, and returns 0 if every read fails with the expected error
+int test_hardened_file(const uint8_t *data, size_t size, int memory_error, int file_error) {
+    const TgaReadOptions options[] = {{false, 1, NULL, false}, {true, 1, NULL, true}};
+    TgaImage read_tga = {0};
+
+    int failed = write_bytes(FILENAME_HARDENED, data, size);
+    for (int i = 0; !failed && i < 2; ++i) {
+        failed = tga_decode_memory(&read_tga, data, size, &options[i]) != memory_error ||
+                 tga_read_file_ex(&read_tga, FILENAME_HARDENED, &options[i]) != file_error;
+    }
+    return failed;
+}
+
+int test_hardened() {
+    // 2 by 1 true color image with a run of 3 pixels, stored top to bottom
+    // so that every read of it takes the same path
+    uint8_t file[64] = {0, 0, RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1, 0, 24, 0x20,
+                        0x82, 1, 2, 3};
+    int failed = test_hardened_file(file, 22, TGA_RLE_DECODE_ERROR, TGA_RLE_DECODE_ERROR);
+
+    // A raw packet of 4 pixels with only 2 of them in the file
+    file[12] = 4;
+    file[18] = 0x03;
+    failed = failed || test_hardened_file(file, 25, TGA_RLE_DECODE_ERROR, TGA_FILE_READ_ERROR);
+
+    // Unknown image types, including no image at all
+    file[2] = 4;
+    failed = failed || test_hardened_file(file, 25, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR);
+    file[2] = NO_IMAGE;
+    failed = failed || test_hardened_file(file, 25, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR);
+
+    // Color mapped images without a color map, with a color map of a bad
+    // depth, and with a color map that runs past the end of the file
+    file[2] = UNCOMPRESSED_COLOR_MAPPED_IMAGE;
+    file[16] = 8;
+    failed = failed || test_hardened_file(file, 25, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR, TGA_UNSUPPORTED_IMAGE_TYPE_ERROR);
+    file[1] = 1;
+    file[5] = 200;
+    file[7] = 12;
+    failed = failed || test_hardened_file(file, 25, TGA_INVALID_PIXEL_DEPTH_ERROR, TGA_INVALID_PIXEL_DEPTH_ERROR);
+    file[7] = 24;
+    failed = failed || test_hardened_file(file, 25, TGA_FILE_READ_ERROR, TGA_FILE_READ_ERROR);
+
+    // The largest image there is, with its size worked out without
+    // overflowing, is turned down before it is allocated
+    TgaImage read_tga = {0};
+    TgaProbe probe = {0};
+    const uint8_t huge[] = {0, 0, UNCOMPRESSED_TRUE_COLOR_IMAGE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 32, 0,
+                            0x80, 0, 0, 0, 0};
+    uint8_t huge_rle[sizeof(huge)];
+    memcpy(huge_rle, huge, sizeof(huge));
+    huge_rle[2] = RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE;
+    probe.header.width = 0xffff;
+    probe.header.height = 0xffff;
+    probe.header.image_pixel_depth = 32;
+    failed = failed || tga_image_size(&probe.header) != (size_t)0xffff * 0xffff * 4 ||
+             tga_probe_memory(huge, sizeof(huge), false, &probe) != TGA_FILE_READ_ERROR ||
+             tga_probe_memory(huge_rle, sizeof(huge_rle), false, &probe) != TGA_FILE_READ_ERROR ||
+             tga_decode_memory(&read_tga, huge, sizeof(huge), NULL) != TGA_FILE_READ_ERROR ||
+             tga_decode_memory(&read_tga, huge_rle, sizeof(huge_rle), NULL) != TGA_RLE_DECODE_ERROR;
+
+    // Damage a run-length encoded color mapped file with an image id and a
+    // scan line table a few bytes at a time. Every read either succeeds or
+    // fails cleanly, which the sanitizers check as well.
+    TgaImage written_tga = {0};
+    uint8_t *source = NULL;
+    size_t source_size = 0;
+    if (!failed) {
+        const char image_id[] = "hardened";
+        TgaWriteOptions write_options = {2, true, 0};
+        failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 40, 70, 24, &written_tga) != TGA_SUCCESS;
+        if (!failed) {
+            fill_runs_and_noise(written_tga.image_data, 40 * 70, 3);
+            written_tga.header.id_length = sizeof(image_id) - 1;
+            written_tga.image_id = malloc(sizeof(image_id));
+            memcpy(written_tga.image_id, image_id, sizeof(image_id));
+            failed = tga_to_color_map(&written_tga) != TGA_SUCCESS;
+            written_tga.header.image_type = RUN_LENGTH_ENCODED_COLOR_MAPPED_IMAGE;
+            failed = failed || tga_write_file_ex(&written_tga, FILENAME_HARDENED_SOURCE, &write_options) != TGA_SUCCESS ||
+                     !(source = read_bytes(FILENAME_HARDENED_SOURCE, &source_size));
+        }
+    }
+    uint8_t *damaged = source ? malloc(source_size) : NULL;
+    const TgaReadOptions options[] = {{false, 1, NULL, false}, {true, 1, NULL, true}, {false, 2, NULL, false}};
+    failed = failed || !damaged;
+    for (int i = 0; !failed && i < 600; ++i) {
+        memcpy(damaged, source, source_size);
+        size_t size = source_size;
+        int changes = 1 + test_random() % 4;
+        for (int c = 0; c < changes; ++c) {
+            // The header and the tail of the file are where most of the
+            // sizes and offsets are
+            uint32_t where = test_random() % 3;
+            size_t offset = where == 0 ? test_random() % TGA_HEADER_SIZE :
+                            where == 1 ? size - 1 - test_random() % 600 % size :
+                            test_random() % size;
+            damaged[offset] = (uint8_t)test_random();
+        }
+        if (test_random() % 4 == 0) size = test_random() % size;
+
+        for (int o = 0; !failed && o < 3; ++o) {
+            int result = tga_decode_memory(&read_tga, damaged, size, &options[o]);
+            failed = !damaged_result(result);
+            if (result == TGA_SUCCESS) tga_free(&read_tga);
+        }
+
+        // Files go through the streaming reader, which can not know the size
+        // of the file before it allocates the image
+        if (!failed && i % 8 == 0 && tga_probe_memory(damaged, size, false, &probe) == TGA_SUCCESS) {
+            failed = write_bytes(FILENAME_HARDENED, damaged, size);
+            for (int o = 0; !failed && o < 3; ++o) {
+                int result = tga_read_file_ex(&read_tga, FILENAME_HARDENED, &options[o]);
+                failed = !damaged_result(result);
+                if (result == TGA_SUCCESS) tga_free(&read_tga);
+            }
+        }
+    }
+    free(damaged);
+    free(source);
+    tga_free(&written_tga);
+
+    if (failed) {
+        printf("Hardened decoder test failed\n");
         return 1;
     }
 
-    // Fill with white
-    tga_fill(&tga, WHITE16);
-    // Explicit greyscale colors
-    tga_set_pixel(&tga, 1, 1, RED16);
-    tga_set_pixel(&tga, 2, 2, BLUE16);
-    tga_set_pixel(&tga, 3, 3, GREEN16);
-    tga_set_pixel(&tga, 4, 4, YELLOW16);
-    tga_set_pixel(&tga, 5, 5, MAGENTA16);
-    tga_set_pixel(&tga, 6, 6, CYAN16);
-    tga_set_pixel(&tga, 7, 7, PURPLE16);
-    tga_set_pixel(&tga, 8, 8, ROSE16);
-    tga_set_pixel(&tga, 9, 9, ORANGE16);
-    tga_set_pixel(&tga, 10, 10, LIME16);
-    tga_set_pixel(&tga, 11, 11, MINT16);
-    tga_set_pixel(&tga, 10, 10, AZURE16);
-    tga_set_pixel(&tga, 12, 12, BLACK16);
-    
-    write_file(FILENAME16);
-    tga_free(&tga);
+    printf("Hardened decoder test passed\n");
+    return 0;
+}
+
+// Returns 0 if result is what reading the file of the loader test at index
+// with options gives. The last file is missing and the one before it is
+// truncated.
+int check_load(const char *directory, const TgaLoadResult *result, const TgaReadOptions *options) {
+    unsigned index = (unsigned)(size_t)result->user_data;
+    char filename[64];
+    TgaImage read_tga = {0};
+
+    snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, index);
+    int expected = tga_read_file_ex(&read_tga, filename, options);
+    int failed = result->result != expected ||
+                 (index == LOADER_FILE_COUNT - 1 && expected != TGA_FILE_OPEN_ERROR) ||
+                 (index == LOADER_FILE_COUNT - 2 && expected != TGA_FILE_READ_ERROR);
+    if (!failed && expected == TGA_SUCCESS) {
+        const TgaHeader *header = &result->image.header;
+        failed = header->image_type != read_tga.header.image_type || header->width != read_tga.header.width ||
+                 header->height != read_tga.header.height || header->descriptor != read_tga.header.descriptor ||
+                 header->image_pixel_depth != read_tga.header.image_pixel_depth || result->image.state != read_tga.state ||
+                 memcmp(result->image.image_data, read_tga.image_data, tga_image_size(&read_tga.header)) != 0;
+    }
+    tga_free(&read_tga);
+    return failed;
+}
+
+// Counts files handed to the callback of the loader test and whether any of
+// them was wrong
+typedef struct {
+    const char *directory;
+    const TgaReadOptions *options;
+    unsigned count;
+    int failed;
+} LoaderCallback;
+
+void loader_callback(void *context, TgaLoadResult *result) {
+    LoaderCallback *callback = context;
+    callback->failed |= check_load(callback->directory, result, callback->options);
+    callback->count++;
+    tga_free(&result->image);
+}
+
+// Loads every file of the loader test and returns 0 if each was loaded
+// exactly once with the right result
+int test_loader_run(const char *directory, bool blocking_io, bool top_left) {
+    TgaReadOptions read = {false, 1, NULL, top_left};
+    TgaLoaderOptions options = {read, 2, 8, NULL, NULL, blocking_io};
+    TgaLoader *loader;
+    TgaLoadResult result;
+    bool seen[LOADER_FILE_COUNT] = {false};
+    char filename[64];
+
+    // Results are polled as they arrive, in whatever order
+    int failed = tga_loader_create(&options, &loader) != TGA_SUCCESS;
+    if (failed) return 1;
+    failed = blocking_io && tga_loader_uses_io_uring(loader);
+    for (unsigned i = 0; !failed && i < LOADER_FILE_COUNT; ++i) {
+        snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, i);
+        failed = tga_loader_submit(loader, filename, (void *)(size_t)i) != TGA_SUCCESS;
+    }
+    unsigned count = 0;
+    while (tga_loader_poll(loader, true, &result)) {
+        unsigned index = (unsigned)(size_t)result.user_data;
+        failed = failed || index >= LOADER_FILE_COUNT || seen[index] || check_load(directory, &result, &read);
+        if (index < LOADER_FILE_COUNT) seen[index] = true;
+        tga_free(&result.image);
+        count++;
+    }
+    failed = failed || count != LOADER_FILE_COUNT || tga_loader_poll(loader, false, &result);
+    tga_loader_destroy(loader);
+
+    // A single decoding thread runs the callback one file at a time
+    LoaderCallback callback = {directory, &read, 0, 0};
+    options.thread_count = 1;
+    options.callback = loader_callback;
+    options.context = &callback;
+    failed = failed || tga_loader_create(&options, &loader) != TGA_SUCCESS;
+    if (failed) return 1;
+    for (unsigned i = 0; i < LOADER_FILE_COUNT; ++i) {
+        snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, i);
+        failed = failed || tga_loader_submit(loader, filename, (void *)(size_t)i) != TGA_SUCCESS;
+    }
+    tga_loader_wait(loader);
+    failed = failed || callback.failed || callback.count != LOADER_FILE_COUNT || tga_loader_poll(loader, true, &result);
+    tga_loader_destroy(loader);
+
+    return failed;
+}
+
+int test_loader() {
+    TgaImage load_tga = {0};
+    TgaWriteOptions table_options = {1, true, 0};
+    char filename[64];
+    struct stat st;
+
+    // Generate files of every depth and encoding on tmpfs, so the test
+    // measures the loader rather than the disk
+    const char *directory = stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? DIRECTORY_LOADER_TMPFS : DIRECTORY_LOADER;
+    mkdir(directory, 0755);
+    int failed = 0;
+    for (unsigned i = 0; !failed && i < LOADER_FILE_COUNT - 1; ++i) {
+        static const uint8_t DEPTHS[] = {8, 16, 24, 32};
+        uint8_t depth = DEPTHS[i % 4];
+        uint16_t load_width = (uint16_t)(5 + i * 7), load_height = (uint16_t)(4 + i * 3);
+        TgaImageType image_type = depth == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        if (i % 3 == 1) image_type = (TgaImageType)(image_type + 8);
+        if (tga_alloc(image_type, load_width, load_height, depth, &load_tga) != TGA_SUCCESS) {
+            printf("Memory allocation error in function %s\n", __func__);
+            return 1;
+        }
+        fill_runs_and_noise(load_tga.image_data, (size_t)load_width * load_height, tga_pixel_size(&load_tga.header));
+        load_tga.header.descriptor |= i % 2 ? 0x20 : 0;
+        snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, i);
+        failed = tga_write_file_ex(&load_tga, filename, i % 6 == 4 ? &table_options : NULL) != TGA_SUCCESS;
+        tga_free(&load_tga);
+    }
+
+    // The file before the last is cut short, and the last does not exist
+    size_t size = 0;
+    snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, 0);
+    uint8_t *file = failed ? NULL : read_bytes(filename, &size);
+    snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, LOADER_FILE_COUNT - 2);
+    failed = !file || write_bytes(filename, file, size - 2);
+    free(file);
+    snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, LOADER_FILE_COUNT - 1);
+    remove(filename);
+
+    for (int i = 0; !failed && i < 4; ++i) {
+        failed = test_loader_run(directory, i & 1, i & 2);
+    }
+
+    for (unsigned i = 0; i < LOADER_FILE_COUNT; ++i) {
+        snprintf(filename, sizeof(filename), FILENAME_LOADER_FORMAT, directory, i);
+        remove(filename);
+    }
+    remove(directory);
+
+    if (failed) {
+        printf("Loader test failed\n");
+        return 1;
+    }
 
+    printf("Loader test passed\n");
     return 0;
 }
 
-int test_color24() {
-    width = 13;
-    height = 13;
-    pixel_depth = 24;
-    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, pixel_depth, &tga) != TGA_SUCCESS) {
+int test_thumbnail() {
+    TgaImage stamped_tga = {0}, read_tga = {0}, thumbnail = {0};
+    TgaWriteOptions stamp_options = {2, true, 64};
+    TgaWriteOptions table_options = {2, true, 0};
+    TgaReadOptions expand_options = {true, 1, NULL, false};
+    TgaProbe probe;
+
+    width = 200;
+    height = 120;
+    if (tga_alloc(RUN_LENGTH_ENCODED_TRUE_COLOR_IMAGE, width, height, 32, &stamped_tga) != TGA_SUCCESS) {
         printf("Memory allocation error in function %s\n", __func__);
         return 1;
     }
+    fill_runs_and_noise(stamped_tga.image_data, (size_t)width * height, 4);
+    stamped_tga.header.descriptor = 8;
 
-    // Fill with white
-    tga_fill(&tga, WHITE24);
-    // Explicit greyscale colors
-    tga_set_pixel(&tga, 1, 1, RED24);
-    tga_set_pixel(&tga, 2, 2, BLUE24);
-    tga_set_pixel(&tga, 3, 3, GREEN24);
-    tga_set_pixel(&tga, 4, 4, YELLOW24);
-    tga_set_pixel(&tga, 5, 5, MAGENTA24);
-    tga_set_pixel(&tga, 6, 6, CYAN24);
-    tga_set_pixel(&tga, 7, 7, PURPLE24);
-    tga_set_pixel(&tga, 8, 8, ROSE24);
-    tga_set_pixel(&tga, 9, 9, ORANGE24);
-    tga_set_pixel(&tga, 10, 10, LIME24);
-    tga_set_pixel(&tga, 11, 11, MINT24);
-    tga_set_pixel(&tga, 10, 10, AZURE24);
-    tga_set_pixel(&tga, 12, 12, BLACK24);
-    
-    write_file(FILENAME24);
-    tga_free(&tga);
+    // The stamp goes between the image data and the scan line table, and
+    // the file is still read the same, in bands or not
+    size_t size = tga_encoded_size(&stamped_tga, &stamp_options);
+    int failed = tga_write_file_ex(&stamped_tga, FILENAME_THUMBNAIL, &stamp_options) != TGA_SUCCESS ||
+                 tga_probe_file(FILENAME_THUMBNAIL, true, &probe) != TGA_SUCCESS ||
+                 !probe.has_extension || probe.postage_stamp_offset == 0 || probe.file_size != size ||
+                 probe.scan_line_offset != probe.postage_stamp_offset + 2 + 64 * 38 * 4;
+    for (unsigned threads = 1; !failed && threads <= 2; ++threads) {
+        TgaReadOptions options = {false, threads, NULL, false};
+        failed = tga_read_file_ex(&read_tga, FILENAME_THUMBNAIL, &options) != TGA_SUCCESS ||
+                 memcmp(read_tga.image_data, stamped_tga.image_data, tga_image_size(&read_tga.header)) != 0;
+        tga_free(&read_tga);
+    }
+
+    // The longer side of the thumbnail is 64 pixels and its pixels are the
+    // box filtered image
+    failed = failed ||
+             tga_read_thumbnail(&thumbnail, FILENAME_THUMBNAIL, NULL) != TGA_SUCCESS ||
+             thumbnail.header.width != 64 || thumbnail.header.height != 38 ||
+             thumbnail.header.image_type != UNCOMPRESSED_TRUE_COLOR_IMAGE || thumbnail.header.image_pixel_depth != 32 ||
+             tga_read_file(&read_tga, FILENAME_THUMBNAIL) != TGA_SUCCESS ||
+             tga_resize(&read_tga, 64, 38, TGA_FILTER_BOX, 1) != TGA_SUCCESS ||
+             memcmp(read_tga.image_data, thumbnail.image_data, tga_image_size(&thumbnail.header)) != 0;
+    tga_free(&read_tga);
+    tga_free(&thumbnail);
+
+    // Color mapped stamps sample indices into the color map of the image,
+    // and expand like the image does
+    stamped_tga.header.image_type = UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    for (size_t i = 0; i < (size_t)width * height; ++i) stamped_tga.image_data[i * 4] &= 0xc0;
+    failed = failed ||
+             tga_to_color_map(&stamped_tga) != TGA_SUCCESS ||
+             tga_write_file_ex(&stamped_tga, FILENAME_THUMBNAIL_MAPPED, &stamp_options) != TGA_SUCCESS ||
+             tga_read_thumbnail(&thumbnail, FILENAME_THUMBNAIL_MAPPED, NULL) != TGA_SUCCESS ||
+             thumbnail.state != IS_COLOR_MAPPED || thumbnail.header.width != 64 ||
+             thumbnail.image_data[0] != stamped_tga.image_data[(120 / 76) * 200 + 200 / 128] ||
+             memcmp(thumbnail.color_map_data, stamped_tga.color_map_data, 4 * stamped_tga.header.color_map_length) != 0;
+    tga_free(&thumbnail);
+    failed = failed ||
+             tga_read_thumbnail(&thumbnail, FILENAME_THUMBNAIL_MAPPED, &expand_options) != TGA_SUCCESS ||
+             thumbnail.state != IS_UNCOMPRESSED || thumbnail.header.image_pixel_depth != 32;
+    tga_free(&thumbnail);
+
+    // Files without a stamp, with or without an extension area
+    stamped_tga.header.image_type = UNCOMPRESSED_TRUE_COLOR_IMAGE;
+    failed = failed ||
+             tga_write_file(&stamped_tga, FILENAME_THUMBNAIL_NONE) != TGA_SUCCESS ||
+             tga_read_thumbnail(&thumbnail, FILENAME_THUMBNAIL_NONE, NULL) != TGA_NO_POSTAGE_STAMP_ERROR ||
+             tga_write_file_ex(&stamped_tga, FILENAME_THUMBNAIL_NONE, &table_options) != TGA_SUCCESS ||
+             tga_read_thumbnail(&thumbnail, FILENAME_THUMBNAIL_NONE, NULL) != TGA_NO_POSTAGE_STAMP_ERROR ||
+             tga_read_thumbnail(&thumbnail, FILENAME_BATCH_MISSING, NULL) != TGA_FILE_OPEN_ERROR;
+    tga_free(&stamped_tga);
+
+    if (failed) {
+        printf("Thumbnail test failed\n");
+        return 1;
+    }
+
+    printf("Thumbnail test passed\n");
+    return 0;
+}
+
+// Tells whether tga_equal finds a and b differ first at x, y
+int test_first_difference(const TgaImage *a, const TgaImage *b, uint16_t x, uint16_t y) {
+    bool equal = true;
+    uint16_t found_x = 0, found_y = 0;
+    return tga_equal(a, b, &equal, &found_x, &found_y) == TGA_SUCCESS && !equal && found_x == x && found_y == y;
+}
+
+int test_compare() {
+    TgaImage a = {0};
+    TgaImage b = {0};
+    TgaCompareResult result;
+    TgaCompareOptions options = {3, true};
+    bool equal = false;
+    uint16_t x = 0, y = 0;
+
+    // An image equals its copy at another pixel depth and orientation, whose
+    // attribute bytes hold no alpha
+    int failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 101, 67, 24, &a) != TGA_SUCCESS ||
+                 tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 101, 67, 24, &b) != TGA_SUCCESS;
+    if (!failed) {
+        fill_runs_and_noise(a.image_data, 101 * 67, 3);
+        memcpy(b.image_data, a.image_data, tga_image_size(&a.header));
+        failed = tga_convert_depth(&b, 32, false) != TGA_SUCCESS || tga_flip_vertical(&b) != TGA_SUCCESS;
+        b.header.descriptor |= 0x20;
+        b.image_data[7] ^= 0xff;
+    }
+    failed = failed || tga_equal(&a, &b, &equal, &x, &y) != TGA_SUCCESS || !equal;
+    failed = failed || tga_compare(&a, &b, &options, &result) != TGA_SUCCESS;
+    failed = failed || result.channels != 3 || result.different_pixels != 0 || result.max_error != 0 ||
+             result.mse != 0 || !isinf(result.psnr) || result.ssim != 1;
+
+    // The first difference is found from the top left corner, whichever way
+    // the pixels are stored
+    if (!failed) {
+        size_t offset = (size_t)(66 - 40) * 101 + 70;
+        a.image_data[offset * 3 + 1] ^= 0x40;
+        a.image_data[(offset + 3) * 3] ^= 0x01;
+        a.image_data[(offset - 101) * 3] ^= 0x01;
+        failed = !test_first_difference(&a, &b, 70, 40) || !test_first_difference(&b, &a, 70, 40);
+    }
+    if (!failed) {
+        failed = tga_convert_depth(&b, 24, false) != TGA_SUCCESS || tga_flip_vertical(&b) != TGA_SUCCESS ||
+                 tga_flip_horizontal(&a) != TGA_SUCCESS || tga_flip_horizontal(&b) != TGA_SUCCESS;
+        a.header.descriptor |= 0x10;
+        b.header.descriptor = a.header.descriptor;
+        failed = failed || !test_first_difference(&a, &b, 70, 40);
+    }
+
+    // Errors of the three changed pixels, the same on any number of threads
+    TgaCompareResult serial;
+    TgaCompareOptions serial_options = {1, true};
+    failed = failed || tga_compare(&a, &b, &options, &result) != TGA_SUCCESS ||
+             tga_compare(&a, &b, &serial_options, &serial) != TGA_SUCCESS;
+    failed = failed || result.different_pixels != 3 || result.max_error != 0x40 ||
+             result.mean_error != 0x42 / (101.0 * 67 * 3) || result.mse != (0x40 * 0x40 + 2) / (101.0 * 67 * 3) ||
+             result.psnr < 55 || result.psnr > 55.2;
+    failed = failed || result.ssim >= 1 || result.ssim < 0.99 || result.ssim != serial.ssim ||
+             result.mse != serial.mse;
+
+    // Noise lowers the similarity far more than a few pixels, and alpha
+    // counts as a channel
+    if (!failed) {
+        fill_runs_and_noise(b.image_data, 101 * 67, 3);
+        failed = tga_compare(&a, &b, &options, &result) != TGA_SUCCESS || result.ssim > 0.9 || result.psnr > 20;
+        failed = failed || tga_convert_depth(&b, 32, false) != TGA_SUCCESS;
+        b.header.descriptor |= 8;
+        failed = failed || tga_compare(&a, &b, NULL, &result) != TGA_SUCCESS || result.channels != 4;
+    }
+
+    // Alpha counts when either image has it, whichever comes first
+    if (!failed) {
+        TgaImage opaque = {0};
+        TgaImage clear = {0};
+        bool reversed = true;
+        failed = tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 4, 4, 32, &opaque) != TGA_SUCCESS ||
+                 tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, 4, 4, 32, &clear) != TGA_SUCCESS;
+        if (!failed) {
+            memset(opaque.image_data, 0, tga_image_size(&opaque.header));
+            memset(clear.image_data, 0, tga_image_size(&clear.header));
+            clear.header.descriptor |= 8;
+            failed = tga_equal(&opaque, &clear, &equal, NULL, NULL) != TGA_SUCCESS ||
+                     tga_equal(&clear, &opaque, &reversed, NULL, NULL) != TGA_SUCCESS || equal || reversed ||
+                     tga_compare(&opaque, &clear, &options, &result) != TGA_SUCCESS || result.different_pixels != 16;
+        }
+        tga_free(&opaque);
+        tga_free(&clear);
+    }
+
+    // Images smaller than a window still compare, and images of other sizes
+    // do not
+    tga_free(&b);
+    failed = failed || tga_alloc(UNCOMPRESSED_BLACK_AND_WHITE_IMAGE, 5, 3, 8, &b) != TGA_SUCCESS;
+    failed = failed || tga_compare(&a, &b, &options, &result) != TGA_SIZE_MISMATCH_ERROR ||
+             tga_equal(&a, &b, &equal, NULL, NULL) != TGA_SUCCESS || equal;
+    tga_free(&a);
+    failed = failed || tga_alloc(UNCOMPRESSED_BLACK_AND_WHITE_IMAGE, 5, 3, 8, &a) != TGA_SUCCESS;
+    if (!failed) {
+        tga_fill(&a, COLOR8(90));
+        tga_fill(&b, COLOR8(90));
+        b.image_data[14] = 80;
+        failed = tga_compare(&a, &b, &options, &result) != TGA_SUCCESS || result.channels != 1 ||
+                 result.max_error != 10 || result.ssim >= 1 || !test_first_difference(&a, &b, 4, 0);
+    }
+    tga_free(&a);
+    tga_free(&b);
+
+    if (failed) {
+        printf("Compare test failed\n");
+        return 1;
+    }
+
+    printf("Compare test passed\n");
+    return 0;
+}
+
+// Sets the pixels of a line one at a time, skipping those outside the image
+void test_reference_line(TgaImage *tga, int32_t x0, int32_t y0, int32_t x1, int32_t y1, TgaColor color) {
+    int64_t dx = x1 > x0 ? (int64_t)x1 - x0 : (int64_t)x0 - x1;
+    int64_t dy = y1 > y0 ? (int64_t)y1 - y0 : (int64_t)y0 - y1;
+    int64_t major = dx > dy ? dx : dy, minor = dx > dy ? dy : dx;
+    for (int64_t t = 0; t <= major; ++t) {
+        int64_t m = major ? (2 * t * minor + major) / (2 * major) : 0;
+        int64_t x = x0 + (x1 < x0 ? -1 : 1) * (dx >= dy ? t : m);
+        int64_t y = y0 + (y1 < y0 ? -1 : 1) * (dx >= dy ? m : t);
+        if (x >= 0 && y >= 0 && x < tga->header.width && y < tga->header.height) {
+            tga_set_pixel(tga, (uint16_t)x, (uint16_t)y, color);
+        }
+    }
+}
+
+int test_draw() {
+    TgaImage draw_tga = {0};
+    TgaImage reference_tga = {0};
+    const TgaColor colors[] = {GRAY8, ORANGE16, ROSE24, COLOR32(10, 20, 30, 40)};
+    const uint8_t depths[] = {8, 16, 24, 32};
+    int32_t xs[500], ys[500];
+
+    width = 71;
+    height = 43;
+    for (int i = 0; i < 4; ++i) {
+        if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, depths[i], &draw_tga) != TGA_SUCCESS ||
+            tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, width, height, depths[i], &reference_tga) != TGA_SUCCESS) {
+            printf("Memory allocation error in function %s\n", __func__);
+            return 1;
+        }
+        size_t size = tga_image_size(&draw_tga.header);
+        memset(draw_tga.image_data, 0, size);
+        memset(reference_tga.image_data, 0, size);
+
+        // Lines in every direction, partly or wholly outside the image, and
+        // from far away
+        for (int l = 0; l < 300; ++l) {
+            int32_t x0 = (int32_t)(test_random() % (width + 80)) - 40, y0 = (int32_t)(test_random() % (height + 80)) - 40;
+            int32_t x1 = (int32_t)(test_random() % (width + 80)) - 40, y1 = (int32_t)(test_random() % (height + 80)) - 40;
+            tga_draw_line(&draw_tga, x0, y0, x1, y1, colors[i]);
+            test_reference_line(&reference_tga, x0, y0, x1, y1, colors[i]);
+        }
+        tga_draw_line(&draw_tga, -100000, 70001, 100000, -69999, colors[i]);
+        test_reference_line(&reference_tga, -100000, 70001, 100000, -69999, colors[i]);
+        tga_draw_line(&draw_tga, 100000, 50010, -100000, -49990, colors[i]);
+        test_reference_line(&reference_tga, 100000, 50010, -100000, -49990, colors[i]);
+        tga_draw_line(&draw_tga, 5, 5, 5, 5, colors[i]);
+        tga_set_pixel(&reference_tga, 5, 5, colors[i]);
+        int failed = memcmp(draw_tga.image_data, reference_tga.image_data, size) != 0;
+
+        // Spans, outlines and filled rectangles, clipped on every side
+        memset(draw_tga.image_data, 0, size);
+        memset(reference_tga.image_data, 0, size);
+        const int32_t rects[][4] = {{3, 4, 20, 9}, {-5, -6, 10, 12}, {60, 30, 40, 40}, {10, 20, 1, 1}, {30, 2, 1, 9}, {-10, -10, 100, 100}};
+        for (int r = 0; r < 6; ++r) {
+            bool filled = r % 2 == 1;
+            tga_draw_rect(&draw_tga, rects[r][0], rects[r][1], rects[r][2], rects[r][3], filled, colors[i]);
+            tga_draw_span(&draw_tga, rects[r][1], rects[r][0], rects[r][2], colors[i]);
+            for (int32_t y = rects[r][1]; y < rects[r][1] + rects[r][3]; ++y) {
+                for (int32_t x = rects[r][0]; x < rects[r][0] + rects[r][2]; ++x) {
+                    bool edge = x == rects[r][0] || y == rects[r][1] || x == rects[r][0] + rects[r][2] - 1 || y == rects[r][1] + rects[r][3] - 1;
+                    if ((filled || edge) && x >= 0 && y >= 0 && x < width && y < height) {
+                        tga_set_pixel(&reference_tga, (uint16_t)x, (uint16_t)y, colors[i]);
+                    }
+                }
+            }
+            for (int32_t x = rects[r][1]; x < rects[r][1] + rects[r][2]; ++x) {
+                if (x >= 0 && x < width && rects[r][0] >= 0 && rects[r][0] < height) {
+                    tga_set_pixel(&reference_tga, (uint16_t)x, (uint16_t)rects[r][0], colors[i]);
+                }
+            }
+        }
+        failed = failed || memcmp(draw_tga.image_data, reference_tga.image_data, size) != 0;
+
+        // Points, many of them outside the image
+        memset(draw_tga.image_data, 0, size);
+        memset(reference_tga.image_data, 0, size);
+        for (int p = 0; p < 500; ++p) {
+            xs[p] = (int32_t)(test_random() % (width + 20)) - 10;
+            ys[p] = (int32_t)(test_random() % (height + 20)) - 10;
+            if (xs[p] >= 0 && ys[p] >= 0 && xs[p] < width && ys[p] < height) {
+                tga_set_pixel(&reference_tga, (uint16_t)xs[p], (uint16_t)ys[p], colors[i]);
+            }
+        }
+        tga_draw_points(&draw_tga, xs, ys, 500, colors[i]);
+        failed = failed || memcmp(draw_tga.image_data, reference_tga.image_data, size) != 0;
+
+        tga_free(&draw_tga);
+        tga_free(&reference_tga);
 
+        if (failed) {
+            printf("Draw test failed with Depth{%u}\n", depths[i]);
+            return 1;
+        }
+    }
+
+    printf("Draw test passed\n");
+    return 0;
+}
+
+// Tells whether rects lie inside an atlas of width by height, with at least
+// padding pixels between any two
+int test_rects_apart(const TgaAtlasRect *rects, size_t count, uint16_t width, uint16_t height, uint16_t padding) {
+    for (size_t i = 0; i < count; ++i) {
+        const TgaAtlasRect *a = &rects[i];
+        if (a->x + a->width > width || a->y + a->height > height) return 0;
+        for (size_t j = 0; j < i; ++j) {
+            const TgaAtlasRect *b = &rects[j];
+            if (!a->width || !a->height || !b->width || !b->height) continue;
+            if (a->x < b->x + b->width + padding && b->x < a->x + a->width + padding &&
+                a->y < b->y + b->height + padding && b->y < a->y + a->height + padding) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Tells whether the pixels of an atlas at rect look like image
+int test_atlas_region(const TgaImage *atlas, const TgaAtlasRect *rect, const TgaImage *image) {
+    TgaImage region = {0};
+    if (tga_alloc(UNCOMPRESSED_TRUE_COLOR_IMAGE, rect->width, rect->height, atlas->header.image_pixel_depth, &region) != TGA_SUCCESS) return 0;
+    region.header.descriptor = atlas->header.descriptor;
+    size_t row_size = (size_t)rect->width * 4;
+    for (uint16_t y = 0; y < rect->height; ++y) {
+        memcpy(region.image_data + y * row_size, atlas->image_data + ((size_t)(rect->y + y) * atlas->header.width + rect->x) * 4, row_size);
+    }
+    bool equal = false;
+    int matches = tga_equal(&region, image, &equal, NULL, NULL) == TGA_SUCCESS && equal;
+    tga_free(&region);
+    return matches;
+}
+
+int test_atlas() {
+    TgaImage images[ATLAS_IMAGE_COUNT];
+    TgaImage atlas = {0};
+    TgaImage file_atlas = {0};
+    TgaAtlasRect rects[300];
+    TgaAtlasRect file_rects[ATLAS_IMAGE_COUNT + 1];
+    uint16_t widths[300], heights[300];
+    uint16_t atlas_width = 0, atlas_height = 0;
+    char filenames[ATLAS_IMAGE_COUNT + 1][32];
+    const char *names[ATLAS_IMAGE_COUNT + 1];
+    int results[ATLAS_IMAGE_COUNT + 1];
+
+    // Many rectangles, some of them empty, packed apart inside the atlas
+    for (int i = 0; i < 300; ++i) {
+        widths[i] = (uint16_t)(i % 37 == 0 ? 0 : 1 + test_random() % 40);
+        heights[i] = (uint16_t)(1 + test_random() % 40);
+    }
+    TgaAtlasOptions options = {0, 0, 2, 32, 2, NULL};
+    int failed = tga_atlas_pack(widths, heights, 300, &options, rects, &atlas_width, &atlas_height) != TGA_SUCCESS ||
+                 !test_rects_apart(rects, 300, atlas_width, atlas_height, 2);
+    options.max_width = 100;
+    failed = failed || tga_atlas_pack(widths, heights, 300, &options, rects, &atlas_width, &atlas_height) != TGA_SUCCESS ||
+             atlas_width != 100 || !test_rects_apart(rects, 300, atlas_width, atlas_height, 2);
+    options.max_height = 50;
+    failed = failed || tga_atlas_pack(widths, heights, 300, &options, rects, &atlas_width, &atlas_height) != TGA_ATLAS_FULL_ERROR;
+    options.max_width = 0;
+    options.max_height = 0;
+
+    // Images of every kind keep their pixels in the atlas
+    memset(images, 0, sizeof(images));
+    const uint8_t depths[ATLAS_IMAGE_COUNT] = {8, 16, 24, 32, 24};
+    for (unsigned i = 0; !failed && i < ATLAS_IMAGE_COUNT; ++i) {
+        TgaImageType type = depths[i] == 8 ? UNCOMPRESSED_BLACK_AND_WHITE_IMAGE : UNCOMPRESSED_TRUE_COLOR_IMAGE;
+        failed = tga_alloc(type, (uint16_t)(13 + i * 7), (uint16_t)(29 - i * 3), depths[i], &images[i]) != TGA_SUCCESS;
+        if (failed) break;
+        fill_runs_and_noise(images[i].image_data, (size_t)images[i].header.width * images[i].header.height, tga_pixel_size(&images[i].header));
+        if (depths[i] == 32) images[i].header.descriptor = 0x28;
+        if (i == ATLAS_IMAGE_COUNT - 1) {
+            tga_fill(&images[i], ROSE24);
+            tga_fill_rect(&images[i], 2, 3, 5, 6, AZURE24);
+            failed = tga_to_color_map(&images[i]) != TGA_SUCCESS;
+        }
+        snprintf(filenames[i], sizeof(filenames[i]), FILENAME_ATLAS_FORMAT, i);
+        names[i] = filenames[i];
+        failed = failed || tga_write_file(&images[i], filenames[i]) != TGA_SUCCESS;
+    }
+    failed = failed || tga_atlas_build(&atlas, images, ATLAS_IMAGE_COUNT, &options, rects) != TGA_SUCCESS;
+    failed = failed || !test_rects_apart(rects, ATLAS_IMAGE_COUNT, atlas.header.width, atlas.header.height, 2);
+    for (unsigned i = 0; !failed && i < ATLAS_IMAGE_COUNT; ++i) {
+        failed = rects[i].width != images[i].header.width || rects[i].height != images[i].header.height ||
+                 !test_atlas_region(&atlas, &rects[i], &images[i]);
+    }
+
+    // Files give the same atlas, and a missing one only leaves its place
+    // empty
+    remove(FILENAME_ATLAS_MISSING);
+    names[ATLAS_IMAGE_COUNT] = FILENAME_ATLAS_MISSING;
+    failed = failed || tga_atlas_build_files(&file_atlas, names, ATLAS_IMAGE_COUNT + 1, &options, file_rects, results) != TGA_FILE_OPEN_ERROR;
+    for (unsigned i = 0; !failed && i < ATLAS_IMAGE_COUNT; ++i) {
+        failed = results[i] != TGA_SUCCESS || memcmp(&file_rects[i], &rects[i], sizeof(TgaAtlasRect)) != 0;
+    }
+    if (!failed) {
+        bool equal = false;
+        failed = results[ATLAS_IMAGE_COUNT] != TGA_FILE_OPEN_ERROR || file_rects[ATLAS_IMAGE_COUNT].width != 0 ||
+                 tga_equal(&atlas, &file_atlas, &equal, NULL, NULL) != TGA_SUCCESS || !equal;
+    }
+
+    // The table names every image and its place
+    failed = failed || tga_atlas_write_table(FILENAME_ATLAS_TABLE, &atlas, names, rects, ATLAS_IMAGE_COUNT) != TGA_SUCCESS;
+    if (!failed) {
+        char table[1024] = {0};
+        char entry[128];
+        FILE *fp = fopen(FILENAME_ATLAS_TABLE, "r");
+        failed = !fp || fread(table, 1, sizeof(table) - 1, fp) == 0;
+        if (fp) fclose(fp);
+        snprintf(entry, sizeof(entry), "{\"name\": \"%s\", \"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u}",
+                 names[3], rects[3].x, rects[3].y, rects[3].width, rects[3].height);
+        failed = failed || strncmp(table, "{\"width\": ", 10) != 0 || !strstr(table, entry);
+    }
+
+    tga_free(&file_atlas);
+    tga_free(&atlas);
+    for (unsigned i = 0; i < ATLAS_IMAGE_COUNT; ++i) {
+        if (images[i].image_data) tga_free(&images[i]);
+    }
+
+    if (failed) {
+        printf("Atlas test failed\n");
+        return 1;
+    }
+
+    printf("Atlas test passed\n");
     return 0;
 }
 
@@ -144,9 +3042,44 @@ int test_color24() {
  *
  */
 int main(void) {
-    test_color8();
-    test_color16();
-    test_color24();
+    int failures = 0;
+
+    failures += test_color8();
+    failures += test_color16();
+    failures += test_color24();
+    failures += test_rle_codec();
+    failures += test_rle_file(8);
+    failures += test_rle_file(16);
+    failures += test_rle_file(24);
+    failures += test_rle_file(32);
+    failures += test_map_file();
+    failures += test_stream();
+    failures += test_fill_rect();
+    failures += test_color_map_exact();
+    failures += test_color_map_quantized(16);
+    failures += test_color_map_quantized(24);
+    failures += test_color_map_quantized(32);
+    failures += test_color_map_expand();
+    failures += test_parallel_rle();
+    failures += test_batch();
+    failures += test_allocators();
+    failures += test_convert_depth();
+    failures += test_memory();
+    failures += test_probe();
+    failures += test_view();
+    failures += test_orientation();
+    failures += test_blend();
+    failures += test_resize();
+    failures += test_mipmaps();
+    failures += test_stats();
+    failures += test_hardened();
+    failures += test_hash();
+    failures += test_cache();
+    failures += test_loader();
+    failures += test_thumbnail();
+    failures += test_compare();
+    failures += test_draw();
+    failures += test_atlas();
     /*
     TgaImage tga;
     int success;
@@ -247,4 +3180,6 @@ int main(void) {
     }
     tga_free(&tga);
     */
+
+    return failures != 0;
 }
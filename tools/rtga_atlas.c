@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtga/rtga.h"
+
+void usage(const char *program) {
+    printf("Usage: %s [-j threads] [-p padding] [-w width] [-d depth] [-t table] -o atlas files...\n", program);
+    printf("\n");
+    printf("Packs TGA image files into one atlas and writes the place of each\n");
+    printf("file in it as JSON.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -j threads   number of worker threads, by default one per CPU\n");
+    printf("  -p padding   pixels left between images\n");
+    printf("  -w width     width of the atlas, by default the smallest power of two\n");
+    printf("  -d depth     pixel depth of the atlas, 8, 16, 24 or 32 by default\n");
+    printf("  -t table     file the table is written to, by default the atlas\n");
+    printf("               file followed by .json\n");
+    printf("  -o atlas     file the atlas is written to\n");
+}
+
+int main(int argc, char **argv) {
+    TgaAtlasOptions options = {0};
+    const char *atlas_file = NULL;
+    const char *table_file = NULL;
+    int first_file = argc;
+
+    // Parse options up to the first file
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.thread_count = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            options.padding = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            options.max_width = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            options.pixel_depth = (uint8_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            table_file = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            atlas_file = argv[++i];
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+
+    if (!atlas_file || first_file == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t file_count = (size_t)(argc - first_file);
+    const char **input_files = (const char **)(argv + first_file);
+    TgaAtlasRect *rects = malloc(file_count * sizeof(TgaAtlasRect));
+    int *results = malloc(file_count * sizeof(int));
+    if (!rects || !results) {
+        printf("Memory allocation error\n");
+        return 1;
+    }
+
+    // Files that fail are reported and left out, the rest are still packed
+    TgaImage atlas = {0};
+    int result = tga_atlas_build_files(&atlas, input_files, file_count, &options, rects, results);
+    if (!atlas.image_data) {
+        if (result == TGA_INVALID_PIXEL_DEPTH_ERROR) printf("Invalid pixel depth %u\n", options.pixel_depth);
+        if (result == TGA_ATLAS_FULL_ERROR) printf("Files do not fit in the atlas\n");
+        if (result == TGA_ALLOCATION_ERROR) printf("Memory allocation error\n");
+        return 1;
+    }
+    size_t failed_count = 0;
+    for (size_t i = 0; i < file_count; ++i) {
+        if (results[i] == TGA_SUCCESS) continue;
+        printf("%s: error %d\n", input_files[i], results[i]);
+        ++failed_count;
+    }
+
+    char *default_table = NULL;
+    if (!table_file) {
+        default_table = malloc(strlen(atlas_file) + 6);
+        if (default_table) sprintf(default_table, "%s.json", atlas_file);
+        table_file = default_table;
+    }
+
+    result = tga_write_file(&atlas, atlas_file);
+    if (result != TGA_SUCCESS) printf("%s: error %d\n", atlas_file, result);
+    if (result == TGA_SUCCESS && table_file) {
+        result = tga_atlas_write_table(table_file, &atlas, input_files, rects, file_count);
+        if (result != TGA_SUCCESS) printf("%s: error %d\n", table_file, result);
+    }
+    if (!table_file) printf("Memory allocation error\n");
+    printf("Packed %zu files into %ux%u, %zu failed\n", file_count - failed_count, atlas.header.width, atlas.header.height, failed_count);
+
+    tga_free(&atlas);
+    free(default_table);
+    free(rects);
+    free(results);
+    return result != TGA_SUCCESS || !table_file || failed_count != 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtga/rtga.h"
+
+void usage(const char *program) {
+    printf("Usage: %s [-r] [-j threads] -o directory operation files...\n", program);
+    printf("\n");
+    printf("Operations:\n");
+    printf("  recompress   rewrite image data, uncompressed or with -r run-length encoded\n");
+    printf("  depth=BITS   convert pixels to 8, 16, 24 or 32 bits\n");
+    printf("  palettize    convert true color and grayscale images to color mapped\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -r           run-length encode the output files\n");
+    printf("  -j threads   number of worker threads, by default two per CPU\n");
+    printf("  -o directory directory the output files are written to\n");
+}
+
+// Returns the part of path after the last separator
+const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int main(int argc, char **argv) {
+    TgaBatchOptions options = {0};
+    const char *directory = NULL;
+    const char *operation = NULL;
+    int first_file = argc;
+
+    // Parse options up to the operation, which is followed by the files
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0) {
+            options.rle = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.thread_count = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            directory = argv[++i];
+        } else {
+            operation = argv[i];
+            first_file = i + 1;
+            break;
+        }
+    }
+
+    if (!directory || !operation) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (strcmp(operation, "recompress") == 0) {
+        options.operation = TGA_BATCH_RECOMPRESS;
+    } else if (strncmp(operation, "depth=", 6) == 0) {
+        options.operation = TGA_BATCH_CONVERT_DEPTH;
+        options.pixel_depth = (uint8_t)atoi(operation + 6);
+    } else if (strcmp(operation, "palettize") == 0) {
+        options.operation = TGA_BATCH_PALETTIZE;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Every output file has the name of its input file
+    size_t file_count = (size_t)(argc - first_file);
+    const char **input_files = (const char **)(argv + first_file);
+    char **output_files = malloc((file_count ? file_count : 1) * sizeof(char *));
+    int *results = malloc((file_count ? file_count : 1) * sizeof(int));
+    if (!output_files || !results) {
+        printf("Memory allocation error\n");
+        return 1;
+    }
+    for (size_t i = 0; i < file_count; ++i) {
+        const char *name = base_name(input_files[i]);
+        output_files[i] = malloc(strlen(directory) + strlen(name) + 2);
+        if (!output_files[i]) {
+            printf("Memory allocation error\n");
+            return 1;
+        }
+        sprintf(output_files[i], "%s/%s", directory, name);
+    }
+
+    TgaBatchStats stats = {0};
+    int result = tga_batch_convert(input_files, (const char *const *)output_files, file_count, &options, results, &stats);
+    if (result == TGA_INVALID_PIXEL_DEPTH_ERROR && stats.files_converted + stats.files_failed == 0) {
+        printf("Invalid pixel depth %u\n", options.pixel_depth);
+        return 1;
+    }
+    if (result == TGA_ALLOCATION_ERROR && stats.files_converted + stats.files_failed == 0) {
+        printf("Memory allocation error\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < file_count; ++i) {
+        if (results[i] != TGA_SUCCESS) printf("%s: error %d\n", input_files[i], results[i]);
+        free(output_files[i]);
+    }
+    free(output_files);
+    free(results);
+
+    // Throughput counts the input files
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    printf("Converted %zu files, %zu failed, in %.3f s\n", stats.files_converted, stats.files_failed, stats.seconds);
+    printf("%.1f files/s, %.1f MB/s read, %.1f MB/s written\n",
+           stats.files_converted / seconds, stats.bytes_read / seconds * 1e-6, stats.bytes_written / seconds * 1e-6);
+
+    return stats.files_failed != 0;
+}